@@ -35,6 +35,7 @@
 #include "lib_aci.h"
 #include "hal_platform.h"
 #include "hal_aci_tl.h"
+#include "aci_log.h"
 
 // aci_struct that will contain
 // total initial credits
@@ -47,15 +48,67 @@
 // Current connection interval, slave latency and link supervision timeout
 // Current State of the the GATT client (Service Discovery)
 // Status of the bond (R) Peer address
-static struct aci_state_t aci_state;
+//
+// One for each nRF8001. Define HAL_ACI_TL_INSTANCES as 2 or 3 in the project to run the echo test
+// on several nRF8001s at the same time, connected as in aci_radio_pins below.
+#define ACI_RADIO_COUNT HAL_ACI_TL_INSTANCES
+
+static struct aci_state_t aci_state[ACI_RADIO_COUNT];
 
 static hal_aci_evt_t aci_data;
 
-static uint8_t echo_data[] = { 0x00, 0xaa, 0x55, 0xff, 0x77, 0x55, 0x33, 0x22, 0x11, 0x44, 
-                               0x66, 0x88, 0x99, 0xbb, 0xdd, 0xcc, 0x00, 0xaa, 0x55, 0xff };
-static uint8_t aci_echo_cmd = 0;
+static const uint8_t echo_data[ACI_ECHO_DATA_MAX_LEN] =
+{
+  0x00, 0xaa, 0x55, 0xff, 0x77, 0x55, 0x33, 0x22, 0x11, 0x44,
+  0x66, 0x88, 0x99, 0xbb, 0xdd, 0xcc, 0x00, 0xaa, 0x55, 0xff,
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x5a
+};
+
+/* 0 runs the transactions from the RDYN interrupt. Otherwise RDYN is polled, and up to this many
+   transactions run back to back in each pass of the main loop, see lib_aci_pump() */
+#ifndef ACI_PUMP_LIMIT
+#define ACI_PUMP_LIMIT 0
+#endif
+
+/*
+  Benchmark. Every echo payload length from 1 to ACI_ECHO_DATA_MAX_LEN runs at every queue depth
+  from 1 to BENCH_DEPTH_MAX for BENCH_POINT_MS, the queue depth being the number of echo commands
+  kept in flight. Each point prints a CSV line per nRF8001, starting with "bench," so that it can be
+  picked out of the output:
+
+    bench,radio,payload,depth,echoes,errors,echo_per_s,bytes_per_s,lat_min_us,lat_median_us,lat_p99_us,cycles_per_tx
+
+  The latency runs from queuing the Echo command to receiving the Echo event, on the RTC. The cycles
+  are the DWT cycles the CPU was busy per SPI transaction of all the nRF8001s.
+*/
+#define BENCH_DEPTH_MAX    4
+#define BENCH_POINT_MS     200
+
+/* Latency histogram in RTC ticks, the last bin holds the longer latencies */
+#define BENCH_LATENCY_BINS 128
+
+typedef struct
+{
+  uint8_t  in_flight;
+  uint8_t  sent_first;                      /* Oldest entry of sent_time */
+  uint32_t sent_time[BENCH_DEPTH_MAX];      /* RTC ticks at which the echoes in flight were queued */
+  uint32_t echoes;
+  uint32_t errors;
+  uint32_t transactions;
+  uint16_t latency[BENCH_LATENCY_BINS];
+} bench_radio_t;
+
+static bench_radio_t bench_radio[ACI_RADIO_COUNT];
+static bool          bench_ready[ACI_RADIO_COUNT];
 
-#define NUM_ECHO_CMDS 3
+static bool     bench_running;            /* The point is being measured, the echoes are kept in flight */
+static bool     bench_draining;           /* The point is over, waiting for the echoes in flight */
+static uint8_t  bench_payload;
+static uint8_t  bench_depth;
+static uint32_t bench_start_time;
+static uint32_t bench_start_cycles;
+static uint32_t bench_elapsed;
+static uint32_t bench_cycles;
 
 /* Define how assert should function in the BLE library */
 void __ble_assert(const char *file, uint16_t line)
@@ -68,41 +121,343 @@ void __ble_assert(const char *file, uint16_t line)
   while(1);
 }
 
-#define ACI_MOSI  0
-#define ACI_MISO  1
-#define ACI_SCLK  2
 #define ACI_REQN  3
 #define ACI_RDYN  5
 #define ACI_RESET 6
 
+/* USART and the REQN, RDYN and RESET pins on port D of each nRF8001. The MOSI, MISO and SCK pins
+   follow the USART location: USART1 #1 is PD0-PD2, USART0 #0 is PE10-PE12, USART2 #0 is PC2-PC4.
+   The RDYN pins must have different pin numbers, they share the GPIO interrupts. */
+typedef struct
+{
+  uint8_t spi_instance;
+  uint8_t spi_location;
+  uint8_t reqn_pin;
+  uint8_t rdyn_pin;
+  uint8_t reset_pin;
+} aci_radio_pins_t;
+
+static const aci_radio_pins_t aci_radio_pins[3] =
+{
+  { 1, 1, ACI_REQN, ACI_RDYN, ACI_RESET },
+  { 0, 0, 9,        10,       11        },
+  { 2, 0, 13,       12,       14        },
+};
+
 void setupACI(void)
 { 
-  printf("ACI setup\n");
+  uint8_t radio;
+
+  ACI_LOG_INFO("ACI setup\n");
 
   enableClocksForAci();
 
-  /*
-  Tell the ACI library, the MCU to nRF8001 pin connections.
-  The Active pin is optional and can be marked UNUSED
-  */
-  aci_state.aci_pins.board_name = BOARD_DEFAULT; //See board.h for details
-  aci_state.aci_pins.reqn_pin   = ACI_REQN;
-  aci_state.aci_pins.rdyn_pin   = ACI_RDYN;
-  aci_state.aci_pins.mosi_pin   = ACI_MOSI;
-  aci_state.aci_pins.miso_pin   = ACI_MISO;
-  aci_state.aci_pins.sck_pin    = ACI_SCLK;
-
-  aci_state.aci_pins.spi_clock_divider     = 0;
-  
-  aci_state.aci_pins.reset_pin             = ACI_RESET;
-  aci_state.aci_pins.active_pin            = UNUSED;
-  aci_state.aci_pins.optional_chip_sel_pin = UNUSED;
-
-  aci_state.aci_pins.interface_is_interrupt = false;
-  aci_state.aci_pins.interrupt_number       = 1;
-  
-  hal_aci_tl_init(&(aci_state.aci_pins), false);
-  printf("nRF8001 Reset done\n");
+  for (radio = 0; radio < ACI_RADIO_COUNT; radio++)
+  {
+    /*
+    Tell the ACI library, the MCU to nRF8001 pin connections.
+    The Active pin is optional and can be marked UNUSED
+    */
+    aci_state[radio].aci_pins.board_name = BOARD_DEFAULT; //See board.h for details
+    aci_state[radio].aci_pins.reqn_pin   = aci_radio_pins[radio].reqn_pin;
+    aci_state[radio].aci_pins.rdyn_pin   = aci_radio_pins[radio].rdyn_pin;
+    aci_state[radio].aci_pins.mosi_pin   = UNUSED;
+    aci_state[radio].aci_pins.miso_pin   = UNUSED;
+    aci_state[radio].aci_pins.sck_pin    = UNUSED;
+
+    aci_state[radio].aci_pins.spi_clock_divider     = 0;
+    aci_state[radio].aci_pins.spi_instance          = aci_radio_pins[radio].spi_instance;
+    aci_state[radio].aci_pins.spi_location          = aci_radio_pins[radio].spi_location;
+
+    aci_state[radio].aci_pins.reset_pin             = aci_radio_pins[radio].reset_pin;
+    aci_state[radio].aci_pins.active_pin            = UNUSED;
+    aci_state[radio].aci_pins.optional_chip_sel_pin = UNUSED;
+
+    aci_state[radio].aci_pins.interface_is_interrupt = (0 == ACI_PUMP_LIMIT);
+    aci_state[radio].aci_pins.interrupt_number       = aci_radio_pins[radio].rdyn_pin;
+
+    /*
+    The benchmark only exchanges echo and test commands, but it goes through the lib_aci helpers,
+    so lib_aci_init() sets up the transport layer together with the credits and dispatch tables
+    */
+    lib_aci_init(&aci_state[radio], false);
+    ACI_LOG_INFO("nRF8001 %d Reset done\n", radio);
+  }
+}
+
+/* Queues an echo of the payload length of the point, returns false if the command queue is full */
+static bool bench_echo_send(uint8_t radio)
+{
+  bench_radio_t *p_bench = &bench_radio[radio];
+
+  // Timestamped first, the transaction may start before lib_aci_echo_msg() returns
+  p_bench->sent_time[(p_bench->sent_first + p_bench->in_flight) % BENCH_DEPTH_MAX] = efm_lf_ticks_get();
+  if (!lib_aci_echo_msg(&aci_state[radio], bench_payload, (uint8_t *)&echo_data[0]))
+  {
+    return false;
+  }
+  p_bench->in_flight++;
+
+  return true;
+}
+
+static void bench_point_start(void)
+{
+  uint8_t radio;
+  uint8_t i;
+
+  bench_start_time   = efm_lf_ticks_get();
+  bench_start_cycles = efm_cycles_get();
+  bench_running      = true;
+
+  for (radio = 0; radio < ACI_RADIO_COUNT; radio++)
+  {
+    memset(&bench_radio[radio], 0, sizeof(bench_radio[radio]));
+    bench_radio[radio].transactions = hal_aci_tl_transaction_count_get(aci_state[radio].aci_tl);
+
+    for (i = 0; i < bench_depth; i++)
+    {
+      if (!bench_echo_send(radio))
+      {
+        ACI_LOG_ERROR("Error: Echo command queue full at depth %u\n", i + 1);
+        break;
+      }
+    }
+  }
+}
+
+/* Latency in microseconds within which the given share, in percent, of the echoes came back */
+static uint32_t bench_latency_us(const bench_radio_t *p_bench, uint8_t percent)
+{
+  const uint32_t threshold = (uint32_t)(((uint64_t)p_bench->echoes * percent + 99) / 100);
+  uint32_t count = 0;
+  uint8_t  bin;
+
+  for (bin = 0; bin < (BENCH_LATENCY_BINS - 1); bin++)
+  {
+    count += p_bench->latency[bin];
+    if ((0 != count) && (count >= threshold))
+    {
+      break;
+    }
+  }
+
+  return (uint32_t)(((uint64_t)bin * 1000000) / EFM_LF_TICKS_PER_SECOND);
+}
+
+static void bench_point_report(void)
+{
+  bench_radio_t *p_bench;
+  uint32_t       transactions = 0;
+  uint32_t       rate;
+  uint8_t        radio;
+
+  for (radio = 0; radio < ACI_RADIO_COUNT; radio++)
+  {
+    transactions += bench_radio[radio].transactions;
+  }
+
+  for (radio = 0; radio < ACI_RADIO_COUNT; radio++)
+  {
+    p_bench = &bench_radio[radio];
+    rate    = (uint32_t)(((uint64_t)p_bench->echoes * EFM_LF_TICKS_PER_SECOND) / bench_elapsed);
+
+    printf("bench,%u,%u,%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", radio, bench_payload, bench_depth,
+           (unsigned long)p_bench->echoes, (unsigned long)p_bench->errors,
+           (unsigned long)rate, (unsigned long)(rate * bench_payload),
+           (unsigned long)bench_latency_us(p_bench, 0), (unsigned long)bench_latency_us(p_bench, 50),
+           (unsigned long)bench_latency_us(p_bench, 99),
+           (unsigned long)((0 != transactions) ? (bench_cycles / transactions) : 0));
+  }
+}
+
+/* Starts the sweep once every nRF8001 is in test mode with its SPI clock negotiated */
+static void bench_start(uint8_t radio)
+{
+  uint8_t i;
+
+  bench_ready[radio] = true;
+  for (i = 0; i < ACI_RADIO_COUNT; i++)
+  {
+    if (!bench_ready[i])
+    {
+      return;
+    }
+  }
+
+  efm_cycle_counter_init();
+  printf("# Echo benchmark, latency resolution %lu us, %lu cycles/s\n",
+         (unsigned long)(1000000 / EFM_LF_TICKS_PER_SECOND), (unsigned long)efm_cycle_clock_get());
+  printf("bench,radio,payload,depth,echoes,errors,echo_per_s,bytes_per_s,"
+         "lat_min_us,lat_median_us,lat_p99_us,cycles_per_tx\n");
+
+  bench_payload = 1;
+  bench_depth   = 1;
+  bench_point_start();
+}
+
+/* Ends the point after BENCH_POINT_MS and moves to the next one once the echoes in flight are back */
+static void bench_poll(void)
+{
+  uint8_t radio;
+
+  if (bench_running)
+  {
+    if ((efm_lf_ticks_get() - bench_start_time) < EFM_LF_MS_TO_TICKS(BENCH_POINT_MS))
+    {
+      return;
+    }
+
+    bench_elapsed = efm_lf_ticks_get() - bench_start_time;
+    bench_cycles  = efm_cycles_get() - bench_start_cycles;
+    for (radio = 0; radio < ACI_RADIO_COUNT; radio++)
+    {
+      bench_radio[radio].transactions = hal_aci_tl_transaction_count_get(aci_state[radio].aci_tl) -
+                                        bench_radio[radio].transactions;
+    }
+    bench_running  = false;
+    bench_draining = true;
+  }
+
+  if (!bench_draining)
+  {
+    return;
+  }
+
+  for (radio = 0; radio < ACI_RADIO_COUNT; radio++)
+  {
+    if (0 != bench_radio[radio].in_flight)
+    {
+      return;
+    }
+  }
+
+  bench_draining = false;
+  bench_point_report();
+
+  if (bench_depth < BENCH_DEPTH_MAX)
+  {
+    bench_depth++;
+  }
+  else if (bench_payload < ACI_ECHO_DATA_MAX_LEN)
+  {
+    bench_depth = 1;
+    bench_payload++;
+  }
+  else
+  {
+    printf("bench,done\n");
+    return;
+  }
+
+  bench_point_start();
+}
+
+/* Checks an echo that came back and keeps the queue depth of the point while it runs */
+static void bench_echo_received(uint8_t radio, const aci_evt_t *aci_evt)
+{
+  bench_radio_t *p_bench = &bench_radio[radio];
+  uint32_t       latency;
+
+  if (0 == p_bench->in_flight)
+  {
+    return;
+  }
+
+  latency = efm_lf_ticks_get() - p_bench->sent_time[p_bench->sent_first];
+  p_bench->sent_first = (p_bench->sent_first + 1) % BENCH_DEPTH_MAX;
+  p_bench->in_flight--;
+
+  if (!bench_running)
+  {
+    return;
+  }
+
+  if ((bench_payload != (aci_evt->len - 1)) ||
+      (0 != memcmp(&echo_data[0], &(aci_evt->params.echo.echo_data[0]), bench_payload)))
+  {
+    p_bench->errors++;
+  }
+  else
+  {
+    p_bench->echoes++;
+    p_bench->latency[(latency < BENCH_LATENCY_BINS) ? latency : (BENCH_LATENCY_BINS - 1)]++;
+  }
+
+  bench_echo_send(radio);
+}
+
+/* Handles the events of one nRF8001, returns false if it had none */
+static bool aci_loop(uint8_t radio)
+{
+  struct aci_state_t *p_aci_state = &aci_state[radio];
+  aci_evt_t          *aci_evt;
+
+#if (ACI_PUMP_LIMIT > 0)
+  // Move everything the nRF8001 has to send before processing the events
+  lib_aci_pump(p_aci_state, ACI_PUMP_LIMIT);
+#endif
+
+  // We enter the if statement only when there is a ACI event available to be processed
+  if (!lib_aci_event_get(p_aci_state, &aci_data))
+  {
+    return false;
+  }
+
+  aci_evt = &aci_data.evt;
+  switch(aci_evt->evt_opcode)
+  {
+    /**
+    As soon as you reset the nRF8001 you will get an ACI Device Started Event
+    */
+    case ACI_EVT_DEVICE_STARTED:
+    {
+      switch(aci_evt->params.device_started.device_mode)
+      {
+        case ACI_DEVICE_SETUP:
+          ACI_LOG_INFO("Evt Device Started: Setup\n");
+          lib_aci_test(p_aci_state, ACI_TEST_MODE_DTM_UART);
+        break;
+        case ACI_DEVICE_STANDBY:
+          ACI_LOG_INFO("Evt Device Started: Standby\n");
+        break;
+        case ACI_DEVICE_TEST:
+          ACI_LOG_INFO("Evt Device Started: Test\n");
+          ACI_LOG_INFO("Negotiating the ACI SPI clock\n");
+          if (lib_aci_spi_clock_negotiate(p_aci_state))
+          {
+            ACI_LOG_INFO("SPI clock: %lu Hz, echo errors: %u\n",
+                         (unsigned long)lib_aci_spi_clock_get(p_aci_state), lib_aci_spi_echo_errors_get(p_aci_state));
+          }
+          else
+          {
+            ACI_LOG_ERROR("Error: No SPI clock passed the echo test. Verify the SPI connectivity on the PCB.\n");
+          }
+          bench_start(radio);
+        break;
+      }
+    }
+    break; //ACI Device Started Event
+    case ACI_EVT_CMD_RSP:
+      //If an ACI command response event comes with an error -> stop
+      if (ACI_STATUS_SUCCESS != aci_evt->params.cmd_rsp.cmd_status)
+      {
+        //ACI ReadDynamicData and ACI WriteDynamicData will have status codes of
+        //TRANSACTION_CONTINUE and TRANSACTION_COMPLETE
+        //all other ACI commands will have status code of ACI_STATUS_SCUCCESS 
+        //for a successful command
+        printf("ACI Command 0x");
+        printf("%x", aci_evt->params.cmd_rsp.cmd_opcode);
+        printf("Evt Cmd respone: Error. Arduino is in an while(1); loop");
+        while (1);
+      }
+      break;
+    case ACI_EVT_ECHO:
+      bench_echo_received(radio, aci_evt);
+    break;
+  }
+
+  return true;
 }
 
 //###############################################################################
@@ -112,6 +467,9 @@ void setupACI(void)
  *****************************************************************************/
 int main(void)
 {
+  uint8_t radio;
+  bool    event_handled;
+
   /* Chip errata */
   CHIP_Init();
 
@@ -121,8 +479,7 @@ int main(void)
   /*Setup SWO output for printing*/
   setupSWO();
 
-  /* Setup SysTick Timer for 1 msec interrupts  */
-  if (SysTick_Config(CMU_ClockFreqGet(cmuClock_CORE) / 1000)) while (1) ;
+  /* delay() runs on the RTC and sleeps, no SysTick interrupt is needed */
 
   /* Enable ACI lib */
   setupACI();
@@ -130,87 +487,22 @@ int main(void)
   /* Infinite blink loop */
   while (1)
   {
-    // We enter the if statement only when there is a ACI event available to be processed
-    if (lib_aci_event_get(&aci_state, &aci_data))
+    event_handled = false;
+    for (radio = 0; radio < ACI_RADIO_COUNT; radio++)
     {
-      aci_evt_t * aci_evt;
-      aci_evt = &aci_data.evt;
-      switch(aci_evt->evt_opcode)
+      if (aci_loop(radio))
       {
-        /**
-        As soon as you reset the nRF8001 you will get an ACI Device Started Event
-        */
-        case ACI_EVT_DEVICE_STARTED:
-        {
-          aci_state.data_credit_available = aci_evt->params.device_started.credit_available;
-          switch(aci_evt->params.device_started.device_mode)
-          {
-            case ACI_DEVICE_SETUP:
-              printf("Evt Device Started: Setup\n");
-              lib_aci_test(ACI_TEST_MODE_DTM_UART);
-            break;
-            case ACI_DEVICE_STANDBY:
-              printf("Evt Device Started: Standby\n");
-            break;
-            case ACI_DEVICE_TEST:
-            {
-              uint8_t i = 0;
-              printf("Evt Device Started: Test\n");
-              printf("Started infinite Echo test\n");
-              printf("Repeat the test with all bytes in echo_data inverted.\n");
-              printf("Waiting 4 seconds before the test starts....\n");
-              delay(4000);
-              for(i=0; i<NUM_ECHO_CMDS; i++)
-              {
-                lib_aci_echo_msg(sizeof(echo_data), &echo_data[0]);
-                aci_echo_cmd++;
-              }
-            }
-            break;
-          }
-        }
-        break; //ACI Device Started Event
-        case ACI_EVT_CMD_RSP:
-          //If an ACI command response event comes with an error -> stop
-          if (ACI_STATUS_SUCCESS != aci_evt->params.cmd_rsp.cmd_status)
-          {
-            //ACI ReadDynamicData and ACI WriteDynamicData will have status codes of
-            //TRANSACTION_CONTINUE and TRANSACTION_COMPLETE
-            //all other ACI commands will have status code of ACI_STATUS_SCUCCESS 
-            //for a successful command
-            printf("ACI Command 0x");
-            printf("%x", aci_evt->params.cmd_rsp.cmd_opcode);
-            printf("Evt Cmd respone: Error. Arduino is in an while(1); loop");
-            while (1);
-          }
-          break;
-        case ACI_EVT_ECHO:
-          if (0 != memcmp(&echo_data[0], &(aci_evt->params.echo.echo_data[0]), sizeof(echo_data)))
-          {
-            printf("Error: Echo loop test failed. Verify the SPI connectivity on the PCB.");
-          }
-          else
-          {
-            printf("Echo OK\n");
-          }
-          if (NUM_ECHO_CMDS == aci_echo_cmd)
-          {
-            uint8_t i = 0;
-            aci_echo_cmd = 0;
-            for(i=0; i<NUM_ECHO_CMDS; i++)
-            {
-              lib_aci_echo_msg(sizeof(echo_data), &echo_data[0]);
-              aci_echo_cmd++;
-            }
-          }
-        break;
+        event_handled = true;
       }
     }
-    else
+
+    bench_poll();
+
+    if (!event_handled)
     {
-    // No event in the ACI Event queue
-    // Arduino can go to sleep now
-    // Wakeup from sleep from the RDYN line
+      // No event in the ACI Event queues
+      // Sleep until one of the nRF8001s lowers the RDYN line
+      lib_aci_idle(&aci_state[0]);
     }
   }
 }
@@ -36,6 +36,8 @@
 #include "hal_platform.h"
 #include "hal_aci_tl.h"
 #include "aci_setup.h"
+#include "aci_log.h"
+#include "aci_evt_view.h"
 
 /**
 Put the nRF8001 setup in the RAM of the nRF8001.
@@ -69,9 +71,11 @@ static hal_aci_data_t setup_msgs[NB_SETUP_MESSAGES] = SETUP_MESSAGES_CONTENT;
 // Current State of the the GATT client (Service Discovery)
 // Status of the bond (R) Peer address
 static struct aci_state_t aci_state;
-static hal_aci_evt_t aci_data;
 //static hal_aci_data_t aci_cmd;
 
+/* Set when the nRF8001 starts in setup mode, do_aci_setup() is then called from the main loop */
+static bool setup_required = false;
+
 
 /* Define how assert should function in the BLE library */
 void __ble_assert(const char *file, uint16_t line)
@@ -84,6 +88,104 @@ void __ble_assert(const char *file, uint16_t line)
   while(1);
 }
 
+/**
+As soon as you reset the nRF8001 you will get an ACI Device Started Event
+*/
+static void on_device_started(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  switch(aci_evt->params.device_started.device_mode)
+  {
+    case ACI_DEVICE_SETUP:
+      /**
+      When the device is in the setup mode
+      */
+      ACI_LOG_INFO("Evt Device Started: Setup\n");
+      setup_required = true;
+      break;
+
+    case ACI_DEVICE_STANDBY:
+      ACI_LOG_INFO("Evt Device Started: Standby\n");
+      if (aci_evt->params.device_started.hw_error)
+      {
+        delay(20); //Magic number used to make sure the HW error event is handled correctly.
+      }
+      else
+      {
+      lib_aci_connect(aci_stat, 180/* in seconds */, 0x0100 /* advertising interval 100ms*/);
+      ACI_LOG_INFO("Advertising started\n");
+      }
+      break;
+  }
+}
+
+static void on_cmd_rsp(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  //If an ACI command response event comes with an error -> stop
+  if (ACI_STATUS_SUCCESS != aci_evt->params.cmd_rsp.cmd_status)
+  {
+    //ACI ReadDynamicData and ACI WriteDynamicData will have status codes of
+    //TRANSACTION_CONTINUE and TRANSACTION_COMPLETE
+    //all other ACI commands will have status code of ACI_STATUS_SCUCCESS for 
+    //a successful command
+    printf("ACI Command ");
+    printf("%x", aci_evt->params.cmd_rsp.cmd_opcode);
+    printf("Evt Cmd respone: Error. Arduino is in an while(1); loop\n");
+    while (1);
+  }
+}
+
+static void on_connected(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  ACI_LOG_INFO("Evt Connected\n");
+}
+
+static void on_pipe_status(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  ACI_LOG_INFO("Evt Pipe Status\n");
+}
+
+static void on_disconnected(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  ACI_LOG_INFO("Evt Disconnected/Advertising timed out\n");
+  lib_aci_connect(aci_stat, 180/* in seconds */, 0x0100 /* advertising interval 100ms*/);
+  ACI_LOG_INFO("Advertising started\n");
+}
+
+static void on_pipe_error(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  //See the appendix in the nRF8001 Product Specication for details on the error codes
+  ACI_LOG_WARNING("ACI Evt Pipe Error: Pipe #:%d  Pipe Error Code: 0x%x\n",
+                  aci_evt->params.pipe_error.pipe_number, aci_evt->params.pipe_error.error_code);
+  //lib_aci returns the credit of the data packet that was not sent
+}
+
+static void on_data_received(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  aci_evt_view_data_received_t data_received;
+  int i=0;
+
+  //The data is read in place in the event queue
+  if (!aci_evt_view_data_received(aci_evt_view_raw(aci_evt), &data_received))
+  {
+    return;
+  }
+
+  ACI_LOG_INFO("Pipe #: 0x%x Data length: %d\n",
+               aci_evt_data_received_pipe_number(&data_received), aci_evt_data_received_data_len(&data_received));
+  for(i=0; i<aci_evt_data_received_data_len(&data_received); i++)
+  {
+    ACI_LOG_DEBUG(" Data(Hex) : %x\n", aci_evt_data_received_data(&data_received)[i]);
+  }
+}
+
+static void on_hw_error(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context)
+{
+  //The file name is in the event, not in flash, so only the line is logged
+  ACI_LOG_ERROR("HW error: %d\n", aci_evt->params.hw_error.line_num);
+  lib_aci_connect(aci_stat, 180/* in seconds */, 0x0050 /* advertising interval 50ms*/);
+  ACI_LOG_INFO("Advertising started\n");
+}
+
 #define ACI_MOSI  0
 #define ACI_MISO  1
 #define ACI_SCLK  2
@@ -93,7 +195,7 @@ void __ble_assert(const char *file, uint16_t line)
 
 void setupACI(void)
 { 
-  printf("ACI setup\n");
+  ACI_LOG_INFO("ACI setup\n");
 
   enableClocksForAci();
   
@@ -124,21 +226,33 @@ void setupACI(void)
   aci_state.aci_pins.sck_pin    = ACI_SCLK;
 
   aci_state.aci_pins.spi_clock_divider     = 0;
+  aci_state.aci_pins.spi_instance          = 1; //USART1, the MOSI, MISO and SCK pins follow the location
+  aci_state.aci_pins.spi_location          = 1;
   
   aci_state.aci_pins.reset_pin             = ACI_RESET;
   aci_state.aci_pins.active_pin            = UNUSED;
   aci_state.aci_pins.optional_chip_sel_pin = UNUSED;
 
-  aci_state.aci_pins.interface_is_interrupt = false;
-  aci_state.aci_pins.interrupt_number       = 1;
+  aci_state.aci_pins.interface_is_interrupt = true;
+  aci_state.aci_pins.interrupt_number       = ACI_RDYN;
   
   /* We initialize the data structures required to setup the nRF8001
   */
   //The second parameter is for turning debug printing on for the ACI Commands and Events 
   //so they be printed on the Serial
   lib_aci_init(&aci_state, true);
+
+  /* The events are handled by the functions registered here, see lib_aci_event_dispatch() */
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_DEVICE_STARTED, on_device_started, NULL);
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_CMD_RSP, on_cmd_rsp, NULL);
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_CONNECTED, on_connected, NULL);
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_PIPE_STATUS, on_pipe_status, NULL);
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_DISCONNECTED, on_disconnected, NULL);
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_PIPE_ERROR, on_pipe_error, NULL);
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_DATA_RECEIVED, on_data_received, NULL);
+  lib_aci_evt_handler_set(&aci_state, ACI_EVT_HW_ERROR, on_hw_error, NULL);
   
-  printf("nRF8001 Reset done\n");
+  ACI_LOG_INFO("nRF8001 Reset done\n");
 }
 
 //###############################################################################
@@ -157,8 +271,7 @@ int main(void)
   /*Setup SWO output for printing*/
   setupSWO();
 
-  /* Setup SysTick Timer for 1 msec interrupts  */
-  if (SysTick_Config(CMU_ClockFreqGet(cmuClock_CORE) / 1000)) while (1) ;
+  /* delay() runs on the RTC and sleeps, no SysTick interrupt is needed */
 
   /* Enable ACI lib */
   setupACI();
@@ -166,128 +279,13 @@ int main(void)
   /* Infinite blink loop */
   while (1)
   {
-static bool setup_required = false;
-
-  // We enter the if statement only when there is a ACI event available to be processed
-  if (lib_aci_event_get(&aci_state, &aci_data))
-  {
-    aci_evt_t * aci_evt;
-
-    aci_evt = &aci_data.evt;
-    switch(aci_evt->evt_opcode)
-    {
-      /**
-      As soon as you reset the nRF8001 you will get an ACI Device Started Event
-      */
-      case ACI_EVT_DEVICE_STARTED:
-      {
-        aci_state.data_credit_available = aci_evt->params.device_started.credit_available;
-        switch(aci_evt->params.device_started.device_mode)
-        {
-          case ACI_DEVICE_SETUP:
-            /**
-            When the device is in the setup mode
-            */
-            printf("Evt Device Started: Setup\n");
-            setup_required = true;
-            break;
-
-          case ACI_DEVICE_STANDBY:
-            printf("Evt Device Started: Standby\n");
-            if (aci_evt->params.device_started.hw_error)
-            {
-              delay(20); //Magic number used to make sure the HW error event is handled correctly.
-            }
-            else
-            {
-            lib_aci_connect(180/* in seconds */, 0x0100 /* advertising interval 100ms*/);
-            printf("Advertising started\n");
-            }
-            break;
-        }
-      }
-        break; //ACI Device Started Event
-
-      case ACI_EVT_CMD_RSP:
-        //If an ACI command response event comes with an error -> stop
-        if (ACI_STATUS_SUCCESS != aci_evt->params.cmd_rsp.cmd_status)
-        {
-          //ACI ReadDynamicData and ACI WriteDynamicData will have status codes of
-          //TRANSACTION_CONTINUE and TRANSACTION_COMPLETE
-          //all other ACI commands will have status code of ACI_STATUS_SCUCCESS for 
-          //a successful command
-          printf("ACI Command ");
-          printf("%x", aci_evt->params.cmd_rsp.cmd_opcode);
-          printf("Evt Cmd respone: Error. Arduino is in an while(1); loop\n");
-          while (1);
-        }
-        break;
-
-      case ACI_EVT_CONNECTED:
-        printf("Evt Connected\n");
-        break;
-
-      case ACI_EVT_PIPE_STATUS:
-        printf("Evt Pipe Status\n");
-        break;
-
-      case ACI_EVT_DISCONNECTED:
-        printf("Evt Disconnected/Advertising timed out\n");
-        lib_aci_connect(180/* in seconds */, 0x0100 /* advertising interval 100ms*/);
-        printf("Advertising started\n");
-        break;
-
-      case ACI_EVT_PIPE_ERROR:
-        //See the appendix in the nRF8001 Product Specication for details on the error codes
-        printf("ACI Evt Pipe Error: Pipe #:");
-        printf("%d", aci_evt->params.pipe_error.pipe_number);
-        printf("  Pipe Error Code: 0x");
-        printf("%x\n", aci_evt->params.pipe_error.error_code);
-
-        //Increment the credit available as the data packet was not sent.
-        //The pipe error also represents the Attribute protocol Error Response sent from the peer 
-        //and that should not be counted for the credit.
-        if (ACI_STATUS_ERROR_PEER_ATT_ERROR != aci_evt->params.pipe_error.error_code)
-        {
-          aci_state.data_credit_available++;
-        }
-        break;
-
-      case ACI_EVT_DATA_RECEIVED:
-        printf("Pipe #: 0x");
-        printf("%x", aci_evt->params.data_received.rx_data.pipe_number);
-        {
-          int i=0;
-          printf(" Data(Hex) : ");
-          for(i=0; i<aci_evt->len - 2; i++)
-          {
-            printf("%x", aci_evt->params.data_received.rx_data.aci_data[i]);
-            printf(" ");
-          }
-        }
-        printf("\n");
-        break;
-
-      case ACI_EVT_HW_ERROR:
-        printf("HW error: ");
-        printf("%d", aci_evt->params.hw_error.line_num);
-
-        for(uint8_t counter = 0; counter <= (aci_evt->len - 3); counter++)
-        {
-        //Serial.write(aci_evt->params.hw_error.file_name[counter]); //uint8_t file_name[20];
-        }
-        printf("\n");
-        lib_aci_connect(180/* in seconds */, 0x0050 /* advertising interval 50ms*/);
-        printf("Advertising started");
-        break;
-    }
-  }
-  else
+  // The handler of the next ACI event, if there is one, is called in place in the event queue
+  if (!lib_aci_event_dispatch(&aci_state) && !setup_required)
   {
     //Serial.println(F("No ACI Events available"));
     // No event in the ACI Event queue
-    // Arduino can go to sleep now
-    // Wakeup from sleep from the RDYN line
+    // Sleep until the nRF8001 lowers the RDYN line
+    lib_aci_idle(&aci_state);
   }
 
   /* setup_required is set to true when the device starts up and enters setup mode.
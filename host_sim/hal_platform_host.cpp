@@ -0,0 +1,766 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief hal_platform.h on Linux, in place of hal_platform.cpp and hal_dma.cpp.
+ *
+ * The GPIOs, the USARTs with their DMA and the RTC are simulated on the virtual clock of host_sim.h,
+ * the nRF8001 on the other side of the SPI is nrf8001_sim.cpp. Interrupts are serviced in IRQ number
+ * order, DMA before GPIO before RTC, as soon as nothing masks them.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hal_platform.h"
+#include "host_sim.h"
+
+/* Length of the simulated run, EFM_HOST_RUN_TIME in seconds overrides it */
+#define HOST_SIM_RUN_TIME_DEFAULT_S  10.0
+
+/* What a pin or clock poll costs the MCU, so that busy loops move the clock */
+#define HOST_SIM_POLL_NS             250ULL
+
+#define HOST_SIM_SPI_CLOCK           14000000UL
+
+static uint64_t           sim_time_ns = 0;
+static uint64_t           sim_end_ns  = 0;
+static host_sim_event_t  *sim_events  = NULL;
+
+/* Interrupt masking as INT_Disable() counts it, and whether an interrupt handler is running */
+static uint32_t           irq_disable_count = 0;
+static bool               irq_active        = false;
+static uint32_t           irq_serviced      = 0;
+
+static void host_irq_dispatch(void);
+static bool host_irq_pending(void);
+static bool host_lf_timer_due(void);
+
+static void host_sim_init(void)
+{
+  const char *p_run_time;
+  double      run_time = HOST_SIM_RUN_TIME_DEFAULT_S;
+
+  if (0 != sim_end_ns)
+  {
+    return;
+  }
+
+  p_run_time = getenv("EFM_HOST_RUN_TIME");
+  if ((NULL != p_run_time) && (atof(p_run_time) > 0))
+  {
+    run_time = atof(p_run_time);
+  }
+  sim_end_ns = (uint64_t)(run_time * HOST_SIM_NS_PER_S);
+}
+
+uint64_t host_sim_time_get(void)
+{
+  return sim_time_ns;
+}
+
+/* The application loops forever, the run ends with the simulated time */
+static void host_sim_end(void)
+{
+  fflush(stdout);
+  fprintf(stderr, "host_sim: %.3f s simulated\n", (double)sim_time_ns / HOST_SIM_NS_PER_S);
+  exit(0);
+}
+
+void host_sim_time_advance(uint64_t ns)
+{
+  const uint64_t    target = sim_time_ns + ns;
+  host_sim_event_t *p_event;
+
+  host_sim_init();
+
+  while ((NULL != sim_events) && (sim_events->time_ns <= target))
+  {
+    p_event     = sim_events;
+    sim_events  = p_event->p_next;
+    p_event->scheduled = false;
+
+    if (p_event->time_ns > sim_time_ns)
+    {
+      sim_time_ns = p_event->time_ns;
+    }
+    p_event->handler(p_event->p_context);
+  }
+
+  // Interrupts serviced by the handlers may have moved the clock further already
+  if (target > sim_time_ns)
+  {
+    sim_time_ns = target;
+  }
+
+  if (sim_time_ns >= sim_end_ns)
+  {
+    host_sim_end();
+  }
+
+  host_irq_dispatch();
+}
+
+void host_sim_event_schedule(host_sim_event_t *p_event, uint64_t delay_ns,
+                             void (*handler)(void *p_context), void *p_context)
+{
+  host_sim_event_t **pp_event = &sim_events;
+
+  host_sim_event_cancel(p_event);
+
+  p_event->time_ns   = sim_time_ns + delay_ns;
+  p_event->handler   = handler;
+  p_event->p_context = p_context;
+  p_event->scheduled = true;
+
+  // Events due at the same time run in the order they were scheduled
+  while ((NULL != *pp_event) && ((*pp_event)->time_ns <= p_event->time_ns))
+  {
+    pp_event = &(*pp_event)->p_next;
+  }
+  p_event->p_next = *pp_event;
+  *pp_event       = p_event;
+}
+
+void host_sim_event_cancel(host_sim_event_t *p_event)
+{
+  host_sim_event_t **pp_event = &sim_events;
+
+  if (!p_event->scheduled)
+  {
+    return;
+  }
+
+  while (NULL != *pp_event)
+  {
+    if (*pp_event == p_event)
+    {
+      *pp_event          = p_event->p_next;
+      p_event->scheduled = false;
+      return;
+    }
+    pp_event = &(*pp_event)->p_next;
+  }
+}
+
+void setupSWO(void)
+{
+  // printf() goes to stdout
+  host_sim_init();
+}
+
+void enableClocksForAci(void)
+{
+}
+
+void efm_cycle_counter_init(void)
+{
+}
+
+uint32_t efm_cycle_clock_get(void)
+{
+  return (uint32_t)HOST_SIM_NS_PER_S;
+}
+
+uint32_t efm_cycles_get(void)
+{
+  struct timespec cpu_time;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+
+  return (uint32_t)(((uint64_t)cpu_time.tv_sec * HOST_SIM_NS_PER_S) + (uint64_t)cpu_time.tv_nsec);
+}
+
+/*
+  ITM. The stimulus port writes go to the file named by EFM_HOST_SWO as the software source packets
+  the SWO pin would carry, so that the same decoders read a capture from either. Without the
+  variable they are dropped.
+*/
+static FILE     *swo_file;
+static bool      swo_opened;
+static uint32_t  itm_ports_enabled;
+
+void efm_itm_port_enable(uint8_t port)
+{
+  itm_ports_enabled |= (1UL << port);
+}
+
+void efm_itm_write32(uint8_t port, uint32_t value)
+{
+  uint8_t packet[5];
+
+  if (!swo_opened)
+  {
+    const char *p_path = getenv("EFM_HOST_SWO");
+
+    swo_opened = true;
+    if (NULL != p_path)
+    {
+      swo_file = fopen(p_path, "wb");
+    }
+  }
+  if ((NULL == swo_file) || (0 == (itm_ports_enabled & (1UL << port))))
+  {
+    return;
+  }
+
+  packet[0] = (uint8_t)((port << 3) | 0x03);
+  packet[1] = (uint8_t)(value);
+  packet[2] = (uint8_t)(value >> 8);
+  packet[3] = (uint8_t)(value >> 16);
+  packet[4] = (uint8_t)(value >> 24);
+  fwrite(packet, sizeof(packet), 1, swo_file);
+}
+
+/*
+  GPIO. A pin reads back its output, or the pull-up, unless something outside drives it. The edge
+  detection of an interrupt line keeps running while it is detached, as on the EFM32.
+*/
+#define HOST_PIN_COUNT   (6 * 16)
+#define GPIO_INT_COUNT   16
+
+static uint8_t  pin_modes[HOST_PIN_COUNT];
+static uint8_t  pin_outputs[HOST_PIN_COUNT];
+static bool     pin_driven[HOST_PIN_COUNT];
+static uint8_t  pin_drive_levels[HOST_PIN_COUNT];
+
+static void    (*gpio_int_handlers[GPIO_INT_COUNT])(void);
+static uint8_t   gpio_int_modes[GPIO_INT_COUNT];
+static uint8_t   gpio_int_ports[GPIO_INT_COUNT];
+static bool      gpio_int_configured[GPIO_INT_COUNT];
+static uint32_t  gpio_int_flags   = 0;
+static uint32_t  gpio_int_enabled = 0;
+
+static uint8_t host_pin_index(uint8_t pin)
+{
+  return (uint8_t)((EFM_PIN_PORT(pin) * 16) + EFM_PIN_NUMBER(pin));
+}
+
+bool host_sim_pin_is(uint8_t pin_a, uint8_t pin_b)
+{
+  return host_pin_index(pin_a) == host_pin_index(pin_b);
+}
+
+static uint8_t host_pin_level(uint8_t index)
+{
+  return pin_driven[index] ? pin_drive_levels[index] : pin_outputs[index];
+}
+
+/* Latches the edge on the interrupt line of the pin, if the line is configured for its port */
+static void host_pin_edge(uint8_t index, uint8_t old_level, uint8_t new_level)
+{
+  const uint8_t line = index % 16;
+  const uint8_t mode = gpio_int_modes[line];
+
+  if ((old_level == new_level) || !gpio_int_configured[line] || (gpio_int_ports[line] != (index / 16)))
+  {
+    return;
+  }
+
+  if ((new_level && ((RISING == mode) || (CHANGE == mode))) ||
+      (!new_level && ((FALLING == mode) || (CHANGE == mode) || (LOW == mode))))
+  {
+    gpio_int_flags |= 1UL << line;
+  }
+}
+
+static void host_pin_update(uint8_t index, uint8_t old_level)
+{
+  const uint8_t new_level = host_pin_level(index);
+
+  host_pin_edge(index, old_level, new_level);
+  host_irq_dispatch();
+}
+
+void host_sim_pin_drive(uint8_t pin, uint8_t level)
+{
+  const uint8_t index     = host_pin_index(pin);
+  const uint8_t old_level = host_pin_level(index);
+
+  pin_driven[index]       = true;
+  pin_drive_levels[index] = level ? 1 : 0;
+  host_pin_update(index, old_level);
+}
+
+void host_sim_pin_release(uint8_t pin)
+{
+  const uint8_t index     = host_pin_index(pin);
+  const uint8_t old_level = host_pin_level(index);
+
+  pin_driven[index] = false;
+  host_pin_update(index, old_level);
+}
+
+static void host_pin_output_set(uint8_t pin, uint8_t value)
+{
+  const uint8_t index     = host_pin_index(pin);
+  const uint8_t old_level = host_pin_level(index);
+  const uint8_t old_value = pin_outputs[index];
+
+  pin_outputs[index] = value ? 1 : 0;
+
+  if ((OUTPUT == pin_modes[index]) && (old_value != pin_outputs[index]))
+  {
+    nrf8001_sim_pin_changed(pin, pin_outputs[index]);
+  }
+  host_pin_update(index, old_level);
+}
+
+void pinMode(uint8_t pin, uint8_t pinMode)
+{
+  const uint8_t index = host_pin_index(pin);
+
+  pin_modes[index] = pinMode;
+
+  // As GPIO_PinModeSet(), the pull-up is selected through DOUT
+  host_pin_output_set(pin, (INPUT_PULLUP == pinMode) ? 1 : 0);
+}
+
+uint8_t digitalRead(uint8_t pin)
+{
+  host_sim_time_advance(HOST_SIM_POLL_NS);
+
+  return host_pin_level(host_pin_index(pin));
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  host_pin_output_set(pin, value);
+}
+
+static uint8_t gpio_int_line_get(uint8_t pin)
+{
+  if (!(pin & 0x80) && (pin >= GPIO_INT_COUNT))
+  {
+    return GPIO_INT_COUNT;
+  }
+
+  return EFM_PIN_NUMBER(pin);
+}
+
+void attachInterrupt(uint8_t interruptNumber, void (*handlerPtr)(void), uint8_t mode)
+{
+  const uint8_t line = gpio_int_line_get(interruptNumber);
+  const uint32_t mask = 1UL << line;
+  bool pending;
+
+  if (line >= GPIO_INT_COUNT)
+  {
+    return;
+  }
+
+  gpio_int_enabled &= ~mask;
+
+  // An edge that came while detached is kept, configuring the line clears the flag
+  pending = (0 != (gpio_int_flags & mask));
+  gpio_int_flags &= ~mask;
+
+  gpio_int_handlers[line]   = handlerPtr;
+  gpio_int_modes[line]      = mode;
+  gpio_int_ports[line]      = (uint8_t)EFM_PIN_PORT(interruptNumber);
+  gpio_int_configured[line] = true;
+
+  if (pending || ((LOW == mode) && (0 == host_pin_level(host_pin_index(interruptNumber)))))
+  {
+    gpio_int_flags |= mask;
+  }
+
+  gpio_int_enabled |= mask;
+  host_irq_dispatch();
+}
+
+void detachInterrupt(uint8_t interruptNumber)
+{
+  const uint8_t line = gpio_int_line_get(interruptNumber);
+
+  if (line >= GPIO_INT_COUNT)
+  {
+    return;
+  }
+
+  gpio_int_enabled &= ~(1UL << line);
+  gpio_int_handlers[line] = NULL;
+}
+
+static void gpio_int_dispatch(uint32_t flags)
+{
+  uint8_t line;
+
+  gpio_int_flags &= ~flags;
+
+  for (line = 0; flags != 0; line++, flags >>= 1)
+  {
+    if ((flags & 0x01) && (NULL != gpio_int_handlers[line]))
+    {
+      gpio_int_handlers[line]();
+
+      if ((LOW == gpio_int_modes[line]) &&
+          (NULL != gpio_int_handlers[line]) &&
+          (0 == host_pin_level((uint8_t)((gpio_int_ports[line] * 16) + line))))
+      {
+        gpio_int_flags |= 1UL << line;
+      }
+    }
+  }
+}
+
+/* SPI masters with DMA, the bytes are exchanged with the model one after another on the clock */
+static uint32_t spi_baudrates[EFM_SPI_COUNT];
+static uint32_t spi_transfers_active = 0;
+static uint32_t spi_transfers_done   = 0;
+static void   (*spi_transfer_done_handler[EFM_SPI_COUNT])(void *p_context);
+static void    *spi_transfer_done_context[EFM_SPI_COUNT];
+
+void efm_spi_init(uint8_t spi, uint8_t location, uint32_t baudrate)
+{
+  (void)location;
+
+  host_sim_init();
+  efm_spi_baudrate_set(spi, baudrate);
+}
+
+static uint64_t host_spi_byte_ns(uint8_t spi)
+{
+  return (8 * HOST_SIM_NS_PER_S) / spi_baudrates[spi];
+}
+
+uint8_t efm_spi_readwrite(uint8_t spi, const uint8_t aci_byte)
+{
+  const uint8_t miso = nrf8001_sim_spi_exchange(spi, aci_byte);
+
+  host_sim_time_advance(host_spi_byte_ns(spi));
+
+  return miso;
+}
+
+uint32_t efm_spi_clock_source_get(void)
+{
+  return HOST_SIM_SPI_CLOCK;
+}
+
+void efm_spi_baudrate_set(uint8_t spi, uint32_t baudrate)
+{
+  // The USART divides the clock by 2 at least
+  if ((0 == baudrate) || (baudrate > (HOST_SIM_SPI_CLOCK / 2)))
+  {
+    baudrate = HOST_SIM_SPI_CLOCK / 2;
+  }
+  spi_baudrates[spi] = baudrate;
+}
+
+uint32_t efm_spi_baudrate_get(uint8_t spi)
+{
+  return spi_baudrates[spi];
+}
+
+void efm_spi_transfer_start(uint8_t spi, const uint8_t *tx_data, uint8_t tx_length, uint8_t *rx_data,
+                            uint8_t length, void (*done_handler)(void *p_context), void *p_context)
+{
+  uint8_t i;
+
+  spi_transfer_done_handler[spi] = done_handler;
+  spi_transfer_done_context[spi] = p_context;
+  spi_transfers_active |= 1UL << spi;
+
+  for (i = 0; i < length; i++)
+  {
+    rx_data[i] = nrf8001_sim_spi_exchange(spi, ((NULL != tx_data) && (i < tx_length)) ? tx_data[i] : 0);
+    host_sim_time_advance(host_spi_byte_ns(spi));
+  }
+
+  // The DMA interrupt
+  spi_transfers_done |= 1UL << spi;
+  host_irq_dispatch();
+}
+
+static void spi_dma_dispatch(void)
+{
+  uint8_t spi;
+
+  for (spi = 0; spi < EFM_SPI_COUNT; spi++)
+  {
+    if (spi_transfers_done & (1UL << spi))
+    {
+      spi_transfers_done   &= ~(1UL << spi);
+      spi_transfers_active &= ~(1UL << spi);
+
+      if (NULL != spi_transfer_done_handler[spi])
+      {
+        spi_transfer_done_handler[spi](spi_transfer_done_context[spi]);
+      }
+    }
+  }
+}
+
+/* The RTC, the counter follows the clock. The timers are kept as hal_platform.cpp keeps them. */
+static efm_timer_t *lf_timers = NULL;
+
+static void efm_lf_timers_run(void);
+
+void efm_lf_timer_init(void)
+{
+  host_sim_init();
+}
+
+static uint64_t host_lf_ticks(void)
+{
+  return (sim_time_ns * EFM_LF_TICKS_PER_SECOND) / HOST_SIM_NS_PER_S;
+}
+
+uint32_t efm_lf_ticks_get(void)
+{
+  host_sim_time_advance(HOST_SIM_POLL_NS);
+
+  return (uint32_t)host_lf_ticks();
+}
+
+static bool host_lf_timer_due(void)
+{
+  return (NULL != lf_timers) && ((int32_t)((uint32_t)host_lf_ticks() - lf_timers->expiry) >= 0);
+}
+
+/* Time at which the first timer is due */
+static uint64_t host_lf_timer_time_ns(void)
+{
+  const uint64_t ticks = host_lf_ticks();
+  const uint64_t expiry = ticks + (uint64_t)(int64_t)(int32_t)(lf_timers->expiry - (uint32_t)ticks);
+
+  return ((expiry * HOST_SIM_NS_PER_S) + EFM_LF_TICKS_PER_SECOND - 1) / EFM_LF_TICKS_PER_SECOND;
+}
+
+static void efm_lf_timer_insert(efm_timer_t *p_timer)
+{
+  efm_timer_t **pp_timer = &lf_timers;
+
+  p_timer->running = true;
+
+  while ((NULL != *pp_timer) && ((int32_t)((*pp_timer)->expiry - p_timer->expiry) <= 0))
+  {
+    pp_timer = &(*pp_timer)->p_next;
+  }
+
+  p_timer->p_next = *pp_timer;
+  *pp_timer       = p_timer;
+}
+
+static bool efm_lf_timer_remove(efm_timer_t *p_timer)
+{
+  efm_timer_t **pp_timer = &lf_timers;
+
+  if (!p_timer->running)
+  {
+    return false;
+  }
+
+  while (NULL != *pp_timer)
+  {
+    if (*pp_timer == p_timer)
+    {
+      *pp_timer        = p_timer->p_next;
+      p_timer->running = false;
+      return true;
+    }
+    pp_timer = &(*pp_timer)->p_next;
+  }
+
+  return false;
+}
+
+static void efm_lf_timers_run(void)
+{
+  efm_timer_t *p_timer;
+
+  while (host_lf_timer_due())
+  {
+    p_timer   = lf_timers;
+    lf_timers = p_timer->p_next;
+
+    if (0 != p_timer->period)
+    {
+      p_timer->expiry += p_timer->period;
+      efm_lf_timer_insert(p_timer);
+    }
+    else
+    {
+      p_timer->running = false;
+    }
+
+    p_timer->handler(p_timer->p_context);
+  }
+}
+
+void efm_timer_start(efm_timer_t *p_timer, uint32_t ticks, uint32_t period,
+                     efm_timer_handler_t handler, void *p_context)
+{
+  noInterrupts();
+  efm_lf_timer_remove(p_timer);
+
+  p_timer->expiry    = (uint32_t)host_lf_ticks() + ticks;
+  p_timer->period    = period;
+  p_timer->handler   = handler;
+  p_timer->p_context = p_context;
+  efm_lf_timer_insert(p_timer);
+  interrupts();
+}
+
+void efm_timer_stop(efm_timer_t *p_timer)
+{
+  noInterrupts();
+  efm_lf_timer_remove(p_timer);
+  interrupts();
+}
+
+bool efm_timer_is_running(efm_timer_t *p_timer)
+{
+  return p_timer->running;
+}
+
+static void delay_done(void *p_context)
+{
+  *(volatile bool *)p_context = true;
+}
+
+void delay(uint32_t dlyTicks)
+{
+  efm_timer_t   timer;
+  volatile bool done = false;
+
+  if (0 == dlyTicks)
+  {
+    return;
+  }
+
+  timer.running = false;
+  efm_timer_start(&timer, EFM_LF_MS_TO_TICKS(dlyTicks), 0, delay_done, (void *)&done);
+
+  while (!done)
+  {
+    noInterrupts();
+    if (!done)
+    {
+      efm_sleep();
+    }
+    interrupts();
+  }
+}
+
+uint32_t millis(void)
+{
+  return (uint32_t)(((uint64_t)efm_lf_ticks_get() * 1000) / EFM_LF_TICKS_PER_SECOND);
+}
+
+/*
+  Waits for an interrupt, as WFI does also with the interrupts masked. The clock jumps to the next
+  event of the simulated peripherals until one of them raises an interrupt.
+*/
+static void host_sleep(void)
+{
+  const uint32_t serviced = irq_serviced;
+  uint64_t       wakeup_ns;
+
+  while (!host_irq_pending() && (serviced == irq_serviced))
+  {
+    if ((NULL == sim_events) && (NULL == lf_timers))
+    {
+      // Nothing is left to wake the MCU up
+      host_sim_time_advance(sim_end_ns - sim_time_ns);
+    }
+
+    wakeup_ns = sim_end_ns;
+    if ((NULL != sim_events) && (sim_events->time_ns < wakeup_ns))
+    {
+      wakeup_ns = sim_events->time_ns;
+    }
+    if ((NULL != lf_timers) && (host_lf_timer_time_ns() < wakeup_ns))
+    {
+      wakeup_ns = host_lf_timer_time_ns();
+    }
+
+    host_sim_time_advance((wakeup_ns > sim_time_ns) ? (wakeup_ns - sim_time_ns) : 0);
+  }
+}
+
+void efm_sleep_em1(void)
+{
+  host_sleep();
+}
+
+void efm_sleep_em2(void)
+{
+  host_sleep();
+}
+
+void efm_sleep(void)
+{
+  host_sleep();
+}
+
+void noInterrupts(void)
+{
+  irq_disable_count++;
+}
+
+void interrupts(void)
+{
+  if (irq_disable_count > 0)
+  {
+    irq_disable_count--;
+  }
+  host_irq_dispatch();
+}
+
+static bool host_irq_pending(void)
+{
+  return (0 != (gpio_int_flags & gpio_int_enabled)) || (0 != spi_transfers_done) || host_lf_timer_due();
+}
+
+static void host_irq_dispatch(void)
+{
+  uint32_t gpio_flags;
+
+  if ((0 != irq_disable_count) || irq_active)
+  {
+    return;
+  }
+
+  irq_active = true;
+  while (host_irq_pending())
+  {
+    irq_serviced++;
+
+    gpio_flags = gpio_int_flags & gpio_int_enabled;
+    if (0 != spi_transfers_done)
+    {
+      spi_dma_dispatch();
+    }
+    else if (0 != gpio_flags)
+    {
+      gpio_int_dispatch(gpio_flags);
+    }
+    else
+    {
+      efm_lf_timers_run();
+    }
+  }
+  irq_active = false;
+}
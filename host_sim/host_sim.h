@@ -0,0 +1,73 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Simulated EFM32 shared by the host platform layer and the nRF8001 model.
+ *
+ * Everything runs on one thread against a virtual clock. The clock moves when the MCU clocks SPI
+ * bytes, polls a pin or the time, or sleeps. Interrupts are pended by the simulated peripherals and
+ * serviced as soon as they are unmasked, in the thread that unmasked them.
+ */
+
+#ifndef HOST_SIM_H__
+#define HOST_SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HOST_SIM_NS_PER_US  1000ULL
+#define HOST_SIM_NS_PER_MS  1000000ULL
+#define HOST_SIM_NS_PER_S   1000000000ULL
+
+/* Simulated peripheral event, owned by the caller. A zeroed event is not scheduled. */
+typedef struct host_sim_event_t
+{
+  struct host_sim_event_t  *p_next;
+  uint64_t                  time_ns;
+  void                    (*handler)(void *p_context);
+  void                     *p_context;
+  bool                      scheduled;
+} host_sim_event_t;
+
+uint64_t host_sim_time_get(void);
+
+/* Moves the clock forward, running the events that fall due and the interrupts that they raise */
+void host_sim_time_advance(uint64_t ns);
+
+/* Runs the handler delay_ns from now. Reschedules an event that is already scheduled. */
+void host_sim_event_schedule(host_sim_event_t *p_event, uint64_t delay_ns,
+                             void (*handler)(void *p_context), void *p_context);
+void host_sim_event_cancel(host_sim_event_t *p_event);
+
+/* Drives an MCU input pin from outside, edges raise the GPIO interrupt configured on the pin */
+void host_sim_pin_drive(uint8_t pin, uint8_t level);
+/* Stops driving the pin, it reads back as the MCU output or pull-up */
+void host_sim_pin_release(uint8_t pin);
+
+/* Same pin, whether given as a plain port D number or as EFM_PIN(port, pin) */
+bool host_sim_pin_is(uint8_t pin_a, uint8_t pin_b);
+
+/* Model side of the SPI, a byte is exchanged for every byte the master clocks */
+uint8_t nrf8001_sim_spi_exchange(uint8_t spi, uint8_t mosi);
+/* Called when an MCU output changes level */
+void nrf8001_sim_pin_changed(uint8_t pin, uint8_t level);
+
+#endif /* HOST_SIM_H__ */
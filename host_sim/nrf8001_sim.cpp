@@ -0,0 +1,646 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal_platform.h"
+#include "aci.h"
+#include "aci_cmds.h"
+#include "aci_evts.h"
+#include "host_sim.h"
+#include "nrf8001_sim.h"
+
+/* Wired as the radios of the transport verification demo, by USART number */
+static const nrf8001_sim_wiring_t nrf8001_sim_wiring[EFM_SPI_COUNT] =
+{
+  {  9, 10, 11 },
+  {  3,  5,  6 },
+  { 13, 12, 14 }
+};
+
+#define NRF8001_SIM_EVT_QUEUE_SIZE  16
+#define NRF8001_SIM_CREDITS         2
+#define NRF8001_SIM_SETUP_LAST      0xF0
+
+/* The peer connects with a 100 ms interval and moves to NRF8001_SIM_INTERVAL after the timing update */
+#define NRF8001_SIM_INTERVAL_INITIAL  0x0050
+#define NRF8001_SIM_TIMING_UPDATE_MS  500
+
+/* Pipes 1 to 7 open when connected, the model does not read the services out of the setup */
+#define NRF8001_SIM_PIPES_OPEN      0xFE
+
+typedef struct
+{
+  const nrf8001_sim_wiring_t *p_wiring;
+
+  bool              in_reset;
+  bool              started;
+  bool              setup_done;
+  uint8_t           mode;             /* aci_device_operation_mode_t */
+  bool              advertising;
+  bool              connected;
+  uint8_t           pipes_open;
+  uint8_t           credits;
+  uint8_t           credits_in_flight;
+  uint16_t          conn_interval;
+
+  /* Events waiting for the MCU, each as the length byte followed by the event */
+  uint8_t           evt_queue[NRF8001_SIM_EVT_QUEUE_SIZE][ACI_PACKET_MAX_LEN + 1];
+  uint8_t           evt_head;
+  uint8_t           evt_count;
+
+  /* SPI handshake and the transaction that is running */
+  bool              reqn_low;
+  bool              rdyn_low;
+  bool              in_transaction;
+  bool              evt_sending;
+  uint8_t           byte_index;
+  uint8_t           cmd[ACI_PACKET_MAX_LEN + 1];
+
+  host_sim_event_t  start_event;
+  host_sim_event_t  link_event;
+  host_sim_event_t  credit_event;
+  host_sim_event_t  timing_event;
+  host_sim_event_t  peer_event;
+  uint8_t           peer_count;
+
+  nrf8001_sim_cmd_observer_t cmd_observer;
+} nrf8001_sim_t;
+
+static nrf8001_sim_t nrf8001_sims[EFM_SPI_COUNT];
+
+static uint64_t nrf8001_sim_startup_ns;
+static uint64_t nrf8001_sim_response_ns;
+static uint64_t nrf8001_sim_connect_ns;
+static uint16_t nrf8001_sim_interval;
+static uint64_t nrf8001_sim_peer_write_ns;
+static uint8_t  nrf8001_sim_peer_pipe;
+
+static uint32_t nrf8001_sim_env_get(const char *p_name, uint32_t default_value)
+{
+  const char *p_value = getenv(p_name);
+
+  return (NULL != p_value) ? (uint32_t)strtoul(p_value, NULL, 0) : default_value;
+}
+
+static nrf8001_sim_t *nrf8001_sim_get(uint8_t spi)
+{
+  static bool initialized = false;
+  uint8_t i;
+
+  if (!initialized)
+  {
+    nrf8001_sim_startup_ns  = nrf8001_sim_env_get("NRF8001_SIM_STARTUP_MS", 62) * HOST_SIM_NS_PER_MS;
+    nrf8001_sim_response_ns = nrf8001_sim_env_get("NRF8001_SIM_RESPONSE_US", 20) * HOST_SIM_NS_PER_US;
+    nrf8001_sim_connect_ns  = nrf8001_sim_env_get("NRF8001_SIM_CONNECT_MS", 1000) * HOST_SIM_NS_PER_MS;
+    nrf8001_sim_interval    = (uint16_t)nrf8001_sim_env_get("NRF8001_SIM_INTERVAL", 0x0018);
+    nrf8001_sim_peer_write_ns = nrf8001_sim_env_get("NRF8001_SIM_PEER_WRITE_MS", 0) * HOST_SIM_NS_PER_MS;
+    nrf8001_sim_peer_pipe     = (uint8_t)nrf8001_sim_env_get("NRF8001_SIM_PEER_PIPE", 1);
+
+    for (i = 0; i < EFM_SPI_COUNT; i++)
+    {
+      nrf8001_sims[i].p_wiring = &nrf8001_sim_wiring[i];
+      nrf8001_sims[i].in_reset = true;
+    }
+    initialized = true;
+  }
+
+  return (spi < EFM_SPI_COUNT) ? &nrf8001_sims[spi] : NULL;
+}
+
+/* RDYN is low from the first event or REQN until the end of the transaction */
+static void nrf8001_sim_rdyn_update(nrf8001_sim_t *p_sim)
+{
+  const bool low = p_sim->started && (p_sim->in_transaction || p_sim->reqn_low || (p_sim->evt_count > 0));
+
+  if (low != p_sim->rdyn_low)
+  {
+    p_sim->rdyn_low = low;
+    host_sim_pin_drive(p_sim->p_wiring->rdyn_pin, low ? 0 : 1);
+  }
+}
+
+static void nrf8001_sim_evt_put(nrf8001_sim_t *p_sim, uint8_t opcode, const uint8_t *p_params, uint8_t length)
+{
+  uint8_t *p_evt;
+
+  if (p_sim->evt_count >= NRF8001_SIM_EVT_QUEUE_SIZE)
+  {
+    fprintf(stderr, "nrf8001_sim: event queue full, 0x%02x dropped\n", opcode);
+    return;
+  }
+
+  p_evt = p_sim->evt_queue[(p_sim->evt_head + p_sim->evt_count) % NRF8001_SIM_EVT_QUEUE_SIZE];
+  p_evt[0] = (uint8_t)(length + 1);
+  p_evt[1] = opcode;
+  if (length > 0)
+  {
+    memcpy(&p_evt[2], p_params, length);
+  }
+  p_sim->evt_count++;
+
+  nrf8001_sim_rdyn_update(p_sim);
+}
+
+static void nrf8001_sim_device_started(nrf8001_sim_t *p_sim, uint8_t mode)
+{
+  uint8_t params[3];
+
+  p_sim->mode = mode;
+
+  params[0] = mode;
+  params[1] = ACI_HW_ERROR_NONE;
+  params[2] = NRF8001_SIM_CREDITS;
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_DEVICE_STARTED, params, sizeof(params));
+}
+
+static void nrf8001_sim_cmd_rsp(nrf8001_sim_t *p_sim, uint8_t cmd_opcode, uint8_t status)
+{
+  uint8_t params[2];
+
+  params[0] = cmd_opcode;
+  params[1] = status;
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_CMD_RSP, params, sizeof(params));
+}
+
+static void nrf8001_sim_disconnected(nrf8001_sim_t *p_sim, uint8_t aci_status, uint8_t btle_status)
+{
+  uint8_t params[2];
+
+  host_sim_event_cancel(&p_sim->link_event);
+  host_sim_event_cancel(&p_sim->credit_event);
+  host_sim_event_cancel(&p_sim->timing_event);
+  host_sim_event_cancel(&p_sim->peer_event);
+  p_sim->advertising       = false;
+  p_sim->connected         = false;
+  p_sim->credits           = NRF8001_SIM_CREDITS;
+  p_sim->credits_in_flight = 0;
+
+  params[0] = aci_status;
+  params[1] = btle_status;
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_DISCONNECTED, params, sizeof(params));
+}
+
+static void nrf8001_sim_started(void *p_context)
+{
+  nrf8001_sim_t *p_sim = (nrf8001_sim_t *)p_context;
+
+  p_sim->started = true;
+  p_sim->credits = NRF8001_SIM_CREDITS;
+  nrf8001_sim_device_started(p_sim, ACI_DEVICE_SETUP);
+}
+
+static void nrf8001_sim_reset(nrf8001_sim_t *p_sim)
+{
+  host_sim_event_cancel(&p_sim->start_event);
+  host_sim_event_cancel(&p_sim->link_event);
+  host_sim_event_cancel(&p_sim->credit_event);
+  host_sim_event_cancel(&p_sim->timing_event);
+  host_sim_event_cancel(&p_sim->peer_event);
+
+  p_sim->in_reset          = true;
+  p_sim->started           = false;
+  p_sim->setup_done        = false;
+  p_sim->mode              = ACI_DEVICE_INVALID;
+  p_sim->advertising       = false;
+  p_sim->connected         = false;
+  p_sim->credits_in_flight = 0;
+  p_sim->evt_head          = 0;
+  p_sim->evt_count         = 0;
+  p_sim->in_transaction    = false;
+
+  nrf8001_sim_rdyn_update(p_sim);
+}
+
+/* Connection interval, slave latency and supervision timeout as in the Connected and Timing events */
+static void nrf8001_sim_timing_put(uint8_t *p_params, uint16_t interval)
+{
+  p_params[0] = (uint8_t)interval;
+  p_params[1] = (uint8_t)(interval >> 8);
+  p_params[2] = 0;                  /* Slave latency */
+  p_params[3] = 0;
+  p_params[4] = 0xF4;               /* Supervision timeout of 5 s */
+  p_params[5] = 0x01;
+}
+
+static void nrf8001_sim_timing_update(void *p_context)
+{
+  nrf8001_sim_t *p_sim = (nrf8001_sim_t *)p_context;
+  uint8_t timing[6];
+
+  p_sim->conn_interval = nrf8001_sim_interval;
+  nrf8001_sim_timing_put(timing, p_sim->conn_interval);
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_TIMING, timing, sizeof(timing));
+}
+
+/* The peer writes a counter to NRF8001_SIM_PEER_PIPE */
+static void nrf8001_sim_peer_periodic_write(void *p_context)
+{
+  nrf8001_sim_t *p_sim = (nrf8001_sim_t *)p_context;
+
+  p_sim->peer_count++;
+  nrf8001_sim_peer_write((uint8_t)(p_sim - &nrf8001_sims[0]), nrf8001_sim_peer_pipe, &p_sim->peer_count, 1);
+  host_sim_event_schedule(&p_sim->peer_event, nrf8001_sim_peer_write_ns, nrf8001_sim_peer_periodic_write, p_sim);
+}
+
+/* Only pipes 1 to 7 are modelled, the rest of the bitmaps stays empty */
+static void nrf8001_sim_pipe_status(nrf8001_sim_t *p_sim)
+{
+  uint8_t pipe_status[16];
+
+  memset(pipe_status, 0, sizeof(pipe_status));
+  pipe_status[0] = p_sim->pipes_open;
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_PIPE_STATUS, pipe_status, sizeof(pipe_status));
+}
+
+static void nrf8001_sim_connected(void *p_context)
+{
+  nrf8001_sim_t *p_sim = (nrf8001_sim_t *)p_context;
+  uint8_t connected[14] = { ACI_BD_ADDR_TYPE_PUBLIC, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+
+  p_sim->advertising   = false;
+  p_sim->connected     = true;
+  p_sim->pipes_open    = NRF8001_SIM_PIPES_OPEN;
+  p_sim->conn_interval = NRF8001_SIM_INTERVAL_INITIAL;
+
+  nrf8001_sim_timing_put(&connected[7], p_sim->conn_interval);
+  connected[13] = ACI_CLOCK_ACCURACY_250_PPM;
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_CONNECTED, connected, sizeof(connected));
+
+  nrf8001_sim_pipe_status(p_sim);
+
+  host_sim_event_schedule(&p_sim->timing_event, NRF8001_SIM_TIMING_UPDATE_MS * HOST_SIM_NS_PER_MS,
+                          nrf8001_sim_timing_update, p_sim);
+  if (0 != nrf8001_sim_peer_write_ns)
+  {
+    host_sim_event_schedule(&p_sim->peer_event, nrf8001_sim_peer_write_ns, nrf8001_sim_peer_periodic_write, p_sim);
+  }
+}
+
+static void nrf8001_sim_advertising_timeout(void *p_context)
+{
+  nrf8001_sim_disconnected((nrf8001_sim_t *)p_context, ACI_STATUS_ERROR_ADVT_TIMEOUT, 0);
+}
+
+/* The peer has acknowledged the data sent since the last connection event */
+static void nrf8001_sim_credits_return(void *p_context)
+{
+  nrf8001_sim_t *p_sim = (nrf8001_sim_t *)p_context;
+  uint8_t credit = p_sim->credits_in_flight;
+
+  p_sim->credits          += credit;
+  p_sim->credits_in_flight = 0;
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_DATA_CREDIT, &credit, sizeof(credit));
+}
+
+static void nrf8001_sim_cmd_connect(nrf8001_sim_t *p_sim, const uint8_t *p_params)
+{
+  const uint16_t timeout_s = (uint16_t)(p_params[0] | (p_params[1] << 8));
+  const uint64_t timeout_ns = timeout_s * HOST_SIM_NS_PER_S;
+
+  if ((ACI_DEVICE_STANDBY != p_sim->mode) || p_sim->advertising || p_sim->connected)
+  {
+    nrf8001_sim_cmd_rsp(p_sim, ACI_CMD_CONNECT, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+    return;
+  }
+
+  nrf8001_sim_cmd_rsp(p_sim, ACI_CMD_CONNECT, ACI_STATUS_SUCCESS);
+  p_sim->advertising = true;
+
+  // A timeout of 0 advertises until a peer connects
+  if ((0 != nrf8001_sim_connect_ns) && ((0 == timeout_s) || (nrf8001_sim_connect_ns < timeout_ns)))
+  {
+    host_sim_event_schedule(&p_sim->link_event, nrf8001_sim_connect_ns, nrf8001_sim_connected, p_sim);
+  }
+  else if (0 != timeout_s)
+  {
+    host_sim_event_schedule(&p_sim->link_event, timeout_ns, nrf8001_sim_advertising_timeout, p_sim);
+  }
+}
+
+static void nrf8001_sim_cmd_send_data(nrf8001_sim_t *p_sim, uint8_t pipe)
+{
+  uint8_t pipe_error[2];
+
+  if (!p_sim->connected)
+  {
+    nrf8001_sim_cmd_rsp(p_sim, ACI_CMD_SEND_DATA, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+    return;
+  }
+
+  pipe_error[0] = pipe;
+  if ((pipe > 7) || !(p_sim->pipes_open & (1 << pipe)))
+  {
+    pipe_error[1] = ACI_STATUS_ERROR_PIPE_STATE_INVALID;
+    nrf8001_sim_evt_put(p_sim, ACI_EVT_PIPE_ERROR, pipe_error, sizeof(pipe_error));
+    return;
+  }
+
+  if (0 == p_sim->credits)
+  {
+    pipe_error[1] = ACI_STATUS_ERROR_CREDIT_NOT_AVAILABLE;
+    nrf8001_sim_evt_put(p_sim, ACI_EVT_PIPE_ERROR, pipe_error, sizeof(pipe_error));
+    return;
+  }
+
+  // Sent in the next connection event, the credit comes back with it
+  p_sim->credits--;
+  p_sim->credits_in_flight++;
+  if (!p_sim->credit_event.scheduled)
+  {
+    host_sim_event_schedule(&p_sim->credit_event, p_sim->conn_interval * 1250 * HOST_SIM_NS_PER_US,
+                            nrf8001_sim_credits_return, p_sim);
+  }
+}
+
+/* Runs the command the MCU has sent, length and opcode as on the SPI followed by the parameters */
+static void nrf8001_sim_cmd(nrf8001_sim_t *p_sim, const uint8_t *p_cmd)
+{
+  const uint8_t  length   = p_cmd[0];
+  const uint8_t  opcode   = p_cmd[1];
+  const uint8_t *p_params = &p_cmd[2];
+
+  if (NULL != p_sim->cmd_observer)
+  {
+    p_sim->cmd_observer((uint8_t)(p_sim - &nrf8001_sims[0]), p_cmd);
+  }
+
+  switch (opcode)
+  {
+    case ACI_CMD_TEST:
+      if ((ACI_DEVICE_TEST == p_sim->mode) && (ACI_TEST_MODE_EXIT == p_params[0]))
+      {
+        nrf8001_sim_device_started(p_sim, p_sim->setup_done ? ACI_DEVICE_STANDBY : ACI_DEVICE_SETUP);
+      }
+      else if ((ACI_DEVICE_TEST != p_sim->mode) && (ACI_TEST_MODE_EXIT != p_params[0]))
+      {
+        nrf8001_sim_device_started(p_sim, ACI_DEVICE_TEST);
+      }
+      else
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      break;
+
+    case ACI_CMD_ECHO:
+      if (ACI_DEVICE_TEST == p_sim->mode)
+      {
+        nrf8001_sim_evt_put(p_sim, ACI_EVT_ECHO, p_params, (uint8_t)(length - 1));
+      }
+      else
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      break;
+
+    case ACI_CMD_SETUP:
+      if (ACI_DEVICE_SETUP != p_sim->mode)
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      else if (NRF8001_SIM_SETUP_LAST == p_params[0])
+      {
+        // The record with the CRC closes the setup
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_TRANSACTION_COMPLETE);
+        p_sim->setup_done = true;
+        nrf8001_sim_device_started(p_sim, ACI_DEVICE_STANDBY);
+      }
+      else
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_TRANSACTION_CONTINUE);
+      }
+      break;
+
+    case ACI_CMD_SLEEP:
+      if (ACI_DEVICE_STANDBY == p_sim->mode)
+      {
+        p_sim->mode = ACI_DEVICE_SLEEP;
+      }
+      else
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      break;
+
+    case ACI_CMD_WAKEUP:
+      if (ACI_DEVICE_SLEEP == p_sim->mode)
+      {
+        nrf8001_sim_device_started(p_sim, ACI_DEVICE_STANDBY);
+      }
+      else
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      break;
+
+    case ACI_CMD_CONNECT:
+      nrf8001_sim_cmd_connect(p_sim, p_params);
+      break;
+
+    case ACI_CMD_DISCONNECT:
+      if (p_sim->connected)
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_SUCCESS);
+        nrf8001_sim_disconnected(p_sim, ACI_STATUS_SUCCESS, 0x16);   /* Terminated by local host */
+      }
+      else
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      break;
+
+    case ACI_CMD_SEND_DATA:
+      nrf8001_sim_cmd_send_data(p_sim, p_params[0]);
+      break;
+
+    default:
+      if ((ACI_CMD_TEST > opcode) || (ACI_CMD_CLOSE_REMOTE_PIPE < opcode))
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_CMD_UNKNOWN);
+      }
+      else if ((ACI_DEVICE_STANDBY != p_sim->mode) &&
+               (ACI_CMD_GET_DEVICE_VERSION != opcode) && (ACI_CMD_GET_DEVICE_ADDRESS != opcode))
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      else
+      {
+        nrf8001_sim_cmd_rsp(p_sim, opcode, ACI_STATUS_SUCCESS);
+      }
+      break;
+  }
+}
+
+/* REQN has gone high, the event that was clocked out is gone and the command that came in runs */
+static void nrf8001_sim_transaction_end(nrf8001_sim_t *p_sim)
+{
+  bool cmd_received;
+
+  p_sim->in_transaction = false;
+
+  if (p_sim->evt_sending && (p_sim->byte_index >= 2))
+  {
+    p_sim->evt_head = (uint8_t)((p_sim->evt_head + 1) % NRF8001_SIM_EVT_QUEUE_SIZE);
+    p_sim->evt_count--;
+  }
+
+  cmd_received = (p_sim->cmd[0] > 0) && (p_sim->byte_index > p_sim->cmd[0]);
+
+  // RDYN goes high before the nRF8001 asks for the next transaction
+  p_sim->rdyn_low = false;
+  host_sim_pin_drive(p_sim->p_wiring->rdyn_pin, 1);
+
+  if (cmd_received)
+  {
+    nrf8001_sim_cmd(p_sim, p_sim->cmd);
+    // The MCU waits for the response, the nRF8001 takes its time to process the command
+    host_sim_time_advance(nrf8001_sim_response_ns);
+  }
+
+  nrf8001_sim_rdyn_update(p_sim);
+}
+
+void nrf8001_sim_pin_changed(uint8_t pin, uint8_t level)
+{
+  uint8_t        spi;
+  nrf8001_sim_t *p_sim;
+
+  for (spi = 0; spi < EFM_SPI_COUNT; spi++)
+  {
+    p_sim = nrf8001_sim_get(spi);
+
+    if (host_sim_pin_is(pin, p_sim->p_wiring->reset_pin))
+    {
+      if (0 == level)
+      {
+        nrf8001_sim_reset(p_sim);
+      }
+      else if (p_sim->in_reset)
+      {
+        p_sim->in_reset = false;
+        host_sim_event_schedule(&p_sim->start_event, nrf8001_sim_startup_ns, nrf8001_sim_started, p_sim);
+      }
+    }
+    else if (host_sim_pin_is(pin, p_sim->p_wiring->reqn_pin))
+    {
+      p_sim->reqn_low = (0 == level);
+
+      if (!p_sim->reqn_low && p_sim->in_transaction)
+      {
+        nrf8001_sim_transaction_end(p_sim);
+      }
+      else
+      {
+        nrf8001_sim_rdyn_update(p_sim);
+      }
+    }
+  }
+}
+
+uint8_t nrf8001_sim_spi_exchange(uint8_t spi, uint8_t mosi)
+{
+  nrf8001_sim_t *p_sim = nrf8001_sim_get(spi);
+  uint8_t        miso  = 0;
+  const uint8_t *p_evt;
+
+  // The nRF8001 only listens while both lines are low
+  if ((NULL == p_sim) || !p_sim->reqn_low || !p_sim->rdyn_low)
+  {
+    return 0;
+  }
+
+  if (!p_sim->in_transaction)
+  {
+    p_sim->in_transaction = true;
+    p_sim->evt_sending    = (p_sim->evt_count > 0);
+    p_sim->byte_index     = 0;
+    p_sim->cmd[0]         = 0;
+  }
+
+  // The debug byte, then the event with its length
+  if ((p_sim->byte_index > 0) && p_sim->evt_sending)
+  {
+    p_evt = p_sim->evt_queue[p_sim->evt_head];
+    if (p_sim->byte_index <= p_evt[0] + 1)
+    {
+      miso = p_evt[p_sim->byte_index - 1];
+    }
+  }
+
+  if (p_sim->byte_index < sizeof(p_sim->cmd))
+  {
+    p_sim->cmd[p_sim->byte_index] = mosi;
+  }
+  p_sim->byte_index++;
+
+  return miso;
+}
+
+bool nrf8001_sim_peer_write(uint8_t spi, uint8_t pipe, const uint8_t *p_data, uint8_t length)
+{
+  nrf8001_sim_t *p_sim = nrf8001_sim_get(spi);
+  uint8_t        params[ACI_PACKET_MAX_LEN];
+
+  if ((NULL == p_sim) || !p_sim->connected || (length > (ACI_PACKET_MAX_LEN - 3)))
+  {
+    return false;
+  }
+
+  params[0] = pipe;
+  memcpy(&params[1], p_data, length);
+  nrf8001_sim_evt_put(p_sim, ACI_EVT_DATA_RECEIVED, params, (uint8_t)(length + 1));
+
+  return true;
+}
+
+void nrf8001_sim_peer_disconnect(uint8_t spi)
+{
+  nrf8001_sim_t *p_sim = nrf8001_sim_get(spi);
+
+  if ((NULL != p_sim) && p_sim->connected)
+  {
+    nrf8001_sim_disconnected(p_sim, ACI_STATUS_SUCCESS, 0x13);   /* Remote user terminated */
+  }
+}
+
+void nrf8001_sim_peer_pipe_close(uint8_t spi, uint8_t pipe)
+{
+  nrf8001_sim_t *p_sim = nrf8001_sim_get(spi);
+
+  if ((NULL != p_sim) && p_sim->connected && (pipe <= 7) && (p_sim->pipes_open & (1 << pipe)))
+  {
+    p_sim->pipes_open = (uint8_t)(p_sim->pipes_open & ~(1 << pipe));
+    nrf8001_sim_pipe_status(p_sim);
+  }
+}
+
+void nrf8001_sim_cmd_observer_set(uint8_t spi, nrf8001_sim_cmd_observer_t observer)
+{
+  nrf8001_sim_t *p_sim = nrf8001_sim_get(spi);
+
+  if (NULL != p_sim)
+  {
+    p_sim->cmd_observer = observer;
+  }
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Behavioural model of the nRF8001 for the host build.
+ *
+ * One model sits on each USART, wired to the MCU as the transport verification demo wires its
+ * radios. It answers the ACI commands the SDK sends: Test and Echo, the Setup records, Connect,
+ * Disconnect and SendData, with a peer that connects, updates the connection timing and returns the
+ * data credits one connection interval after the data was sent. Other commands are acknowledged
+ * with a success response.
+ *
+ * The timing is set from the environment:
+ *  - NRF8001_SIM_STARTUP_MS      Reset to DeviceStarted, 62 by default
+ *  - NRF8001_SIM_RESPONSE_US     Command to response event, 20 by default
+ *  - NRF8001_SIM_CONNECT_MS      Advertising to Connected, 1000 by default. 0 never connects
+ *  - NRF8001_SIM_INTERVAL        Connection interval after the timing update, in 1.25 ms units,
+ *                                0x0018 by default
+ *  - NRF8001_SIM_PEER_WRITE_MS   Period of the peer writing a counter while connected, 0 by default
+ *                                which does not write
+ *  - NRF8001_SIM_PEER_PIPE       Pipe the peer writes the counter to, 1 by default
+ */
+
+#ifndef NRF8001_SIM_H__
+#define NRF8001_SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Pins the model on a USART is wired to, as in the aci_radio_pins table of the demo */
+typedef struct
+{
+  uint8_t reqn_pin;
+  uint8_t rdyn_pin;
+  uint8_t reset_pin;
+} nrf8001_sim_wiring_t;
+
+/* The peer writes to a pipe, the model reports a DataReceived event. Returns false unless connected */
+bool nrf8001_sim_peer_write(uint8_t spi, uint8_t pipe, const uint8_t *p_data, uint8_t length);
+
+/* The peer drops the link, the model reports a Disconnected event */
+void nrf8001_sim_peer_disconnect(uint8_t spi);
+
+/* The peer closes a pipe, the model reports a Pipe Status event and answers SendData on the pipe
+   with a PipeError until the next connection */
+void nrf8001_sim_peer_pipe_close(uint8_t spi, uint8_t pipe);
+
+/* Sees every command the model receives, length and opcode as on the SPI followed by the
+   parameters, before the model runs it */
+typedef void (*nrf8001_sim_cmd_observer_t)(uint8_t spi, const uint8_t *p_cmd);
+
+/* Sets the observer of the model on a USART, NULL removes it */
+void nrf8001_sim_cmd_observer_set(uint8_t spi, nrf8001_sim_cmd_observer_t observer);
+
+#endif /* NRF8001_SIM_H__ */
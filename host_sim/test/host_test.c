@@ -0,0 +1,101 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Checks shared by the host tests, see host_test.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "host_test.h"
+
+static const char *test_name     = "test";
+static uint32_t    test_checks   = 0;
+static uint32_t    test_failures = 0;
+static uint32_t    test_asserts  = 0;
+static bool        test_asserts_expected = false;
+static bool        test_done     = false;
+
+/* The host platform ends a program with exit(0) when the simulated time runs out */
+static void host_test_exit_check(void)
+{
+  if (!test_done)
+  {
+    fflush(stdout);
+    fprintf(stderr, "%s: FAILED, did not finish in the simulated time\n", test_name);
+    _exit(1);
+  }
+}
+
+void host_test_init(const char *p_name)
+{
+  test_name = p_name;
+  atexit(host_test_exit_check);
+}
+
+bool host_test_check(bool ok, const char *p_expr, const char *p_file, int line)
+{
+  test_checks++;
+  if (!ok)
+  {
+    test_failures++;
+    printf("%s:%d: check failed: %s\n", p_file, line, p_expr);
+  }
+
+  return ok;
+}
+
+/* Define how assert should function in the BLE library */
+void __ble_assert(const char *file, uint16_t line)
+{
+  test_asserts++;
+  if (!test_asserts_expected)
+  {
+    host_test_check(false, "ble_assert", file, line);
+  }
+}
+
+void host_test_assert_expect(bool expect)
+{
+  test_asserts_expected = expect;
+}
+
+uint32_t host_test_asserts_get(void)
+{
+  return test_asserts;
+}
+
+int host_test_result(void)
+{
+  test_done = true;
+  fflush(stdout);
+
+  if (0 != test_failures)
+  {
+    fprintf(stderr, "%s: FAILED, %u of %u checks\n", test_name, (unsigned)test_failures, (unsigned)test_checks);
+    return 1;
+  }
+
+  fprintf(stderr, "%s: passed, %u checks\n", test_name, (unsigned)test_checks);
+  return 0;
+}
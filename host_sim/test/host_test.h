@@ -0,0 +1,53 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Checks shared by the host tests.
+ *
+ * A test is a program that runs its checks and returns host_test_result() from main(). A failed
+ * check prints its file and line and fails the test, the test keeps running so that one run
+ * reports every failure. ble_assert() failures are counted as failed checks unless the test
+ * expects them, see host_test_assert_expect().
+ */
+
+#ifndef HOST_TEST_H__
+#define HOST_TEST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HOST_TEST_CHECK(expr)  host_test_check((expr), #expr, __FILE__, __LINE__)
+
+/* Must be called first. A test that does not return from main(), because the simulated time ran
+   out, fails. */
+void host_test_init(const char *p_name);
+
+bool host_test_check(bool ok, const char *p_expr, const char *p_file, int line);
+
+/* While expect is true, ble_assert() failures are expected and only counted */
+void     host_test_assert_expect(bool expect);
+/* ble_assert() failures so far, expected or not */
+uint32_t host_test_asserts_get(void);
+
+/* Prints the summary, the exit status of the test */
+int host_test_result(void);
+
+#endif /* HOST_TEST_H__ */
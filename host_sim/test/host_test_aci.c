@@ -0,0 +1,123 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Brings up lib_aci against the nRF8001 model, see host_test_aci.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib_aci.h"
+#include "aci_setup.h"
+#include "hal_platform.h"
+#include "host_test.h"
+#include "host_test_aci.h"
+
+static services_pipe_type_mapping_t host_test_aci_pipe_types[HOST_TEST_ACI_PIPES] =
+{
+  { ACI_STORE_LOCAL, ACI_TX }, { ACI_STORE_LOCAL, ACI_TX }, { ACI_STORE_LOCAL, ACI_TX },
+  { ACI_STORE_LOCAL, ACI_TX }, { ACI_STORE_LOCAL, ACI_TX }, { ACI_STORE_LOCAL, ACI_TX },
+  { ACI_STORE_LOCAL, ACI_TX }
+};
+
+/* The first and the last record of the setup of the template demo, the model only looks for the
+   record that closes the setup */
+static hal_aci_data_t host_test_aci_setup_msgs[] =
+{
+  { 0x00, { 0x07, 0x06, 0x00, 0x00, 0x03, 0x02, 0x41, 0xfe } },
+  { 0x00, { 0x06, 0x06, 0xf0, 0x00, 0x03, 0x4d, 0xf9 } }
+};
+
+bool host_test_aci_event_wait(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data, uint32_t timeout_ms)
+{
+  const uint32_t start = millis();
+
+  while (!lib_aci_event_get(aci_stat, p_aci_evt_data))
+  {
+    if ((uint32_t)(millis() - start) >= timeout_ms)
+    {
+      return false;
+    }
+    // Not lib_aci_idle(), the model may have nothing scheduled
+    delay(1);
+  }
+
+  return true;
+}
+
+bool host_test_aci_connect(aci_state_t *aci_stat)
+{
+  hal_aci_evt_t aci_data;
+  bool          connected = false;
+
+  enableClocksForAci();
+
+  aci_stat->aci_setup_info.services_pipe_type_mapping = &host_test_aci_pipe_types[0];
+  aci_stat->aci_setup_info.number_of_pipes            = HOST_TEST_ACI_PIPES;
+  aci_stat->aci_setup_info.setup_msgs                 = host_test_aci_setup_msgs;
+  aci_stat->aci_setup_info.num_setup_msgs             = sizeof(host_test_aci_setup_msgs) / sizeof(host_test_aci_setup_msgs[0]);
+
+  aci_stat->aci_pins.board_name             = BOARD_DEFAULT;
+  aci_stat->aci_pins.reqn_pin               = 3;
+  aci_stat->aci_pins.rdyn_pin               = 5;
+  aci_stat->aci_pins.mosi_pin               = 0;
+  aci_stat->aci_pins.miso_pin               = 1;
+  aci_stat->aci_pins.sck_pin                = 2;
+  aci_stat->aci_pins.spi_clock_divider      = 0;
+  aci_stat->aci_pins.spi_instance           = HOST_TEST_ACI_SPI;
+  aci_stat->aci_pins.spi_location           = 1;
+  aci_stat->aci_pins.reset_pin              = 6;
+  aci_stat->aci_pins.active_pin             = UNUSED;
+  aci_stat->aci_pins.optional_chip_sel_pin  = UNUSED;
+  aci_stat->aci_pins.interface_is_interrupt = true;
+  aci_stat->aci_pins.interrupt_number       = 5;
+
+  lib_aci_init(aci_stat, false);
+
+  // The model connects a second after the advertising starts
+  while (!connected && host_test_aci_event_wait(aci_stat, &aci_data, 2000))
+  {
+    switch (aci_data.evt.evt_opcode)
+    {
+      case ACI_EVT_DEVICE_STARTED:
+        if (ACI_DEVICE_SETUP == aci_data.evt.params.device_started.device_mode)
+        {
+          HOST_TEST_CHECK(SETUP_SUCCESS == do_aci_setup(aci_stat));
+        }
+        else if (ACI_DEVICE_STANDBY == aci_data.evt.params.device_started.device_mode)
+        {
+          HOST_TEST_CHECK(lib_aci_connect(aci_stat, 0, 0x0100));
+        }
+        break;
+
+      case ACI_EVT_PIPE_STATUS:
+        connected = true;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  return HOST_TEST_CHECK(connected);
+}
@@ -0,0 +1,51 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Brings up lib_aci against the nRF8001 model for the tests of the library.
+ *
+ * The radio sits on USART1 with the pins of the demos. host_test_aci_connect() runs the Setup with
+ * a minimal setup, has the model connect and returns once the pipes are open. Pipes 1 to 7 are TX
+ * pipes in the pipe type mapping, the model opens all of them.
+ */
+
+#ifndef HOST_TEST_ACI_H__
+#define HOST_TEST_ACI_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lib_aci.h"
+
+#define HOST_TEST_ACI_SPI           1
+#define HOST_TEST_ACI_PIPES         7
+
+/* Longest wait for an event of the model, it answers in a connection interval at most */
+#define HOST_TEST_ACI_TIMEOUT_MS    500
+
+/* Initializes lib_aci on aci_stat and waits for the Pipe Status event of the connection. Returns
+   false, after a failed check, if the model does not get there. */
+bool host_test_aci_connect(aci_state_t *aci_stat);
+
+/* Gets the next event, sleeping while there is none. Returns false if none comes within timeout_ms. */
+bool host_test_aci_event_wait(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data, uint32_t timeout_ms);
+
+#endif /* HOST_TEST_ACI_H__ */
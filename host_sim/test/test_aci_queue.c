@@ -0,0 +1,314 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Random sequences of producer and consumer calls on the ACI queues, checked against a
+ * plain FIFO. Built once for the slot queues and once with ACI_QUEUE_BYTE_RING.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aci_queue.h"
+#include "host_test.h"
+
+#define TEST_OPERATIONS     100000
+#define TEST_SMALL_SLOT     12
+
+/* More packets than any of the queues can hold */
+#define TEST_MODEL_SIZE     128
+
+ACI_QUEUE_DEFINE(test_q, ACI_QUEUE_SIZE_DEFAULT, ACI_QUEUE_SLOT_SIZE_MAX);
+ACI_QUEUE_DEFINE(test_small_q, ACI_QUEUE_SIZE_DEFAULT, TEST_SMALL_SLOT);
+
+/* What the queue should hold, oldest first */
+static hal_aci_data_t model[TEST_MODEL_SIZE];
+static uint16_t       model_head;
+static uint16_t       model_count;
+static uint32_t       packet_count;
+
+static void test_packet_fill(hal_aci_data_t *p_packet, uint8_t length)
+{
+  uint8_t i;
+
+  p_packet->status_byte = 0;
+  p_packet->buffer[0]   = length;
+  for (i = 1; i <= length; i++)
+  {
+    p_packet->buffer[i] = (uint8_t)(packet_count * 7 + i);
+  }
+  packet_count++;
+}
+
+static void test_model_push(const hal_aci_data_t *p_packet)
+{
+  memcpy(&model[(model_head + model_count) % TEST_MODEL_SIZE], p_packet, sizeof(hal_aci_data_t));
+  model_count++;
+}
+
+/* Compares the packet with the oldest one in the model and drops that */
+static bool test_model_pop(const hal_aci_data_t *p_packet)
+{
+  const hal_aci_data_t *p_expected = &model[model_head];
+  bool ok;
+
+  if (!HOST_TEST_CHECK(model_count > 0))
+  {
+    return false;
+  }
+
+  ok = HOST_TEST_CHECK(p_packet->buffer[0] == p_expected->buffer[0]) &&
+       HOST_TEST_CHECK(0 == memcmp(&p_packet->buffer[1], &p_expected->buffer[1], p_expected->buffer[0]));
+
+  model_head = (uint16_t)((model_head + 1) % TEST_MODEL_SIZE);
+  model_count--;
+
+  return ok;
+}
+
+static void test_model_reset(void)
+{
+  model_head  = 0;
+  model_count = 0;
+}
+
+/* A refused packet is only fine when the queue is full */
+static bool test_full_check(aci_queue_t *aci_q)
+{
+#if defined(ACI_QUEUE_BYTE_RING)
+  return HOST_TEST_CHECK(aci_queue_is_full(aci_q)) && HOST_TEST_CHECK(model_count > 0);
+#else
+  return HOST_TEST_CHECK(aci_queue_is_full(aci_q)) && HOST_TEST_CHECK(model_count == (aci_q->mask + 1));
+#endif
+}
+
+static bool test_produce(aci_queue_t *aci_q)
+{
+  const uint8_t   length = (uint8_t)(1 + rand() % (aci_q->slot_size - 2));
+  hal_aci_data_t  packet;
+  hal_aci_data_t *p_slot;
+
+  test_packet_fill(&packet, length);
+
+  if (rand() & 1)
+  {
+    p_slot = aci_queue_acquire(aci_q);
+    if (NULL == p_slot)
+    {
+      return test_full_check(aci_q);
+    }
+
+    memcpy(p_slot, &packet, length + 2);
+    aci_queue_commit(aci_q);
+  }
+  else if (!aci_queue_enqueue(aci_q, &packet))
+  {
+    return test_full_check(aci_q);
+  }
+
+  test_model_push(&packet);
+
+  return HOST_TEST_CHECK(!aci_queue_is_empty(aci_q));
+}
+
+static bool test_consume(aci_queue_t *aci_q)
+{
+  hal_aci_data_t        packet;
+  const hal_aci_data_t *p_slot;
+
+  if (0 == model_count)
+  {
+    return HOST_TEST_CHECK(aci_queue_is_empty(aci_q)) &&
+           HOST_TEST_CHECK(NULL == aci_queue_peek_slot(aci_q)) &&
+           HOST_TEST_CHECK(!aci_queue_dequeue(aci_q, &packet)) &&
+           HOST_TEST_CHECK(0 == aci_queue_fill_get(aci_q));
+  }
+
+  switch (rand() % 3)
+  {
+    case 0:
+      p_slot = aci_queue_peek_slot(aci_q);
+      if (!HOST_TEST_CHECK(NULL != p_slot) || !test_model_pop(p_slot))
+      {
+        return false;
+      }
+      aci_queue_release(aci_q);
+      break;
+
+    case 1:
+      if (!HOST_TEST_CHECK(aci_queue_dequeue(aci_q, &packet)) || !test_model_pop(&packet))
+      {
+        return false;
+      }
+      break;
+
+    default:
+      if (!HOST_TEST_CHECK(aci_queue_peek(aci_q, &packet)) || !test_model_pop(&packet))
+      {
+        return false;
+      }
+      aci_queue_release(aci_q);
+      break;
+  }
+
+  return HOST_TEST_CHECK(aci_queue_is_empty(aci_q) == (0 == model_count));
+}
+
+/* Producer and consumer calls in random order and with random lengths, then drained */
+static void test_queue_random(aci_queue_t *aci_q)
+{
+  uint32_t i;
+  bool     ok = true;
+
+  aci_queue_init(aci_q);
+  test_model_reset();
+
+  for (i = 0; ok && (i < TEST_OPERATIONS); i++)
+  {
+    // Runs of one side let the queue fill up and run empty
+    ok = ((i / 64) & 1) ? ((rand() % 4) ? test_produce(aci_q) : test_consume(aci_q))
+                        : ((rand() % 4) ? test_consume(aci_q) : test_produce(aci_q));
+  }
+
+  while (ok && (model_count > 0))
+  {
+    ok = test_consume(aci_q);
+  }
+  test_consume(aci_q);
+}
+
+/* A length byte larger than the slot is not copied past the slot or past the packet of the caller */
+static void test_queue_oversize_copy(aci_queue_t *aci_q)
+{
+  struct
+  {
+    hal_aci_data_t packet;
+    uint8_t        guard[256];
+  } copy;
+  hal_aci_data_t *p_slot;
+  uint16_t        i;
+
+  aci_queue_init(aci_q);
+
+  for (i = 0; i < 2; i++)
+  {
+    p_slot = aci_queue_acquire(aci_q);
+    if (!HOST_TEST_CHECK(NULL != p_slot))
+    {
+      return;
+    }
+    test_packet_fill(p_slot, (uint8_t)(aci_q->slot_size - 2));
+    p_slot->buffer[0] = 0xFF;
+    aci_queue_commit(aci_q);
+  }
+
+  memset(&copy, 0xA5, sizeof(copy));
+  HOST_TEST_CHECK(aci_queue_peek(aci_q, &copy.packet));
+  HOST_TEST_CHECK(copy.packet.buffer[0] == (aci_q->slot_size - 2));
+  HOST_TEST_CHECK(aci_queue_dequeue(aci_q, &copy.packet));
+  HOST_TEST_CHECK(copy.packet.buffer[0] == (aci_q->slot_size - 2));
+  HOST_TEST_CHECK(aci_queue_dequeue(aci_q, &copy.packet));
+  HOST_TEST_CHECK(copy.packet.buffer[0] == (aci_q->slot_size - 2));
+
+  for (i = 0; i < sizeof(copy.guard); i++)
+  {
+    if (!HOST_TEST_CHECK(0xA5 == copy.guard[i]))
+    {
+      break;
+    }
+  }
+  HOST_TEST_CHECK(aci_queue_is_empty(aci_q));
+}
+
+#if defined(ACI_QUEUE_BYTE_RING)
+/* A length byte that does not fit the slot, 0xFF being the padding marker, at every offset of the ring */
+static void test_queue_oversize(aci_queue_t *aci_q)
+{
+  hal_aci_data_t  packet;
+  hal_aci_data_t *p_slot;
+  uint8_t         offset;
+  uint8_t         i;
+
+  for (offset = 0; offset < 32; offset++)
+  {
+    aci_queue_init(aci_q);
+    test_model_reset();
+
+    // Move the ring to a different position each time
+    for (i = 0; i < offset; i++)
+    {
+      test_packet_fill(&packet, (uint8_t)(1 + (i % 3)));
+      aci_queue_enqueue(aci_q, &packet);
+      aci_queue_dequeue(aci_q, &packet);
+    }
+
+    p_slot = aci_queue_acquire(aci_q);
+    if (!HOST_TEST_CHECK(NULL != p_slot))
+    {
+      return;
+    }
+    test_packet_fill(&packet, (uint8_t)(aci_q->slot_size - 2));
+    memcpy(p_slot, &packet, aci_q->slot_size);
+    p_slot->buffer[0] = 0xFF;
+    aci_queue_commit(aci_q);
+    test_model_push(&packet);
+
+    for (i = 0; i < 2; i++)
+    {
+      test_packet_fill(&packet, (uint8_t)(5 + i));
+      HOST_TEST_CHECK(aci_queue_enqueue(aci_q, &packet));
+      test_model_push(&packet);
+    }
+
+    // Stored with the length of the slot, and the packets behind it are intact
+    while (model_count > 0)
+    {
+      if (!test_consume(aci_q))
+      {
+        return;
+      }
+    }
+    HOST_TEST_CHECK(aci_queue_is_empty(aci_q));
+  }
+}
+#endif
+
+int main(void)
+{
+#if defined(ACI_QUEUE_BYTE_RING)
+  host_test_init("test_aci_queue_byte_ring");
+#else
+  host_test_init("test_aci_queue");
+#endif
+  srand(1);
+
+  test_queue_random(&test_q);
+  test_queue_random(&test_small_q);
+  test_queue_oversize_copy(&test_q);
+  test_queue_oversize_copy(&test_small_q);
+#if defined(ACI_QUEUE_BYTE_RING)
+  test_queue_oversize(&test_q);
+#endif
+
+  return host_test_result();
+}
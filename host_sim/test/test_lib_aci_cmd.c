@@ -0,0 +1,239 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Commands encoded in place in the command queue by lib_aci, checked byte for byte as the
+ * nRF8001 model receives them over the SPI, and the refusal of a second reservation of the
+ * command queue, also from an interrupt handler.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib_aci.h"
+#include "acilib.h"
+#include "acilib_if.h"
+#include "hal_aci_tl.h"
+#include "nrf8001_sim.h"
+#include "host_test.h"
+#include "host_test_aci.h"
+
+#define TEST_DRAIN_MS     5
+
+/* Checks that the call is accepted and that the model receives the bytes that follow */
+#define TEST_CMD(call, ...)                                                                         \
+  do                                                                                                \
+  {                                                                                                 \
+    static const uint8_t expected[] = { __VA_ARGS__ };                                              \
+    const uint16_t       count      = cmd_count;                                                    \
+    host_test_check((call) && test_cmd_received(count, expected, sizeof(expected)), #call, __FILE__, __LINE__); \
+  } while (0)
+
+static aci_state_t   aci_state;
+static hal_aci_evt_t aci_data;
+
+/* The last command the model received, length byte first */
+static uint8_t  last_cmd[ACI_PACKET_MAX_LEN + 1];
+static uint16_t cmd_count;
+static bool     connect_seen;
+
+static void test_cmd_observer(uint8_t spi, const uint8_t *p_cmd)
+{
+  static const uint8_t connect[] = { 0x05, ACI_CMD_CONNECT, 0x00, 0x00, 0x00, 0x01 };
+
+  if (p_cmd[0] < sizeof(last_cmd))
+  {
+    memcpy(last_cmd, p_cmd, p_cmd[0] + 1);
+  }
+  cmd_count++;
+
+  // Sent by host_test_aci_connect()
+  if (0 == memcmp(p_cmd, connect, sizeof(connect)))
+  {
+    connect_seen = true;
+  }
+}
+
+/* Runs the transport until the model is quiet, true if it has received exactly one command since
+   count, the expected one. The command may reach the model before the call that queues it returns. */
+static bool test_cmd_received(uint16_t count, const uint8_t *p_expected, uint8_t length)
+{
+  while (host_test_aci_event_wait(&aci_state, &aci_data, TEST_DRAIN_MS))
+  {
+  }
+
+  return ((count + 1) == cmd_count) && (length == (last_cmd[0] + 1)) && (0 == memcmp(last_cmd, p_expected, length));
+}
+
+static void test_encode(void)
+{
+  uint8_t data[ACI_PIPE_TX_DATA_MAX_LEN];
+  uint8_t key[6] = { 1, 2, 3, 4, 5, 6 };
+  uint8_t i;
+
+  for (i = 0; i < sizeof(data); i++)
+  {
+    data[i] = (uint8_t)(0xA0 + i);
+  }
+
+  HOST_TEST_CHECK(connect_seen);
+
+  TEST_CMD(lib_aci_send_data(&aci_state, 3, data, 3), 0x05, ACI_CMD_SEND_DATA, 0x03, 0xA0, 0xA1, 0xA2);
+  TEST_CMD(lib_aci_send_data(&aci_state, 7, data, ACI_PIPE_TX_DATA_MAX_LEN),
+           0x16, ACI_CMD_SEND_DATA, 0x07, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9,
+           0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB0, 0xB1, 0xB2, 0xB3);
+  TEST_CMD(lib_aci_set_local_data(&aci_state, 2, data, 2), 0x04, ACI_CMD_SET_LOCAL_DATA, 0x02, 0xA0, 0xA1);
+  TEST_CMD(lib_aci_change_timing(&aci_state, 0x0006, 0x0C80, 0x01F3, 0x0C80),
+           0x09, ACI_CMD_CHANGE_TIMING, 0x06, 0x00, 0x80, 0x0C, 0xF3, 0x01, 0x80, 0x0C);
+  TEST_CMD(lib_aci_change_timing_GAP_PPCP(&aci_state), 0x01, ACI_CMD_CHANGE_TIMING);
+  TEST_CMD(lib_aci_set_app_latency(&aci_state, 0x1234, ACI_APP_LATENCY_ENABLE),
+           0x04, ACI_CMD_SET_APP_LATENCY, 0x01, 0x34, 0x12);
+  TEST_CMD(lib_aci_set_tx_power(&aci_state, ACI_DEVICE_OUTPUT_POWER_MINUS_6DBM), 0x02, ACI_CMD_SET_TX_POWER, 0x02);
+  TEST_CMD(lib_aci_send_ack(&aci_state, 4), 0x02, ACI_CMD_SEND_DATA_ACK, 0x04);
+  TEST_CMD(lib_aci_send_nack(&aci_state, 5, 0x80), 0x03, ACI_CMD_SEND_DATA_NACK, 0x05, 0x80);
+  TEST_CMD(lib_aci_set_key(&aci_state, ACI_KEY_TYPE_PASSKEY, key, sizeof(key)),
+           0x08, ACI_CMD_SET_KEY, ACI_KEY_TYPE_PASSKEY, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06);
+  TEST_CMD(lib_aci_get_address(&aci_state), 0x01, ACI_CMD_GET_DEVICE_ADDRESS);
+  TEST_CMD(lib_aci_get_battery_level(&aci_state), 0x01, ACI_CMD_GET_BATTERY_LEVEL);
+  TEST_CMD(lib_aci_get_temperature(&aci_state), 0x01, ACI_CMD_GET_TEMPERATURE);
+  TEST_CMD(lib_aci_device_version(&aci_state), 0x01, ACI_CMD_GET_DEVICE_VERSION);
+}
+
+/* A reservation while one is open is refused, the open one is still sent */
+static void test_reserve_twice(void)
+{
+  static const uint8_t get_address[] = { 0x01, ACI_CMD_GET_DEVICE_ADDRESS };
+  const uint32_t  asserts = host_test_asserts_get();
+  const uint16_t  count   = cmd_count;
+  hal_aci_data_t *p_slot  = hal_aci_tl_cmd_reserve(aci_state.aci_tl, MSG_GET_DEVICE_ADDR_LEN);
+
+  if (!HOST_TEST_CHECK(NULL != p_slot))
+  {
+    return;
+  }
+
+  HOST_TEST_CHECK(NULL == hal_aci_tl_cmd_reserve(aci_state.aci_tl, MSG_GET_DEVICE_ADDR_LEN));
+  HOST_TEST_CHECK(!lib_aci_get_temperature(&aci_state));
+
+  acil_encode_cmd_get_address(&p_slot->buffer[0]);
+  HOST_TEST_CHECK(hal_aci_tl_cmd_commit(aci_state.aci_tl) && test_cmd_received(count, get_address, sizeof(get_address)));
+
+  // The reservation has ended
+  TEST_CMD(lib_aci_get_temperature(&aci_state), 0x01, ACI_CMD_GET_TEMPERATURE);
+  HOST_TEST_CHECK(asserts == host_test_asserts_get());
+}
+
+static efm_timer_t    timer;
+static volatile bool  timer_ran;
+static volatile bool  timer_queued;
+
+/* Composes a command from the RTC interrupt */
+static void test_timer_cmd(void *p_context)
+{
+  (void)p_context;
+
+  timer_queued = lib_aci_get_battery_level(&aci_state);
+  timer_ran    = true;
+}
+
+static void test_timer_run(void)
+{
+  timer_ran    = false;
+  timer_queued = false;
+  efm_timer_start(&timer, 1, 0, test_timer_cmd, NULL);
+  while (!timer_ran)
+  {
+    delay(1);
+  }
+}
+
+/* A command composed in an interrupt handler while the main context holds a reservation is
+   refused, and does not take or corrupt the slot of the command being composed */
+static void test_reserve_from_timer(void)
+{
+  static const uint8_t get_address[] = { 0x01, ACI_CMD_GET_DEVICE_ADDRESS };
+  const uint32_t  asserts = host_test_asserts_get();
+  const uint16_t  count   = cmd_count;
+  hal_aci_data_t *p_slot  = hal_aci_tl_cmd_reserve(aci_state.aci_tl, MSG_GET_DEVICE_ADDR_LEN);
+
+  if (!HOST_TEST_CHECK(NULL != p_slot))
+  {
+    return;
+  }
+
+  acil_encode_cmd_get_address(&p_slot->buffer[0]);
+  test_timer_run();
+  HOST_TEST_CHECK(!timer_queued);
+  HOST_TEST_CHECK(count == cmd_count);
+
+  HOST_TEST_CHECK(hal_aci_tl_cmd_commit(aci_state.aci_tl) && test_cmd_received(count, get_address, sizeof(get_address)));
+
+  // Without a reservation open the interrupt handler is the producer
+  {
+    static const uint8_t get_battery_level[] = { 0x01, ACI_CMD_GET_BATTERY_LEVEL };
+    const uint16_t       count_timer         = cmd_count;
+
+    test_timer_run();
+    HOST_TEST_CHECK(timer_queued && test_cmd_received(count_timer, get_battery_level, sizeof(get_battery_level)));
+  }
+  HOST_TEST_CHECK(asserts == host_test_asserts_get());
+}
+
+/* Flushing the queues ends the reservation, the command composed meanwhile is not sent */
+static void test_reserve_flush(void)
+{
+  const uint16_t  count  = cmd_count;
+  hal_aci_data_t *p_slot = hal_aci_tl_cmd_reserve(aci_state.aci_tl, MSG_GET_DEVICE_ADDR_LEN);
+
+  if (!HOST_TEST_CHECK(NULL != p_slot))
+  {
+    return;
+  }
+
+  lib_aci_flush(&aci_state);
+  acil_encode_cmd_get_address(&p_slot->buffer[0]);
+  HOST_TEST_CHECK(!hal_aci_tl_cmd_commit(aci_state.aci_tl));
+  HOST_TEST_CHECK(hal_aci_tl_tx_q_empty(aci_state.aci_tl));
+  while (host_test_aci_event_wait(&aci_state, &aci_data, TEST_DRAIN_MS))
+  {
+  }
+  HOST_TEST_CHECK(count == cmd_count);
+
+  TEST_CMD(lib_aci_get_temperature(&aci_state), 0x01, ACI_CMD_GET_TEMPERATURE);
+}
+
+int main(void)
+{
+  host_test_init("test_lib_aci_cmd");
+
+  nrf8001_sim_cmd_observer_set(HOST_TEST_ACI_SPI, test_cmd_observer);
+  if (host_test_aci_connect(&aci_state))
+  {
+    test_encode();
+    test_reserve_twice();
+    test_reserve_from_timer();
+    test_reserve_flush();
+    TEST_CMD(lib_aci_disconnect(&aci_state, ACI_REASON_TERMINATE), 0x02, ACI_CMD_DISCONNECT, ACI_REASON_TERMINATE);
+  }
+
+  return host_test_result();
+}
@@ -0,0 +1,247 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Reassembly of lib_aci_rx_framing_set() against the nRF8001 model. The peer writes the
+ * fragments of messages, with lost fragments, a sequence number that wraps and messages too large
+ * for the buffer, and the test checks the messages handed over and the errors counted.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib_aci.h"
+#include "nrf8001_sim.h"
+#include "host_test.h"
+#include "host_test_aci.h"
+
+/* The events of a fragment are through the transport well within this */
+#define TEST_DRAIN_MS       5
+#define TEST_FRAGMENT_LEN   20
+#define TEST_FRAMED_PIPE    1
+#define TEST_PLAIN_PIPE     2
+#define TEST_BUFFER_SIZE    256
+#define TEST_NO_LOSS        0xFF
+
+static aci_state_t   aci_state;
+static hal_aci_evt_t aci_data;
+
+static uint8_t  rx_buffer[TEST_BUFFER_SIZE];
+static uint8_t  message[TEST_BUFFER_SIZE + 64];
+static uint8_t  peer_seq;
+
+/* Messages handed over by lib_aci */
+static uint16_t messages;
+static uint8_t  message_pipe;
+static uint8_t  last_message[TEST_BUFFER_SIZE];
+static uint16_t last_length;
+
+/* DataReceived events that reached the application */
+static uint16_t framed_events;
+static uint16_t plain_events;
+
+static void test_message(struct aci_state_t *aci_stat, uint8_t pipe, const uint8_t *p_message,
+                         uint16_t length, void *p_context)
+{
+  messages++;
+  message_pipe = pipe;
+  last_length  = length;
+  HOST_TEST_CHECK(&rx_buffer[0] == (uint8_t *)p_context);
+  if (HOST_TEST_CHECK(length <= sizeof(last_message)))
+  {
+    memcpy(last_message, p_message, length);
+  }
+}
+
+static void test_drain(void)
+{
+  while (host_test_aci_event_wait(&aci_state, &aci_data, TEST_DRAIN_MS))
+  {
+    if (ACI_EVT_DATA_RECEIVED == aci_data.evt.evt_opcode)
+    {
+      if (TEST_FRAMED_PIPE == aci_data.evt.params.data_received.rx_data.pipe_number)
+      {
+        framed_events++;
+      }
+      else
+      {
+        plain_events++;
+      }
+    }
+  }
+}
+
+static void test_message_fill(uint16_t length, uint8_t seed)
+{
+  uint16_t i;
+
+  for (i = 0; i < length; i++)
+  {
+    message[i] = (uint8_t)(seed + i * 7);
+  }
+}
+
+/* The peer cuts the message in fragments and writes them, except the one numbered lost */
+static void test_message_write(const uint8_t *p_message, uint16_t length, uint8_t lost)
+{
+  uint8_t  fragment[TEST_FRAGMENT_LEN];
+  uint16_t offset = 0;
+  uint8_t  index  = 0;
+  uint8_t  header_len;
+  uint8_t  data_len;
+
+  do
+  {
+    fragment[0] = (uint8_t)(peer_seq & LIB_ACI_RX_FRAME_SEQ_MASK);
+    header_len  = LIB_ACI_RX_FRAME_HEADER_LEN;
+    if (0 == offset)
+    {
+      fragment[0] |= LIB_ACI_RX_FRAME_START;
+      fragment[1]  = (uint8_t)length;
+      fragment[2]  = (uint8_t)(length >> 8);
+      header_len   = LIB_ACI_RX_FRAME_START_LEN;
+    }
+    data_len = ((length - offset) > (TEST_FRAGMENT_LEN - header_len))
+               ? (uint8_t)(TEST_FRAGMENT_LEN - header_len)
+               : (uint8_t)(length - offset);
+    memcpy(&fragment[header_len], &p_message[offset], data_len);
+
+    if (index != lost)
+    {
+      HOST_TEST_CHECK(nrf8001_sim_peer_write(HOST_TEST_ACI_SPI, TEST_FRAMED_PIPE, fragment,
+                                             (uint8_t)(header_len + data_len)));
+      test_drain();
+    }
+    peer_seq++;
+    index++;
+    offset = (uint16_t)(offset + data_len);
+  } while (offset < length);
+}
+
+static bool test_message_check(uint16_t length)
+{
+  return (TEST_FRAMED_PIPE == message_pipe) && (length == last_length) &&
+         (0 == memcmp(last_message, message, length));
+}
+
+/* Messages of one fragment and of several, data of the other pipes passes through */
+static void test_reassembly(void)
+{
+  const uint8_t plain = 0x5A;
+
+  test_message_fill(10, 1);
+  test_message_write(message, 10, TEST_NO_LOSS);
+  HOST_TEST_CHECK((1 == messages) && test_message_check(10));
+
+  test_message_fill(TEST_BUFFER_SIZE, 2);
+  test_message_write(message, TEST_BUFFER_SIZE, TEST_NO_LOSS);
+  HOST_TEST_CHECK((2 == messages) && test_message_check(TEST_BUFFER_SIZE));
+
+  HOST_TEST_CHECK(nrf8001_sim_peer_write(HOST_TEST_ACI_SPI, TEST_PLAIN_PIPE, &plain, 1));
+  test_drain();
+  HOST_TEST_CHECK(1 == plain_events);
+
+  HOST_TEST_CHECK(0 == framed_events);
+  HOST_TEST_CHECK(0 == lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE));
+}
+
+/* A message with a lost fragment is dropped, the next one is received */
+static void test_lost_fragment(void)
+{
+  const uint16_t messages_before = messages;
+  const uint16_t errors_before   = lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE);
+
+  test_message_fill(100, 3);
+  test_message_write(message, 100, 2);
+  HOST_TEST_CHECK(messages_before == messages);
+  HOST_TEST_CHECK((errors_before + 1) == lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE));
+
+  // Losing the start drops the rest of the message without another error
+  test_message_write(message, 100, 0);
+  HOST_TEST_CHECK(messages_before == messages);
+  HOST_TEST_CHECK((errors_before + 1) == lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE));
+
+  test_message_fill(100, 4);
+  test_message_write(message, 100, TEST_NO_LOSS);
+  HOST_TEST_CHECK(((messages_before + 1) == messages) && test_message_check(100));
+  HOST_TEST_CHECK(0 == framed_events);
+}
+
+/* More fragments than the sequence number counts, the messages across the wrap are received */
+static void test_sequence_wrap(void)
+{
+  const uint16_t messages_before = messages;
+  const uint16_t errors_before   = lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE);
+  const uint8_t  seq_before      = peer_seq;
+  uint8_t        i;
+  bool           all_received    = true;
+
+  for (i = 0; i < 12; i++)
+  {
+    test_message_fill(TEST_BUFFER_SIZE - i, (uint8_t)(10 + i));
+    test_message_write(message, (uint16_t)(TEST_BUFFER_SIZE - i), TEST_NO_LOSS);
+    all_received = all_received && ((messages_before + i + 1) == messages) &&
+                   test_message_check((uint16_t)(TEST_BUFFER_SIZE - i));
+  }
+  HOST_TEST_CHECK(all_received);
+  HOST_TEST_CHECK((uint8_t)(peer_seq - seq_before) > (LIB_ACI_RX_FRAME_SEQ_MASK + 1));
+  HOST_TEST_CHECK(errors_before == lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE));
+}
+
+/* A message longer than the buffer is dropped, the next one is received */
+static void test_too_large(void)
+{
+  const uint16_t messages_before = messages;
+  const uint16_t errors_before   = lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE);
+
+  test_message_fill(TEST_BUFFER_SIZE + 1, 5);
+  test_message_write(message, TEST_BUFFER_SIZE + 1, TEST_NO_LOSS);
+  HOST_TEST_CHECK(messages_before == messages);
+  HOST_TEST_CHECK((errors_before + 1) == lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE));
+
+  test_message_fill(sizeof(message), 6);
+  test_message_write(message, sizeof(message), TEST_NO_LOSS);
+  HOST_TEST_CHECK(messages_before == messages);
+  HOST_TEST_CHECK((errors_before + 2) == lib_aci_rx_framing_errors_get(&aci_state, TEST_FRAMED_PIPE));
+
+  test_message_fill(50, 7);
+  test_message_write(message, 50, TEST_NO_LOSS);
+  HOST_TEST_CHECK(((messages_before + 1) == messages) && test_message_check(50));
+  HOST_TEST_CHECK(0 == framed_events);
+}
+
+int main(void)
+{
+  host_test_init("test_lib_aci_rx_frame");
+
+  if (host_test_aci_connect(&aci_state) &&
+      HOST_TEST_CHECK(lib_aci_rx_framing_set(&aci_state, TEST_FRAMED_PIPE, rx_buffer, sizeof(rx_buffer),
+                                             test_message, rx_buffer)))
+  {
+    test_reassembly();
+    test_lost_fragment();
+    test_sequence_wrap();
+    test_too_large();
+  }
+
+  return host_test_result();
+}
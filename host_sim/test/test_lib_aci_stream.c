@@ -0,0 +1,212 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief lib_aci_stream_write() against the nRF8001 model: the data that arrives, the done handler
+ * called before the write returns, lib_aci_send_data() refused on the pipe of a stream and the abort
+ * on a Disconnected event.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib_aci.h"
+#include "nrf8001_sim.h"
+#include "host_test.h"
+#include "host_test_aci.h"
+
+#define TEST_QUIET_MS     300
+#define TEST_STREAM_LEN   1000
+
+static aci_state_t   aci_state;
+static hal_aci_evt_t aci_data;
+
+static uint8_t  stream_data[TEST_STREAM_LEN];
+
+/* Data of the SendData commands the model has received on test_pipe */
+static uint8_t  test_pipe;
+static uint8_t  received[TEST_STREAM_LEN];
+static uint16_t received_len;
+static bool     received_overflow;
+
+/* Calls of the done handler */
+static uint8_t  done_count;
+static uint8_t  done_pipe;
+static uint16_t done_length;
+static bool     done_in_write;
+static bool     in_write;
+
+static void test_cmd_observer(uint8_t spi, const uint8_t *p_cmd)
+{
+  const uint8_t size = (uint8_t)(p_cmd[0] - 2);
+
+  if ((ACI_CMD_SEND_DATA != p_cmd[1]) || (test_pipe != p_cmd[2]))
+  {
+    return;
+  }
+
+  if ((received_len + size) > sizeof(received))
+  {
+    received_overflow = true;
+    return;
+  }
+  memcpy(&received[received_len], &p_cmd[3], size);
+  received_len = (uint16_t)(received_len + size);
+}
+
+static void test_done(struct aci_state_t *aci_stat, uint8_t pipe, uint16_t length_sent, void *p_context)
+{
+  done_count++;
+  done_pipe     = pipe;
+  done_length   = length_sent;
+  done_in_write = in_write;
+  HOST_TEST_CHECK(!lib_aci_stream_busy(aci_stat, pipe));
+  HOST_TEST_CHECK(&stream_data[0] == (uint8_t *)p_context);
+}
+
+static void test_clear(uint8_t pipe)
+{
+  test_pipe         = pipe;
+  received_len      = 0;
+  received_overflow = false;
+  done_count        = 0;
+  done_in_write     = false;
+}
+
+static bool test_write(uint8_t pipe, uint16_t length)
+{
+  bool started;
+
+  in_write = true;
+  started  = lib_aci_stream_write(&aci_state, pipe, stream_data, length, test_done, stream_data);
+  in_write = false;
+
+  return started;
+}
+
+/* Handles the events until the model has nothing more to say, returns true if one was Disconnected */
+static bool test_run(void)
+{
+  bool disconnected = false;
+
+  while (host_test_aci_event_wait(&aci_state, &aci_data, TEST_QUIET_MS))
+  {
+    disconnected = disconnected || (ACI_EVT_DISCONNECTED == aci_data.evt.evt_opcode);
+  }
+
+  return disconnected;
+}
+
+/* The buffer arrives whole and in order, the pipe takes no other data while it streams */
+static void test_stream(void)
+{
+  uint8_t value = 0;
+
+  test_clear(1);
+
+  HOST_TEST_CHECK(test_write(1, TEST_STREAM_LEN));
+  HOST_TEST_CHECK(lib_aci_stream_busy(&aci_state, 1));
+  HOST_TEST_CHECK(!lib_aci_send_data(&aci_state, 1, &value, 1));
+  HOST_TEST_CHECK(!test_write(1, TEST_STREAM_LEN));
+  HOST_TEST_CHECK(0 == done_count);
+
+  test_run();
+
+  HOST_TEST_CHECK(1 == done_count);
+  HOST_TEST_CHECK(!done_in_write);
+  HOST_TEST_CHECK((1 == done_pipe) && (TEST_STREAM_LEN == done_length));
+  HOST_TEST_CHECK(!received_overflow && (TEST_STREAM_LEN == received_len));
+  HOST_TEST_CHECK(0 == memcmp(received, stream_data, TEST_STREAM_LEN));
+  HOST_TEST_CHECK(!lib_aci_stream_busy(&aci_state, 1));
+  HOST_TEST_CHECK(lib_aci_send_data(&aci_state, 1, &value, 1));
+  test_run();
+}
+
+/* A stream that the credits cover is over before lib_aci_stream_write() returns */
+static void test_stream_done_in_write(void)
+{
+  const uint16_t length = (uint16_t)(lib_aci_get_nb_available_credits(&aci_state) * ACI_PIPE_TX_DATA_MAX_LEN);
+
+  test_clear(2);
+  HOST_TEST_CHECK(length > 0);
+
+  HOST_TEST_CHECK(test_write(2, length));
+  HOST_TEST_CHECK(1 == done_count);
+  HOST_TEST_CHECK(done_in_write);
+  HOST_TEST_CHECK((2 == done_pipe) && (length == done_length));
+  HOST_TEST_CHECK(!lib_aci_stream_busy(&aci_state, 2));
+
+  test_run();
+
+  HOST_TEST_CHECK(length == received_len);
+  HOST_TEST_CHECK(0 == memcmp(received, stream_data, length));
+}
+
+/* A Disconnected event ends the stream with the bytes that were handed to the transport */
+static void test_stream_abort(void)
+{
+  uint8_t credit_events = 0;
+
+  test_clear(3);
+
+  HOST_TEST_CHECK(test_write(3, TEST_STREAM_LEN));
+  while ((credit_events < 2) && host_test_aci_event_wait(&aci_state, &aci_data, TEST_QUIET_MS))
+  {
+    if (ACI_EVT_DATA_CREDIT == aci_data.evt.evt_opcode)
+    {
+      credit_events++;
+    }
+  }
+  HOST_TEST_CHECK(2 == credit_events);
+  HOST_TEST_CHECK(0 == done_count);
+
+  nrf8001_sim_peer_disconnect(HOST_TEST_ACI_SPI);
+  HOST_TEST_CHECK(test_run());
+
+  HOST_TEST_CHECK(1 == done_count);
+  HOST_TEST_CHECK((3 == done_pipe) && (done_length > 0) && (done_length < TEST_STREAM_LEN));
+  HOST_TEST_CHECK(done_length == received_len);
+  HOST_TEST_CHECK(0 == memcmp(received, stream_data, received_len));
+  HOST_TEST_CHECK(!lib_aci_stream_busy(&aci_state, 3));
+}
+
+int main(void)
+{
+  uint16_t i;
+
+  host_test_init("test_lib_aci_stream");
+
+  for (i = 0; i < TEST_STREAM_LEN; i++)
+  {
+    stream_data[i] = (uint8_t)(i * 13 + (i >> 8));
+  }
+
+  nrf8001_sim_cmd_observer_set(HOST_TEST_ACI_SPI, test_cmd_observer);
+  if (host_test_aci_connect(&aci_state))
+  {
+    test_stream();
+    test_stream_done_in_write();
+    test_stream_abort();
+  }
+
+  return host_test_result();
+}
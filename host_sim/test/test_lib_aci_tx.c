@@ -0,0 +1,276 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief The send queues of lib_aci_send_data() against the nRF8001 model: data waiting for credits,
+ * the round robin between the pipes, the credits of PipeError events and of a DataCredit event got
+ * twice, and the Disconnected event.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "lib_aci.h"
+#include "hal_platform.h"
+#include "nrf8001_sim.h"
+#include "host_test.h"
+#include "host_test_aci.h"
+
+/* The model returns the credits a connection interval after the data, so the run is quiet once
+   nothing is left to send */
+#define TEST_QUIET_MS     300
+#define TEST_SENT_MAX     64
+
+static aci_state_t   aci_state;
+static hal_aci_evt_t aci_data;
+
+/* SendData commands the model has received */
+static uint8_t  sent_pipe[TEST_SENT_MAX];
+static uint8_t  sent_data[TEST_SENT_MAX];
+static uint16_t sent_count;
+
+static uint16_t pipe_errors;
+static bool     disconnected;
+
+static void test_cmd_observer(uint8_t spi, const uint8_t *p_cmd)
+{
+  if ((ACI_CMD_SEND_DATA == p_cmd[1]) && (sent_count < TEST_SENT_MAX))
+  {
+    sent_pipe[sent_count] = p_cmd[2];
+    sent_data[sent_count] = p_cmd[3];
+    sent_count++;
+  }
+}
+
+static void test_sent_clear(void)
+{
+  sent_count   = 0;
+  pipe_errors  = 0;
+  disconnected = false;
+}
+
+/* Handles the events until the model has nothing more to say */
+static void test_run(void)
+{
+  while (host_test_aci_event_wait(&aci_state, &aci_data, TEST_QUIET_MS))
+  {
+    if (ACI_EVT_PIPE_ERROR == aci_data.evt.evt_opcode)
+    {
+      pipe_errors++;
+    }
+    else if (ACI_EVT_DISCONNECTED == aci_data.evt.evt_opcode)
+    {
+      disconnected = true;
+    }
+  }
+}
+
+static bool test_send(uint8_t pipe, uint8_t value)
+{
+  return lib_aci_send_data(&aci_state, pipe, &value, 1);
+}
+
+/* More data than credits and buffers, it goes out in order as the credits come back */
+static void test_credit_starvation(void)
+{
+  const uint8_t credits = lib_aci_get_nb_available_credits(&aci_state);
+  uint8_t       i;
+
+  test_sent_clear();
+  HOST_TEST_CHECK(credits > 0);
+
+  for (i = 0; i < (credits + LIB_ACI_TX_BUFFERS); i++)
+  {
+    HOST_TEST_CHECK(test_send(1, i));
+  }
+  HOST_TEST_CHECK(0 == lib_aci_get_nb_available_credits(&aci_state));
+  HOST_TEST_CHECK(LIB_ACI_TX_BUFFERS == lib_aci_tx_queued_get(&aci_state));
+  HOST_TEST_CHECK(!test_send(1, i));
+
+  test_run();
+
+  HOST_TEST_CHECK((credits + LIB_ACI_TX_BUFFERS) == sent_count);
+  for (i = 0; i < sent_count; i++)
+  {
+    HOST_TEST_CHECK((1 == sent_pipe[i]) && (i == sent_data[i]));
+  }
+  HOST_TEST_CHECK(0 == pipe_errors);
+  HOST_TEST_CHECK(0 == lib_aci_tx_queued_get(&aci_state));
+  HOST_TEST_CHECK(credits == lib_aci_get_nb_available_credits(&aci_state));
+}
+
+/* Data queued on three pipes, one after the other, goes out a buffer per pipe in turn */
+static void test_round_robin(void)
+{
+  const uint8_t credits = lib_aci_get_nb_available_credits(&aci_state);
+  uint8_t       next[4] = { 0, 0, 0, 0 };
+  uint8_t       pipe;
+  uint8_t       i;
+
+  test_sent_clear();
+
+  for (i = 0; i < credits; i++)
+  {
+    HOST_TEST_CHECK(test_send(4, i));
+  }
+  for (pipe = 1; pipe <= 3; pipe++)
+  {
+    for (i = 0; i < 2; i++)
+    {
+      HOST_TEST_CHECK(test_send(pipe, i));
+    }
+  }
+  HOST_TEST_CHECK(6 == lib_aci_tx_queued_get(&aci_state));
+
+  test_run();
+
+  HOST_TEST_CHECK((credits + 6) == sent_count);
+  for (i = credits; i < sent_count; i++)
+  {
+    pipe = sent_pipe[i];
+    HOST_TEST_CHECK((pipe >= 1) && (pipe <= 3));
+    if (i > credits)
+    {
+      HOST_TEST_CHECK(pipe == ((sent_pipe[i - 1] % 3) + 1));
+    }
+    if ((pipe >= 1) && (pipe <= 3))
+    {
+      HOST_TEST_CHECK(next[pipe] == sent_data[i]);
+      next[pipe]++;
+    }
+  }
+  HOST_TEST_CHECK(0 == pipe_errors);
+  HOST_TEST_CHECK(credits == lib_aci_get_nb_available_credits(&aci_state));
+}
+
+/* The peer closes a pipe, the credits of the data the model refuses on it send the queued data */
+static void test_pipe_error(void)
+{
+  const uint8_t credits = lib_aci_get_nb_available_credits(&aci_state);
+  uint8_t       i;
+
+  test_sent_clear();
+  nrf8001_sim_peer_pipe_close(HOST_TEST_ACI_SPI, 5);
+  test_run();
+  HOST_TEST_CHECK(!lib_aci_is_pipe_available(&aci_state, 5));
+
+  for (i = 0; i < credits; i++)
+  {
+    HOST_TEST_CHECK(test_send(5, i));
+  }
+  for (i = 0; i < 4; i++)
+  {
+    HOST_TEST_CHECK(test_send(1, i));
+  }
+  HOST_TEST_CHECK(4 == lib_aci_tx_queued_get(&aci_state));
+
+  test_run();
+
+  HOST_TEST_CHECK(credits == pipe_errors);
+  HOST_TEST_CHECK((credits + 4) == sent_count);
+  for (i = credits; i < sent_count; i++)
+  {
+    HOST_TEST_CHECK((1 == sent_pipe[i]) && ((i - credits) == sent_data[i]));
+  }
+  HOST_TEST_CHECK(0 == lib_aci_tx_queued_get(&aci_state));
+  HOST_TEST_CHECK(credits == lib_aci_get_nb_available_credits(&aci_state));
+}
+
+/* Getting a DataCredit event twice before releasing it adds its credits once */
+static void test_event_get_slot_twice(void)
+{
+  const uint8_t  credits = lib_aci_get_nb_available_credits(&aci_state);
+  const uint32_t start   = millis();
+  hal_aci_evt_t *p_slot  = NULL;
+  uint8_t        i;
+
+  for (i = 0; i < credits; i++)
+  {
+    HOST_TEST_CHECK(test_send(1, i));
+  }
+  HOST_TEST_CHECK(0 == lib_aci_get_nb_available_credits(&aci_state));
+
+  while ((NULL == p_slot) && ((uint32_t)(millis() - start) < HOST_TEST_ACI_TIMEOUT_MS))
+  {
+    p_slot = lib_aci_event_get_slot(&aci_state);
+    if ((NULL != p_slot) && (ACI_EVT_DATA_CREDIT != p_slot->evt.evt_opcode))
+    {
+      lib_aci_event_release(&aci_state);
+      p_slot = NULL;
+    }
+    else if (NULL == p_slot)
+    {
+      delay(1);
+    }
+  }
+
+  if (HOST_TEST_CHECK(NULL != p_slot))
+  {
+    HOST_TEST_CHECK(credits == p_slot->evt.params.data_credit.credit);
+    HOST_TEST_CHECK(credits == lib_aci_get_nb_available_credits(&aci_state));
+    HOST_TEST_CHECK(p_slot == lib_aci_event_get_slot(&aci_state));
+    HOST_TEST_CHECK(credits == lib_aci_get_nb_available_credits(&aci_state));
+    lib_aci_event_release(&aci_state);
+  }
+  test_run();
+  HOST_TEST_CHECK(credits == lib_aci_get_nb_available_credits(&aci_state));
+}
+
+/* The data waiting for credits is dropped and the credits are back to the total */
+static void test_disconnected(void)
+{
+  const uint8_t credits = lib_aci_get_nb_available_credits(&aci_state);
+  uint8_t       i;
+
+  test_sent_clear();
+
+  for (i = 0; i < (credits + 4); i++)
+  {
+    HOST_TEST_CHECK(test_send(2, i));
+  }
+  HOST_TEST_CHECK(4 == lib_aci_tx_queued_get(&aci_state));
+
+  nrf8001_sim_peer_disconnect(HOST_TEST_ACI_SPI);
+  test_run();
+
+  HOST_TEST_CHECK(disconnected);
+  HOST_TEST_CHECK(credits == sent_count);
+  HOST_TEST_CHECK(0 == lib_aci_tx_queued_get(&aci_state));
+  HOST_TEST_CHECK(credits == lib_aci_get_nb_available_credits(&aci_state));
+}
+
+int main(void)
+{
+  host_test_init("test_lib_aci_tx");
+
+  nrf8001_sim_cmd_observer_set(HOST_TEST_ACI_SPI, test_cmd_observer);
+  if (host_test_aci_connect(&aci_state))
+  {
+    test_credit_starvation();
+    test_round_robin();
+    test_pipe_error();
+    test_event_get_slot_twice();
+    test_disconnected();
+  }
+
+  return host_test_result();
+}
@@ -0,0 +1,432 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Typed views of the ACI events in place in the event queue.
+ *
+ * A view points at the parameters of one type of event. The aci_evt_view_<event>() functions open
+ * it on the raw event, the length byte followed by the opcode and the parameters, as returned by
+ * aci_evt_view_raw() for a slot from lib_aci_event_get_slot(). They check the opcode, and check
+ * the length against the parameters of the event and against HAL_ACI_MAX_LENGTH, the bytes the
+ * transport actually stored.
+ *
+ * The accessors read the fields at the offsets of aci_protocol_defines.h one byte at a time and
+ * assemble the 16-bit fields little endian, so neither the packed structures of aci_evts.h nor
+ * unaligned loads are involved and nothing is copied. A view is valid until the event is released.
+ */
+#ifndef ACI_EVT_VIEW_H__
+#define ACI_EVT_VIEW_H__
+
+#include "hal_platform.h"
+#include "aci.h"
+#include "aci_evts.h"
+#include "aci_protocol_defines.h"
+#include "acilib_defs.h"
+#include "hal_aci_tl.h"
+
+/* Fixed parameter bytes of the events, the length byte of an event also counts the opcode */
+#define ACI_EVT_VIEW_DEVICE_STARTED_LEN   (OFFSET_ACI_EVT_PARAMS_DEVICE_STARTED_T_CREDIT_AVAILABLE + 1)
+#define ACI_EVT_VIEW_HW_ERROR_LEN         (OFFSET_ACI_EVT_PARAMS_HW_ERROR_T_FILE_NAME)
+#define ACI_EVT_VIEW_CMD_RSP_LEN          (OFFSET_ACI_EVT_PARAMS_CMD_RSP_T_CMD_STATUS + 1)
+#define ACI_EVT_VIEW_CONNECTED_LEN        (OFFSET_ACI_EVT_PARAMS_CONNECTED_T_MASTER_CLOCK_ACCURACY + 1)
+#define ACI_EVT_VIEW_DISCONNECTED_LEN     (OFFSET_ACI_EVT_PARAMS_DISCONNECTED_T_BTLE_STATUS + 1)
+#define ACI_EVT_VIEW_BOND_STATUS_LEN      (OFFSET_ACI_EVT_PARAMS_BOND_STATUS_T_KEYS_EXCHANGED_MASTER + 1)
+#define ACI_EVT_VIEW_PIPE_STATUS_LEN      (OFFSET_ACI_EVT_PARAMS_PIPE_STATUS_T_PIPES_CLOSED_BITMAP + ACI_EVT_VIEW_PIPE_BITMAP_LEN)
+#define ACI_EVT_VIEW_TIMING_LEN           (OFFSET_ACI_EVT_PARAMS_TIMING_T_CONN_RF_TIMEOUT_MSB + 1)
+#define ACI_EVT_VIEW_DATA_CREDIT_LEN      (OFFSET_ACI_EVT_PARAMS_DATA_CREDIT_T_CREDIT + 1)
+#define ACI_EVT_VIEW_DATA_ACK_LEN         (OFFSET_ACI_EVT_PARAMS_DATA_ACK_T_PIPE_NUMBER + 1)
+#define ACI_EVT_VIEW_DATA_RECEIVED_LEN    (OFFSET_ACI_EVT_PARAMS_DATA_RECEIVED_T_RX_DATA + OFFSET_ACI_RX_DATA_T_ACI_DATA)
+#define ACI_EVT_VIEW_PIPE_ERROR_LEN       (OFFSET_ACI_EVT_PARAMS_PIPE_ERROR_T_ERROR_CODE + 1)
+#define ACI_EVT_VIEW_DISPLAY_PASSKEY_LEN  (OFFSET_ACI_EVT_PARAMS_DISPLAY_PASSKEY_T_PASSKEY + ACI_EVT_VIEW_PASSKEY_LEN)
+#define ACI_EVT_VIEW_KEY_REQUEST_LEN      (OFFSET_ACI_EVT_PARAMS_KEY_REQUEST_T_KEY_TYPE + 1)
+
+#define ACI_EVT_VIEW_PIPE_BITMAP_LEN  8
+#define ACI_EVT_VIEW_PASSKEY_LEN      6
+
+/* Parameters of an event, p_params is NULL when the view could not be opened. The views of the
+   events wrap it in types of their own so the accessors of one event do not take another. */
+typedef struct
+{
+  const uint8_t *p_params;
+  uint8_t        length;        /* Parameter bytes, including the variable part of the event */
+} aci_evt_view_t;
+
+typedef struct { aci_evt_view_t view; } aci_evt_view_device_started_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_hw_error_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_cmd_rsp_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_connected_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_disconnected_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_bond_status_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_pipe_status_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_timing_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_data_credit_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_data_ack_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_data_received_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_pipe_error_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_display_passkey_t;
+typedef struct { aci_evt_view_t view; } aci_evt_view_key_request_t;
+
+/* The raw bytes of an event, for the aci_evt_view_<event>() functions */
+static inline const uint8_t * aci_evt_view_raw(const aci_evt_t *aci_evt)
+{
+  return (const uint8_t *)aci_evt;
+}
+
+static inline aci_evt_opcode_t aci_evt_view_opcode(const uint8_t *p_evt)
+{
+  return (aci_evt_opcode_t)ACIL_DECODE_EVT_GET_OPCODE(p_evt);
+}
+
+/* Opens the view of an event with the given opcode and at least params_len parameter bytes */
+static inline bool aci_evt_view_open(const uint8_t *p_evt, uint8_t evt_opcode, uint8_t params_offset,
+                                     uint8_t params_len, aci_evt_view_t *p_view)
+{
+  const uint8_t length = ACIL_DECODE_EVT_GET_LENGTH(p_evt);
+
+  if ((evt_opcode != ACIL_DECODE_EVT_GET_OPCODE(p_evt)) ||
+      (length < (params_len + 1)) || (length > HAL_ACI_MAX_LENGTH))
+  {
+    p_view->p_params = NULL;
+    p_view->length   = 0;
+    return false;
+  }
+
+  p_view->p_params = p_evt + params_offset;
+  p_view->length   = (uint8_t)(length - 1);
+  return true;
+}
+
+static inline uint16_t aci_evt_view_le16(const aci_evt_view_t *p_view, uint8_t offset_lsb, uint8_t offset_msb)
+{
+  return (uint16_t)(p_view->p_params[offset_lsb] | (p_view->p_params[offset_msb] << 8));
+}
+
+/* Device Started */
+static inline bool aci_evt_view_device_started(const uint8_t *p_evt, aci_evt_view_device_started_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_DEVICE_STARTED, OFFSET_ACI_EVT_T_DEVICE_STARTED,
+                           ACI_EVT_VIEW_DEVICE_STARTED_LEN, &p_view->view);
+}
+
+static inline aci_device_operation_mode_t aci_evt_device_started_mode(const aci_evt_view_device_started_t *p_view)
+{
+  return (aci_device_operation_mode_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DEVICE_STARTED_T_DEVICE_MODE];
+}
+
+static inline aci_hw_error_t aci_evt_device_started_hw_error(const aci_evt_view_device_started_t *p_view)
+{
+  return (aci_hw_error_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DEVICE_STARTED_T_HW_ERROR];
+}
+
+static inline uint8_t aci_evt_device_started_credit_available(const aci_evt_view_device_started_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DEVICE_STARTED_T_CREDIT_AVAILABLE];
+}
+
+/* Hardware Error */
+static inline bool aci_evt_view_hw_error(const uint8_t *p_evt, aci_evt_view_hw_error_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_HW_ERROR, OFFSET_ACI_EVT_T_HW_ERROR,
+                           ACI_EVT_VIEW_HW_ERROR_LEN, &p_view->view);
+}
+
+static inline uint16_t aci_evt_hw_error_line_num(const aci_evt_view_hw_error_t *p_view)
+{
+  return aci_evt_view_le16(&p_view->view, OFFSET_ACI_EVT_PARAMS_HW_ERROR_T_LINE_NUM_LSB,
+                           OFFSET_ACI_EVT_PARAMS_HW_ERROR_T_LINE_NUM_MSB);
+}
+
+/* Not terminated, aci_evt_hw_error_file_name_len() bytes */
+static inline const uint8_t * aci_evt_hw_error_file_name(const aci_evt_view_hw_error_t *p_view)
+{
+  return &p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_HW_ERROR_T_FILE_NAME];
+}
+
+static inline uint8_t aci_evt_hw_error_file_name_len(const aci_evt_view_hw_error_t *p_view)
+{
+  return (uint8_t)(p_view->view.length - OFFSET_ACI_EVT_PARAMS_HW_ERROR_T_FILE_NAME);
+}
+
+/* Command Response */
+static inline bool aci_evt_view_cmd_rsp(const uint8_t *p_evt, aci_evt_view_cmd_rsp_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_CMD_RSP, OFFSET_ACI_EVT_T_CMD_RSP,
+                           ACI_EVT_VIEW_CMD_RSP_LEN, &p_view->view);
+}
+
+static inline aci_cmd_opcode_t aci_evt_cmd_rsp_cmd_opcode(const aci_evt_view_cmd_rsp_t *p_view)
+{
+  return (aci_cmd_opcode_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_CMD_RSP_T_CMD_OPCODE];
+}
+
+static inline aci_status_code_t aci_evt_cmd_rsp_cmd_status(const aci_evt_view_cmd_rsp_t *p_view)
+{
+  return (aci_status_code_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_CMD_RSP_T_CMD_STATUS];
+}
+
+/* Response parameters of the command, aci_evt_cmd_rsp_data_len() bytes */
+static inline const uint8_t * aci_evt_cmd_rsp_data(const aci_evt_view_cmd_rsp_t *p_view)
+{
+  return &p_view->view.p_params[ACI_EVT_VIEW_CMD_RSP_LEN];
+}
+
+static inline uint8_t aci_evt_cmd_rsp_data_len(const aci_evt_view_cmd_rsp_t *p_view)
+{
+  return (uint8_t)(p_view->view.length - ACI_EVT_VIEW_CMD_RSP_LEN);
+}
+
+/* Connected */
+static inline bool aci_evt_view_connected(const uint8_t *p_evt, aci_evt_view_connected_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_CONNECTED, OFFSET_ACI_EVT_T_CONNECTED,
+                           ACI_EVT_VIEW_CONNECTED_LEN, &p_view->view);
+}
+
+static inline aci_bd_addr_type_t aci_evt_connected_dev_addr_type(const aci_evt_view_connected_t *p_view)
+{
+  return (aci_bd_addr_type_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_CONNECTED_T_DEV_ADDR_TYPE];
+}
+
+/* BTLE_DEVICE_ADDRESS_SIZE bytes, least significant byte first */
+static inline const uint8_t * aci_evt_connected_dev_addr(const aci_evt_view_connected_t *p_view)
+{
+  return &p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_CONNECTED_T_DEV_ADDR];
+}
+
+static inline uint16_t aci_evt_connected_conn_rf_interval(const aci_evt_view_connected_t *p_view)
+{
+  return aci_evt_view_le16(&p_view->view, OFFSET_ACI_EVT_PARAMS_CONNECTED_T_CONN_RF_INTERVAL_LSB,
+                           OFFSET_ACI_EVT_PARAMS_CONNECTED_T_CONN_RF_INTERVAL_MSB);
+}
+
+static inline uint16_t aci_evt_connected_conn_slave_rf_latency(const aci_evt_view_connected_t *p_view)
+{
+  return aci_evt_view_le16(&p_view->view, OFFSET_ACI_EVT_PARAMS_CONNECTED_T_CONN_SLAVE_RF_LATENCY_LSB,
+                           OFFSET_ACI_EVT_PARAMS_CONNECTED_T_CONN_SLAVE_RF_LATENCY_MSB);
+}
+
+static inline uint16_t aci_evt_connected_conn_rf_timeout(const aci_evt_view_connected_t *p_view)
+{
+  return aci_evt_view_le16(&p_view->view, OFFSET_ACI_EVT_PARAMS_CONNECTED_T_CONN_RF_TIMEOUT_LSB,
+                           OFFSET_ACI_EVT_PARAMS_CONNECTED_T_CONN_RF_TIMEOUT_MSB);
+}
+
+static inline aci_clock_accuracy_t aci_evt_connected_master_clock_accuracy(const aci_evt_view_connected_t *p_view)
+{
+  return (aci_clock_accuracy_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_CONNECTED_T_MASTER_CLOCK_ACCURACY];
+}
+
+/* Disconnected */
+static inline bool aci_evt_view_disconnected(const uint8_t *p_evt, aci_evt_view_disconnected_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_DISCONNECTED, OFFSET_ACI_EVT_T_DISCONNECTED,
+                           ACI_EVT_VIEW_DISCONNECTED_LEN, &p_view->view);
+}
+
+static inline aci_status_code_t aci_evt_disconnected_aci_status(const aci_evt_view_disconnected_t *p_view)
+{
+  return (aci_status_code_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DISCONNECTED_T_ACI_STATUS];
+}
+
+static inline uint8_t aci_evt_disconnected_btle_status(const aci_evt_view_disconnected_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DISCONNECTED_T_BTLE_STATUS];
+}
+
+/* Bond Status */
+static inline bool aci_evt_view_bond_status(const uint8_t *p_evt, aci_evt_view_bond_status_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_BOND_STATUS, OFFSET_ACI_EVT_T_BOND_STATUS,
+                           ACI_EVT_VIEW_BOND_STATUS_LEN, &p_view->view);
+}
+
+static inline aci_bond_status_code_t aci_evt_bond_status_status_code(const aci_evt_view_bond_status_t *p_view)
+{
+  return (aci_bond_status_code_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_BOND_STATUS_T_STATUS_CODE];
+}
+
+static inline aci_bond_status_source_t aci_evt_bond_status_status_source(const aci_evt_view_bond_status_t *p_view)
+{
+  return (aci_bond_status_source_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_BOND_STATUS_T_STATUS_SOURCE];
+}
+
+static inline uint8_t aci_evt_bond_status_secmode1_bitmap(const aci_evt_view_bond_status_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_BOND_STATUS_T_SECMODE1_BITMAP];
+}
+
+static inline uint8_t aci_evt_bond_status_secmode2_bitmap(const aci_evt_view_bond_status_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_BOND_STATUS_T_SECMODE2_BITMAP];
+}
+
+static inline uint8_t aci_evt_bond_status_keys_exchanged_slave(const aci_evt_view_bond_status_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_BOND_STATUS_T_KEYS_EXCHANGED_SLAVE];
+}
+
+static inline uint8_t aci_evt_bond_status_keys_exchanged_master(const aci_evt_view_bond_status_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_BOND_STATUS_T_KEYS_EXCHANGED_MASTER];
+}
+
+/* Pipe Status, the bitmaps are ACI_EVT_VIEW_PIPE_BITMAP_LEN bytes with pipe 0 in bit 0 of byte 0 */
+static inline bool aci_evt_view_pipe_status(const uint8_t *p_evt, aci_evt_view_pipe_status_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_PIPE_STATUS, OFFSET_ACI_EVT_T_PIPE_STATUS,
+                           ACI_EVT_VIEW_PIPE_STATUS_LEN, &p_view->view);
+}
+
+static inline const uint8_t * aci_evt_pipe_status_pipes_open_bitmap(const aci_evt_view_pipe_status_t *p_view)
+{
+  return &p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_PIPE_STATUS_T_PIPES_OPEN_BITMAP];
+}
+
+static inline const uint8_t * aci_evt_pipe_status_pipes_closed_bitmap(const aci_evt_view_pipe_status_t *p_view)
+{
+  return &p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_PIPE_STATUS_T_PIPES_CLOSED_BITMAP];
+}
+
+/* Timing */
+static inline bool aci_evt_view_timing(const uint8_t *p_evt, aci_evt_view_timing_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_TIMING, OFFSET_ACI_EVT_T_TIMING,
+                           ACI_EVT_VIEW_TIMING_LEN, &p_view->view);
+}
+
+static inline uint16_t aci_evt_timing_conn_rf_interval(const aci_evt_view_timing_t *p_view)
+{
+  return aci_evt_view_le16(&p_view->view, OFFSET_ACI_EVT_PARAMS_TIMING_T_CONN_RF_INTERVAL_LSB,
+                           OFFSET_ACI_EVT_PARAMS_TIMING_T_CONN_RF_INTERVAL_MSB);
+}
+
+static inline uint16_t aci_evt_timing_conn_slave_rf_latency(const aci_evt_view_timing_t *p_view)
+{
+  return aci_evt_view_le16(&p_view->view, OFFSET_ACI_EVT_PARAMS_TIMING_T_CONN_SLAVE_RF_LATENCY_LSB,
+                           OFFSET_ACI_EVT_PARAMS_TIMING_T_CONN_SLAVE_RF_LATENCY_MSB);
+}
+
+static inline uint16_t aci_evt_timing_conn_rf_timeout(const aci_evt_view_timing_t *p_view)
+{
+  return aci_evt_view_le16(&p_view->view, OFFSET_ACI_EVT_PARAMS_TIMING_T_CONN_RF_TIMEOUT_LSB,
+                           OFFSET_ACI_EVT_PARAMS_TIMING_T_CONN_RF_TIMEOUT_MSB);
+}
+
+/* Data Credit */
+static inline bool aci_evt_view_data_credit(const uint8_t *p_evt, aci_evt_view_data_credit_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_DATA_CREDIT, OFFSET_ACI_EVT_T_DATA_CREDIT,
+                           ACI_EVT_VIEW_DATA_CREDIT_LEN, &p_view->view);
+}
+
+static inline uint8_t aci_evt_data_credit_credit(const aci_evt_view_data_credit_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DATA_CREDIT_T_CREDIT];
+}
+
+/* Data Ack */
+static inline bool aci_evt_view_data_ack(const uint8_t *p_evt, aci_evt_view_data_ack_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_DATA_ACK, OFFSET_ACI_EVT_T_DATA_ACK,
+                           ACI_EVT_VIEW_DATA_ACK_LEN, &p_view->view);
+}
+
+static inline uint8_t aci_evt_data_ack_pipe_number(const aci_evt_view_data_ack_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DATA_ACK_T_PIPE_NUMBER];
+}
+
+/* Data Received */
+static inline bool aci_evt_view_data_received(const uint8_t *p_evt, aci_evt_view_data_received_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_DATA_RECEIVED, OFFSET_ACI_EVT_T_DATA_RECEIVED,
+                           ACI_EVT_VIEW_DATA_RECEIVED_LEN, &p_view->view);
+}
+
+static inline uint8_t aci_evt_data_received_pipe_number(const aci_evt_view_data_received_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DATA_RECEIVED_T_RX_DATA + OFFSET_ACI_RX_DATA_T_PIPE_NUMBER];
+}
+
+/* aci_evt_data_received_data_len() bytes */
+static inline const uint8_t * aci_evt_data_received_data(const aci_evt_view_data_received_t *p_view)
+{
+  return &p_view->view.p_params[ACI_EVT_VIEW_DATA_RECEIVED_LEN];
+}
+
+static inline uint8_t aci_evt_data_received_data_len(const aci_evt_view_data_received_t *p_view)
+{
+  return (uint8_t)(p_view->view.length - ACI_EVT_VIEW_DATA_RECEIVED_LEN);
+}
+
+/* Pipe Error */
+static inline bool aci_evt_view_pipe_error(const uint8_t *p_evt, aci_evt_view_pipe_error_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_PIPE_ERROR, OFFSET_ACI_EVT_T_PIPE_ERROR,
+                           ACI_EVT_VIEW_PIPE_ERROR_LEN, &p_view->view);
+}
+
+static inline uint8_t aci_evt_pipe_error_pipe_number(const aci_evt_view_pipe_error_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_PIPE_ERROR_T_PIPE_NUMBER];
+}
+
+static inline uint8_t aci_evt_pipe_error_error_code(const aci_evt_view_pipe_error_t *p_view)
+{
+  return p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_PIPE_ERROR_T_ERROR_CODE];
+}
+
+/* aci_evt_pipe_error_error_data_len() bytes */
+static inline const uint8_t * aci_evt_pipe_error_error_data(const aci_evt_view_pipe_error_t *p_view)
+{
+  return &p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_PIPE_ERROR_T_ERROR_DATA];
+}
+
+static inline uint8_t aci_evt_pipe_error_error_data_len(const aci_evt_view_pipe_error_t *p_view)
+{
+  return (uint8_t)(p_view->view.length - ACI_EVT_VIEW_PIPE_ERROR_LEN);
+}
+
+/* Display Passkey, ACI_EVT_VIEW_PASSKEY_LEN ASCII digits */
+static inline bool aci_evt_view_display_passkey(const uint8_t *p_evt, aci_evt_view_display_passkey_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_DISPLAY_PASSKEY, OFFSET_ACI_EVT_T_DISPLAY_PASSKEY,
+                           ACI_EVT_VIEW_DISPLAY_PASSKEY_LEN, &p_view->view);
+}
+
+static inline const uint8_t * aci_evt_display_passkey_passkey(const aci_evt_view_display_passkey_t *p_view)
+{
+  return &p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_DISPLAY_PASSKEY_T_PASSKEY];
+}
+
+/* Key Request */
+static inline bool aci_evt_view_key_request(const uint8_t *p_evt, aci_evt_view_key_request_t *p_view)
+{
+  return aci_evt_view_open(p_evt, ACI_EVT_KEY_REQUEST, OFFSET_ACI_EVT_T_KEY_REQUEST,
+                           ACI_EVT_VIEW_KEY_REQUEST_LEN, &p_view->view);
+}
+
+static inline aci_key_type_t aci_evt_key_request_key_type(const aci_evt_view_key_request_t *p_view)
+{
+  return (aci_key_type_t)p_view->view.p_params[OFFSET_ACI_EVT_PARAMS_KEY_REQUEST_T_KEY_TYPE];
+}
+
+#endif /* ACI_EVT_VIEW_H__ */
@@ -0,0 +1,86 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+@brief Implementation of the deferred logging ring
+*/
+
+#include "hal_platform.h"
+#include "aci_log.h"
+
+#define ACI_LOG_RING_MASK  (ACI_LOG_RING_WORDS - 1)
+
+/* Free running word indexes, written by the log calls and aci_log_drain() in the main context */
+static uint32_t aci_log_ring[ACI_LOG_RING_WORDS];
+static uint16_t aci_log_head;
+static uint16_t aci_log_tail;
+static uint16_t aci_log_dropped;
+
+void aci_log_init(void)
+{
+  efm_itm_port_enable(ACI_LOG_ITM_PORT);
+}
+
+void aci_log_write(uint8_t level, const char *p_format, uint8_t argc, const uint32_t *p_args)
+{
+  uint16_t tail = aci_log_tail;
+  uint8_t  i;
+
+  if ((uint16_t)(ACI_LOG_RING_WORDS - (uint16_t)(tail - aci_log_head)) < (ACI_LOG_HEADER_WORDS + argc))
+  {
+    if (aci_log_dropped < 0xFFFF)
+    {
+      aci_log_dropped++;
+    }
+    return;
+  }
+
+  aci_log_ring[tail++ & ACI_LOG_RING_MASK] = ACI_LOG_MARKER | ((uint32_t)level << 8) | ((uint32_t)argc << 12) |
+                                             ((uint32_t)aci_log_dropped << 16);
+  aci_log_ring[tail++ & ACI_LOG_RING_MASK] = efm_lf_ticks_get();
+  aci_log_ring[tail++ & ACI_LOG_RING_MASK] = (uint32_t)(uintptr_t)p_format;
+  for (i = 0; i < argc; i++)
+  {
+    aci_log_ring[tail++ & ACI_LOG_RING_MASK] = p_args[i];
+  }
+
+  aci_log_dropped = 0;
+  aci_log_tail    = tail;
+}
+
+bool aci_log_drain(void)
+{
+  const uint16_t tail = aci_log_tail;
+  uint16_t       head = aci_log_head;
+
+  if (head == tail)
+  {
+    return false;
+  }
+
+  while (head != tail)
+  {
+    efm_itm_write32(ACI_LOG_ITM_PORT, aci_log_ring[head++ & ACI_LOG_RING_MASK]);
+  }
+  aci_log_head = head;
+
+  return true;
+}
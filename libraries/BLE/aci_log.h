@@ -0,0 +1,149 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Deferred logging for the BLE library and the demos.
+ *
+ * A log call stores the address of its format string, the time and up to ACI_LOG_ARGS_MAX
+ * arguments in a RAM ring, a few words and no formatting. aci_log_drain() moves the records to
+ * the ITM port ACI_LOG_ITM_PORT, and lib_aci_idle() calls it when the MCU has nothing else to
+ * do. tools/aci_log_decode.py looks the format strings up in the firmware image and prints the
+ * messages.
+ *
+ * - The arguments are stored as 32-bit integers. %s only works for strings in flash, as the host
+ *   reads them from the image, and floating point is not supported.
+ * - Log from the main context only, the ring has a single producer.
+ * - Calls below ACI_LOG_LEVEL compile to nothing. With ACI_LOG_PRINTF defined the calls are
+ *   printf() calls instead, for a debugger without access to the raw SWO output.
+ */
+#ifndef ACI_LOG_H__
+#define ACI_LOG_H__
+
+#include "hal_platform.h"
+
+#define ACI_LOG_LEVEL_NONE     0
+#define ACI_LOG_LEVEL_ERROR    1
+#define ACI_LOG_LEVEL_WARNING  2
+#define ACI_LOG_LEVEL_INFO     3
+#define ACI_LOG_LEVEL_DEBUG    4
+
+/** Least important level that is compiled in */
+#ifndef ACI_LOG_LEVEL
+#define ACI_LOG_LEVEL          ACI_LOG_LEVEL_INFO
+#endif
+
+/** printf() uses port 0, the ACI probes port 1 and the packet trace port 2 */
+#ifndef ACI_LOG_ITM_PORT
+#define ACI_LOG_ITM_PORT       3
+#endif
+
+/** Size of the ring in 32-bit words, a power of two */
+#ifndef ACI_LOG_RING_WORDS
+#define ACI_LOG_RING_WORDS     256
+#endif
+
+#if (ACI_LOG_RING_WORDS & (ACI_LOG_RING_WORDS - 1)) || (ACI_LOG_RING_WORDS < 16) || (ACI_LOG_RING_WORDS > 32768)
+#error "ACI_LOG_RING_WORDS must be a power of two from 16 to 32768"
+#endif
+
+#define ACI_LOG_ARGS_MAX       6
+
+/** A record is the header word, the efm_lf_ticks_get() time, the format string address and the
+    arguments. The header holds ACI_LOG_MARKER in bits 7..0, the level in bits 11..8, the number of
+    arguments in bits 15..12 and the number of records dropped before this one, because the ring
+    was full, in bits 31..16. Keep in step with tools/aci_log_decode.py. */
+#define ACI_LOG_MARKER         0xA1UL
+#define ACI_LOG_HEADER_WORDS   3
+
+/** @brief Stores a record in the ring, call through the ACI_LOG_* macros
+ *  @param level ACI_LOG_LEVEL_ERROR to ACI_LOG_LEVEL_DEBUG
+ *  @param p_format printf() format string, it must stay in flash
+ *  @param argc Number of arguments in p_args, at most ACI_LOG_ARGS_MAX
+ *  @param p_args The arguments
+ */
+void aci_log_write(uint8_t level, const char *p_format, uint8_t argc, const uint32_t *p_args);
+
+/** @brief Writes the records in the ring to ACI_LOG_ITM_PORT
+ *  @details Blocks while the ITM FIFO is full, a word takes about 60 us at the SWO clock of
+ *  setupSWO(). Called by lib_aci_idle().
+ *  @return true if records were written
+ */
+bool aci_log_drain(void);
+
+/** @brief Opens ACI_LOG_ITM_PORT, called by lib_aci_init() */
+void aci_log_init(void);
+
+/* Counts the arguments after the format string */
+#define ACI_LOG_ARGC(...)      ACI_LOG_ARGC_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0, ~)
+#define ACI_LOG_ARGC_(f, a1, a2, a3, a4, a5, a6, n, ...)  n
+#define ACI_LOG_CAT(a, b)      ACI_LOG_CAT_(a, b)
+#define ACI_LOG_CAT_(a, b)     a##b
+#define ACI_LOG_ARG(a)         ((uint32_t)(uintptr_t)(a))
+
+#define ACI_LOG_WRITE_0(l, f)                       aci_log_write((l), (f), 0, NULL)
+#define ACI_LOG_WRITE_1(l, f, a)                    do { const uint32_t aci_log_args[1] = { ACI_LOG_ARG(a) }; \
+                                                         aci_log_write((l), (f), 1, aci_log_args); } while (0)
+#define ACI_LOG_WRITE_2(l, f, a, b)                 do { const uint32_t aci_log_args[2] = { ACI_LOG_ARG(a), ACI_LOG_ARG(b) }; \
+                                                         aci_log_write((l), (f), 2, aci_log_args); } while (0)
+#define ACI_LOG_WRITE_3(l, f, a, b, c)              do { const uint32_t aci_log_args[3] = { ACI_LOG_ARG(a), ACI_LOG_ARG(b), ACI_LOG_ARG(c) }; \
+                                                         aci_log_write((l), (f), 3, aci_log_args); } while (0)
+#define ACI_LOG_WRITE_4(l, f, a, b, c, d)           do { const uint32_t aci_log_args[4] = { ACI_LOG_ARG(a), ACI_LOG_ARG(b), ACI_LOG_ARG(c), \
+                                                                                            ACI_LOG_ARG(d) }; \
+                                                         aci_log_write((l), (f), 4, aci_log_args); } while (0)
+#define ACI_LOG_WRITE_5(l, f, a, b, c, d, e)        do { const uint32_t aci_log_args[5] = { ACI_LOG_ARG(a), ACI_LOG_ARG(b), ACI_LOG_ARG(c), \
+                                                                                            ACI_LOG_ARG(d), ACI_LOG_ARG(e) }; \
+                                                         aci_log_write((l), (f), 5, aci_log_args); } while (0)
+#define ACI_LOG_WRITE_6(l, f, a, b, c, d, e, g)     do { const uint32_t aci_log_args[6] = { ACI_LOG_ARG(a), ACI_LOG_ARG(b), ACI_LOG_ARG(c), \
+                                                                                            ACI_LOG_ARG(d), ACI_LOG_ARG(e), ACI_LOG_ARG(g) }; \
+                                                         aci_log_write((l), (f), 6, aci_log_args); } while (0)
+
+#if defined(ACI_LOG_PRINTF)
+  #define ACI_LOG_WRITE(level, ...)  printf(__VA_ARGS__)
+#else
+  #define ACI_LOG_WRITE(level, ...)  ACI_LOG_CAT(ACI_LOG_WRITE_, ACI_LOG_ARGC(__VA_ARGS__))(level, __VA_ARGS__)
+#endif
+
+/** Log calls, a format string in flash followed by up to ACI_LOG_ARGS_MAX integer arguments */
+#if (ACI_LOG_LEVEL >= ACI_LOG_LEVEL_ERROR)
+  #define ACI_LOG_ERROR(...)    ACI_LOG_WRITE(ACI_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+  #define ACI_LOG_ERROR(...)    ((void)0)
+#endif
+
+#if (ACI_LOG_LEVEL >= ACI_LOG_LEVEL_WARNING)
+  #define ACI_LOG_WARNING(...)  ACI_LOG_WRITE(ACI_LOG_LEVEL_WARNING, __VA_ARGS__)
+#else
+  #define ACI_LOG_WARNING(...)  ((void)0)
+#endif
+
+#if (ACI_LOG_LEVEL >= ACI_LOG_LEVEL_INFO)
+  #define ACI_LOG_INFO(...)     ACI_LOG_WRITE(ACI_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+  #define ACI_LOG_INFO(...)     ((void)0)
+#endif
+
+#if (ACI_LOG_LEVEL >= ACI_LOG_LEVEL_DEBUG)
+  #define ACI_LOG_DEBUG(...)    ACI_LOG_WRITE(ACI_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+  #define ACI_LOG_DEBUG(...)    ((void)0)
+#endif
+
+#endif /* ACI_LOG_H__ */
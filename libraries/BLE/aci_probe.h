@@ -0,0 +1,83 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Cycle counter probes on the ACI hot paths.
+ *
+ * With ACI_PROBE defined every probe writes one 32-bit record to the ITM stimulus port
+ * ACI_PROBE_ITM_PORT: bit 31 is set on the exit of the function, bits 30..24 hold the probe id and
+ * bits 23..0 the low bits of the DWT cycle counter. One word per record keeps a record from an
+ * interrupt from landing in the middle of another. tools/aci_probe_decode.py pairs the entry and
+ * exit records of a capture of the SWO output and prints the cycles spent per probe.
+ *
+ * Without ACI_PROBE the probes are empty.
+ */
+#ifndef ACI_PROBE_H__
+#define ACI_PROBE_H__
+
+#include "hal_platform.h"
+
+/* The ids are part of the record format, keep them in step with tools/aci_probe_decode.py */
+typedef enum
+{
+  ACI_PROBE_SPI_TRANSFER       = 1,
+  ACI_PROBE_SPI_TRANSFER_DONE  = 2,
+  ACI_PROBE_QUEUE_ENQUEUE      = 3,
+  ACI_PROBE_QUEUE_DEQUEUE      = 4,
+  ACI_PROBE_QUEUE_PEEK         = 5,
+  ACI_PROBE_QUEUE_ACQUIRE      = 6,
+  ACI_PROBE_QUEUE_COMMIT       = 7,
+  ACI_PROBE_QUEUE_PEEK_SLOT    = 8,
+  ACI_PROBE_QUEUE_RELEASE      = 9,
+  ACI_PROBE_EVENT_GET          = 10,
+  ACI_PROBE_EVENT_GET_SLOT     = 11,
+  ACI_PROBE_DECODE_EVT         = 12,
+  ACI_PROBE_SETUP              = 13,
+  ACI_PROBE_EVENT_DISPATCH     = 14
+} aci_probe_id_t;
+
+#if defined(ACI_PROBE)
+
+/* printf() uses port 0 */
+#ifndef ACI_PROBE_ITM_PORT
+#define ACI_PROBE_ITM_PORT  1
+#endif
+
+#define ACI_PROBE_EXIT_FLAG   0x80000000UL
+#define ACI_PROBE_CYCLE_MASK  0x00FFFFFFUL
+
+#define ACI_PROBE_RECORD(flag, id) \
+  efm_itm_write32(ACI_PROBE_ITM_PORT, (flag) | ((uint32_t)(id) << 24) | (efm_cycles_get() & ACI_PROBE_CYCLE_MASK))
+
+/* Starts the cycle counter and opens the probe port, the debugger must have the ITM enabled */
+#define ACI_PROBE_INIT()  do { efm_cycle_counter_init(); efm_itm_port_enable(ACI_PROBE_ITM_PORT); } while (0)
+#define ACI_PROBE_ENTER(id)  ACI_PROBE_RECORD(0UL, (id))
+#define ACI_PROBE_EXIT(id)   ACI_PROBE_RECORD(ACI_PROBE_EXIT_FLAG, (id))
+
+#else
+
+#define ACI_PROBE_INIT()     ((void)0)
+#define ACI_PROBE_ENTER(id)  ((void)0)
+#define ACI_PROBE_EXIT(id)   ((void)0)
+
+#endif
+
+#endif /* ACI_PROBE_H__ */
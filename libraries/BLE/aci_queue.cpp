@@ -25,178 +25,387 @@
 
 #include "hal_aci_tl.h"
 #include "aci_queue.h"
+#include "aci_probe.h"
 #include "ble_assert.h"
 
-void aci_queue_init(aci_queue_t *aci_q)
+/* Orders the slot accesses against the index updates. The producer must finish writing a slot
+   before the new tail is visible, and the consumer must finish reading a slot before the new
+   head hands it back to the producer. */
+#if defined(__EFM32__)
+  #define ACI_QUEUE_BARRIER()  __DMB()
+#else
+  #define ACI_QUEUE_BARRIER()  __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/* Size of the queue, in slots or ring bytes */
+#define ACI_QUEUE_SIZE_GET(aci_q)  ((uint16_t)((aci_q)->mask + 1))
+
+#if defined(ACI_QUEUE_BYTE_RING)
+
+/* A length byte no stored packet can have, aci_queue_commit() limits the length to the slot.
+   Marks that the rest of the ring is skipped. */
+#define ACI_QUEUE_PAD_MARKER  0xFF
+
+typedef char aci_queue_pad_marker_assert_t[((ACI_QUEUE_SLOT_SIZE_MAX - 2) < ACI_QUEUE_PAD_MARKER) ? 1 : -1];
+
+static inline hal_aci_data_t *aci_queue_slot_get(aci_queue_t *aci_q, uint16_t index)
 {
-  uint8_t loop;
+  return (hal_aci_data_t *)&(aci_q->storage[index & aci_q->mask]);
+}
 
-  ble_assert(NULL != aci_q);
+/* Bytes taken by a stored packet, kept even so a padding marker always fits at the end of the ring */
+static inline uint16_t aci_queue_packet_size(const hal_aci_data_t *p_slot)
+{
+  return (uint16_t)((p_slot->buffer[0] + 3) & ~1);
+}
 
-  aci_q->head = 0;
-  aci_q->tail = 0;
-  for(loop=0; loop<ACI_QUEUE_SIZE; loop++)
+/* Head of the queue with any padding at the end of the ring skipped. Does not modify the queue. */
+static uint16_t aci_queue_head_get(aci_queue_t *aci_q)
+{
+  uint16_t head = aci_q->head;
+
+  if (head == aci_q->tail)
+  {
+    return head;
+  }
+
+  ACI_QUEUE_BARRIER();
+  if (ACI_QUEUE_PAD_MARKER == aci_q->storage[(head & aci_q->mask) + 1])
   {
-    aci_q->aci_data[loop].buffer[0] = 0x00;
-    aci_q->aci_data[loop].buffer[1] = 0x00;
+    head += ACI_QUEUE_SIZE_GET(aci_q) - (head & aci_q->mask);
   }
+
+  return head;
 }
 
-bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data)
+/* Bytes the producer needs free to hand out the next slot, including padding at the end of the ring */
+static inline uint16_t aci_queue_slot_need(aci_queue_t *aci_q, uint16_t tail)
 {
-  ble_assert(NULL != aci_q);
-  ble_assert(NULL != p_data);
+  const uint16_t contiguous = ACI_QUEUE_SIZE_GET(aci_q) - (tail & aci_q->mask);
 
-  if (aci_queue_is_empty(aci_q))
+  return (contiguous < aci_q->slot_size) ? (contiguous + aci_q->slot_size) : aci_q->slot_size;
+}
+
+#else
+
+static inline hal_aci_data_t *aci_queue_slot_get(aci_queue_t *aci_q, uint16_t index)
+{
+  return (hal_aci_data_t *)&(aci_q->storage[(index & aci_q->mask) * aci_q->slot_size]);
+}
+
+#endif
+
+/*
+  Copies the packet in the slot to p_data. The length byte of an event comes from the nRF8001, so the
+  copy is limited to the slot, and the copied length byte to what was copied.
+*/
+static void aci_queue_slot_copy(aci_queue_t *aci_q, hal_aci_data_t *p_data, const hal_aci_data_t *p_slot)
+{
+  const uint8_t length = p_slot->buffer[0];
+
+  if ((length + 2) > aci_q->slot_size)
   {
-    return false;
+    memcpy((uint8_t *)p_data, (uint8_t *)p_slot, aci_q->slot_size);
+    p_data->buffer[0] = (uint8_t)(aci_q->slot_size - 2);
+  }
+  else
+  {
+    memcpy((uint8_t *)p_data, (uint8_t *)p_slot, length + 2);
   }
+}
 
-  memcpy((uint8_t *)p_data, (uint8_t *)&(aci_q->aci_data[aci_q->head]), sizeof(hal_aci_data_t));
-  aci_q->head = (aci_q->head + 1) % ACI_QUEUE_SIZE;
+void aci_queue_storage_set(aci_queue_t *aci_q, uint8_t *storage, uint16_t size, uint8_t slot_size)
+{
+  ble_assert(NULL != aci_q);
+  ble_assert(NULL != storage);
 
-  return true;
+  aci_q->storage   = storage;
+  aci_q->mask      = size - 1;
+  aci_q->slot_size = slot_size;
 }
 
-bool aci_queue_dequeue_from_isr(aci_queue_t *aci_q, hal_aci_data_t *p_data)
+void aci_queue_init(aci_queue_t *aci_q)
 {
   ble_assert(NULL != aci_q);
-  ble_assert(NULL != p_data);
+  ble_assert(NULL != aci_q->storage);
 
-  if (aci_queue_is_empty_from_isr(aci_q))
-  {
-    return false;
-  }
+  aci_q->head = 0;
+  aci_q->tail = 0;
 
-  memcpy((uint8_t *)p_data, (uint8_t *)&(aci_q->aci_data[aci_q->head]), sizeof(hal_aci_data_t));
-  aci_q->head = (aci_q->head + 1) % ACI_QUEUE_SIZE;
+#if !defined(ACI_QUEUE_BYTE_RING)
+  {
+    uint16_t loop;
 
-  return true;
+    for(loop=0; loop<ACI_QUEUE_SIZE_GET(aci_q); loop++)
+    {
+      aci_queue_slot_get(aci_q, loop)->buffer[0] = 0x00;
+      aci_queue_slot_get(aci_q, loop)->buffer[1] = 0x00;
+    }
+  }
+#endif
 }
 
-bool aci_queue_enqueue(aci_queue_t *aci_q, hal_aci_data_t *p_data)
+bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data)
 {
-  const uint8_t length = p_data->buffer[0];
+  const hal_aci_data_t *p_slot;
 
+  ACI_PROBE_ENTER(ACI_PROBE_QUEUE_DEQUEUE);
   ble_assert(NULL != aci_q);
   ble_assert(NULL != p_data);
 
-  if (aci_queue_is_full(aci_q))
+  p_slot = aci_queue_peek_slot(aci_q);
+  if (NULL == p_slot)
   {
+    ACI_PROBE_EXIT(ACI_PROBE_QUEUE_DEQUEUE);
     return false;
   }
 
-  aci_q->aci_data[aci_q->tail].status_byte = 0;
-  memcpy((uint8_t *)&(aci_q->aci_data[aci_q->tail].buffer[0]), (uint8_t *)&p_data->buffer[0], length + 1);
-  aci_q->tail = (aci_q->tail + 1) % ACI_QUEUE_SIZE;
+  aci_queue_slot_copy(aci_q, p_data, p_slot);
+  aci_queue_release(aci_q);
 
+  ACI_PROBE_EXIT(ACI_PROBE_QUEUE_DEQUEUE);
   return true;
 }
 
-bool aci_queue_enqueue_from_isr(aci_queue_t *aci_q, hal_aci_data_t *p_data)
+bool aci_queue_dequeue_from_isr(aci_queue_t *aci_q, hal_aci_data_t *p_data)
 {
-  const uint8_t length = p_data->buffer[0];
+  return aci_queue_dequeue(aci_q, p_data);
+}
 
+bool aci_queue_enqueue(aci_queue_t *aci_q, hal_aci_data_t *p_data)
+{
+  uint8_t length;
+  hal_aci_data_t *p_slot;
+
+  ACI_PROBE_ENTER(ACI_PROBE_QUEUE_ENQUEUE);
   ble_assert(NULL != aci_q);
   ble_assert(NULL != p_data);
 
-  if (aci_queue_is_full_from_isr(aci_q))
+  length = p_data->buffer[0];
+
+  // The packet must fit in a slot of this queue
+  if ((length + 2) > aci_q->slot_size)
   {
+    ACI_PROBE_EXIT(ACI_PROBE_QUEUE_ENQUEUE);
     return false;
   }
 
-  aci_q->aci_data[aci_q->tail].status_byte = 0;
-  memcpy((uint8_t *)&(aci_q->aci_data[aci_q->tail].buffer[0]), (uint8_t *)&p_data->buffer[0], length + 1);
-  aci_q->tail = (aci_q->tail + 1) % ACI_QUEUE_SIZE;
+  p_slot = aci_queue_acquire(aci_q);
+  if (NULL == p_slot)
+  {
+    ACI_PROBE_EXIT(ACI_PROBE_QUEUE_ENQUEUE);
+    return false;
+  }
+
+  p_slot->status_byte = 0;
+  memcpy((uint8_t *)&(p_slot->buffer[0]), (uint8_t *)&p_data->buffer[0], length + 1);
+  aci_queue_commit(aci_q);
 
+  ACI_PROBE_EXIT(ACI_PROBE_QUEUE_ENQUEUE);
   return true;
 }
 
-bool aci_queue_is_empty(aci_queue_t *aci_q)
+bool aci_queue_enqueue_from_isr(aci_queue_t *aci_q, hal_aci_data_t *p_data)
 {
-  bool state = false;
+  return aci_queue_enqueue(aci_q, p_data);
+}
 
+bool aci_queue_is_empty(aci_queue_t *aci_q)
+{
   ble_assert(NULL != aci_q);
 
-  //Critical section
-  noInterrupts();
-  if (aci_q->head == aci_q->tail)
-  {
-    state = true;
-  }
-  interrupts();
-
-  return state;
+#if defined(ACI_QUEUE_BYTE_RING)
+  return aci_queue_head_get(aci_q) == aci_q->tail;
+#else
+  return aci_q->head == aci_q->tail;
+#endif
 }
 
 bool aci_queue_is_empty_from_isr(aci_queue_t *aci_q)
 {
-  ble_assert(NULL != aci_q);
-
-  return aci_q->head == aci_q->tail;
+  return aci_queue_is_empty(aci_q);
 }
 
 bool aci_queue_is_full(aci_queue_t *aci_q)
 {
-  uint8_t next;
-  bool state;
+  uint16_t tail;
+  uint16_t used;
 
   ble_assert(NULL != aci_q);
 
-  //This should be done in a critical section
-  noInterrupts();
-  next = (aci_q->tail + 1) % ACI_QUEUE_SIZE;
+  tail = aci_q->tail;
+  used = (uint16_t)(tail - aci_q->head);
 
-  if (next == aci_q->head)
-  {
-    state = true;
-  }
-  else
-  {
-    state = false;
-  }
-
-  interrupts();
-  //end
-
-  return state;
+#if defined(ACI_QUEUE_BYTE_RING)
+  return (uint16_t)(ACI_QUEUE_SIZE_GET(aci_q) - used) < aci_queue_slot_need(aci_q, tail);
+#else
+  return used == ACI_QUEUE_SIZE_GET(aci_q);
+#endif
 }
 
 bool aci_queue_is_full_from_isr(aci_queue_t *aci_q)
 {
-  const uint8_t next = (aci_q->tail + 1) % ACI_QUEUE_SIZE;
+  return aci_queue_is_full(aci_q);
+}
 
+uint16_t aci_queue_fill_get(aci_queue_t *aci_q)
+{
   ble_assert(NULL != aci_q);
 
-  return next == aci_q->head;
+  return (uint16_t)(aci_q->tail - aci_q->head);
 }
 
 bool aci_queue_peek(aci_queue_t *aci_q, hal_aci_data_t *p_data)
 {
+  const hal_aci_data_t *p_slot;
+
+  ACI_PROBE_ENTER(ACI_PROBE_QUEUE_PEEK);
   ble_assert(NULL != aci_q);
   ble_assert(NULL != p_data);
 
-  if (aci_queue_is_empty(aci_q))
+  p_slot = aci_queue_peek_slot(aci_q);
+  if (NULL == p_slot)
   {
+    ACI_PROBE_EXIT(ACI_PROBE_QUEUE_PEEK);
     return false;
   }
 
-  memcpy((uint8_t *)p_data, (uint8_t *)&(aci_q->aci_data[aci_q->head]), sizeof(hal_aci_data_t));
+  aci_queue_slot_copy(aci_q, p_data, p_slot);
 
+  ACI_PROBE_EXIT(ACI_PROBE_QUEUE_PEEK);
   return true;
 }
 
 bool aci_queue_peek_from_isr(aci_queue_t *aci_q, hal_aci_data_t *p_data)
 {
+  return aci_queue_peek(aci_q, p_data);
+}
+
+hal_aci_data_t *aci_queue_acquire(aci_queue_t *aci_q)
+{
+  uint16_t tail;
+
+  ACI_PROBE_ENTER(ACI_PROBE_QUEUE_ACQUIRE);
+  if (aci_queue_is_full(aci_q))
+  {
+    ACI_PROBE_EXIT(ACI_PROBE_QUEUE_ACQUIRE);
+    return NULL;
+  }
+
+  tail = aci_q->tail;
+
+#if defined(ACI_QUEUE_BYTE_RING)
+  {
+    const uint16_t contiguous = ACI_QUEUE_SIZE_GET(aci_q) - (tail & aci_q->mask);
+
+    // Skip the end of the ring when the slot does not fit, is_full() made sure the start has room
+    if (contiguous < aci_q->slot_size)
+    {
+      aci_q->storage[(tail & aci_q->mask) + 1] = ACI_QUEUE_PAD_MARKER;
+      ACI_QUEUE_BARRIER();
+      tail += contiguous;
+      aci_q->tail = tail;
+    }
+  }
+#endif
+
+  ACI_PROBE_EXIT(ACI_PROBE_QUEUE_ACQUIRE);
+  return aci_queue_slot_get(aci_q, tail);
+}
+
+hal_aci_data_t *aci_queue_acquire_from_isr(aci_queue_t *aci_q)
+{
+  return aci_queue_acquire(aci_q);
+}
+
+void aci_queue_commit(aci_queue_t *aci_q)
+{
+  ACI_PROBE_ENTER(ACI_PROBE_QUEUE_COMMIT);
   ble_assert(NULL != aci_q);
-  ble_assert(NULL != p_data);
 
-  if (aci_queue_is_empty_from_isr(aci_q))
+#if defined(ACI_QUEUE_BYTE_RING)
   {
-    return false;
+    hal_aci_data_t *p_slot = aci_queue_slot_get(aci_q, aci_q->tail);
+
+    // The length byte sizes the packet in the ring, a length that does not fit the slot would
+    // move the tail over the packets behind it
+    if ((p_slot->buffer[0] + 2) > aci_q->slot_size)
+    {
+      p_slot->buffer[0] = (uint8_t)(aci_q->slot_size - 2);
+    }
+
+    ACI_QUEUE_BARRIER();
+    aci_q->tail = aci_q->tail + aci_queue_packet_size(p_slot);
   }
+#else
+  ACI_QUEUE_BARRIER();
+  aci_q->tail = aci_q->tail + 1;
+#endif
+  ACI_PROBE_EXIT(ACI_PROBE_QUEUE_COMMIT);
+}
 
-  memcpy((uint8_t *)p_data, (uint8_t *)&(aci_q->aci_data[aci_q->head]), sizeof(hal_aci_data_t));
+void aci_queue_commit_from_isr(aci_queue_t *aci_q)
+{
+  aci_queue_commit(aci_q);
+}
 
-  return true;
+hal_aci_data_t *aci_queue_peek_slot(aci_queue_t *aci_q)
+{
+  uint16_t head;
+
+  ACI_PROBE_ENTER(ACI_PROBE_QUEUE_PEEK_SLOT);
+  ble_assert(NULL != aci_q);
+
+#if defined(ACI_QUEUE_BYTE_RING)
+  head = aci_queue_head_get(aci_q);
+  if (head == aci_q->tail)
+  {
+    ACI_PROBE_EXIT(ACI_PROBE_QUEUE_PEEK_SLOT);
+    return NULL;
+  }
+
+  // Only the consumer moves the head, so the padding can be dropped here
+  aci_q->head = head;
+#else
+  head = aci_q->head;
+  if (head == aci_q->tail)
+  {
+    ACI_PROBE_EXIT(ACI_PROBE_QUEUE_PEEK_SLOT);
+    return NULL;
+  }
+
+  ACI_QUEUE_BARRIER();
+#endif
+
+  ACI_PROBE_EXIT(ACI_PROBE_QUEUE_PEEK_SLOT);
+  return aci_queue_slot_get(aci_q, head);
+}
+
+hal_aci_data_t *aci_queue_peek_slot_from_isr(aci_queue_t *aci_q)
+{
+  return aci_queue_peek_slot(aci_q);
+}
+
+void aci_queue_release(aci_queue_t *aci_q)
+{
+  uint16_t head;
+
+  ACI_PROBE_ENTER(ACI_PROBE_QUEUE_RELEASE);
+  ble_assert(NULL != aci_q);
+
+#if defined(ACI_QUEUE_BYTE_RING)
+  head = aci_queue_head_get(aci_q);
+  head += aci_queue_packet_size(aci_queue_slot_get(aci_q, head));
+#else
+  head = aci_q->head + 1;
+#endif
+
+  ACI_QUEUE_BARRIER();
+  aci_q->head = head;
+  ACI_PROBE_EXIT(ACI_PROBE_QUEUE_RELEASE);
+}
+
+void aci_queue_release_from_isr(aci_queue_t *aci_q)
+{
+  aci_queue_release(aci_q);
 }
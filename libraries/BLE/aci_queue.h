@@ -35,11 +35,92 @@
 #include "aci.h"
 #include "hal_aci_tl.h"
 
+/** Size of a queue slot holding any ACI packet, the status byte and the length byte included */
+#define ACI_QUEUE_SLOT_SIZE_MAX  ((uint8_t)sizeof(hal_aci_data_t))
+
+#if defined(ACI_QUEUE_BYTE_RING)
+
+/***********************************************************************    */
+/* The ACI_QUEUE_RING_SIZE is the default number of bytes in a queue when   */
+/* the packets are stored in a byte ring, define ACI_QUEUE_BYTE_RING to     */
+/* use it. The size must be a power of two from 64 to 32768 bytes.          */
+/***********************************************************************    */
+#ifndef ACI_QUEUE_RING_SIZE
+#define ACI_QUEUE_RING_SIZE  128
+#endif
+
+/* Default size of the command and event queues, in bytes */
+#define ACI_QUEUE_SIZE_DEFAULT  ACI_QUEUE_RING_SIZE
+
+/* Bytes of storage for a queue of the given size */
+#define ACI_QUEUE_STORAGE_SIZE(size, slot_size)  (size)
+
+/* The ring must fit at least two packets of slot_size */
+#define ACI_QUEUE_SIZE_VALID(size, slot_size) \
+  ((((size) & ((size) - 1)) == 0) && ((size) >= (2 * (slot_size))) && ((size) <= 32768))
+
+#else
+
 /***********************************************************************    */
 /* The ACI_QUEUE_SIZE determines the memory usage of the system.            */
 /* Successfully tested to a ACI_QUEUE_SIZE of 4 (interrupt) and 4 (polling) */
+/* It is the default number of slots in the command and event queues. The   */
+/* size must be a power of two and no larger than 128.                      */
 /***********************************************************************    */
+#ifndef ACI_QUEUE_SIZE
 #define ACI_QUEUE_SIZE  4
+#endif
+
+/* Default size of the command and event queues, in slots */
+#define ACI_QUEUE_SIZE_DEFAULT  ACI_QUEUE_SIZE
+
+/* Bytes of storage for a queue of the given size */
+#define ACI_QUEUE_STORAGE_SIZE(size, slot_size)  ((size) * (slot_size))
+
+#define ACI_QUEUE_SIZE_VALID(size, slot_size) \
+  ((((size) & ((size) - 1)) == 0) && ((size) >= 1) && ((size) <= 128))
+
+#endif
+
+/***********************************************************************    */
+/* The ACI command (TX) and event (RX) queues are sized independently.      */
+/* A sensor node pushing notifications needs a deep command queue, a node   */
+/* doing a lot of configuration a deep event queue. The slot size limits    */
+/* the longest command that can be queued. Events are received in place,    */
+/* so the event queue always uses the largest slot size.                    */
+/***********************************************************************    */
+#ifndef ACI_TX_QUEUE_SIZE
+#define ACI_TX_QUEUE_SIZE       ACI_QUEUE_SIZE_DEFAULT
+#endif
+
+#ifndef ACI_TX_QUEUE_SLOT_SIZE
+#define ACI_TX_QUEUE_SLOT_SIZE  ACI_QUEUE_SLOT_SIZE_MAX
+#endif
+
+#ifndef ACI_RX_QUEUE_SIZE
+#define ACI_RX_QUEUE_SIZE       ACI_QUEUE_SIZE_DEFAULT
+#endif
+
+#define ACI_RX_QUEUE_SLOT_SIZE  ACI_QUEUE_SLOT_SIZE_MAX
+
+/***********************************************************************    */
+/* The transport stops honouring RDYN when the event queue holds            */
+/* ACI_RX_QUEUE_HIGH_WATERMARK, or when it is full, and resumes when the    */
+/* application has drained it to ACI_RX_QUEUE_LOW_WATERMARK. The nRF8001    */
+/* holds its events meanwhile. Both are in slots, or bytes with             */
+/* ACI_QUEUE_BYTE_RING.                                                     */
+/***********************************************************************    */
+#ifndef ACI_RX_QUEUE_HIGH_WATERMARK
+#define ACI_RX_QUEUE_HIGH_WATERMARK  ACI_RX_QUEUE_SIZE
+#endif
+
+#ifndef ACI_RX_QUEUE_LOW_WATERMARK
+#define ACI_RX_QUEUE_LOW_WATERMARK   (ACI_RX_QUEUE_SIZE / 2)
+#endif
+
+#if (ACI_RX_QUEUE_LOW_WATERMARK >= ACI_RX_QUEUE_HIGH_WATERMARK) || (ACI_RX_QUEUE_HIGH_WATERMARK > ACI_RX_QUEUE_SIZE)
+#error "ACI_RX_QUEUE_LOW_WATERMARK must be below ACI_RX_QUEUE_HIGH_WATERMARK, which must not exceed ACI_RX_QUEUE_SIZE"
+#endif
 
 /** Data type for queue of data packets to send/receive from radio.
  *
@@ -47,14 +128,53 @@
  *  at the tail and taken (dequeued) from the head. The head variable is the
  *  index of the next packet to dequeue while the tail variable is the index of
  *  where the next packet should be queued.
+ *
+ *  The queue is lock free for a single producer and a single consumer, e.g. the
+ *  ACI interrupt and the main loop. The tail is only written by the producer and
+ *  the head only by the consumer. Both run freely and are masked when indexing,
+ *  so all slots are usable and tail - head is the fill level.
+ *  The _from_isr variants are kept for the callers, they are the same functions.
+ *
+ *  With ACI_QUEUE_BYTE_RING defined, the packets are stored back to back in a byte
+ *  ring as the status byte, the length byte and the payload, rounded up to an even
+ *  number of bytes. Small events like Data Credit or Command Response take a few bytes
+ *  instead of a full slot, so the same RAM holds several times more events. Head and
+ *  tail then count bytes. A slot is only handed out when slot_size bytes fit before the
+ *  end of the ring, so a slot is always contiguous and can be filled in place. When it
+ *  does not fit, the rest of the ring is skipped with a padding marker. The queue is
+ *  full when no more slots can be handed out.
+ *
+ *  The storage is allocated by @ref ACI_QUEUE_DEFINE.
  */
 
 typedef struct {
-	hal_aci_data_t           aci_data[ACI_QUEUE_SIZE];
-	uint8_t                  head;
-	uint8_t                  tail;
+	uint8_t                 *storage;
+	uint16_t                 mask;       /**< Size of the queue minus one, in slots or ring bytes */
+	uint8_t                  slot_size;  /**< Bytes reserved for a packet, the status byte and the length byte included */
+	volatile uint16_t        head;
+	volatile uint16_t        tail;
 } aci_queue_t;
 
+/** Checks the size and the slot size of a queue at compile time, name is only used for the check */
+#define ACI_QUEUE_ASSERT(name, size, slot_size) \
+  typedef char name ## _assert_size_t[-1+10*(ACI_QUEUE_SIZE_VALID((size), (slot_size)) && \
+                                             ((slot_size) >= 3) && ((slot_size) <= ACI_QUEUE_SLOT_SIZE_MAX))]
+
+/** Defines a queue called name and its storage.
+ *  The size is the number of slots, or the number of bytes with ACI_QUEUE_BYTE_RING, and
+ *  must be a power of two. The slot_size is checked at compile time as well.
+ */
+#define ACI_QUEUE_DEFINE(name, size, slot_size) \
+  ACI_QUEUE_ASSERT(name, size, slot_size); \
+  static uint8_t name ## _storage[ACI_QUEUE_STORAGE_SIZE((size), (slot_size))]; \
+  aci_queue_t name = { &name ## _storage[0], (uint16_t)((size) - 1), (uint8_t)(slot_size), 0, 0 }
+
+/** Points a queue at its storage, for queues that are not defined with @ref ACI_QUEUE_DEFINE.
+ *  The storage must be ACI_QUEUE_STORAGE_SIZE(size, slot_size) bytes, check the size with
+ *  @ref ACI_QUEUE_ASSERT. Call aci_queue_init() afterwards.
+ */
+void aci_queue_storage_set(aci_queue_t *aci_q, uint8_t *storage, uint16_t size, uint8_t slot_size);
+
 void aci_queue_init(aci_queue_t *aci_q);
 
 bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data);
@@ -69,8 +189,31 @@ bool aci_queue_is_empty_from_isr(aci_queue_t *aci_q);
 bool aci_queue_is_full(aci_queue_t *aci_q);
 bool aci_queue_is_full_from_isr(aci_queue_t *aci_q);
 
+/** Number of queued packets, in bytes with ACI_QUEUE_BYTE_RING */
+uint16_t aci_queue_fill_get(aci_queue_t *aci_q);
+
 bool aci_queue_peek(aci_queue_t *aci_q, hal_aci_data_t *p_data);
 bool aci_queue_peek_from_isr(aci_queue_t *aci_q, hal_aci_data_t *p_data);
 
+/** @name Zero copy access to the queue slots
+ *  The producer fills the slot returned by aci_queue_acquire() in place and makes it
+ *  visible to the consumer with aci_queue_commit(). The consumer reads the slot returned
+ *  by aci_queue_peek_slot() in place and frees it with aci_queue_release().
+ *  A slot pointer is valid until it is committed or released.
+ */
+//@{
+hal_aci_data_t *aci_queue_acquire(aci_queue_t *aci_q);
+hal_aci_data_t *aci_queue_acquire_from_isr(aci_queue_t *aci_q);
+
+void aci_queue_commit(aci_queue_t *aci_q);
+void aci_queue_commit_from_isr(aci_queue_t *aci_q);
+
+hal_aci_data_t *aci_queue_peek_slot(aci_queue_t *aci_q);
+hal_aci_data_t *aci_queue_peek_slot_from_isr(aci_queue_t *aci_q);
+
+void aci_queue_release(aci_queue_t *aci_q);
+void aci_queue_release_from_isr(aci_queue_t *aci_q);
+//@}
+
 #endif /* ACI_QUEUE_H__ */
 /** @} */
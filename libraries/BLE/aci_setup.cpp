@@ -21,6 +21,7 @@
 
 #include <lib_aci.h>
 #include "aci_setup.h"
+#include "aci_probe.h"
 
 
 // aci_struct that will contain 
@@ -35,9 +36,6 @@
 // Current State of the the GATT client (Service Discovery status)
 
 
-extern hal_aci_data_t msg_to_send;
-
-
 
 /**************************************************************************                */
 /* Utility function to fill the the ACI command queue                                      */
@@ -50,31 +48,39 @@ extern hal_aci_data_t msg_to_send;
 static bool aci_setup_fill(aci_state_t *aci_stat, uint8_t *num_cmd_offset)
 {
   bool ret_val = false;
+  hal_aci_data_t *p_slot;
+  uint8_t length;
   
   while (*num_cmd_offset < aci_stat->aci_setup_info.num_setup_msgs)
   {
 	//Board dependent defines
 	#if defined (__AVR__)
-		//For Arduino copy the setup ACI message from Flash to RAM.
-		memcpy_P(&msg_to_send, &(aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset]), 
-				  pgm_read_byte_near(&(aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset].buffer[0]))+2); 
-	#elif defined(__PIC32MX__)
-		//In ChipKit we store the setup messages in RAM
-		//Add 2 bytes to the length byte for status byte, length for the total number of bytes
-		memcpy(&msg_to_send, &(aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset]), 
-				  (aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset].buffer[0]+2)); 
-    #elif defined(__EFM32__)
-        memcpy(&msg_to_send, &(aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset]), 
-                (aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset].buffer[0]+2)); 
+		length = pgm_read_byte_near(&(aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset].buffer[0]));
+	#else
+		length = aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset].buffer[0];
 	#endif
 
-    //Put the Setup ACI message in the command queue
-    if (!hal_aci_tl_send(&msg_to_send))
+    //Reserve a slot in the command queue for the Setup ACI message
+    p_slot = hal_aci_tl_cmd_reserve(aci_stat->aci_tl, length);
+    if (NULL == p_slot)
     {
       //ACI Command Queue is full
       // *num_cmd_offset is now pointing to the index of the Setup command that did not get sent
       return ret_val;
     }
+
+	//Copy the length byte and the message straight into the slot
+	#if defined (__AVR__)
+		//For Arduino copy the setup ACI message from Flash to RAM.
+		memcpy_P(&(p_slot->buffer[0]), &(aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset].buffer[0]), length+1);
+	#else
+		memcpy(&(p_slot->buffer[0]), &(aci_stat->aci_setup_info.setup_msgs[*num_cmd_offset].buffer[0]), length+1);
+	#endif
+
+    if (!hal_aci_tl_cmd_commit(aci_stat->aci_tl))
+    {
+      return ret_val;
+    }
    
     ret_val = true;
     
@@ -92,17 +98,20 @@ uint8_t do_aci_setup(aci_state_t *aci_stat)
   aci_status_code_t cmd_status = ACI_STATUS_ERROR_CRC_MISMATCH;
   
   /*
-  We are using the same buffer since we are copying the contents of the buffer 
-  when queuing and immediately processing the buffer when receiving
+  The events are processed in place in the ACI event queue, the Setup messages
+  are copied straight into a slot of the ACI command queue
   */
-  hal_aci_evt_t  *aci_data = (hal_aci_evt_t *)&msg_to_send;
+  hal_aci_evt_t  *aci_data = NULL;
+
+  ACI_PROBE_ENTER(ACI_PROBE_SETUP);
   
   /* Messages in the outgoing queue must be handled before the Setup routine can run.
    * If it is non-empty we return. The user should then process the messages before calling
    * do_aci_setup() again.
    */
-  if (!lib_aci_command_queue_empty())
+  if (!lib_aci_command_queue_empty(aci_stat))
   {
+    ACI_PROBE_EXIT(ACI_PROBE_SETUP);
     return SETUP_FAIL_COMMAND_QUEUE_NOT_EMPTY;
   }
   
@@ -110,8 +119,9 @@ uint8_t do_aci_setup(aci_state_t *aci_stat)
    * so that the user can handle them. At this point we don't care what the event is,
    * as any event is an error.
    */
-  if (lib_aci_event_peek(aci_data))
+  if (NULL != lib_aci_event_peek_slot(aci_stat))
   {
+    ACI_PROBE_EXIT(ACI_PROBE_SETUP);
     return SETUP_FAIL_EVENT_QUEUE_NOT_EMPTY;
   }
   
@@ -125,16 +135,22 @@ uint8_t do_aci_setup(aci_state_t *aci_stat)
      */
     if (i++ > 0xFFFFE)
     {
+      ACI_PROBE_EXIT(ACI_PROBE_SETUP);
       return SETUP_FAIL_TIMEOUT;	
     }
     
-    if (lib_aci_event_peek(aci_data))
+    /* In polling mode move the queued Setup messages and their responses in one go */
+    lib_aci_pump(aci_stat, 0xFF);
+
+    aci_data = lib_aci_event_peek_slot(aci_stat);
+    if (NULL != aci_data)
     {
       aci_evt = &(aci_data->evt);
       
       if (ACI_EVT_CMD_RSP != aci_evt->evt_opcode)
       {
         //Receiving something other than a Command Response Event is an error.
+        ACI_PROBE_EXIT(ACI_PROBE_SETUP);
         return SETUP_FAIL_NOT_COMMAND_RESPONSE;
       }
       
@@ -157,6 +173,7 @@ uint8_t do_aci_setup(aci_state_t *aci_stat)
         
         default:
           //An event with any other status code should be handled by the application
+          ACI_PROBE_EXIT(ACI_PROBE_SETUP);
           return SETUP_FAIL_NOT_SETUP_EVENT;
       }
       
@@ -164,10 +181,13 @@ uint8_t do_aci_setup(aci_state_t *aci_stat)
        * or ACI_STATUS_TRANSACTION_COMPLETE. We don't need the event itself, so we simply
        * remove it from the queue.
        */
-       lib_aci_event_get (aci_stat, aci_data);
+       lib_aci_event_get_slot(aci_stat);
+       lib_aci_event_release(aci_stat);
     }
   }
   
+  ACI_PROBE_EXIT(ACI_PROBE_SETUP);
+  
   return SETUP_SUCCESS;
 }
   
@@ -37,24 +37,25 @@
 #include "acilib_defs.h"
 #include "acilib_if.h"
 #include "acilib_types.h"
+#include "aci_probe.h"
 
 
 void acil_encode_cmd_set_test_mode(uint8_t *buffer, aci_cmd_params_test_t *p_aci_cmd_params_test)
 {
-  *(buffer + OFFSET_ACI_CMD_T_LEN) = 2;
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_SET_TEST_MODE_LEN;
   *(buffer + OFFSET_ACI_CMD_T_CMD_OPCODE) = ACI_CMD_TEST;
   *(buffer + OFFSET_ACI_CMD_T_TEST + OFFSET_ACI_CMD_PARAMS_TEST_T_TEST_MODE_CHANGE) = p_aci_cmd_params_test->test_mode_change;
 }
 
 void acil_encode_cmd_sleep(uint8_t *buffer)
 {
-  *(buffer + OFFSET_ACI_CMD_T_LEN) = 1;
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_SLEEP_LEN;
   *(buffer + OFFSET_ACI_CMD_T_CMD_OPCODE) = ACI_CMD_SLEEP;
 }
 
 void acil_encode_cmd_get_device_version(uint8_t *buffer)
 {
-  *(buffer + OFFSET_ACI_CMD_T_LEN) = 1;
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_GET_DEVICE_VERSION_LEN;
   *(buffer + OFFSET_ACI_CMD_T_CMD_OPCODE) = ACI_CMD_GET_DEVICE_VERSION;
 }
 
@@ -162,19 +163,19 @@ void acil_encode_cmd_echo_msg(uint8_t *buffer, aci_cmd_params_echo_t *p_cmd_para
 
 void acil_encode_cmd_battery_level(uint8_t *buffer)
 {
-  *(buffer + OFFSET_ACI_CMD_T_LEN) = 1;
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_GET_BATTERY_LEVEL_LEN;
   *(buffer + OFFSET_ACI_CMD_T_CMD_OPCODE) = ACI_CMD_GET_BATTERY_LEVEL;
 }
 
 void acil_encode_cmd_temparature(uint8_t *buffer)
 {
-  *(buffer + OFFSET_ACI_CMD_T_LEN) = 1;
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_GET_TEMPERATURE_LEN;
   *(buffer + OFFSET_ACI_CMD_T_CMD_OPCODE) = ACI_CMD_GET_TEMPERATURE;
 }
 
 void acil_encode_cmd_read_dynamic_data(uint8_t *buffer)
 {
-  *(buffer + OFFSET_ACI_CMD_T_LEN) = 1;
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_READ_DYNAMIC_DATA_LEN;
   *(buffer + OFFSET_ACI_CMD_T_CMD_OPCODE) = ACI_CMD_READ_DYNAMIC_DATA;
 }
 
@@ -248,7 +249,7 @@ void acil_encode_cmd_send_data_nack(uint8_t *buffer, const uint8_t pipe_number,
 
 void acil_encode_cmd_bond_security_request(uint8_t *buffer)
 {
-  *(buffer + OFFSET_ACI_CMD_T_LEN) = 1;
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_BOND_SECURITY_REQUEST_LEN;
   *(buffer + OFFSET_ACI_CMD_T_CMD_OPCODE) = ACI_CMD_BOND_SECURITY_REQUEST;
 }
 
@@ -555,6 +556,7 @@ bool acil_decode_evt(uint8_t *buffer_in, aci_evt_t *p_aci_evt)
 {
   bool ret_val = true;
 
+  ACI_PROBE_ENTER(ACI_PROBE_DECODE_EVT);
   p_aci_evt->len = ACIL_DECODE_EVT_GET_LENGTH(buffer_in);
   p_aci_evt->evt_opcode = (aci_evt_opcode_t)ACIL_DECODE_EVT_GET_OPCODE(buffer_in);
 
@@ -606,5 +608,6 @@ bool acil_decode_evt(uint8_t *buffer_in, aci_evt_t *p_aci_evt)
       ret_val = false;
       break;
   }
+  ACI_PROBE_EXIT(ACI_PROBE_DECODE_EVT);
   return ret_val;
 }
@@ -57,5 +57,12 @@
 #define MSG_NACK_LEN                             3
 #define MSG_BROADCAST_LEN                        5
 #define MSG_OPEN_ADV_PIPES_LEN                   9
+#define MSG_SET_TEST_MODE_LEN                    2
+#define MSG_SLEEP_LEN                            1
+#define MSG_GET_DEVICE_VERSION_LEN               1
+#define MSG_GET_BATTERY_LEVEL_LEN                1
+#define MSG_GET_TEMPERATURE_LEN                  1
+#define MSG_READ_DYNAMIC_DATA_LEN                1
+#define MSG_BOND_SECURITY_REQUEST_LEN            1
 
 #endif /* _acilib_H_ */
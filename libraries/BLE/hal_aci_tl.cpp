@@ -27,6 +27,8 @@
 #include "hal_platform.h"
 #include "hal_aci_tl.h"
 #include "aci_queue.h"
+#include "aci_probe.h"
+#include "ble_assert.h"
 //#include <avr/sleep.h>
 
 /*
@@ -45,28 +47,170 @@ The outgoing command and the incoming event needs to be converted
     //For EFM32 add nothing
 #endif
 
-static void m_aci_data_print(hal_aci_data_t *p_data);
-static void m_aci_event_check(void);
-static void m_aci_isr(void);
-static void m_aci_pins_set(aci_pins_t *a_pins_ptr);
-static inline void m_aci_reqn_disable (void);
-static inline void m_aci_reqn_enable (void);
-static void m_aci_q_flush(void);
-static bool m_aci_spi_transfer(hal_aci_data_t * data_to_send, hal_aci_data_t * received_data);
+#if defined(HAL_ACI_TL_STATS)
+/* Most commands the command queue can hold, the byte ring holds packets of at least 4 bytes */
+#if defined(ACI_QUEUE_BYTE_RING)
+  #define ACI_STATS_TX_TIME_SIZE  (ACI_TX_QUEUE_SIZE / 4)
+#else
+  #define ACI_STATS_TX_TIME_SIZE  (ACI_TX_QUEUE_SIZE)
+#endif
+#endif
+
+ACI_QUEUE_ASSERT(aci_tx_q, ACI_TX_QUEUE_SIZE, ACI_TX_QUEUE_SLOT_SIZE);
+ACI_QUEUE_ASSERT(aci_rx_q, ACI_RX_QUEUE_SIZE, ACI_RX_QUEUE_SLOT_SIZE);
 
-static uint8_t        spi_readwrite(uint8_t aci_byte);
+/* State of the transport driving one nRF8001 */
+struct hal_aci_tl_t
+{
+  aci_pins_t              *a_pins;          /* Pins and USART, NULL while the instance is unused */
+  void                   (*isr)(void);      /* RDYN interrupt handler of this instance */
+  bool                     debug_print;
+
+  /* REQN and RDYN, on the EFM32 their bit-band aliases so the handshake is a single store or load */
+  efm_pin_ref_t            reqn_ref;
+  efm_pin_ref_t            rdyn_ref;
+
+  aci_queue_t              tx_q;
+  aci_queue_t              rx_q;
+  uint8_t                  tx_q_storage[ACI_QUEUE_STORAGE_SIZE(ACI_TX_QUEUE_SIZE, ACI_TX_QUEUE_SLOT_SIZE)];
+  uint8_t                  rx_q_storage[ACI_QUEUE_STORAGE_SIZE(ACI_RX_QUEUE_SIZE, ACI_RX_QUEUE_SLOT_SIZE)];
+
+  /* The transfer runs directly from the head slot of the command queue into the tail slot of the
+     event queue. The slots are released and committed when the transfer is complete. */
+  hal_aci_data_t          *spi_tx_slot;
+  hal_aci_data_t          *spi_rx_slot;
+  volatile bool            spi_busy;
+  volatile uint32_t        transaction_count;
+
+  /* Command queue slot a command is being encoded in, NULL when none is. Commands are composed
+     one at a time, a command from an interrupt handler while the main context composes another
+     is refused rather than given the same slot. */
+  hal_aci_data_t * volatile tx_reserved_slot;
+  uint8_t                  tx_reserved_length;
+
+  /* Set by the interrupt context when the event queue reaches the high watermark. RDYN is not
+     honoured until the main context has drained the queue to the low watermark, and the nRF8001
+     holds its events meanwhile. The queues are lock free, so the main context cannot rely on
+     seeing the queue full itself. */
+  volatile bool            rx_throttled;
+  volatile uint16_t        rx_throttle_count;
+
+#if defined(HAL_ACI_TL_STATS)
+  hal_aci_tl_stats_t       stats;
+
+  /* Time each queued command was queued, in the order of the command queue */
+  uint32_t                 stats_tx_time[ACI_STATS_TX_TIME_SIZE];
+  volatile uint16_t        stats_tx_time_head;
+  volatile uint16_t        stats_tx_time_tail;
+#endif
+};
+
+static void m_aci_data_print(hal_aci_tl_t *p_tl, bool event, const hal_aci_data_t *p_data);
+static bool m_aci_event_check(hal_aci_tl_t *p_tl);
+static void m_aci_isr(hal_aci_tl_t *p_tl);
+static inline void m_aci_reqn_disable (hal_aci_tl_t *p_tl);
+static inline void m_aci_reqn_enable (hal_aci_tl_t *p_tl);
+static inline uint8_t m_aci_rdyn_read (hal_aci_tl_t *p_tl);
+static void m_aci_q_flush(hal_aci_tl_t *p_tl);
+static void m_aci_spi_transfer(hal_aci_tl_t *p_tl, const hal_aci_data_t * data_to_send, hal_aci_data_t * received_data);
+static void m_aci_spi_transfer_done(void *p_context);
+static uint32_t m_aci_spi_baudrate_calc(uint8_t divider);
+static void m_aci_rx_throttle(hal_aci_tl_t *p_tl);
+static void m_aci_rx_resume_check(hal_aci_tl_t *p_tl);
+
+static uint8_t        spi_readwrite(hal_aci_tl_t *p_tl, uint8_t aci_byte);
+
+static hal_aci_tl_t          aci_tl_instances[HAL_ACI_TL_INSTANCES];
+static const hal_aci_data_t  aci_spi_empty_cmd = { 0, { 0 } };
+
+/* attachInterrupt() handlers take no argument, so each instance has its own */
+static void m_aci_isr_0(void)
+{
+  m_aci_isr(&aci_tl_instances[0]);
+}
 
-static bool           aci_debug_print = false;
+#if (HAL_ACI_TL_INSTANCES > 1)
+static void m_aci_isr_1(void)
+{
+  m_aci_isr(&aci_tl_instances[1]);
+}
+#endif
+
+#if (HAL_ACI_TL_INSTANCES > 2)
+static void m_aci_isr_2(void)
+{
+  m_aci_isr(&aci_tl_instances[2]);
+}
+#endif
+
+static void (* const aci_isr_table[HAL_ACI_TL_INSTANCES])(void) =
+{
+  m_aci_isr_0,
+#if (HAL_ACI_TL_INSTANCES > 1)
+  m_aci_isr_1,
+#endif
+#if (HAL_ACI_TL_INSTANCES > 2)
+  m_aci_isr_2,
+#endif
+};
+
+#if defined(HAL_ACI_TL_STATS)
+static uint16_t m_aci_stats_high_water(uint16_t high_water, aci_queue_t *aci_q);
+static void m_aci_stats_tx_queued(hal_aci_tl_t *p_tl);
+static void m_aci_stats_tx_started(hal_aci_tl_t *p_tl);
+static void m_aci_stats_transaction(hal_aci_tl_t *p_tl, bool tx, bool rx);
+
+#define ACI_STATS_INC(p_tl, field)                  ((p_tl)->stats.field++)
+#define ACI_STATS_HIGH_WATER(p_tl, field, aci_q)    ((p_tl)->stats.field = m_aci_stats_high_water((p_tl)->stats.field, (aci_q)))
+#define ACI_STATS_TX_QUEUED(p_tl)                   m_aci_stats_tx_queued(p_tl)
+#define ACI_STATS_TX_STARTED(p_tl)                  m_aci_stats_tx_started(p_tl)
+#define ACI_STATS_TX_FLUSHED(p_tl)                  ((p_tl)->stats_tx_time_head = (p_tl)->stats_tx_time_tail)
+#define ACI_STATS_TRANSACTION(p_tl, tx, rx)         m_aci_stats_transaction((p_tl), (tx), (rx))
+#else
+#define ACI_STATS_INC(p_tl, field)
+#define ACI_STATS_HIGH_WATER(p_tl, field, aci_q)
+#define ACI_STATS_TX_QUEUED(p_tl)
+#define ACI_STATS_TX_STARTED(p_tl)
+#define ACI_STATS_TX_FLUSHED(p_tl)
+#define ACI_STATS_TRANSACTION(p_tl, tx, rx)
+#endif
 
-aci_queue_t    aci_tx_q;
-aci_queue_t    aci_rx_q;
+#if defined(ACI_TRACE)
+/*
+  Writes the packet as one trace record to ITM port ACI_TRACE_ITM_PORT, see hal_aci_tl_debug_print().
+  The ITM stalls only while its FIFO is full, a byte per character of printf() stalled on every byte.
+*/
+static void m_aci_data_print(hal_aci_tl_t *p_tl, bool event, const hal_aci_data_t *p_data)
+{
+  const uint8_t length = (p_data->buffer[0] > HAL_ACI_MAX_LENGTH) ? HAL_ACI_MAX_LENGTH : p_data->buffer[0];
+  const uint8_t flags  = (uint8_t)(((p_tl - &aci_tl_instances[0]) << 4) | (event ? ACI_TRACE_FLAG_EVENT : 0));
+  uint32_t word = 0;
+  uint8_t i;
 
-static aci_pins_t	 *a_pins_local_ptr;
+  efm_itm_write32(ACI_TRACE_ITM_PORT, ACI_TRACE_MARKER | ((uint32_t)flags << 8) | ((uint32_t)length << 16) |
+                                      ((uint32_t)(event ? p_data->status_byte : 0) << 24));
+  efm_itm_write32(ACI_TRACE_ITM_PORT, efm_lf_ticks_get());
 
-void m_aci_data_print(hal_aci_data_t *p_data)
+  for (i = 0; i < length; i++)
+  {
+    word |= (uint32_t)p_data->buffer[i + 1] << (8 * (i & 3));
+    if (3 == (i & 3))
+    {
+      efm_itm_write32(ACI_TRACE_ITM_PORT, word);
+      word = 0;
+    }
+  }
+  if (0 != (length & 3))
+  {
+    efm_itm_write32(ACI_TRACE_ITM_PORT, word);
+  }
+}
+#else
+static void m_aci_data_print(hal_aci_tl_t *p_tl, bool event, const hal_aci_data_t *p_data)
 {
   const uint8_t length = p_data->buffer[0];
   uint8_t i;
+  printf(event ? "E" : "C");
   printf("%d", length);
   printf(" :");
   for (i=0; i<=length; i++)
@@ -76,163 +220,196 @@ void m_aci_data_print(hal_aci_data_t *p_data)
   }
   printf("\n");
 }
+#endif
 
 /*
-  Interrupt service routine called when the RDYN line goes low. Runs the SPI transfer.
+  Interrupt service routine called when the RDYN line goes low. Starts the SPI transfer.
 */
-static void m_aci_isr(void)
+static void m_aci_isr(hal_aci_tl_t *p_tl)
 {
-  hal_aci_data_t data_to_send;
-  hal_aci_data_t received_data;
-
-  // Receive from queue
-  if (!aci_queue_dequeue_from_isr(&aci_tx_q, &data_to_send))
+  // A transaction is already running, it is completed by m_aci_spi_transfer_done()
+  if (p_tl->spi_busy)
   {
-    /* queue was empty, nothing to send */
-    data_to_send.status_byte = 0;
-    data_to_send.buffer[0] = 0;
+    return;
   }
 
-  // Receive and/or transmit data
-  m_aci_spi_transfer(&data_to_send, &received_data);
-
-  if (!aci_queue_is_full_from_isr(&aci_rx_q) && !aci_queue_is_empty_from_isr(&aci_tx_q))
+  // Stale edge, the nRF8001 is not ready for a transaction
+  if (HIGH == m_aci_rdyn_read(p_tl))
   {
-    m_aci_reqn_enable();
+    return;
   }
 
-  // Check if we received data
-  if (received_data.buffer[0] > 0)
+  // Reserve room for the event
+  p_tl->spi_rx_slot = aci_queue_acquire_from_isr(&p_tl->rx_q);
+  if (NULL == p_tl->spi_rx_slot)
   {
-    if (!aci_queue_enqueue_from_isr(&aci_rx_q, &received_data))
-    {
-      /* Receive Buffer full.
-         Should never happen.
-         Spin in a while loop.
-      */
-      while(1);
-    }
+    m_aci_rx_throttle(p_tl);
+    return;
+  }
 
-    // Disable ready line interrupt until we have room to store incoming messages
-    if (aci_queue_is_full_from_isr(&aci_rx_q))
-    {
-      detachInterrupt(a_pins_local_ptr->interrupt_number);
-    }
+  // Send from the queue, NULL when the queue is empty
+  p_tl->spi_tx_slot = aci_queue_peek_slot_from_isr(&p_tl->tx_q);
+  if (NULL != p_tl->spi_tx_slot)
+  {
+    ACI_STATS_TX_STARTED(p_tl);
   }
 
-  return;
+  // Receive and/or transmit data
+  m_aci_spi_transfer(p_tl, (NULL != p_tl->spi_tx_slot) ? p_tl->spi_tx_slot : &aci_spi_empty_cmd, p_tl->spi_rx_slot);
 }
 
 /*
-  Checks the RDYN line and runs the SPI transfer if required.
+  Checks the RDYN line and starts the SPI transfer if required.
+  Returns true if a transfer was started.
 */
-static void m_aci_event_check(void)
+static bool m_aci_event_check(hal_aci_tl_t *p_tl)
 {
-  hal_aci_data_t data_to_send;
-  hal_aci_data_t received_data;
+  // A transaction is already running, it is completed by m_aci_spi_transfer_done()
+  if (p_tl->spi_busy)
+  {
+    return false;
+  }
 
   // No room to store incoming messages
-  if (aci_queue_is_full(&aci_rx_q))
+  if (p_tl->rx_throttled)
   {
-    return;
+    return false;
+  }
+
+  p_tl->spi_rx_slot = aci_queue_acquire(&p_tl->rx_q);
+  if (NULL == p_tl->spi_rx_slot)
+  {
+    return false;
   }
 
   // If the ready line is disabled and we have pending messages outgoing we enable the request line
-  if (HIGH == digitalRead(a_pins_local_ptr->rdyn_pin))
+  if (HIGH == m_aci_rdyn_read(p_tl))
   {
-    if (!aci_queue_is_empty(&aci_tx_q))
+    if (!aci_queue_is_empty(&p_tl->tx_q))
     {
-      m_aci_reqn_enable();
+      m_aci_reqn_enable(p_tl);
     }
 
-    return;
+    return false;
   }
 
-  // Receive from queue
-  if (!aci_queue_dequeue(&aci_tx_q, &data_to_send))
+  // Send from the queue, NULL when the queue is empty
+  p_tl->spi_tx_slot = aci_queue_peek_slot(&p_tl->tx_q);
+  if (NULL != p_tl->spi_tx_slot)
   {
-    /* queue was empty, nothing to send */
-    data_to_send.status_byte = 0;
-    data_to_send.buffer[0] = 0;
+    ACI_STATS_TX_STARTED(p_tl);
   }
 
   // Receive and/or transmit data
-  m_aci_spi_transfer(&data_to_send, &received_data);
-
-  /* If there are messages to transmit, and we can store the reply, we request a new transfer */
-  if (!aci_queue_is_full(&aci_rx_q) && !aci_queue_is_empty(&aci_tx_q))
-  {
-    m_aci_reqn_enable();
-  }
-
-  // Check if we received data
-  if (received_data.buffer[0] > 0)
-  {
-    if (!aci_queue_enqueue(&aci_rx_q, &received_data))
-    {
-      /* Receive Buffer full.
-         Should never happen.
-         Spin in a while loop.
-      */
-      while(1);
-    }
-  }
+  m_aci_spi_transfer(p_tl, (NULL != p_tl->spi_tx_slot) ? p_tl->spi_tx_slot : &aci_spi_empty_cmd, p_tl->spi_rx_slot);
 
-  return;
+  return true;
 }
 
-/** @brief Point the low level library at the ACI pins specified
- *  @details
- *  The ACI pins are specified in the application and a pointer is made available for
- *  the low level library to use
- */
-static void m_aci_pins_set(aci_pins_t *a_pins_ptr)
+static inline void m_aci_reqn_disable (hal_aci_tl_t *p_tl)
 {
-  a_pins_local_ptr = a_pins_ptr;
+  EFM_PIN_REF_WRITE(p_tl->reqn_ref, 1);
 }
 
-static inline void m_aci_reqn_disable (void)
+static inline void m_aci_reqn_enable (hal_aci_tl_t *p_tl)
 {
-  digitalWrite(a_pins_local_ptr->reqn_pin, 1);
+  EFM_PIN_REF_WRITE(p_tl->reqn_ref, 0);
 }
 
-static inline void m_aci_reqn_enable (void)
+static inline uint8_t m_aci_rdyn_read (hal_aci_tl_t *p_tl)
 {
-  digitalWrite(a_pins_local_ptr->reqn_pin, 0);
+  return EFM_PIN_REF_READ(p_tl->rdyn_ref);
 }
 
-static void m_aci_q_flush(void)
+static void m_aci_q_flush(hal_aci_tl_t *p_tl)
 {
+  /* Let a running transaction complete before the queues are reset under it */
+  while (p_tl->spi_busy);
+
   noInterrupts();
   /* re-initialize aci cmd queue and aci event queue to flush them*/
-  aci_queue_init(&aci_tx_q);
-  aci_queue_init(&aci_rx_q);
+  aci_queue_init(&p_tl->tx_q);
+  aci_queue_init(&p_tl->rx_q);
+  /* A command being composed has lost its slot, hal_aci_tl_cmd_commit() refuses it */
+  p_tl->tx_reserved_slot = NULL;
+  ACI_STATS_TX_FLUSHED(p_tl);
   interrupts();
+
+  /* The event queue is empty now, listen to RDYN again */
+  m_aci_rx_resume_check(p_tl);
+}
+
+/*
+  Stops honouring RDYN, called from the interrupt context when the event queue has reached the
+  high watermark. In interrupt mode the RDYN interrupt is detached, in polling mode
+  m_aci_event_check() stops starting transactions.
+*/
+static void m_aci_rx_throttle(hal_aci_tl_t *p_tl)
+{
+  if (!p_tl->rx_throttled)
+  {
+    p_tl->rx_throttled = true;
+    p_tl->rx_throttle_count++;
+    ACI_STATS_INC(p_tl, rx_throttled);
+  }
+
+  if (p_tl->a_pins->interface_is_interrupt)
+  {
+    detachInterrupt(p_tl->a_pins->interrupt_number);
+  }
 }
 
-static bool m_aci_spi_transfer(hal_aci_data_t * data_to_send, hal_aci_data_t * received_data)
+/*
+  Honours RDYN again once the main context has drained the event queue to the low watermark.
+  Nothing else throttles while the transport is throttled, so the flag cannot change under us.
+*/
+static void m_aci_rx_resume_check(hal_aci_tl_t *p_tl)
+{
+  if (!p_tl->rx_throttled ||
+      aci_queue_is_full(&p_tl->rx_q) ||
+      (aci_queue_fill_get(&p_tl->rx_q) > ACI_RX_QUEUE_LOW_WATERMARK))
+  {
+    return;
+  }
+
+  p_tl->rx_throttled = false;
+
+  if (p_tl->a_pins->interface_is_interrupt)
+  {
+    /* Enable RDY line interrupt again. A falling edge while it was detached triggers it immediately */
+    attachInterrupt(p_tl->a_pins->interrupt_number, p_tl->isr, FALLING);
+  }
+}
+
+/*
+  Runs an SPI transaction in two phases. The status byte and the length byte are clocked first,
+  which gives the number of bytes left in the transaction. On the EFM32 the rest of the packet is
+  then clocked by the DMA, and m_aci_spi_transfer_done() is called from the DMA interrupt.
+*/
+static void m_aci_spi_transfer(hal_aci_tl_t *p_tl, const hal_aci_data_t * data_to_send, hal_aci_data_t * received_data)
 {
-  uint8_t byte_cnt;
-  uint8_t byte_sent_cnt;
   uint8_t max_bytes;
+  uint8_t tx_bytes = 0;
 
-  m_aci_reqn_enable();
+  ACI_PROBE_ENTER(ACI_PROBE_SPI_TRANSFER);
+  p_tl->spi_busy = true;
+
+  m_aci_reqn_enable(p_tl);
 
   // Send length, receive header
-  byte_sent_cnt = 0;
-  received_data->status_byte = spi_readwrite(data_to_send->buffer[byte_sent_cnt++]);
+  received_data->status_byte = spi_readwrite(p_tl, data_to_send->buffer[0]);
   // Send first byte, receive length from slave
-  received_data->buffer[0] = spi_readwrite(data_to_send->buffer[byte_sent_cnt++]);
+  received_data->buffer[0] = spi_readwrite(p_tl, data_to_send->buffer[1]);
   if (0 == data_to_send->buffer[0])
   {
     max_bytes = received_data->buffer[0];
   }
   else
   {
-    // Set the maximum to the biggest size. One command byte is already sent
-    max_bytes = (received_data->buffer[0] > (data_to_send->buffer[0] - 1))
-                                          ? received_data->buffer[0]
-                                          : (data_to_send->buffer[0] - 1);
+    // Set the maximum to the biggest size. One command byte is already sent, the rest of the
+    // command is all that is read from the slot, an event that is longer is clocked with zeros
+    tx_bytes  = (uint8_t)(data_to_send->buffer[0] - 1);
+    max_bytes = (received_data->buffer[0] > tx_bytes) ? received_data->buffer[0] : tx_bytes;
   }
 
   if (max_bytes > HAL_ACI_MAX_LENGTH)
@@ -240,55 +417,157 @@ static bool m_aci_spi_transfer(hal_aci_data_t * data_to_send, hal_aci_data_t * r
     max_bytes = HAL_ACI_MAX_LENGTH;
   }
 
-  // Transmit/receive the rest of the packet
-  for (byte_cnt = 0; byte_cnt < max_bytes; byte_cnt++)
+  if (max_bytes > 0)
   {
-    received_data->buffer[byte_cnt+1] =  spi_readwrite(data_to_send->buffer[byte_sent_cnt++]);
+#if defined(__EFM32__)
+    // Transmit/receive the rest of the packet in the background
+    efm_spi_transfer_start(p_tl->a_pins->spi_instance,
+                           (tx_bytes > 0) ? &data_to_send->buffer[2] : NULL,
+                           tx_bytes,
+                           &received_data->buffer[1],
+                           max_bytes,
+                           m_aci_spi_transfer_done,
+                           p_tl);
+    ACI_PROBE_EXIT(ACI_PROBE_SPI_TRANSFER);
+    return;
+#else
+    uint8_t byte_cnt;
+
+    // Transmit/receive the rest of the packet
+    for (byte_cnt = 0; byte_cnt < max_bytes; byte_cnt++)
+    {
+      received_data->buffer[byte_cnt+1] = spi_readwrite(p_tl, (byte_cnt < tx_bytes) ? data_to_send->buffer[byte_cnt+2] : 0);
+    }
+#endif
   }
 
+  ACI_PROBE_EXIT(ACI_PROBE_SPI_TRANSFER);
+  m_aci_spi_transfer_done(p_tl);
+}
+
+/*
+  Completes the transaction started by m_aci_spi_transfer(). Called from the DMA interrupt when
+  the second phase of the transfer ran in the background.
+*/
+static void m_aci_spi_transfer_done(void *p_context)
+{
+  hal_aci_tl_t *p_tl = (hal_aci_tl_t *)p_context;
+
+  ACI_PROBE_ENTER(ACI_PROBE_SPI_TRANSFER_DONE);
+
   // RDYN should follow the REQN line in approx 100ns
-  m_aci_reqn_disable();
+  m_aci_reqn_disable(p_tl);
+
+  p_tl->transaction_count++;
+  ACI_STATS_TRANSACTION(p_tl, NULL != p_tl->spi_tx_slot, p_tl->spi_rx_slot->buffer[0] > 0);
+
+  // The command has been sent
+  if (NULL != p_tl->spi_tx_slot)
+  {
+    aci_queue_release_from_isr(&p_tl->tx_q);
+    p_tl->spi_tx_slot = NULL;
+  }
+
+  // Check if we received data, the slot was reserved before the transfer started
+  if (p_tl->spi_rx_slot->buffer[0] > 0)
+  {
+    // No more than HAL_ACI_MAX_LENGTH bytes were clocked in, a corrupt length byte must not size the event
+    if (p_tl->spi_rx_slot->buffer[0] > HAL_ACI_MAX_LENGTH)
+    {
+      p_tl->spi_rx_slot->buffer[0] = HAL_ACI_MAX_LENGTH;
+    }
+    aci_queue_commit_from_isr(&p_tl->rx_q);
+    ACI_STATS_HIGH_WATER(p_tl, rx_q_high_water, &p_tl->rx_q);
+  }
+  p_tl->spi_rx_slot = NULL;
+
+  p_tl->spi_busy = false;
 
-  return (max_bytes > 0);
+  // Stop honouring RDYN until we have room to store incoming messages
+  if (aci_queue_is_full_from_isr(&p_tl->rx_q) ||
+      (aci_queue_fill_get(&p_tl->rx_q) >= ACI_RX_QUEUE_HIGH_WATERMARK))
+  {
+    m_aci_rx_throttle(p_tl);
+  }
+
+  /* If there are messages to transmit, and we can store the reply, we request a new transfer */
+  if (!p_tl->rx_throttled && !aci_queue_is_empty_from_isr(&p_tl->tx_q))
+  {
+    m_aci_reqn_enable(p_tl);
+  }
+  ACI_PROBE_EXIT(ACI_PROBE_SPI_TRANSFER_DONE);
+}
+
+static uint32_t m_aci_spi_baudrate_calc(uint8_t divider)
+{
+  uint32_t baudrate;
+
+  if (0 == divider)
+  {
+    divider = HAL_ACI_SPI_CLOCK_DIVIDER_DEFAULT;
+  }
+
+  baudrate = efm_spi_clock_source_get() / divider;
+  if (baudrate > HAL_ACI_SPI_MAX_BAUDRATE)
+  {
+    baudrate = HAL_ACI_SPI_MAX_BAUDRATE;
+  }
+
+  return baudrate;
+}
+
+uint32_t hal_aci_tl_spi_clock_divider_set(hal_aci_tl_t *p_tl, uint8_t divider)
+{
+  /* Do not change the clock in the middle of a transaction */
+  while (p_tl->spi_busy);
+
+  p_tl->a_pins->spi_clock_divider = divider;
+  efm_spi_baudrate_set(p_tl->a_pins->spi_instance, m_aci_spi_baudrate_calc(divider));
+
+  return efm_spi_baudrate_get(p_tl->a_pins->spi_instance);
+}
+
+uint32_t hal_aci_tl_spi_baudrate_get(hal_aci_tl_t *p_tl)
+{
+  return efm_spi_baudrate_get(p_tl->a_pins->spi_instance);
 }
 
-void hal_aci_tl_debug_print(bool enable)
+void hal_aci_tl_debug_print(hal_aci_tl_t *p_tl, bool enable)
 {
-	aci_debug_print = enable;
+	p_tl->debug_print = enable;
 }
 
-void hal_aci_tl_pin_reset(void)
+void hal_aci_tl_pin_reset(hal_aci_tl_t *p_tl)
 {
-    if (UNUSED != a_pins_local_ptr->reset_pin)
+    aci_pins_t *a_pins = p_tl->a_pins;
+
+    if (UNUSED != a_pins->reset_pin)
     {
-        pinMode(a_pins_local_ptr->reset_pin, OUTPUT);
+        pinMode(a_pins->reset_pin, OUTPUT);
 
-        if ((REDBEARLAB_SHIELD_V1_1     == a_pins_local_ptr->board_name) ||
-            (REDBEARLAB_SHIELD_V2012_07 == a_pins_local_ptr->board_name))
+        if ((REDBEARLAB_SHIELD_V1_1     == a_pins->board_name) ||
+            (REDBEARLAB_SHIELD_V2012_07 == a_pins->board_name))
         {
             //The reset for the Redbearlab v1.1 and v2012.07 boards are inverted and has a Power On Reset
             //circuit that takes about 100ms to trigger the reset
-            digitalWrite(a_pins_local_ptr->reset_pin, 1);
+            digitalWrite(a_pins->reset_pin, 1);
             delay(100);
-            digitalWrite(a_pins_local_ptr->reset_pin, 0);
+            digitalWrite(a_pins->reset_pin, 0);
         }
         else
         {
-            digitalWrite(a_pins_local_ptr->reset_pin, 1);
-            digitalWrite(a_pins_local_ptr->reset_pin, 0);
-            digitalWrite(a_pins_local_ptr->reset_pin, 1);
+            digitalWrite(a_pins->reset_pin, 1);
+            digitalWrite(a_pins->reset_pin, 0);
+            digitalWrite(a_pins->reset_pin, 1);
         }
     }
 }
 
-bool hal_aci_tl_event_peek(hal_aci_data_t *p_aci_data)
+bool hal_aci_tl_event_peek(hal_aci_tl_t *p_tl, hal_aci_data_t *p_aci_data)
 {
-  if (!a_pins_local_ptr->interface_is_interrupt)
-  {
-    m_aci_event_check();
-  }
+  hal_aci_tl_pump(p_tl, HAL_ACI_TL_PUMP_LIMIT);
 
-  if (aci_queue_peek(&aci_rx_q, p_aci_data))
+  if (aci_queue_peek(&p_tl->rx_q, p_aci_data))
   {
     return true;
   }
@@ -296,77 +575,130 @@ bool hal_aci_tl_event_peek(hal_aci_data_t *p_aci_data)
   return false;
 }
 
-bool hal_aci_tl_event_get(hal_aci_data_t *p_aci_data)
+hal_aci_data_t * hal_aci_tl_event_peek_slot(hal_aci_tl_t *p_tl)
 {
-  bool was_full;
+  hal_aci_tl_pump(p_tl, HAL_ACI_TL_PUMP_LIMIT);
+
+  return aci_queue_peek_slot(&p_tl->rx_q);
+}
 
-  if (!a_pins_local_ptr->interface_is_interrupt && !aci_queue_is_full(&aci_rx_q))
+void hal_aci_tl_event_release(hal_aci_tl_t *p_tl)
+{
+  hal_aci_data_t *p_aci_data;
+
+  p_aci_data = aci_queue_peek_slot(&p_tl->rx_q);
+  if (NULL == p_aci_data)
   {
-    m_aci_event_check();
+    return;
   }
 
-  was_full = aci_queue_is_full(&aci_rx_q);
+  // An event can be peeked any number of times, it is printed once when it is consumed
+  if (p_tl->debug_print)
+  {
+    m_aci_data_print(p_tl, true, p_aci_data);
+  }
 
-  if (aci_queue_dequeue(&aci_rx_q, p_aci_data))
+  aci_queue_release(&p_tl->rx_q);
+
+  /* Checked after the release, so a throttle racing with it is either seen here or on the next release */
+  m_aci_rx_resume_check(p_tl);
+
+  /* Attempt to pull REQN LOW since we've made room for new messages */
+  if (!p_tl->rx_throttled && !aci_queue_is_empty(&p_tl->tx_q))
   {
-    if (aci_debug_print)
-    {
-      printf("E");
-      m_aci_data_print(p_aci_data);
-    }
+    m_aci_reqn_enable(p_tl);
+  }
+}
 
-    if (was_full && a_pins_local_ptr->interface_is_interrupt)
-	  {
-      /* Enable RDY line interrupt again */
-      attachInterrupt(a_pins_local_ptr->interrupt_number, m_aci_isr, LOW);
-    }
+bool hal_aci_tl_event_get(hal_aci_tl_t *p_tl, hal_aci_data_t *p_aci_data)
+{
+  hal_aci_data_t *p_slot;
+
+  p_slot = hal_aci_tl_event_peek_slot(p_tl);
+  if (NULL == p_slot)
+  {
+    return false;
+  }
 
-    /* Attempt to pull REQN LOW since we've made room for new messages */
-    if (!aci_queue_is_full(&aci_rx_q) && !aci_queue_is_empty(&aci_tx_q))
+  memcpy(p_aci_data, p_slot, sizeof(hal_aci_data_t));
+  hal_aci_tl_event_release(p_tl);
+
+  return true;
+}
+
+hal_aci_tl_t * hal_aci_tl_init(aci_pins_t *a_pins, bool debug)
+{
+  hal_aci_tl_t *p_tl = NULL;
+  uint8_t i;
+
+  ble_assert(a_pins->spi_instance < EFM_SPI_COUNT);
+
+  ACI_PROBE_INIT();
+
+  /* Reuse the instance of the USART, otherwise take a free one */
+  for (i = 0; i < HAL_ACI_TL_INSTANCES; i++)
+  {
+    if ((NULL != aci_tl_instances[i].a_pins) &&
+        (aci_tl_instances[i].a_pins->spi_instance == a_pins->spi_instance))
     {
-      m_aci_reqn_enable();
+      p_tl = &aci_tl_instances[i];
+      break;
     }
+  }
 
-    return true;
+  for (i = 0; (NULL == p_tl) && (i < HAL_ACI_TL_INSTANCES); i++)
+  {
+    if (NULL == aci_tl_instances[i].a_pins)
+    {
+      p_tl = &aci_tl_instances[i];
+    }
   }
 
-  return false;
-}
+  if (NULL == p_tl)
+  {
+    return NULL;
+  }
 
-void hal_aci_tl_init(aci_pins_t *a_pins, bool debug)
-{
-  aci_debug_print = debug;
+  /* Stop listening to RDYN while the instance is set up again */
+  if ((NULL != p_tl->a_pins) && p_tl->a_pins->interface_is_interrupt)
+  {
+    detachInterrupt(p_tl->a_pins->interrupt_number);
+  }
 
   /* Needs to be called as the first thing for proper intialization*/
-  m_aci_pins_set(a_pins);
-
-  /* Setup and init SPI*/
-  pinMode(a_pins->miso_pin, INPUT);
-  pinMode(a_pins->mosi_pin, OUTPUT);
-  pinMode(a_pins->sck_pin, OUTPUT);
-  
-  USART_InitSync_TypeDef initSync = {
-    .enable = usartEnable,          //enable RX and TX
-    .refFreq = 0,                   //use currently configured clock
-    .baudrate = 9600,
-    .databits = usartDatabits8,
-    .master = 1,
-    .msbf = 0,
-    .clockMode = usartClockMode0,   //clock idle low, sample on rising edge
-    .prsRxEnable = 0,
-    .prsRxCh = usartPrsRxCh0,
-    .autoTx = 0
-  };
-  
-  USART_InitSync(USART1, &initSync);
-  USART1->ROUTE |= USART_ROUTE_LOCATION_LOC1 | 
-                   USART_ROUTE_RXPEN | 
-                   USART_ROUTE_TXPEN | 
-                   USART_ROUTE_CLKPEN;
+  p_tl->a_pins            = a_pins;
+  p_tl->isr               = aci_isr_table[p_tl - &aci_tl_instances[0]];
+  p_tl->debug_print       = debug;
+  p_tl->reqn_ref          = EFM_PIN_OUT_REF(a_pins->reqn_pin);
+  p_tl->rdyn_ref          = EFM_PIN_IN_REF(a_pins->rdyn_pin);
+  p_tl->spi_tx_slot       = NULL;
+  p_tl->spi_rx_slot       = NULL;
+  p_tl->spi_busy          = false;
+  p_tl->transaction_count = 0;
+  p_tl->tx_reserved_slot  = NULL;
+  p_tl->rx_throttled      = false;
+  p_tl->rx_throttle_count = 0;
+
+  /* Setup and init SPI, the MOSI, MISO and SCK pins follow the USART location */
+  efm_spi_init(a_pins->spi_instance, a_pins->spi_location, m_aci_spi_baudrate_calc(a_pins->spi_clock_divider));
+
+  /* Timebase for the energy mode statistics of lib_aci_idle() and the packet trace */
+  efm_lf_timer_init();
+#if defined(ACI_TRACE)
+  efm_itm_port_enable(ACI_TRACE_ITM_PORT);
+#endif
 
   /* Initialize the ACI Command queue. This must be called after the delay above. */
-  aci_queue_init(&aci_tx_q);
-  aci_queue_init(&aci_rx_q);
+  aci_queue_storage_set(&p_tl->tx_q, &p_tl->tx_q_storage[0], ACI_TX_QUEUE_SIZE, ACI_TX_QUEUE_SLOT_SIZE);
+  aci_queue_storage_set(&p_tl->rx_q, &p_tl->rx_q_storage[0], ACI_RX_QUEUE_SIZE, ACI_RX_QUEUE_SLOT_SIZE);
+  aci_queue_init(&p_tl->tx_q);
+  aci_queue_init(&p_tl->rx_q);
+
+#if defined(HAL_ACI_TL_STATS)
+  memset(&p_tl->stats, 0, sizeof(hal_aci_tl_stats_t));
+  p_tl->stats_tx_time_head = 0;
+  p_tl->stats_tx_time_tail = 0;
+#endif
 
   //Configure the IO lines
   pinMode(a_pins->rdyn_pin,		INPUT_PULLUP);
@@ -377,54 +709,113 @@ void hal_aci_tl_init(aci_pins_t *a_pins, bool debug)
     pinMode(a_pins->active_pin,	INPUT);
   }
   /* Pin reset the nRF8001, required when the nRF8001 setup is being changed */
-  hal_aci_tl_pin_reset();
+  hal_aci_tl_pin_reset(p_tl);
 
-  /* Set the nRF8001 to a known state as required by the datasheet*/
-  digitalWrite(a_pins->miso_pin, 0);
-  digitalWrite(a_pins->mosi_pin, 0);
+  /* Set the nRF8001 to a known state as required by the datasheet, efm_spi_init() has set MOSI and SCK low */
   digitalWrite(a_pins->reqn_pin, 1);
-  digitalWrite(a_pins->sck_pin,  0);
 
   delay(30); //Wait for the nRF8001 to get hold of its lines - the lines float for a few ms after the reset
 
   /* Attach the interrupt to the RDYN line as requested by the caller */
   if (a_pins->interface_is_interrupt)
   {
-    // We use the LOW level of the RDYN line as the atmega328 can wakeup from sleep only on LOW
-    attachInterrupt(a_pins->interrupt_number, m_aci_isr, LOW);
+    // The EFM32 wakes up on edges from all energy modes. A level interrupt would retrigger for
+    // as long as RDYN is held low during the DMA transfer.
+    attachInterrupt(a_pins->interrupt_number, p_tl->isr, FALLING);
+  }
+
+  return p_tl;
+}
+
+hal_aci_data_t * hal_aci_tl_cmd_reserve(hal_aci_tl_t *p_tl, uint8_t length)
+{
+  hal_aci_data_t *p_slot = NULL;
+
+  if ((0 == length) || (length > HAL_ACI_MAX_LENGTH) || ((length + 2) > ACI_TX_QUEUE_SLOT_SIZE))
+  {
+    ACI_STATS_INC(p_tl, send_rejected);
+    return NULL;
   }
+
+  // The reservation makes its holder the only producer of the command queue until it ends, only
+  // claiming it needs the interrupts masked
+  noInterrupts();
+  if (NULL == p_tl->tx_reserved_slot)
+  {
+    p_slot = aci_queue_acquire(&p_tl->tx_q);
+    p_tl->tx_reserved_slot   = p_slot;
+    p_tl->tx_reserved_length = length;
+  }
+  interrupts();
+
+  if (NULL == p_slot)
+  {
+    ACI_STATS_INC(p_tl, send_rejected);
+  }
+
+  return p_slot;
 }
 
-bool hal_aci_tl_send(hal_aci_data_t *p_aci_cmd)
+bool hal_aci_tl_cmd_commit(hal_aci_tl_t *p_tl)
 {
-  const uint8_t length = p_aci_cmd->buffer[0];
-  bool ret_val = false;
+  hal_aci_data_t *p_slot = p_tl->tx_reserved_slot;
 
-  if (length > HAL_ACI_MAX_LENGTH)
+  if (NULL == p_slot)
   {
     return false;
   }
 
-  ret_val = aci_queue_enqueue(&aci_tx_q, p_aci_cmd);
-  if (ret_val)
+  // The encoder wrote past the reserved length, or nothing at all
+  if ((0 == p_slot->buffer[0]) || (p_slot->buffer[0] > p_tl->tx_reserved_length))
   {
-    if(!aci_queue_is_full(&aci_rx_q))
-    {
-      // Lower the REQN only when successfully enqueued
-      m_aci_reqn_enable();
-    }
+    ACI_STATS_INC(p_tl, send_rejected);
+    hal_aci_tl_cmd_cancel(p_tl);
+    return false;
+  }
 
-    if (aci_debug_print)
-    {
-      printf("C"); //ACI Command
-      m_aci_data_print(p_aci_cmd);
-    }
+  p_slot->status_byte = 0;
+  aci_queue_commit(&p_tl->tx_q);
+  ACI_STATS_TX_QUEUED(p_tl);
+  ACI_STATS_HIGH_WATER(p_tl, tx_q_high_water, &p_tl->tx_q);
+
+  if (!p_tl->rx_throttled)
+  {
+    // Lower the REQN only when successfully enqueued
+    m_aci_reqn_enable(p_tl);
+  }
+
+  // The slot is not handed out again before the reservation ends, so it can still be printed
+  if (p_tl->debug_print)
+  {
+    m_aci_data_print(p_tl, false, p_slot);
   }
 
-  return ret_val;
+  p_tl->tx_reserved_slot = NULL;
+
+  return true;
+}
+
+void hal_aci_tl_cmd_cancel(hal_aci_tl_t *p_tl)
+{
+  p_tl->tx_reserved_slot = NULL;
 }
 
-static uint8_t spi_readwrite(const uint8_t aci_byte)
+bool hal_aci_tl_send(hal_aci_tl_t *p_tl, hal_aci_data_t *p_aci_cmd)
+{
+  const uint8_t   length = p_aci_cmd->buffer[0];
+  hal_aci_data_t *p_slot = hal_aci_tl_cmd_reserve(p_tl, length);
+
+  if (NULL == p_slot)
+  {
+    return false;
+  }
+
+  memcpy(&p_slot->buffer[0], &p_aci_cmd->buffer[0], length + 1);
+
+  return hal_aci_tl_cmd_commit(p_tl);
+}
+
+static uint8_t spi_readwrite(hal_aci_tl_t *p_tl, const uint8_t aci_byte)
 {
 	//Board dependent defines
 #if defined (__AVR__)
@@ -436,31 +827,177 @@ static uint8_t spi_readwrite(const uint8_t aci_byte)
     tmp_bits = SPI.transfer(REVERSE_BITS(aci_byte));
 	return REVERSE_BITS(tmp_bits);
 #elif defined(__EFM32__)
-    return efm_spi_readwrite(aci_byte);
+    return efm_spi_readwrite(p_tl->a_pins->spi_instance, aci_byte);
 #endif
 }
 
-bool hal_aci_tl_rx_q_empty (void)
+bool hal_aci_tl_rx_q_empty (hal_aci_tl_t *p_tl)
+{
+  return aci_queue_is_empty(&p_tl->rx_q);
+}
+
+bool hal_aci_tl_rx_q_full (hal_aci_tl_t *p_tl)
+{
+  return aci_queue_is_full(&p_tl->rx_q);
+}
+
+bool hal_aci_tl_tx_q_empty (hal_aci_tl_t *p_tl)
+{
+  return aci_queue_is_empty(&p_tl->tx_q);
+}
+
+bool hal_aci_tl_tx_q_full (hal_aci_tl_t *p_tl)
+{
+  return aci_queue_is_full(&p_tl->tx_q);
+}
+
+uint16_t hal_aci_tl_rx_throttle_count_get(hal_aci_tl_t *p_tl)
+{
+  return p_tl->rx_throttle_count;
+}
+
+bool hal_aci_tl_spi_busy (hal_aci_tl_t *p_tl)
+{
+  return p_tl->spi_busy;
+}
+
+void hal_aci_tl_q_flush (hal_aci_tl_t *p_tl)
+{
+  m_aci_q_flush(p_tl);
+}
+
+uint8_t hal_aci_tl_pump(hal_aci_tl_t *p_tl, uint8_t max_transactions)
+{
+  uint8_t count = 0;
+
+  // The RDYN interrupt starts the transactions, running them here as well would race with it
+  if (p_tl->a_pins->interface_is_interrupt)
+  {
+    return 0;
+  }
+
+  while ((count < max_transactions) && m_aci_event_check(p_tl))
+  {
+    // The rest of the packet is clocked by the DMA, the next transaction needs the line free
+    while (p_tl->spi_busy);
+    count++;
+  }
+
+  return count;
+}
+
+uint32_t hal_aci_tl_transaction_count_get(hal_aci_tl_t *p_tl)
+{
+  return p_tl->transaction_count;
+}
+
+bool hal_aci_tl_event_inject(hal_aci_tl_t *p_tl, hal_aci_data_t *p_aci_data)
+{
+  return aci_queue_enqueue(&p_tl->rx_q, p_aci_data);
+}
+
+hal_aci_tl_t * hal_aci_tl_instance_get(uint8_t index)
+{
+  if ((index >= HAL_ACI_TL_INSTANCES) || (NULL == aci_tl_instances[index].a_pins))
+  {
+    return NULL;
+  }
+
+  return &aci_tl_instances[index];
+}
+
+bool hal_aci_tl_is_interrupt(hal_aci_tl_t *p_tl)
 {
-  return aci_queue_is_empty(&aci_rx_q);
+  return p_tl->a_pins->interface_is_interrupt;
 }
 
-bool hal_aci_tl_rx_q_full (void)
+#if defined(HAL_ACI_TL_STATS)
+static uint16_t m_aci_stats_high_water(uint16_t high_water, aci_queue_t *aci_q)
 {
-  return aci_queue_is_full(&aci_rx_q);
+  const uint16_t fill = aci_queue_fill_get(aci_q);
+
+  return (fill > high_water) ? fill : high_water;
+}
+
+/* Called from the main context when a command has been queued, the producer of the time stamps */
+static void m_aci_stats_tx_queued(hal_aci_tl_t *p_tl)
+{
+  const uint16_t tail = p_tl->stats_tx_time_tail;
+
+  p_tl->stats_tx_time[tail % ACI_STATS_TX_TIME_SIZE] = efm_lf_ticks_get();
+  p_tl->stats_tx_time_tail = tail + 1;
+}
+
+/* Called when the transfer of the oldest queued command starts, the consumer of the time stamps */
+static void m_aci_stats_tx_started(hal_aci_tl_t *p_tl)
+{
+  const uint16_t head = p_tl->stats_tx_time_head;
+  uint32_t wait;
+  uint8_t  bin = 0;
+
+  if (head == p_tl->stats_tx_time_tail)
+  {
+    return;
+  }
+
+  wait = efm_lf_ticks_get() - p_tl->stats_tx_time[head % ACI_STATS_TX_TIME_SIZE];
+  p_tl->stats_tx_time_head = head + 1;
+
+  while ((0 != wait) && (bin < (HAL_ACI_TL_STATS_WAIT_BINS - 1)))
+  {
+    wait >>= 1;
+    bin++;
+  }
+
+  if (0xFFFF != p_tl->stats.tx_wait[bin])
+  {
+    p_tl->stats.tx_wait[bin]++;
+  }
 }
 
-bool hal_aci_tl_tx_q_empty (void)
+static void m_aci_stats_transaction(hal_aci_tl_t *p_tl, bool tx, bool rx)
 {
-  return aci_queue_is_empty(&aci_tx_q);
+  p_tl->stats.transactions++;
+
+  if (tx && rx)
+  {
+    p_tl->stats.transactions_tx_rx++;
+  }
+  else if (tx)
+  {
+    p_tl->stats.transactions_tx++;
+  }
+  else if (rx)
+  {
+    p_tl->stats.transactions_rx++;
+  }
 }
 
-bool hal_aci_tl_tx_q_full (void)
+void hal_aci_tl_stats_get(hal_aci_tl_t *p_tl, hal_aci_tl_stats_t *p_stats)
 {
-  return aci_queue_is_full(&aci_tx_q);
+  noInterrupts();
+  memcpy(p_stats, &p_tl->stats, sizeof(hal_aci_tl_stats_t));
+  interrupts();
 }
 
-void hal_aci_tl_q_flush (void)
+void hal_aci_tl_stats_clear(hal_aci_tl_t *p_tl)
 {
-  m_aci_q_flush();
+  noInterrupts();
+  memset(&p_tl->stats, 0, sizeof(hal_aci_tl_stats_t));
+  interrupts();
 }
+
+uint8_t hal_aci_tl_stats_dump(hal_aci_tl_t *p_tl, uint8_t *p_buffer, uint8_t size)
+{
+  if (size < (sizeof(hal_aci_tl_stats_t) + 2))
+  {
+    return 0;
+  }
+
+  p_buffer[0] = HAL_ACI_TL_STATS_DUMP_VERSION;
+  p_buffer[1] = sizeof(hal_aci_tl_stats_t);
+  hal_aci_tl_stats_get(p_tl, (hal_aci_tl_stats_t *)&p_buffer[2]);
+
+  return sizeof(hal_aci_tl_stats_t) + 2;
+}
+#endif
@@ -32,11 +32,19 @@
  The hal_aci_tl_send_cmd() can be called directly to send ACI commands.
 
 
-The RDYN line is hooked to an interrupt on the MCU when the level is low.
+The RDYN line is hooked to an interrupt on the MCU on the falling edge.
 The SPI master clocks in the interrupt context.
 The ACI Command is taken from the head of the command queue is sent over the SPI
 and the received ACI event is placed in the tail of the event queue.
 
+On the EFM32 only the status byte and the length byte are clocked by the CPU. The rest of
+the transaction is clocked by the DMA and completed from the DMA interrupt, so the CPU is
+free or can sleep in EM1 while the packet is transferred.
+
+Each nRF8001 is driven by its own transport instance, returned by hal_aci_tl_init(). An
+instance owns its queues, its pins and its USART. Up to HAL_ACI_TL_INSTANCES nRF8001s can
+be connected, one per USART. All other functions take the instance as p_tl.
+
 */
  
 #ifndef HAL_ACI_TL_H__
@@ -55,6 +63,17 @@ and the received ACI event is placed in the tail of the event queue.
 /************************************************************************/
 #define UNUSED		    255
 
+/************************************************************************/
+/* ACI SPI clock                                                        */
+/************************************************************************/
+/** Maximum SPI clock supported by the nRF8001 */
+#define HAL_ACI_SPI_MAX_BAUDRATE           3000000UL
+
+/** Divider of the peripheral clock used when aci_pins_t.spi_clock_divider is 0 */
+#ifndef HAL_ACI_SPI_CLOCK_DIVIDER_DEFAULT
+#define HAL_ACI_SPI_CLOCK_DIVIDER_DEFAULT  16
+#endif
+
 /** Data type for ACI commands and events */
 typedef struct {
   uint8_t status_byte;
@@ -63,7 +82,8 @@ typedef struct {
 
 ACI_ASSERT_SIZE(hal_aci_data_t, HAL_ACI_MAX_LENGTH + 2);
 
-/** Datatype for ACI pins and interface (polling/interrupt)*/
+/** Datatype for ACI pins and interface (polling/interrupt)
+ *  On the EFM32 the pins are on any GPIO port as EFM_PIN(port, pin), plain pin numbers are on port D */
 typedef struct aci_pins_t
 {
 	uint8_t board_name;             //Optional : Use BOARD_DEFAULT if you do not know. See boards.h
@@ -74,6 +94,7 @@ typedef struct aci_pins_t
 	uint8_t	sck_pin;				//Required
 	
 	uint8_t spi_clock_divider;      //Required : Clock divider on the SPI clock : nRF8001 supports a maximum clock of 3MHz
+	                                //           The SPI clock is the peripheral clock divided by this value, 0 selects HAL_ACI_SPI_CLOCK_DIVIDER_DEFAULT
 	
 	uint8_t	reset_pin;				//Recommended but optional - Set it to UNUSED when not connected
 	uint8_t active_pin;				//Optional - Set it to UNUSED when not connected
@@ -81,17 +102,62 @@ typedef struct aci_pins_t
 	
 	bool	interface_is_interrupt;	//Required - true = Uses interrupt on RDYN pin. false - Uses polling on RDYN pin
 	
-	uint8_t	interrupt_number;		//Required when using interrupts, otherwise ignored
+	uint8_t	interrupt_number;		//Required when using interrupts, otherwise ignored. On the EFM32 this is the RDYN pin
+
+	uint8_t spi_instance;           //Required on the EFM32 : USART number (0, 1 or 2) used as the SPI master
+	uint8_t spi_location;           //Required on the EFM32 : USART ROUTE location, the MOSI, MISO and SCK pins follow from it
 } aci_pins_t;
 
+/************************************************************************/
+/* Transport instances                                                  */
+/************************************************************************/
+/** Number of nRF8001s that can be driven at the same time, at most one per USART */
+#ifndef HAL_ACI_TL_INSTANCES
+#define HAL_ACI_TL_INSTANCES 1
+#endif
+
+#if (HAL_ACI_TL_INSTANCES < 1) || (HAL_ACI_TL_INSTANCES > 3)
+#error "HAL_ACI_TL_INSTANCES must be from 1 to 3"
+#endif
+
+/************************************************************************/
+/* Polling mode                                                         */
+/************************************************************************/
+/** Transactions run back to back by each hal_aci_tl_event_get(), hal_aci_tl_event_peek() and
+    hal_aci_tl_event_peek_slot() in polling mode, see hal_aci_tl_pump() */
+#ifndef HAL_ACI_TL_PUMP_LIMIT
+#define HAL_ACI_TL_PUMP_LIMIT 1
+#endif
+
+#if (HAL_ACI_TL_PUMP_LIMIT < 1) || (HAL_ACI_TL_PUMP_LIMIT > 255)
+#error "HAL_ACI_TL_PUMP_LIMIT must be from 1 to 255"
+#endif
+
+/************************************************************************/
+/* Packet trace                                                         */
+/************************************************************************/
+/** ITM port of the binary packet trace that replaces the debug printing when ACI_TRACE is
+    defined, see hal_aci_tl_debug_print(). printf() uses port 0 and the ACI probes port 1. */
+#ifndef ACI_TRACE_ITM_PORT
+#define ACI_TRACE_ITM_PORT     2
+#endif
+
+#define ACI_TRACE_MARKER       0xACUL  /**< First byte of every trace record */
+#define ACI_TRACE_FLAG_EVENT   0x01    /**< The record is an event, otherwise a command */
+
+/** Transport instance driving one nRF8001, the contents are private to hal_aci_tl */
+typedef struct hal_aci_tl_t hal_aci_tl_t;
+
 /** @brief ACI Transport Layer initialization.
  *  @details
  *  This function initializes the transport layer, including configuring the SPI, creating
  *  message queues for Commands and Events and setting up interrupt if required.
  *  @param a_pins Pins on the MCU used to connect to the nRF8001
  *  @param bool True if debug printing should be enabled on the Serial.
+ *  @return The transport instance for the USART in a_pins, NULL if all instances are in use.
+ *  Initializing the same USART again re-initializes its instance.
  */
-void hal_aci_tl_init(aci_pins_t *a_pins, bool debug);
+hal_aci_tl_t * hal_aci_tl_init(aci_pins_t *a_pins, bool debug);
 
 /** @brief Sends an ACI command to the radio.
  *  @details
@@ -100,9 +166,32 @@ void hal_aci_tl_init(aci_pins_t *a_pins, bool debug);
  *  will send the data.
  *  @param aci_buffer Pointer to the message to send.
  *  @return True if the data was successfully queued for sending, 
- *  false if there is no more space to store messages to send.
+ *  false if there is no more space to store messages to send or the message is longer
+ *  than ACI_TX_QUEUE_SLOT_SIZE.
  */
-bool hal_aci_tl_send(hal_aci_data_t *aci_buffer);
+bool hal_aci_tl_send(hal_aci_tl_t *p_tl, hal_aci_data_t *aci_buffer);
+
+/** @brief Reserves a slot of the command queue to encode an ACI command in place.
+ *  @details
+ *  The command is written to the buffer of the slot, starting with its length byte, and sent
+ *  with @ref hal_aci_tl_cmd_commit() or dropped with @ref hal_aci_tl_cmd_cancel(). One command is
+ *  composed at a time per transport. The reservation is taken with the interrupts masked, so a
+ *  command composed in an interrupt handler meanwhile is refused instead of sharing the slot.
+ *  Flushing the queues ends the reservation.
+ *  @param length Largest length byte the command can have.
+ *  @return The slot, NULL if the queue is full, a command is being composed, or the length does
+ *  not fit HAL_ACI_MAX_LENGTH and ACI_TX_QUEUE_SLOT_SIZE.
+ */
+hal_aci_data_t * hal_aci_tl_cmd_reserve(hal_aci_tl_t *p_tl, uint8_t length);
+
+/** @brief Queues the command encoded in the reserved slot and lowers the request line.
+ *  @return True if the command was queued, false if no slot is reserved or the length byte of
+ *  the command is 0 or larger than the reserved length. The reservation ends either way.
+ */
+bool hal_aci_tl_cmd_commit(hal_aci_tl_t *p_tl);
+
+/** @brief Ends a reservation without sending the command. */
+void hal_aci_tl_cmd_cancel(hal_aci_tl_t *p_tl);
 
 /** @brief Process pending transactions.
  *  @details 
@@ -111,29 +200,55 @@ bool hal_aci_tl_send(hal_aci_data_t *aci_buffer);
  *  that was pending.
  *  @return Points to data buffer for received data. Length byte in buffer is 0 if no data received.
  */
-hal_aci_data_t * hal_aci_tl_poll_get(void);
+hal_aci_data_t * hal_aci_tl_poll_get(hal_aci_tl_t *p_tl);
 
 /** @brief Get an ACI event from the event queue
  *  @details 
  *  Call this function from the main context to get an event from the ACI event queue
  *  This is called by lib_aci_event_get
  */
-bool hal_aci_tl_event_get(hal_aci_data_t *p_aci_data);
+bool hal_aci_tl_event_get(hal_aci_tl_t *p_tl, hal_aci_data_t *p_aci_data);
+
+/** @brief Peek at the oldest ACI event in place
+ *  @details
+ *  Call this function from the main context to access the oldest event without copying it.
+ *  The event stays in the event queue until @ref hal_aci_tl_event_release() is called, the
+ *  pointer is not valid after that.
+ *  @return Pointer to the event in the queue, NULL if there is no pending event.
+ */
+hal_aci_data_t * hal_aci_tl_event_peek_slot(hal_aci_tl_t *p_tl);
+
+/** @brief Release the oldest ACI event
+ *  @details
+ *  Frees the slot returned by @ref hal_aci_tl_event_peek_slot() so the transport can reuse it
+ *  for the next event.
+ */
+void hal_aci_tl_event_release(hal_aci_tl_t *p_tl);
 
 /** @brief Peek an ACI event from the event queue
  *  @details
  *  Call this function from the main context to peek an event from the ACI event queue.
  *  This is called by lib_aci_event_peek
  */
-bool hal_aci_tl_event_peek(hal_aci_data_t *p_aci_data);
+bool hal_aci_tl_event_peek(hal_aci_tl_t *p_tl, hal_aci_data_t *p_aci_data);
 
 /** @brief Enable debug printing of all ACI commands sent and ACI events received
  *  @details
  *  when the enable parameter is true. The debug printing is enabled on the Serial.
  *  When the enable parameter is false. The debug printing is disabled on the Serial.
  *  By default the debug printing is disabled.
+ *
+ *  With ACI_TRACE defined the packets are not printed but traced, one binary record per packet on
+ *  ITM port ACI_TRACE_ITM_PORT, for tools/aci_trace_decode.py. A record is 32-bit words:
+ *  - ACI_TRACE_MARKER in bits 7..0, the flags in bits 15..8 (ACI_TRACE_FLAG_EVENT, the transport
+ *    instance in bits 15..12), the length byte of the packet in bits 23..16 and the status byte of
+ *    an event in bits 31..24
+ *  - the time from efm_lf_ticks_get()
+ *  - the packet bytes after the length byte, four per word starting in the low byte
+ *  The records are written by the main context, by hal_aci_tl_cmd_commit() when a command is queued
+ *  and by hal_aci_tl_event_release() when an event is consumed, so each packet is recorded once.
  */
-void hal_aci_tl_debug_print(bool enable);
+void hal_aci_tl_debug_print(hal_aci_tl_t *p_tl, bool enable);
 
 
 /** @brief Pin reset the nRF8001
@@ -143,37 +258,148 @@ void hal_aci_tl_debug_print(bool enable);
  *  have a Power ON Reset circuit that works differently.
  *  The function handles the exceptions based on the board_name in aci_pins_t
  */
-void hal_aci_tl_pin_reset(void);
+void hal_aci_tl_pin_reset(hal_aci_tl_t *p_tl);
+
+/** @brief Set the ACI SPI clock from a divider of the peripheral clock
+ *  @details
+ *  The resulting clock is limited to @ref HAL_ACI_SPI_MAX_BAUDRATE. A running transaction is
+ *  completed before the clock is changed.
+ *  @param divider Divider of the peripheral clock, 0 selects HAL_ACI_SPI_CLOCK_DIVIDER_DEFAULT.
+ *  @return The SPI clock in Hz after the change.
+ */
+uint32_t hal_aci_tl_spi_clock_divider_set(hal_aci_tl_t *p_tl, uint8_t divider);
+
+/** @brief Get the current ACI SPI clock
+ *  @return The SPI clock in Hz.
+ */
+uint32_t hal_aci_tl_spi_baudrate_get(hal_aci_tl_t *p_tl);
 
 /** @brief Return full status of transmit queue
  *  @details
  *
  */
- bool hal_aci_tl_rx_q_full(void);
+ bool hal_aci_tl_rx_q_full(hal_aci_tl_t *p_tl);
  
  /** @brief Return empty status of receive queue
  *  @details
  *
  */
- bool hal_aci_tl_rx_q_empty(void);
+ bool hal_aci_tl_rx_q_empty(hal_aci_tl_t *p_tl);
 
 /** @brief Return full status of receive queue
  *  @details
  *
  */
- bool hal_aci_tl_tx_q_full(void);
+ bool hal_aci_tl_tx_q_full(hal_aci_tl_t *p_tl);
  
  /** @brief Return empty status of transmit queue
  *  @details
  *
  */
- bool hal_aci_tl_tx_q_empty(void);
+ bool hal_aci_tl_tx_q_empty(hal_aci_tl_t *p_tl);
+
+/** @brief Return true while an SPI transaction is in progress
+ *  @details
+ *  The second phase of a transaction is clocked by the DMA, which needs the high
+ *  frequency clocks. The MCU must not go deeper than EM1 while this returns true.
+ */
+ bool hal_aci_tl_spi_busy(hal_aci_tl_t *p_tl);
 
 /** @brief Flush the ACI command Queue and the ACI Event Queue
  *  @details
  *  Call this function in the main thread
  */
-void hal_aci_tl_q_flush(void);
+void hal_aci_tl_q_flush(hal_aci_tl_t *p_tl);
+
+/** @brief Number of times the event queue was throttled
+ *  @details
+ *  When the event queue reaches ACI_RX_QUEUE_HIGH_WATERMARK the transport stops honouring RDYN
+ *  and the nRF8001 holds on to its events. It resumes when the application has drained the queue
+ *  to ACI_RX_QUEUE_LOW_WATERMARK. Each such episode is counted.
+ */
+uint16_t hal_aci_tl_rx_throttle_count_get(hal_aci_tl_t *p_tl);
+
+/** @brief Run SPI transactions back to back
+ *  @details
+ *  In polling mode this runs transactions for as long as the nRF8001 holds RDYN low and the
+ *  event queue has room, moving commands out and events in without a trip through the
+ *  application loop. It returns when RDYN goes high, when the event queue is throttled or when
+ *  max_transactions have run. REQN is lowered if commands are left for the nRF8001.
+ *  In interrupt mode the RDYN interrupt chains the transactions and this function does nothing.
+ *  @param max_transactions Most transactions to run in this call.
+ *  @return Number of transactions that were run.
+ */
+uint8_t hal_aci_tl_pump(hal_aci_tl_t *p_tl, uint8_t max_transactions);
+
+/** @brief Number of SPI transactions run since the instance was initialized
+ *  @details Wraps around, take the difference of two readings.
+ */
+uint32_t hal_aci_tl_transaction_count_get(hal_aci_tl_t *p_tl);
+
+/** @brief Put an event in the event queue
+ *  @details
+ *  Used by the library to hand a synthesized event to the application, e.g. a Device Started
+ *  event when the nRF8001 did not need a reset. Call it only while no event can arrive.
+ *  @return True if the event was queued.
+ */
+bool hal_aci_tl_event_inject(hal_aci_tl_t *p_tl, hal_aci_data_t *p_aci_data);
+
+/** @brief Get an initialized transport instance
+ *  @param index Index of the instance, from 0 to HAL_ACI_TL_INSTANCES - 1.
+ *  @return The instance, NULL if it has not been initialized.
+ */
+hal_aci_tl_t * hal_aci_tl_instance_get(uint8_t index);
+
+/** @brief Check if the transport listens to RDYN through the interrupt
+ *  @return True in interrupt mode, false in polling mode.
+ */
+bool hal_aci_tl_is_interrupt(hal_aci_tl_t *p_tl);
+
+#if defined(HAL_ACI_TL_STATS)
+
+/** Number of bins in the histogram of the time commands wait in the command queue */
+#define HAL_ACI_TL_STATS_WAIT_BINS     16
+
+/** Version of the layout of @ref hal_aci_tl_stats_t in the binary dump */
+#define HAL_ACI_TL_STATS_DUMP_VERSION  1
+
+/** Transport statistics, enabled by defining HAL_ACI_TL_STATS.
+ *  The queue levels are in slots, or in bytes with ACI_QUEUE_BYTE_RING. Bin 0 of the
+ *  wait histogram counts the commands sent within a tick of the low frequency timer,
+ *  bin n those that waited from 2^(n-1) to 2^n - 1 ticks. The last bin also counts
+ *  everything longer. The histogram bins saturate.
+ */
+typedef struct {
+  uint16_t tx_q_high_water;                            /* Highest number of queued commands */
+  uint16_t rx_q_high_water;                            /* Highest number of queued events */
+  uint16_t send_rejected;                              /* Commands rejected by hal_aci_tl_send() */
+  uint16_t rx_throttled;                               /* Times the event queue reached the high watermark */
+  uint32_t transactions;                               /* SPI transactions */
+  uint32_t transactions_tx;                            /* Transactions that only sent a command */
+  uint32_t transactions_rx;                            /* Transactions that only received an event */
+  uint32_t transactions_tx_rx;                         /* Transactions that sent a command and received an event */
+  uint16_t tx_wait[HAL_ACI_TL_STATS_WAIT_BINS];        /* Histogram of the time commands waited in the queue */
+} _aci_packed_ hal_aci_tl_stats_t;
+
+/** @brief Get a copy of the transport statistics
+ */
+void hal_aci_tl_stats_get(hal_aci_tl_t *p_tl, hal_aci_tl_stats_t *p_stats);
+
+/** @brief Clear the transport statistics
+ */
+void hal_aci_tl_stats_clear(hal_aci_tl_t *p_tl);
+
+/** @brief Dump the transport statistics in binary
+ *  @details
+ *  The dump is the @ref HAL_ACI_TL_STATS_DUMP_VERSION byte, a length byte and the
+ *  little endian @ref hal_aci_tl_stats_t.
+ *  @param p_buffer Buffer for the dump.
+ *  @param size Size of the buffer.
+ *  @return The number of bytes written, 0 if the buffer is too small.
+ */
+uint8_t hal_aci_tl_stats_dump(hal_aci_tl_t *p_tl, uint8_t *p_buffer, uint8_t size);
+
+#endif
 
 #endif // HAL_ACI_TL_H__
 /** @} */
@@ -0,0 +1,146 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+@brief Implementation of the minimal DMA driver used by the ACI transport layer
+*/
+
+#include "hal_platform.h"
+
+#if defined(__EFM32__)
+
+#include "em_device.h"
+#include "em_cmu.h"
+#include "hal_dma.h"
+
+/*
+Only the primary descriptors are used. With the 12 channels of the Leopard Gecko the controller
+decodes CTRLBASE[31:9], so the control block is aligned to 512 bytes, the size of the primary and
+alternate descriptors of 16 channels (DMACTRL_ALIGNMENT of emlib). Only the 16 primary descriptors
+are allocated, the alternate ones behind them are never read as CHALT is kept cleared.
+*/
+#define HAL_DMA_PRIMARY_DESCRIPTORS   16
+#define HAL_DMA_CTRL_ALIGNMENT        512
+
+static DMA_DESCRIPTOR_TypeDef dma_ctrl_block[HAL_DMA_PRIMARY_DESCRIPTORS] __attribute__ ((aligned(HAL_DMA_CTRL_ALIGNMENT)));
+
+static hal_dma_callback_t     dma_callbacks[DMA_CHAN_COUNT];
+
+static bool                   dma_initialized = false;
+
+void DMA_IRQHandler(void)
+{
+  uint32_t pending;
+  uint8_t  channel;
+
+  pending  = DMA->IF & DMA->IEN & ((1UL << DMA_CHAN_COUNT) - 1);
+  DMA->IFC = pending;
+
+  for (channel = 0; pending != 0; channel++, pending >>= 1)
+  {
+    if ((pending & 0x01) && (NULL != dma_callbacks[channel]))
+    {
+      dma_callbacks[channel](channel);
+    }
+  }
+}
+
+void hal_dma_init(void)
+{
+  if (dma_initialized)
+  {
+    return;
+  }
+
+  CMU_ClockEnable(cmuClock_DMA, true);
+
+  memset((void *)dma_ctrl_block, 0, sizeof(dma_ctrl_block));
+  memset(dma_callbacks, 0, sizeof(dma_callbacks));
+
+  DMA->CONFIG   = 0;
+  DMA->CHENC    = (1UL << DMA_CHAN_COUNT) - 1;
+  DMA->CHALTC   = (1UL << DMA_CHAN_COUNT) - 1;
+  DMA->CTRLBASE = (uint32_t)dma_ctrl_block;
+  DMA->IEN      = 0;
+  DMA->IFC      = _DMA_IFC_MASK;
+  DMA->CONFIG   = DMA_CONFIG_EN;
+
+  NVIC_ClearPendingIRQ(DMA_IRQn);
+  NVIC_EnableIRQ(DMA_IRQn);
+
+  dma_initialized = true;
+}
+
+void hal_dma_channel_config(uint8_t channel, uint32_t dmareq, hal_dma_callback_t callback)
+{
+  const uint32_t mask = 1UL << channel;
+
+  DMA->CHENC            = mask;
+  DMA->CH[channel].CTRL = dmareq;
+
+  /* Single requests only, the USART requests one byte at a time */
+  DMA->CHUSEBURSTC      = mask;
+  DMA->CHREQMASKC       = mask;
+  DMA->CHALTC           = mask;
+  DMA->CHPRIC           = mask;
+
+  dma_callbacks[channel] = callback;
+  DMA->IFC               = mask;
+  if (NULL != callback)
+  {
+    DMA->IEN |= mask;
+  }
+  else
+  {
+    DMA->IEN &= ~mask;
+  }
+}
+
+void hal_dma_basic_start(uint8_t channel,
+                         volatile void *dst, bool dst_inc,
+                         volatile const void *src, bool src_inc,
+                         uint16_t count)
+{
+  DMA_DESCRIPTOR_TypeDef *desc = &dma_ctrl_block[channel];
+  const uint16_t          last = count - 1;
+
+  /* The descriptor holds the address of the last byte to transfer */
+  desc->SRCEND = (volatile void *)((uint32_t)src + (src_inc ? last : 0));
+  desc->DSTEND = (volatile void *)((uint32_t)dst + (dst_inc ? last : 0));
+  desc->CTRL   = (dst_inc ? DMA_CTRL_DST_INC_BYTE : DMA_CTRL_DST_INC_NONE) |
+                 DMA_CTRL_DST_SIZE_BYTE |
+                 (src_inc ? DMA_CTRL_SRC_INC_BYTE : DMA_CTRL_SRC_INC_NONE) |
+                 DMA_CTRL_SRC_SIZE_BYTE |
+                 DMA_CTRL_DST_PROT_NON_PRIVILEGED |
+                 DMA_CTRL_SRC_PROT_NON_PRIVILEGED |
+                 DMA_CTRL_R_POWER_1 |
+                 ((uint32_t)last << _DMA_CTRL_N_MINUS_1_SHIFT) |
+                 DMA_CTRL_CYCLE_CTRL_BASIC;
+
+  DMA->CHENS = 1UL << channel;
+}
+
+bool hal_dma_channel_active(uint8_t channel)
+{
+  return (DMA->CHENS & (1UL << channel)) != 0;
+}
+
+#endif /* __EFM32__ */
@@ -0,0 +1,82 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Interface for hal_dma.
+ */
+
+/** @defgroup hal_dma hal_dma
+@{
+@ingroup hal
+
+@brief Minimal descriptor based driver for the EFM32 DMA controller (PL230)
+@details emlib in this tree does not include a DMA driver. This module only implements
+ what the ACI transport needs: basic mode, single byte peripheral transfers on the primary
+ descriptor of a channel and a completion callback called from the DMA interrupt.
+*/
+
+#ifndef HAL_DMA_H__
+#define HAL_DMA_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Callback called from the DMA interrupt when a channel has completed its transfer */
+typedef void (*hal_dma_callback_t)(uint8_t channel);
+
+/** @brief Initialize the DMA controller.
+ *  @details
+ *  Enables the DMA clock, points the controller at the control block and enables the DMA interrupt.
+ *  Calling this function more than once has no effect.
+ */
+void hal_dma_init(void);
+
+/** @brief Configure a DMA channel.
+ *  @param channel DMA channel number.
+ *  @param dmareq Request source, one of the DMAREQ_xxx defines from efm32lg_dmareq.h.
+ *  @param callback Function called when a transfer on the channel is complete. May be NULL.
+ */
+void hal_dma_channel_config(uint8_t channel, uint32_t dmareq, hal_dma_callback_t callback);
+
+/** @brief Start a basic mode byte transfer on a channel.
+ *  @details
+ *  The destination and the source address are incremented after each byte when dst_inc and
+ *  src_inc are set. Use a fixed address for the peripheral data register.
+ *  @param channel DMA channel number, configured with @ref hal_dma_channel_config().
+ *  @param dst Destination address of the first byte.
+ *  @param dst_inc True if the destination address should be incremented.
+ *  @param src Source address of the first byte.
+ *  @param src_inc True if the source address should be incremented.
+ *  @param count Number of bytes to transfer, 1 to 1024.
+ */
+void hal_dma_basic_start(uint8_t channel,
+                         volatile void *dst, bool dst_inc,
+                         volatile const void *src, bool src_inc,
+                         uint16_t count);
+
+/** @brief Check if a channel has a transfer in progress.
+ *  @param channel DMA channel number.
+ *  @return True if the channel is enabled and not yet completed.
+ */
+bool hal_dma_channel_active(uint8_t channel);
+
+#endif // HAL_DMA_H__
+/** @} */
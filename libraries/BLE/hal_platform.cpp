@@ -28,21 +28,16 @@
 #include "em_gpio.h"
 #include "em_usart.h"
 #include "em_int.h"
+#include "em_emu.h"
+#include "hal_dma.h"
 
-volatile uint32_t msTicks; /* counts 1ms timeTicks */
+/* SPI transfers the DMA is running, a bit per USART. Changed through the SRAM bit-band, as it is
+   set and cleared from different interrupt levels. */
+static volatile uint32_t spi_transfers_active = 0;
 
-void SysTick_Handler(void)
-{
-  msTicks++;       /* increment counter necessary in delay()*/
-}
-
-void delay(uint32_t dlyTicks)
-{
-  uint32_t curTicks;
-
-  curTicks = msTicks;
-  while ((msTicks - curTicks) < dlyTicks) ;
-}
+/* DMA channels used for the ACI SPI transfers, two per USART */
+#define ACI_SPI_DMA_CH_RX(spi) ((uint8_t)(2 * (spi)))
+#define ACI_SPI_DMA_CH_TX(spi) ((uint8_t)(2 * (spi) + 1))
 
 /* Setup SWO*/
 void setupSWO(void)
@@ -87,6 +82,22 @@ void setupSWO(void)
   ITM->TCR = 0x10009;
 }
 
+void efm_cycle_counter_init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t efm_cycle_clock_get(void)
+{
+  return CMU_ClockFreqGet(cmuClock_CORE);
+}
+
+void efm_itm_port_enable(uint8_t port)
+{
+  ITM->TER |= (1UL << port);
+}
+
 /* Enable the ARM compiler to send printf commands via the SWO interface*/
 
 struct __FILE { int handle; /* Add whatever you need here */ };
@@ -100,6 +111,290 @@ int fputc(int ch, FILE *f)
   return(ch);
 }
 
+/* The RTC counter is 24 bits wide, the overflows extend it to 32 bits */
+static volatile uint32_t lf_overflows = 0;
+static bool              lf_timer_running = false;
+
+/* LF clock cycles a write to COMP0 takes to synchronize */
+#define EFM_LF_COMPARE_SYNC_TICKS  3
+
+/* Running timers, sorted by expiry. COMP0 is set to the expiry of the first one. */
+static efm_timer_t      *lf_timers = NULL;
+
+static void efm_lf_compare_set(void);
+static void efm_lf_timers_run(void);
+
+void RTC_IRQHandler(void)
+{
+  if (RTC->IF & RTC_IF_OF)
+  {
+    RTC->IFC = RTC_IFC_OF;
+    lf_overflows++;
+
+    // A timer more than a counter period away may now be in reach of COMP0
+    efm_lf_compare_set();
+  }
+
+  if (RTC->IF & RTC_IF_COMP0)
+  {
+    RTC->IFC = RTC_IFC_COMP0;
+    efm_lf_timers_run();
+  }
+}
+
+void efm_lf_timer_init(void)
+{
+  if (lf_timer_running)
+  {
+    return;
+  }
+
+  CMU_ClockEnable(cmuClock_CORELE, true);
+#if defined(EFM_LF_CLOCK_LFXO)
+  CMU_OscillatorEnable(cmuOsc_LFXO, true, true);
+  CMU_ClockSelectSet(cmuClock_LFA, cmuSelect_LFXO);
+#else
+  CMU_OscillatorEnable(cmuOsc_LFRCO, true, true);
+  CMU_ClockSelectSet(cmuClock_LFA, cmuSelect_LFRCO);
+#endif
+  CMU_ClockDivSet(cmuClock_RTC, cmuClkDiv_1);
+  CMU_ClockEnable(cmuClock_RTC, true);
+
+  RTC->CTRL = 0;
+  RTC->IFC  = _RTC_IFC_MASK;
+  RTC->IEN  = RTC_IEN_OF;
+  NVIC_ClearPendingIRQ(RTC_IRQn);
+  NVIC_EnableIRQ(RTC_IRQn);
+  RTC->CTRL = RTC_CTRL_EN;
+
+  lf_timer_running = true;
+}
+
+uint32_t efm_lf_ticks_get(void)
+{
+  uint32_t overflows;
+  uint32_t cnt;
+
+  INT_Disable();
+  overflows = lf_overflows;
+  cnt       = RTC->CNT;
+  // The counter has wrapped but RTC_IRQHandler() has not run yet
+  if ((RTC->IF & RTC_IF_OF) && (cnt < (_RTC_CNT_MASK / 2)))
+  {
+    overflows++;
+  }
+  INT_Enable();
+
+  return (overflows << 24) | cnt;
+}
+
+/*
+  Points COMP0 at the first timer. The compare register is 24 bits wide and matches once per counter
+  period, so for a timer less than a period away the first match is the expiry. A timer further away
+  is armed by the overflow interrupt, which comes once per period, so the timer is less than a
+  period away then.
+  Called with the RTC interrupt masked or from it.
+*/
+static void efm_lf_compare_set(void)
+{
+  uint32_t now;
+  int32_t  remaining;
+
+  if (NULL == lf_timers)
+  {
+    RTC->IEN &= ~RTC_IEN_COMP0;
+    return;
+  }
+
+  now       = efm_lf_ticks_get();
+  remaining = (int32_t)(lf_timers->expiry - now);
+  if (remaining > (int32_t)_RTC_CNT_MASK)
+  {
+    RTC->IEN &= ~RTC_IEN_COMP0;
+    return;
+  }
+
+  // The compare register is synchronized to the low frequency clock
+  while (RTC->SYNCBUSY & RTC_SYNCBUSY_COMP0);
+  RTC->COMP0 = lf_timers->expiry & _RTC_COMP0_MASK;
+  RTC->IFC   = RTC_IFC_COMP0;
+  RTC->IEN  |= RTC_IEN_COMP0;
+
+  // A match before the write has synchronized is missed, so for a close expiry wait for it and
+  // raise the interrupt if the expiry is due or passed by then
+  if ((int32_t)(lf_timers->expiry - efm_lf_ticks_get()) <= EFM_LF_COMPARE_SYNC_TICKS)
+  {
+    while (RTC->SYNCBUSY & RTC_SYNCBUSY_COMP0);
+    if ((int32_t)(lf_timers->expiry - efm_lf_ticks_get()) <= 1)
+    {
+      RTC->IFS = RTC_IFS_COMP0;
+    }
+  }
+}
+
+/* Inserts the timer in expiry order, after the timers with the same expiry */
+static void efm_lf_timer_insert(efm_timer_t *p_timer)
+{
+  efm_timer_t **pp_timer = &lf_timers;
+
+  p_timer->running = true;
+
+  while ((NULL != *pp_timer) && ((int32_t)((*pp_timer)->expiry - p_timer->expiry) <= 0))
+  {
+    pp_timer = &(*pp_timer)->p_next;
+  }
+
+  p_timer->p_next = *pp_timer;
+  *pp_timer       = p_timer;
+}
+
+/* Unlinks the timer, returns false if it was not running */
+static bool efm_lf_timer_remove(efm_timer_t *p_timer)
+{
+  efm_timer_t **pp_timer = &lf_timers;
+
+  if (!p_timer->running)
+  {
+    return false;
+  }
+
+  while (NULL != *pp_timer)
+  {
+    if (*pp_timer == p_timer)
+    {
+      *pp_timer        = p_timer->p_next;
+      p_timer->running = false;
+      return true;
+    }
+    pp_timer = &(*pp_timer)->p_next;
+  }
+
+  return false;
+}
+
+/* Runs the expired timers from the RTC interrupt */
+static void efm_lf_timers_run(void)
+{
+  efm_timer_t *p_timer;
+  uint32_t     now = efm_lf_ticks_get();
+
+  while ((NULL != lf_timers) && ((int32_t)(now - lf_timers->expiry) >= 0))
+  {
+    p_timer   = lf_timers;
+    lf_timers = p_timer->p_next;
+
+    if (0 != p_timer->period)
+    {
+      // Periodic timers keep their phase, even when the interrupt was late
+      p_timer->expiry += p_timer->period;
+      efm_lf_timer_insert(p_timer);
+    }
+    else
+    {
+      p_timer->running = false;
+    }
+
+    p_timer->handler(p_timer->p_context);
+    now = efm_lf_ticks_get();
+  }
+
+  efm_lf_compare_set();
+}
+
+void efm_timer_start(efm_timer_t *p_timer, uint32_t ticks, uint32_t period,
+                     efm_timer_handler_t handler, void *p_context)
+{
+  efm_lf_timer_init();
+
+  INT_Disable();
+  efm_lf_timer_remove(p_timer);
+
+  p_timer->expiry    = efm_lf_ticks_get() + ticks;
+  p_timer->period    = period;
+  p_timer->handler   = handler;
+  p_timer->p_context = p_context;
+  efm_lf_timer_insert(p_timer);
+
+  efm_lf_compare_set();
+  INT_Enable();
+}
+
+void efm_timer_stop(efm_timer_t *p_timer)
+{
+  INT_Disable();
+  if (efm_lf_timer_remove(p_timer))
+  {
+    efm_lf_compare_set();
+  }
+  INT_Enable();
+}
+
+bool efm_timer_is_running(efm_timer_t *p_timer)
+{
+  return p_timer->running;
+}
+
+static void delay_done(void *p_context)
+{
+  *(volatile bool *)p_context = true;
+}
+
+void delay(uint32_t dlyTicks)
+{
+  efm_timer_t   timer;
+  volatile bool done = false;
+
+  if (0 == dlyTicks)
+  {
+    return;
+  }
+
+  timer.running = false;
+  efm_timer_start(&timer, EFM_LF_MS_TO_TICKS(dlyTicks), 0, delay_done, (void *)&done);
+
+  while (!done)
+  {
+    /* Masked, so that the timer firing between the check and the sleep wakes the MCU up */
+    INT_Disable();
+    if (!done)
+    {
+      efm_sleep();
+    }
+    INT_Enable();
+  }
+}
+
+uint32_t millis(void)
+{
+  efm_lf_timer_init();
+
+  return (uint32_t)(((uint64_t)efm_lf_ticks_get() * 1000) / EFM_LF_TICKS_PER_SECOND);
+}
+
+void efm_sleep_em1(void)
+{
+  EMU_EnterEM1();
+}
+
+void efm_sleep_em2(void)
+{
+  /* Restore the oscillators and the clock selection that were active before entering EM2 */
+  EMU_EnterEM2(true);
+}
+
+void efm_sleep(void)
+{
+  // The DMA and the USARTs stop in EM2
+  if (0 != spi_transfers_active)
+  {
+    efm_sleep_em1();
+  }
+  else
+  {
+    efm_sleep_em2();
+  }
+}
+
 void enableClocksForAci(void)
 {
   /* Enable clocks*/
@@ -113,49 +408,269 @@ void pinMode(uint8_t pin, uint8_t pinMode)
   switch(pinMode)
   {
     case INPUT:
-      GPIO_PinModeSet(gpioPortD, pin, gpioModeInput, 0);
+      GPIO_PinModeSet(EFM_PIN_PORT(pin), EFM_PIN_NUMBER(pin), gpioModeInput, 0);
     break;
   
     case INPUT_PULLUP:
-      GPIO_PinModeSet(gpioPortD, pin, gpioModeInputPull, 0);
+      GPIO_PinModeSet(EFM_PIN_PORT(pin), EFM_PIN_NUMBER(pin), gpioModeInputPull, 1);
     break;
   
     case OUTPUT:
-      GPIO_PinModeSet(gpioPortD, pin, gpioModePushPull, 0);
+      GPIO_PinModeSet(EFM_PIN_PORT(pin), EFM_PIN_NUMBER(pin), gpioModePushPull, 0);
     break;
   }
 }
 
-uint8_t digitalRead(uint8_t pin)
+static USART_TypeDef * const spi_usart[EFM_SPI_COUNT] = { USART0, USART1, USART2 };
+static const CMU_Clock_TypeDef spi_clock[EFM_SPI_COUNT] = { cmuClock_USART0, cmuClock_USART1, cmuClock_USART2 };
+static const uint32_t spi_dmareq_rx[EFM_SPI_COUNT] = { DMAREQ_USART0_RXDATAV, DMAREQ_USART1_RXDATAV, DMAREQ_USART2_RXDATAV };
+static const uint32_t spi_dmareq_tx[EFM_SPI_COUNT] = { DMAREQ_USART0_TXBL, DMAREQ_USART1_TXBL, DMAREQ_USART2_TXBL };
+
+static void (*spi_transfer_done_handler[EFM_SPI_COUNT])(void *p_context);
+static void *spi_transfer_done_context[EFM_SPI_COUNT];
+static const uint8_t spi_dummy_byte = 0;
+/* Zeros the TX channel sends after tx_data, see efm_spi_transfer_start() */
+static uint8_t spi_tx_dummy_length[EFM_SPI_COUNT];
+
+static void efm_spi_dma_tx_done(uint8_t channel)
+{
+  const uint8_t spi    = channel / 2;
+  const uint8_t length = spi_tx_dummy_length[spi];
+
+  if (0 != length)
+  {
+    spi_tx_dummy_length[spi] = 0;
+    hal_dma_basic_start(ACI_SPI_DMA_CH_TX(spi), &spi_usart[spi]->TXDATA, false, &spi_dummy_byte, false, length);
+  }
+}
+
+static void efm_spi_dma_rx_done(uint8_t channel)
+{
+  const uint8_t spi = channel / 2;
+
+  BITBAND_SRAM((uint32_t *)&spi_transfers_active, spi, 0);
+
+  if (NULL != spi_transfer_done_handler[spi])
+  {
+    spi_transfer_done_handler[spi](spi_transfer_done_context[spi]);
+  }
+}
+
+/* Sets up the pins of a USART location as an SPI master, the clock idles low and MOSI starts low */
+#define EFM_SPI_PINS_SET(n, location)                                                                         \
+  GPIO_PinModeSet((GPIO_Port_TypeDef)AF_USART ## n ## _TX_PORT(location), AF_USART ## n ## _TX_PIN(location),   \
+                  gpioModePushPull, 0);                                                                       \
+  GPIO_PinModeSet((GPIO_Port_TypeDef)AF_USART ## n ## _RX_PORT(location), AF_USART ## n ## _RX_PIN(location),   \
+                  gpioModeInput, 0);                                                                          \
+  GPIO_PinModeSet((GPIO_Port_TypeDef)AF_USART ## n ## _CLK_PORT(location), AF_USART ## n ## _CLK_PIN(location), \
+                  gpioModePushPull, 0)
+
+void efm_spi_init(uint8_t spi, uint8_t location, uint32_t baudrate)
+{
+  USART_InitSync_TypeDef initSync = {
+    .enable = usartEnable,          //enable RX and TX
+    .refFreq = 0,                   //use currently configured clock
+    .baudrate = baudrate,
+    .databits = usartDatabits8,
+    .master = 1,
+    .msbf = 0,
+    .clockMode = usartClockMode0,   //clock idle low, sample on rising edge
+    .prsRxEnable = 0,
+    .prsRxCh = usartPrsRxCh0,
+    .autoTx = 0
+  };
+
+  CMU_ClockEnable(cmuClock_HFPER, true);
+  CMU_ClockEnable(cmuClock_GPIO, true);
+  CMU_ClockEnable(spi_clock[spi], true);
+
+  switch (spi)
+  {
+    case 0:
+      EFM_SPI_PINS_SET(0, location);
+      break;
+
+    case 1:
+      EFM_SPI_PINS_SET(1, location);
+      break;
+
+    case 2:
+      EFM_SPI_PINS_SET(2, location);
+      break;
+  }
+
+  USART_InitSync(spi_usart[spi], &initSync);
+  spi_usart[spi]->ROUTE = ((uint32_t)location << _USART_ROUTE_LOCATION_SHIFT) |
+                          USART_ROUTE_RXPEN |
+                          USART_ROUTE_TXPEN |
+                          USART_ROUTE_CLKPEN;
+
+  /* The DMA clocks all but the first two bytes of every ACI transaction */
+  hal_dma_init();
+  hal_dma_channel_config(ACI_SPI_DMA_CH_RX(spi), spi_dmareq_rx[spi], efm_spi_dma_rx_done);
+  hal_dma_channel_config(ACI_SPI_DMA_CH_TX(spi), spi_dmareq_tx[spi], efm_spi_dma_tx_done);
+}
+
+uint8_t efm_spi_readwrite(uint8_t spi, const uint8_t aci_byte)
+{
+  return USART_SpiTransfer(spi_usart[spi], aci_byte);
+}
+
+uint32_t efm_spi_clock_source_get(void)
+{
+  return CMU_ClockFreqGet(cmuClock_HFPER);
+}
+
+void efm_spi_baudrate_set(uint8_t spi, uint32_t baudrate)
 {
-  return GPIO_PinInGet(gpioPortD, pin);
+  /* Rounds the divider up, the resulting clock is never faster than requested */
+  USART_BaudrateSyncSet(spi_usart[spi], 0, baudrate);
 }
 
-void digitalWrite(uint8_t pin, uint8_t value)
+uint32_t efm_spi_baudrate_get(uint8_t spi)
 {
-  if(value)
+  return USART_BaudrateGet(spi_usart[spi]);
+}
+
+/*
+  Clocks length bytes on the USART without CPU involvement. The RX channel completes after the TX
+  channel, so done_handler is called from the DMA interrupt once the last byte has been received.
+  The first tx_length bytes are sent from tx_data, zeros after them. The TX channel is not run past
+  tx_data, it is restarted on a fixed zero source from its completion interrupt instead.
+*/
+void efm_spi_transfer_start(uint8_t spi, const uint8_t *tx_data, uint8_t tx_length, uint8_t *rx_data, uint8_t length,
+                            void (*done_handler)(void *p_context), void *p_context)
+{
+  USART_TypeDef *usart = spi_usart[spi];
+
+  spi_transfer_done_handler[spi] = done_handler;
+  spi_transfer_done_context[spi] = p_context;
+  BITBAND_SRAM((uint32_t *)&spi_transfers_active, spi, 1);
+
+  /* Arm the receiver first so that no byte is lost when the transmitter starts */
+  hal_dma_basic_start(ACI_SPI_DMA_CH_RX(spi), rx_data, true, &usart->RXDATA, false, length);
+
+  if ((NULL != tx_data) && (0 != tx_length))
   {
-    GPIO_PinOutSet(gpioPortD, pin);
+    if (tx_length > length)
+    {
+      tx_length = length;
+    }
+    spi_tx_dummy_length[spi] = (uint8_t)(length - tx_length);
+    hal_dma_basic_start(ACI_SPI_DMA_CH_TX(spi), &usart->TXDATA, false, tx_data, true, tx_length);
   }
-  else 
+  else
   {
-    GPIO_PinOutClear(gpioPortD, pin);
+    spi_tx_dummy_length[spi] = 0;
+    hal_dma_basic_start(ACI_SPI_DMA_CH_TX(spi), &usart->TXDATA, false, &spi_dummy_byte, false, length);
   }
 }
 
-uint8_t efm_spi_readwrite(const uint8_t aci_byte)
+/*
+  The EFM32 has one external interrupt per pin number, shared by the ports. The interrupt number is the
+  pin, as given to pinMode(), and the interrupt is taken from the port of the pin. Two interrupt pins
+  must not have the same pin number.
+  The GPIO only detects edges. A LOW level interrupt is emulated on top of the falling edge: it is pended
+  when attached while the pin is low, and pended again after the handler as long as the pin stays low.
+*/
+#define GPIO_INT_COUNT 16
+
+static void    (*gpio_int_handlers[GPIO_INT_COUNT])(void);
+static uint8_t gpio_int_modes[GPIO_INT_COUNT];
+static GPIO_Port_TypeDef gpio_int_ports[GPIO_INT_COUNT];
+
+static void gpio_int_dispatch(uint32_t flags)
 {
-  return USART_SpiTransfer(USART1, aci_byte);
+  uint8_t interruptNumber;
+
+  GPIO_IntClear(flags);
+
+  for (interruptNumber = 0; flags != 0; interruptNumber++, flags >>= 1)
+  {
+    if ((flags & 0x01) && (NULL != gpio_int_handlers[interruptNumber]))
+    {
+      gpio_int_handlers[interruptNumber]();
+
+      // Level emulation, only if the handler did not detach itself
+      if ((LOW == gpio_int_modes[interruptNumber]) &&
+          (NULL != gpio_int_handlers[interruptNumber]) &&
+          (0 == GPIO_PinInGet(gpio_int_ports[interruptNumber], interruptNumber)))
+      {
+        GPIO_IntSet(1UL << interruptNumber);
+      }
+    }
+  }
+}
+
+void GPIO_EVEN_IRQHandler(void)
+{
+  gpio_int_dispatch(GPIO_IntGetEnabled() & 0x5555);
+}
+
+void GPIO_ODD_IRQHandler(void)
+{
+  gpio_int_dispatch(GPIO_IntGetEnabled() & 0xAAAA);
+}
+
+/* External interrupt of a pin, GPIO_INT_COUNT for a plain pin number out of range */
+static uint8_t gpio_int_line_get(uint8_t pin)
+{
+  if (!(pin & 0x80) && (pin >= GPIO_INT_COUNT))
+  {
+    return GPIO_INT_COUNT;
+  }
+
+  return EFM_PIN_NUMBER(pin);
 }
 
 void attachInterrupt(uint8_t interruptNumber, void (*handlerPtr)(void), uint8_t mode)
 {
-  //TODO: attach interrupt
+  const uint8_t line = gpio_int_line_get(interruptNumber);
+  uint32_t mask;
+  uint32_t pending;
+
+  if (line >= GPIO_INT_COUNT)
+  {
+    return;
+  }
+
+  mask = 1UL << line;
+  GPIO_IntDisable(mask);
+
+  gpio_int_handlers[line] = handlerPtr;
+  gpio_int_modes[line]    = mode;
+  gpio_int_ports[line]    = EFM_PIN_PORT(interruptNumber);
+
+  /* The edge detection keeps running while detached, keep an edge that happened meanwhile.
+     GPIO_IntConfig() clears the flag. */
+  pending = GPIO_IntGet() & mask;
+  GPIO_IntConfig(gpio_int_ports[line], line,
+                 (RISING == mode) || (CHANGE == mode),
+                 (FALLING == mode) || (CHANGE == mode) || (LOW == mode),
+                 false);
+
+  // The line may already be low, in which case no falling edge will come
+  if (pending || ((LOW == mode) && (0 == GPIO_PinInGet(gpio_int_ports[line], line))))
+  {
+    GPIO_IntSet(mask);
+  }
+
+  NVIC_EnableIRQ((line & 0x01) ? GPIO_ODD_IRQn : GPIO_EVEN_IRQn);
+  GPIO_IntEnable(mask);
 }
 
 void detachInterrupt(uint8_t interruptNumber)
 {
-  //TODO: detach interrupt
+  const uint8_t line = gpio_int_line_get(interruptNumber);
+
+  if (line >= GPIO_INT_COUNT)
+  {
+    return;
+  }
+
+  /* The edge detection is left running so that attachInterrupt() sees edges that happen meanwhile */
+  GPIO_IntDisable(1UL << line);
+  gpio_int_handlers[line] = NULL;
 }
 
 void noInterrupts(void)
@@ -77,7 +77,16 @@
     #include <stdio.h>
     #include <string.h>
 
+  #if defined(EFM_HOST)
+    //Linux build against the nRF8001 simulator, hal_platform_host.cpp in host_sim/ implements the API below
+    #include "em_gpio.h"
+
+    #define __DMB() __sync_synchronize()
+  #else
     #include "em_usart.h"
+    #include "em_gpio.h"
+    #include "em_bitband.h"
+  #endif
 
     #define INPUT        0
     #define INPUT_PULLUP 1
@@ -86,14 +95,133 @@
     #define LOW 0
     #define HIGH 1
 
+    //Interrupt modes for attachInterrupt(), LOW is a level interrupt
+    #define FALLING 2
+    #define RISING  3
+    #define CHANGE  4
+
+    //Sleeps for dlyTicks milliseconds, in EM2 unless an SPI transfer is running
     void delay(uint32_t dlyTicks);
+    //Milliseconds since the low frequency timebase was started
+    uint32_t millis(void);
     void setupSWO(void);
     void enableClocksForAci(void);
-    void enableClocksForAci(void);
+    //A pin on any GPIO port is given as EFM_PIN(gpioPortC, 4). Plain pin numbers 0-15 are on gpioPortD
+    #define EFM_PIN(port, pin)          ((uint8_t)(0x80 | ((port) << 4) | (pin)))
+    #define EFM_PIN_PORT(pin)           ((GPIO_Port_TypeDef)(((pin) & 0x80) ? (((pin) >> 4) & 0x07) : gpioPortD))
+    #define EFM_PIN_NUMBER(pin)         ((pin) & 0x0F)
+
+  #if defined(EFM_HOST)
+    //Pins are simulated, a pin reference is the pin itself
+    typedef uint8_t efm_pin_ref_t;
+
+    #define EFM_PIN_OUT_REF(pin)            (pin)
+    #define EFM_PIN_IN_REF(pin)             (pin)
+    #define EFM_PIN_REF_WRITE(ref, value)   digitalWrite((ref), (value))
+    #define EFM_PIN_REF_READ(ref)           digitalRead(ref)
+
     void pinMode(uint8_t pin, uint8_t pinMode);
     uint8_t digitalRead(uint8_t pin);
     void digitalWrite(uint8_t pin, uint8_t value);
-    uint8_t efm_spi_readwrite(const uint8_t aci_byte);
+  #else
+    //Bit-band alias of the output and input bit of a pin, a single store or load accesses the pin
+    #define EFM_BITBAND_PER(addr, bit)  ((volatile uint32_t *)(BITBAND_PER_BASE + (((uint32_t)(addr) - PER_MEM_BASE) * 32) + ((bit) * 4)))
+    #define EFM_PIN_OUT_BITBAND(pin)    EFM_BITBAND_PER(&GPIO->P[EFM_PIN_PORT(pin)].DOUT, EFM_PIN_NUMBER(pin))
+    #define EFM_PIN_IN_BITBAND(pin)     EFM_BITBAND_PER(&GPIO->P[EFM_PIN_PORT(pin)].DIN, EFM_PIN_NUMBER(pin))
+
+    //A pin reference caches the bit-band alias of a pin for the drivers that access it often
+    typedef volatile uint32_t *efm_pin_ref_t;
+
+    #define EFM_PIN_OUT_REF(pin)            EFM_PIN_OUT_BITBAND(pin)
+    #define EFM_PIN_IN_REF(pin)             EFM_PIN_IN_BITBAND(pin)
+    #define EFM_PIN_REF_WRITE(ref, value)   (*(ref) = (value))
+    #define EFM_PIN_REF_READ(ref)           ((uint8_t)*(ref))
+
+    void pinMode(uint8_t pin, uint8_t pinMode);
+
+    //Inlined, so a constant pin compiles to a single bit-band load or store
+    static inline uint8_t digitalRead(uint8_t pin)
+    {
+      return (uint8_t)BITBAND_PeripheralRead((volatile uint32_t *)&GPIO->P[EFM_PIN_PORT(pin)].DIN, EFM_PIN_NUMBER(pin));
+    }
+
+    static inline void digitalWrite(uint8_t pin, uint8_t value)
+    {
+      BITBAND_Peripheral(&GPIO->P[EFM_PIN_PORT(pin)].DOUT, EFM_PIN_NUMBER(pin), value ? 1 : 0);
+    }
+  #endif
+
+    //SPI masters on USART0, USART1 and USART2, spi is the USART number and location the ROUTE location
+    #define EFM_SPI_COUNT 3
+
+    void efm_spi_init(uint8_t spi, uint8_t location, uint32_t baudrate);
+    uint8_t efm_spi_readwrite(uint8_t spi, const uint8_t aci_byte);
+    uint32_t efm_spi_clock_source_get(void);
+    void efm_spi_baudrate_set(uint8_t spi, uint32_t baudrate);
+    uint32_t efm_spi_baudrate_get(uint8_t spi);
+    //Sends tx_length bytes of tx_data and zeros after them, length bytes are received
+    void efm_spi_transfer_start(uint8_t spi, const uint8_t *tx_data, uint8_t tx_length, uint8_t *rx_data,
+                                uint8_t length, void (*done_handler)(void *p_context), void *p_context);
+    //Core clock cycles on the DWT cycle counter. It stops while the core sleeps, so it counts the
+    //cycles the CPU is busy. On the host it counts the CPU time of the process in ns.
+    void efm_cycle_counter_init(void);
+    uint32_t efm_cycle_clock_get(void);
+  #if defined(EFM_HOST)
+    uint32_t efm_cycles_get(void);
+  #else
+    static inline uint32_t efm_cycles_get(void)
+    {
+      return DWT->CYCCNT;
+    }
+  #endif
+    //32-bit writes to the ITM stimulus ports, port 0 carries printf(). A write waits for the port FIFO
+    //and is dropped while the ITM or the port is disabled. On the host the packets go to the file
+    //named by EFM_HOST_SWO.
+    void efm_itm_port_enable(uint8_t port);
+  #if defined(EFM_HOST)
+    void efm_itm_write32(uint8_t port, uint32_t value);
+  #else
+    static inline void efm_itm_write32(uint8_t port, uint32_t value)
+    {
+      if ((ITM->TCR & ITM_TCR_ITMENA_Msk) && (ITM->TER & (1UL << port)))
+      {
+        while (ITM->PORT[port].u32 == 0);
+        ITM->PORT[port].u32 = value;
+      }
+    }
+  #endif
+
+    //Low frequency timebase running in EM2, clocked from the LFRCO unless EFM_LF_CLOCK_LFXO is defined
+    #define EFM_LF_TICKS_PER_SECOND 32768UL
+
+    void efm_lf_timer_init(void);
+    uint32_t efm_lf_ticks_get(void);
+    #define EFM_LF_MS_TO_TICKS(ms)  ((uint32_t)((((uint64_t)(ms) * EFM_LF_TICKS_PER_SECOND) + 999) / 1000))
+
+    void efm_sleep_em1(void);
+    void efm_sleep_em2(void);
+    //Sleeps in the lowest energy mode that keeps running SPI transfers going
+    void efm_sleep(void);
+
+    //Software timers on the low frequency timebase, the handlers run in the RTC interrupt.
+    //The timer is owned by the caller and must stay valid while it runs. A zeroed timer is stopped.
+    typedef void (*efm_timer_handler_t)(void *p_context);
+
+    typedef struct efm_timer_t
+    {
+      struct efm_timer_t  *p_next;
+      uint32_t             expiry;
+      uint32_t             period;
+      efm_timer_handler_t  handler;
+      void                *p_context;
+      volatile bool        running;
+    } efm_timer_t;
+
+    //Expires after ticks, then every period ticks unless period is 0. Restarts a running timer
+    void efm_timer_start(efm_timer_t *p_timer, uint32_t ticks, uint32_t period,
+                         efm_timer_handler_t handler, void *p_context);
+    void efm_timer_stop(efm_timer_t *p_timer);
+    bool efm_timer_is_running(efm_timer_t *p_timer);
     void attachInterrupt(uint8_t interruptNumber, void (*handlerPtr)(void), uint8_t mode);
     void detachInterrupt(uint8_t interruptNumber);
     void noInterrupts(void);
@@ -29,21 +29,35 @@
 #include "aci_evts.h"
 #include "aci_protocol_defines.h"
 #include "acilib_defs.h"
+#include "acilib.h"
 #include "acilib_if.h"
 #include "hal_aci_tl.h"
 #include "aci_queue.h"
+#include "aci_probe.h"
+#include "aci_log.h"
+#include "aci_evt_view.h"
 #include "lib_aci.h"
+#include "ble_assert.h"
 
 
 #define LIB_ACI_DEFAULT_CREDIT_NUMBER   1
 
-/*
-Global additionally used used in aci_setup 
-*/
-hal_aci_data_t  msg_to_send;
+static void lib_aci_tx_init(aci_state_t *aci_stat);
+static void lib_aci_tx_release(aci_state_t *aci_stat);
+static void lib_aci_stream_abort(aci_state_t *aci_stat);
+static void lib_aci_stream_pump(aci_state_t *aci_stat);
+static bool lib_aci_rx_frame(aci_state_t *aci_stat, const uint8_t *p_evt);
+
+/* Commands are encoded in place in a slot of the command queue, see hal_aci_tl_cmd_reserve().
+   Returns the buffer of the slot, or NULL if the command cannot be queued now. */
+static uint8_t * lib_aci_cmd_reserve(aci_state_t *aci_stat, uint8_t length)
+{
+  hal_aci_data_t *p_slot = hal_aci_tl_cmd_reserve(aci_stat->aci_tl, length);
+
+  return (NULL != p_slot) ? &p_slot->buffer[0] : NULL;
+}
 
 
-static services_pipe_type_mapping_t * p_services_pipe_type_map;
 //static hal_aci_data_t *               p_setup_msgs;
 
 
@@ -58,14 +72,14 @@ static services_pipe_type_mapping_t * p_services_pipe_type_map;
 //static uint8_t indicate_operation_pipe = 0;
 
 
-// The following structure (aci_cmd_params_open_adv_pipe) will be used to store the complete command 
-// including the pipes to be opened. 
-static aci_cmd_params_open_adv_pipe_t aci_cmd_params_open_adv_pipe; 
+/* Energy mode statistics of lib_aci_idle(), em0_ticks is calculated when read */
+static lib_aci_idle_stats_t idle_stats;
+static uint32_t             idle_stats_start;
 
+/* Peripheral clock divisors tried by lib_aci_spi_clock_negotiate(), slowest first */
+static const uint8_t spi_clock_divider_candidates[] = { 64, 32, 16, 8, 6, 4, 2 };
 
 
-extern aci_queue_t    aci_rx_q;
-extern aci_queue_t    aci_tx_q;
 
 bool lib_aci_is_pipe_available(aci_state_t *aci_stat, uint8_t pipe)
 {
@@ -100,8 +114,9 @@ bool lib_aci_is_discovery_finished(aci_state_t *aci_stat)
 
 void lib_aci_board_init(aci_state_t *aci_stat)
 {
-	hal_aci_evt_t *aci_data = NULL;
-	aci_data = (hal_aci_evt_t *)&msg_to_send;
+	hal_aci_evt_t  aci_evt_data;
+	hal_aci_evt_t *aci_data = &aci_evt_data;
+	hal_aci_data_t aci_inject;
 					
 	if (REDBEARLAB_SHIELD_V1_1 == aci_stat->aci_pins.board_name)
 	{
@@ -114,7 +129,7 @@ void lib_aci_board_init(aci_state_t *aci_stat)
 	  /*
 	  Send the soft reset command to the nRF8001 to get the nRF8001 to a known state.
 	  */
-	  lib_aci_radio_reset();
+	  lib_aci_radio_reset(aci_stat);
   
 	  while (1)
 	  {
@@ -133,32 +148,32 @@ void lib_aci_board_init(aci_state_t *aci_stat)
 				if (ACI_STATUS_ERROR_DEVICE_STATE_INVALID == aci_evt->params.cmd_rsp.cmd_status) //in SETUP
 				{
 					//Inject a Device Started Event Setup to the ACI Event Queue
-					msg_to_send.buffer[0] = 4;    //Length
-					msg_to_send.buffer[1] = 0x81; //Device Started Event
-					msg_to_send.buffer[2] = 0x02; //Setup
-					msg_to_send.buffer[3] = 0;    //Hardware Error -> None
-					msg_to_send.buffer[4] = 2;    //Data Credit Available
-					aci_queue_enqueue(&aci_rx_q, &msg_to_send);
+					aci_inject.buffer[0] = 4;    //Length
+					aci_inject.buffer[1] = 0x81; //Device Started Event
+					aci_inject.buffer[2] = 0x02; //Setup
+					aci_inject.buffer[3] = 0;    //Hardware Error -> None
+					aci_inject.buffer[4] = 2;    //Data Credit Available
+					hal_aci_tl_event_inject(aci_stat->aci_tl, &aci_inject);
 				}
 				else if (ACI_STATUS_SUCCESS == aci_evt->params.cmd_rsp.cmd_status) //We are now in STANDBY
 				{
 					//Inject a Device Started Event Standby to the ACI Event Queue
-					msg_to_send.buffer[0] = 4;    //Length
-					msg_to_send.buffer[1] = 0x81; //Device Started Event
-					msg_to_send.buffer[2] = 0x03; //Standby
-					msg_to_send.buffer[3] = 0;    //Hardware Error -> None
-					msg_to_send.buffer[4] = 2;    //Data Credit Available
-					aci_queue_enqueue(&aci_rx_q, &msg_to_send);
+					aci_inject.buffer[0] = 4;    //Length
+					aci_inject.buffer[1] = 0x81; //Device Started Event
+					aci_inject.buffer[2] = 0x03; //Standby
+					aci_inject.buffer[3] = 0;    //Hardware Error -> None
+					aci_inject.buffer[4] = 2;    //Data Credit Available
+					hal_aci_tl_event_inject(aci_stat->aci_tl, &aci_inject);
 				}
 				else if (ACI_STATUS_ERROR_CMD_UNKNOWN == aci_evt->params.cmd_rsp.cmd_status) //We are now in TEST
 				{
 					//Inject a Device Started Event Test to the ACI Event Queue
-					msg_to_send.buffer[0] = 4;    //Length
-					msg_to_send.buffer[1] = 0x81; //Device Started Event
-					msg_to_send.buffer[2] = 0x01; //Test
-					msg_to_send.buffer[3] = 0;    //Hardware Error -> None
-					msg_to_send.buffer[4] = 0;    //Data Credit Available
-					aci_queue_enqueue(&aci_rx_q, &msg_to_send);
+					aci_inject.buffer[0] = 4;    //Length
+					aci_inject.buffer[1] = 0x81; //Device Started Event
+					aci_inject.buffer[2] = 0x01; //Test
+					aci_inject.buffer[3] = 0;    //Hardware Error -> None
+					aci_inject.buffer[4] = 0;    //Data Credit Available
+					hal_aci_tl_event_inject(aci_stat->aci_tl, &aci_inject);
 				}
 				
 				//Break out of the while loop
@@ -183,7 +198,7 @@ void lib_aci_init(aci_state_t *aci_stat, bool debug)
   {
     aci_stat->pipes_open_bitmap[i]          = 0;
     aci_stat->pipes_closed_bitmap[i]        = 0;
-    aci_cmd_params_open_adv_pipe.pipes[i]   = 0;
+    aci_stat->aci_cmd_params_open_adv_pipe.pipes[i]   = 0;
   }
   
 
@@ -203,12 +218,30 @@ void lib_aci_init(aci_state_t *aci_stat, bool debug)
   
   
   
-  p_services_pipe_type_map = aci_stat->aci_setup_info.services_pipe_type_mapping;
-  
 //  p_setup_msgs             = aci_stat->aci_setup_info.setup_msgs;
   
   
-  hal_aci_tl_init(&aci_stat->aci_pins, debug);
+  aci_stat->spi_echo_errors = 0;
+  aci_stat->data_credit_total     = 0;
+  aci_stat->data_credit_available = 0;
+  lib_aci_tx_init(aci_stat);
+  for (i = 0; i < LIB_ACI_STREAMS; i++)
+  {
+    aci_stat->streams[i].pipe = 0;
+  }
+  aci_stat->stream_next = 0;
+  for (i = 0; i < LIB_ACI_RX_FRAMED_PIPES; i++)
+  {
+    aci_stat->rx_frames[i].pipe = 0;
+  }
+  memset(&aci_stat->dispatch, 0, sizeof(aci_stat->dispatch));
+  aci_stat->event_updated = false;
+
+  aci_stat->aci_tl = hal_aci_tl_init(&aci_stat->aci_pins, debug);
+  ble_assert(NULL != aci_stat->aci_tl);
+
+  lib_aci_idle_stats_clear();
+  aci_log_init();
   
   lib_aci_board_init(aci_stat);
 }
@@ -219,6 +252,11 @@ uint8_t lib_aci_get_nb_available_credits(aci_state_t *aci_stat)
   return aci_stat->data_credit_available;
 }
 
+uint8_t lib_aci_tx_queued_get(aci_state_t *aci_stat)
+{
+  return aci_stat->tx.queued;
+}
+
 uint16_t lib_aci_get_cx_interval_ms(aci_state_t *aci_stat)
 {
   uint32_t cx_rf_interval_ms_32bits;
@@ -244,60 +282,97 @@ uint16_t lib_aci_get_slave_latency(aci_state_t *aci_stat)
 }
 
 
-bool lib_aci_set_app_latency(uint16_t latency, aci_app_latency_mode_t latency_mode)
+bool lib_aci_set_app_latency(aci_state_t *aci_stat, uint16_t latency, aci_app_latency_mode_t latency_mode)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_set_app_latency_t aci_set_app_latency;
   
   aci_set_app_latency.mode    = latency_mode;
   aci_set_app_latency.latency = latency;  
-  acil_encode_cmd_set_app_latency(&(msg_to_send.buffer[0]), &aci_set_app_latency);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_SET_APP_LATENCY_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_set_app_latency(p_cmd, &aci_set_app_latency);
   
-  return hal_aci_tl_send(&msg_to_send);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_test(aci_test_mode_change_t enter_exit_test_mode)
+bool lib_aci_test(aci_state_t *aci_stat, aci_test_mode_change_t enter_exit_test_mode)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_test_t aci_cmd_params_test;
   aci_cmd_params_test.test_mode_change = enter_exit_test_mode;
-  acil_encode_cmd_set_test_mode(&(msg_to_send.buffer[0]), &aci_cmd_params_test);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_SET_TEST_MODE_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_set_test_mode(p_cmd, &aci_cmd_params_test);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_sleep()
+bool lib_aci_sleep(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_sleep(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_SLEEP_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_sleep(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_radio_reset()
+bool lib_aci_radio_reset(aci_state_t *aci_stat)
 {
-  acil_encode_baseband_reset(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_BASEBAND_RESET_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_baseband_reset(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_direct_connect()
+bool lib_aci_direct_connect(aci_state_t *aci_stat)
 {
-  acil_encode_direct_connect(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_DIRECT_CONNECT_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_direct_connect(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_device_version()
+bool lib_aci_device_version(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_get_device_version(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_GET_DEVICE_VERSION_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_get_device_version(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
 bool lib_aci_set_local_data(aci_state_t *aci_stat, uint8_t pipe, uint8_t *p_value, uint8_t size)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_set_local_data_t aci_cmd_params_set_local_data;
   
-  if ((p_services_pipe_type_map[pipe-1].location != ACI_STORE_LOCAL)
+  if ((aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].location != ACI_STORE_LOCAL)
       ||
       (size > ACI_PIPE_TX_DATA_MAX_LEN))
   {
@@ -306,28 +381,45 @@ bool lib_aci_set_local_data(aci_state_t *aci_stat, uint8_t pipe, uint8_t *p_valu
 
   aci_cmd_params_set_local_data.tx_data.pipe_number = pipe;
   memcpy(&(aci_cmd_params_set_local_data.tx_data.aci_data[0]), p_value, size);
-  acil_encode_cmd_set_local_data(&(msg_to_send.buffer[0]), &aci_cmd_params_set_local_data, size);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_SET_LOCAL_DATA_BASE_LEN + size);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_set_local_data(p_cmd, &aci_cmd_params_set_local_data, size);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
-bool lib_aci_connect(uint16_t run_timeout, uint16_t adv_interval)
+bool lib_aci_connect(aci_state_t *aci_stat, uint16_t run_timeout, uint16_t adv_interval)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_connect_t aci_cmd_params_connect;
   aci_cmd_params_connect.timeout      = run_timeout;
   aci_cmd_params_connect.adv_interval = adv_interval;
-  acil_encode_cmd_connect(&(msg_to_send.buffer[0]), &aci_cmd_params_connect);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_CONNECT_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_connect(p_cmd, &aci_cmd_params_connect);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
 bool lib_aci_disconnect(aci_state_t *aci_stat, aci_disconnect_reason_t reason)
 {
+  uint8_t *p_cmd;
   bool ret_val;
   uint8_t i;
   aci_cmd_params_disconnect_t aci_cmd_params_disconnect;
   aci_cmd_params_disconnect.reason = reason;
-  acil_encode_cmd_disconnect(&(msg_to_send.buffer[0]), &aci_cmd_params_disconnect);
-  ret_val = hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_DISCONNECT_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_disconnect(p_cmd, &aci_cmd_params_disconnect);
+  ret_val = hal_aci_tl_cmd_commit(aci_stat->aci_tl);
   // If we have actually sent the disconnect
   if (ret_val)
   {
@@ -345,61 +437,193 @@ bool lib_aci_disconnect(aci_state_t *aci_stat, aci_disconnect_reason_t reason)
 }
 
 
-bool lib_aci_bond(uint16_t run_timeout, uint16_t adv_interval)
+bool lib_aci_bond(aci_state_t *aci_stat, uint16_t run_timeout, uint16_t adv_interval)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_bond_t aci_cmd_params_bond;
   aci_cmd_params_bond.timeout = run_timeout;
   aci_cmd_params_bond.adv_interval = adv_interval;
-  acil_encode_cmd_bond(&(msg_to_send.buffer[0]), &aci_cmd_params_bond);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_BOND_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_bond(p_cmd, &aci_cmd_params_bond);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_wakeup()
+bool lib_aci_wakeup(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_wakeup(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_WAKEUP_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_wakeup(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_set_tx_power(aci_device_output_power_t tx_power)
+bool lib_aci_set_tx_power(aci_state_t *aci_stat, aci_device_output_power_t tx_power)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_set_tx_power_t aci_cmd_params_set_tx_power;
   aci_cmd_params_set_tx_power.device_power = tx_power;
-  acil_encode_cmd_set_radio_tx_power(&(msg_to_send.buffer[0]), &aci_cmd_params_set_tx_power);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_SET_RADIO_TX_POWER_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_set_radio_tx_power(p_cmd, &aci_cmd_params_set_tx_power);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_get_address()
+bool lib_aci_get_address(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_get_address(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_GET_DEVICE_ADDR_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_get_address(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_get_temperature()
+bool lib_aci_get_temperature(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_temparature(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_GET_TEMPERATURE_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_temparature(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_get_battery_level()
+bool lib_aci_get_battery_level(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_battery_level(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_GET_BATTERY_LEVEL_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_battery_level(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_send_data(uint8_t pipe, uint8_t *p_value, uint8_t size)
+/* Queues a SendData command and takes a data credit for it */
+static bool lib_aci_send_data_now(aci_state_t *aci_stat, uint8_t pipe, const uint8_t *p_value, uint8_t size)
 {
-  bool ret_val = false;
+  uint8_t *p_cmd;
   aci_cmd_params_send_data_t aci_cmd_params_send_data;
 
-  
-  if(!((p_services_pipe_type_map[pipe-1].pipe_type == ACI_TX) ||
-      (p_services_pipe_type_map[pipe-1].pipe_type == ACI_TX_ACK)))
+  aci_cmd_params_send_data.tx_data.pipe_number = pipe;
+  memcpy(&(aci_cmd_params_send_data.tx_data.aci_data[0]), p_value, size);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_SEND_DATA_BASE_LEN + size);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_send_data(p_cmd, &aci_cmd_params_send_data, size);
+
+  if (!hal_aci_tl_cmd_commit(aci_stat->aci_tl))
+  {
+    return false;
+  }
+  aci_stat->data_credit_available--;
+
+  return true;
+}
+
+static void lib_aci_tx_init(aci_state_t *aci_stat)
+{
+  lib_aci_tx_t *p_tx = &aci_stat->tx;
+  uint8_t i;
+
+  for (i = 0; i < LIB_ACI_TX_BUFFERS; i++)
+  {
+    p_tx->buffers[i].next = (uint8_t)(i + 1);
+  }
+  p_tx->buffers[LIB_ACI_TX_BUFFERS - 1].next = LIB_ACI_TX_NONE;
+  p_tx->free      = 0;
+  p_tx->queued    = 0;
+  p_tx->next_pipe = 1;
+
+  for (i = 0; i <= ACI_DEVICE_MAX_PIPES; i++)
+  {
+    p_tx->head[i] = LIB_ACI_TX_NONE;
+    p_tx->tail[i] = LIB_ACI_TX_NONE;
+  }
+}
+
+/* Sends the queued data while there are credits, one buffer per pipe in turn */
+static void lib_aci_tx_release(aci_state_t *aci_stat)
+{
+  lib_aci_tx_t        *p_tx = &aci_stat->tx;
+  lib_aci_tx_buffer_t *p_buffer;
+  uint8_t              empty_pipes = 0;
+  uint8_t              pipe;
+  uint8_t              index;
+
+  while ((p_tx->queued > 0) && (aci_stat->data_credit_available > 0) && (empty_pipes < ACI_DEVICE_MAX_PIPES))
+  {
+    pipe            = p_tx->next_pipe;
+    p_tx->next_pipe = (pipe < ACI_DEVICE_MAX_PIPES) ? (uint8_t)(pipe + 1) : 1;
+
+    index = p_tx->head[pipe];
+    if (LIB_ACI_TX_NONE == index)
+    {
+      empty_pipes++;
+      continue;
+    }
+
+    // The command queue is full, the next event tries again
+    p_buffer = &p_tx->buffers[index];
+    if (!lib_aci_send_data_now(aci_stat, pipe, &p_buffer->data[0], p_buffer->size))
+    {
+      p_tx->next_pipe = pipe;
+      break;
+    }
+
+    p_tx->head[pipe] = p_buffer->next;
+    if (LIB_ACI_TX_NONE == p_buffer->next)
+    {
+      p_tx->tail[pipe] = LIB_ACI_TX_NONE;
+    }
+    p_buffer->next = p_tx->free;
+    p_tx->free     = index;
+    p_tx->queued--;
+    empty_pipes    = 0;
+  }
+}
+
+static bool lib_aci_pipe_is_tx(aci_state_t *aci_stat, uint8_t pipe)
+{
+  if ((0 == pipe) || (pipe > ACI_DEVICE_MAX_PIPES))
+  {
+    return false;
+  }
+
+  return ((aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_TX) ||
+          (aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_TX_ACK));
+}
+
+bool lib_aci_send_data(aci_state_t *aci_stat, uint8_t pipe, uint8_t *p_value, uint8_t size)
+{
+  lib_aci_tx_t        *p_tx = &aci_stat->tx;
+  lib_aci_tx_buffer_t *p_buffer;
+  uint8_t              index;
+
+  if (!lib_aci_pipe_is_tx(aci_stat, pipe) || lib_aci_stream_busy(aci_stat, pipe))
   {
     return false;
   }
@@ -408,23 +632,325 @@ bool lib_aci_send_data(uint8_t pipe, uint8_t *p_value, uint8_t size)
   {
     return false;
   }
+
+  // Data of the pipe that is already waiting goes first
+  if ((LIB_ACI_TX_NONE == p_tx->head[pipe]) && (aci_stat->data_credit_available > 0) &&
+      lib_aci_send_data_now(aci_stat, pipe, p_value, size))
   {
-      aci_cmd_params_send_data.tx_data.pipe_number = pipe;
-      memcpy(&(aci_cmd_params_send_data.tx_data.aci_data[0]), p_value, size);
-      acil_encode_cmd_send_data(&(msg_to_send.buffer[0]), &aci_cmd_params_send_data, size);
-      
-      ret_val = hal_aci_tl_send(&msg_to_send);          
+    return true;
+  }
+
+  index = p_tx->free;
+  if (LIB_ACI_TX_NONE == index)
+  {
+    return false;
+  }
+  p_buffer   = &p_tx->buffers[index];
+  p_tx->free = p_buffer->next;
+
+  p_buffer->next = LIB_ACI_TX_NONE;
+  p_buffer->size = size;
+  memcpy(&p_buffer->data[0], p_value, size);
+
+  if (LIB_ACI_TX_NONE == p_tx->tail[pipe])
+  {
+    p_tx->head[pipe] = index;
+  }
+  else
+  {
+    p_tx->buffers[p_tx->tail[pipe]].next = index;
+  }
+  p_tx->tail[pipe] = index;
+  p_tx->queued++;
+
+  return true;
+}
+
+static void lib_aci_stream_done(aci_state_t *aci_stat, lib_aci_stream_t *p_stream)
+{
+  const uint8_t pipe = p_stream->pipe;
+
+  // Free before the handler runs, so that it can start the next stream on the pipe
+  p_stream->pipe = 0;
+  if (NULL != p_stream->done_handler)
+  {
+    p_stream->done_handler(aci_stat, pipe, p_stream->offset, p_stream->p_context);
+  }
+}
+
+static void lib_aci_stream_abort(aci_state_t *aci_stat)
+{
+  uint8_t i;
+
+  for (i = 0; i < LIB_ACI_STREAMS; i++)
+  {
+    if (0 != aci_stat->streams[i].pipe)
+    {
+      lib_aci_stream_done(aci_stat, &aci_stat->streams[i]);
+    }
   }
-  return ret_val;
+}
+
+/* Queues a fragment of each stream in turn while there are credits */
+static void lib_aci_stream_pump(aci_state_t *aci_stat)
+{
+  lib_aci_stream_t *p_stream;
+  uint8_t           idle_streams = 0;
+  uint8_t           size;
+
+  while ((aci_stat->data_credit_available > 0) && (idle_streams < LIB_ACI_STREAMS))
+  {
+    p_stream              = &aci_stat->streams[aci_stat->stream_next];
+    aci_stat->stream_next = (uint8_t)((aci_stat->stream_next + 1) % LIB_ACI_STREAMS);
+
+    // The data lib_aci_send_data() queued on the pipe before the stream goes first
+    if ((0 == p_stream->pipe) || (LIB_ACI_TX_NONE != aci_stat->tx.head[p_stream->pipe]))
+    {
+      idle_streams++;
+      continue;
+    }
+
+    size = ((p_stream->length - p_stream->offset) > ACI_PIPE_TX_DATA_MAX_LEN)
+           ? ACI_PIPE_TX_DATA_MAX_LEN
+           : (uint8_t)(p_stream->length - p_stream->offset);
+    if (!lib_aci_send_data_now(aci_stat, p_stream->pipe, &p_stream->p_data[p_stream->offset], size))
+    {
+      // The command queue is full, the next event continues
+      break;
+    }
+    p_stream->offset += size;
+    idle_streams      = 0;
+
+    if (p_stream->offset == p_stream->length)
+    {
+      lib_aci_stream_done(aci_stat, p_stream);
+    }
+  }
+}
+
+bool lib_aci_stream_write(aci_state_t *aci_stat, uint8_t pipe, const uint8_t *p_data, uint16_t length,
+                          lib_aci_stream_done_t done_handler, void *p_context)
+{
+  lib_aci_stream_t *p_stream = NULL;
+  uint8_t           i;
+
+  if (!lib_aci_pipe_is_tx(aci_stat, pipe) || (0 == length) || lib_aci_stream_busy(aci_stat, pipe))
+  {
+    return false;
+  }
+
+  for (i = 0; (NULL == p_stream) && (i < LIB_ACI_STREAMS); i++)
+  {
+    if (0 == aci_stat->streams[i].pipe)
+    {
+      p_stream = &aci_stat->streams[i];
+    }
+  }
+  if (NULL == p_stream)
+  {
+    return false;
+  }
+
+  p_stream->p_data       = p_data;
+  p_stream->length       = length;
+  p_stream->offset       = 0;
+  p_stream->done_handler = done_handler;
+  p_stream->p_context    = p_context;
+  p_stream->pipe         = pipe;
+
+  lib_aci_stream_pump(aci_stat);
+
+  return true;
+}
+
+static lib_aci_rx_frame_t * lib_aci_rx_frame_get(aci_state_t *aci_stat, uint8_t pipe)
+{
+  uint8_t i;
+
+  for (i = 0; i < LIB_ACI_RX_FRAMED_PIPES; i++)
+  {
+    if ((0 != pipe) && (pipe == aci_stat->rx_frames[i].pipe))
+    {
+      return &aci_stat->rx_frames[i];
+    }
+  }
+
+  return NULL;
+}
+
+bool lib_aci_rx_framing_set(aci_state_t *aci_stat, uint8_t pipe, uint8_t *p_buffer, uint16_t size,
+                            lib_aci_rx_message_t handler, void *p_context)
+{
+  lib_aci_rx_frame_t *p_frame = lib_aci_rx_frame_get(aci_stat, pipe);
+  uint8_t             i;
+
+  if ((0 == pipe) || (pipe > ACI_DEVICE_MAX_PIPES))
+  {
+    return false;
+  }
+
+  if (NULL == handler)
+  {
+    if (NULL != p_frame)
+    {
+      p_frame->pipe = 0;
+    }
+    return true;
+  }
+
+  for (i = 0; (NULL == p_frame) && (i < LIB_ACI_RX_FRAMED_PIPES); i++)
+  {
+    if (0 == aci_stat->rx_frames[i].pipe)
+    {
+      p_frame = &aci_stat->rx_frames[i];
+    }
+  }
+  if (NULL == p_frame)
+  {
+    return false;
+  }
+
+  p_frame->p_buffer  = p_buffer;
+  p_frame->size      = (NULL != p_buffer) ? size : 0;
+  p_frame->length    = 0;
+  p_frame->received  = 0;
+  p_frame->handler   = handler;
+  p_frame->p_context = p_context;
+  p_frame->errors    = 0;
+  p_frame->seq       = 0;
+  p_frame->pipe      = pipe;
+
+  return true;
+}
+
+uint16_t lib_aci_rx_framing_errors_get(aci_state_t *aci_stat, uint8_t pipe)
+{
+  lib_aci_rx_frame_t *p_frame = lib_aci_rx_frame_get(aci_stat, pipe);
+
+  return (NULL != p_frame) ? p_frame->errors : 0;
+}
+
+/* Takes the fragment of a framed pipe out of a DataReceived event, returns false for other events */
+static bool lib_aci_rx_frame(aci_state_t *aci_stat, const uint8_t *p_evt)
+{
+  aci_evt_view_data_received_t data_received;
+  lib_aci_rx_frame_t          *p_frame;
+  const uint8_t               *p_data;
+  uint8_t                      data_len;
+  uint8_t                      header;
+
+  if (!aci_evt_view_data_received(p_evt, &data_received))
+  {
+    return false;
+  }
+
+  p_frame = lib_aci_rx_frame_get(aci_stat, aci_evt_data_received_pipe_number(&data_received));
+  if (NULL == p_frame)
+  {
+    return false;
+  }
+
+  p_data   = aci_evt_data_received_data(&data_received);
+  data_len = aci_evt_data_received_data_len(&data_received);
+  if ((data_len < LIB_ACI_RX_FRAME_HEADER_LEN) || (data_len > ACI_PIPE_RX_DATA_MAX_LEN))
+  {
+    p_frame->errors++;
+    return true;
+  }
+  header   = p_data[0];
+
+  if (0 != (header & LIB_ACI_RX_FRAME_START))
+  {
+    // A message that was not complete is lost
+    if (0 != p_frame->length)
+    {
+      p_frame->errors++;
+    }
+    if (data_len < LIB_ACI_RX_FRAME_START_LEN)
+    {
+      p_frame->length = 0;
+      p_frame->errors++;
+      return true;
+    }
+    p_frame->length   = (uint16_t)(p_data[1] | (p_data[2] << 8));
+    p_frame->received = 0;
+    p_data           += LIB_ACI_RX_FRAME_START_LEN;
+    data_len         -= LIB_ACI_RX_FRAME_START_LEN;
+
+    // A message in a single fragment is handed over from the event
+    if (p_frame->length == data_len)
+    {
+      p_frame->length = 0;
+      p_frame->seq    = (uint8_t)((header + 1) & LIB_ACI_RX_FRAME_SEQ_MASK);
+      p_frame->handler(aci_stat, p_frame->pipe, p_data, data_len, p_frame->p_context);
+      return true;
+    }
+  }
+  else
+  {
+    // Without the start of the message the fragments are dropped until the next start
+    if (0 == p_frame->length)
+    {
+      return true;
+    }
+    if ((header & LIB_ACI_RX_FRAME_SEQ_MASK) != p_frame->seq)
+    {
+      p_frame->length = 0;
+      p_frame->errors++;
+      return true;
+    }
+    p_data   += LIB_ACI_RX_FRAME_HEADER_LEN;
+    data_len -= LIB_ACI_RX_FRAME_HEADER_LEN;
+  }
+  p_frame->seq = (uint8_t)((header + 1) & LIB_ACI_RX_FRAME_SEQ_MASK);
+
+  if ((p_frame->length > p_frame->size) || ((p_frame->received + data_len) > p_frame->length))
+  {
+    p_frame->length = 0;
+    p_frame->errors++;
+    return true;
+  }
+
+  memcpy(&p_frame->p_buffer[p_frame->received], p_data, data_len);
+  p_frame->received += data_len;
+
+  if (p_frame->received == p_frame->length)
+  {
+    p_frame->length = 0;
+    p_frame->handler(aci_stat, p_frame->pipe, p_frame->p_buffer, p_frame->received, p_frame->p_context);
+  }
+
+  return true;
+}
+
+bool lib_aci_stream_busy(aci_state_t *aci_stat, uint8_t pipe)
+{
+  uint8_t i;
+
+  if (0 == pipe)
+  {
+    return false;
+  }
+
+  for (i = 0; i < LIB_ACI_STREAMS; i++)
+  {
+    if (pipe == aci_stat->streams[i].pipe)
+    {
+      return true;
+    }
+  }
+
+  return false;
 }
 
 
 bool lib_aci_request_data(aci_state_t *aci_stat, uint8_t pipe)
 {
+  uint8_t *p_cmd;
   bool ret_val = false;
   aci_cmd_params_request_data_t aci_cmd_params_request_data;
 
-  if(!((p_services_pipe_type_map[pipe-1].location == ACI_STORE_REMOTE)&&(p_services_pipe_type_map[pipe-1].pipe_type == ACI_RX_REQ)))
+  if(!((aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].location == ACI_STORE_REMOTE)&&(aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_RX_REQ)))
   {
     return false;
   }
@@ -437,43 +963,61 @@ bool lib_aci_request_data(aci_state_t *aci_stat, uint8_t pipe)
 
 
       aci_cmd_params_request_data.pipe_number = pipe;
-      acil_encode_cmd_request_data(&(msg_to_send.buffer[0]), &aci_cmd_params_request_data);
-
-      ret_val = hal_aci_tl_send(&msg_to_send);
+      p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_DATA_REQUEST_LEN);
+      if (NULL == p_cmd)
+      {
+        return false;
+      }
+      acil_encode_cmd_request_data(p_cmd, &aci_cmd_params_request_data);
+
+      ret_val = hal_aci_tl_cmd_commit(aci_stat->aci_tl);
     }
   }
   return ret_val;
 }
 
 
-bool lib_aci_change_timing(uint16_t minimun_cx_interval, uint16_t maximum_cx_interval, uint16_t slave_latency, uint16_t timeout)
+bool lib_aci_change_timing(aci_state_t *aci_stat, uint16_t minimun_cx_interval, uint16_t maximum_cx_interval, uint16_t slave_latency, uint16_t timeout)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_change_timing_t aci_cmd_params_change_timing;
   aci_cmd_params_change_timing.conn_params.min_conn_interval = minimun_cx_interval;
   aci_cmd_params_change_timing.conn_params.max_conn_interval = maximum_cx_interval;
   aci_cmd_params_change_timing.conn_params.slave_latency     = slave_latency;    
   aci_cmd_params_change_timing.conn_params.timeout_mult      = timeout;     
-  acil_encode_cmd_change_timing_req(&(msg_to_send.buffer[0]), &aci_cmd_params_change_timing);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_CHANGE_TIMING_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_change_timing_req(p_cmd, &aci_cmd_params_change_timing);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_change_timing_GAP_PPCP()
+bool lib_aci_change_timing_GAP_PPCP(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_change_timing_req_GAP_PPCP(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_CHANGE_TIMING_LEN_GAP_PPCP);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_change_timing_req_GAP_PPCP(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
 bool lib_aci_open_remote_pipe(aci_state_t *aci_stat, uint8_t pipe)
 {
+  uint8_t *p_cmd;
   bool ret_val = false;
   aci_cmd_params_open_remote_pipe_t aci_cmd_params_open_remote_pipe;
 
-  if(!((p_services_pipe_type_map[pipe-1].location == ACI_STORE_REMOTE)&&
-                ((p_services_pipe_type_map[pipe-1].pipe_type == ACI_RX)||
-                (p_services_pipe_type_map[pipe-1].pipe_type == ACI_RX_ACK_AUTO)||
-                (p_services_pipe_type_map[pipe-1].pipe_type == ACI_RX_ACK))))
+  if(!((aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].location == ACI_STORE_REMOTE)&&
+                ((aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_RX)||
+                (aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_RX_ACK_AUTO)||
+                (aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_RX_ACK))))
   {
     return false;
   }
@@ -485,8 +1029,13 @@ bool lib_aci_open_remote_pipe(aci_state_t *aci_stat, uint8_t pipe)
 //    is_open_remote_pipe_pending = true;
 //    request_operation_pipe = pipe;
     aci_cmd_params_open_remote_pipe.pipe_number = pipe;
-    acil_encode_cmd_open_remote_pipe(&(msg_to_send.buffer[0]), &aci_cmd_params_open_remote_pipe);
-    ret_val = hal_aci_tl_send(&msg_to_send);
+    p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_OPEN_REMOTE_PIPE_LEN);
+    if (NULL == p_cmd)
+    {
+      return false;
+    }
+    acil_encode_cmd_open_remote_pipe(p_cmd, &aci_cmd_params_open_remote_pipe);
+    ret_val = hal_aci_tl_cmd_commit(aci_stat->aci_tl);
   }
   return ret_val;
 }
@@ -494,13 +1043,14 @@ bool lib_aci_open_remote_pipe(aci_state_t *aci_stat, uint8_t pipe)
 
 bool lib_aci_close_remote_pipe(aci_state_t *aci_stat, uint8_t pipe)
 {
+  uint8_t *p_cmd;
   bool ret_val = false;
   aci_cmd_params_close_remote_pipe_t aci_cmd_params_close_remote_pipe;
 
-  if(!((p_services_pipe_type_map[pipe-1].location == ACI_STORE_REMOTE)&&
-        ((p_services_pipe_type_map[pipe-1].pipe_type == ACI_RX)||
-         (p_services_pipe_type_map[pipe-1].pipe_type == ACI_RX_ACK_AUTO)||
-         (p_services_pipe_type_map[pipe-1].pipe_type == ACI_RX_ACK))))
+  if(!((aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].location == ACI_STORE_REMOTE)&&
+        ((aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_RX)||
+         (aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_RX_ACK_AUTO)||
+         (aci_stat->aci_setup_info.services_pipe_type_mapping[pipe-1].pipe_type == ACI_RX_ACK))))
   {
     return false;
   }  
@@ -512,25 +1062,53 @@ bool lib_aci_close_remote_pipe(aci_state_t *aci_stat, uint8_t pipe)
 //    is_close_remote_pipe_pending = true;
 //    request_operation_pipe = pipe;
     aci_cmd_params_close_remote_pipe.pipe_number = pipe;
-    acil_encode_cmd_close_remote_pipe(&(msg_to_send.buffer[0]), &aci_cmd_params_close_remote_pipe);
-    ret_val = hal_aci_tl_send(&msg_to_send);
+    p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_CLOSE_REMOTE_PIPE_LEN);
+    if (NULL == p_cmd)
+    {
+      return false;
+    }
+    acil_encode_cmd_close_remote_pipe(p_cmd, &aci_cmd_params_close_remote_pipe);
+    ret_val = hal_aci_tl_cmd_commit(aci_stat->aci_tl);
   }
   return ret_val;
 }
 
 
-bool lib_aci_set_key(aci_key_type_t key_rsp_type, uint8_t *key, uint8_t len)
+bool lib_aci_set_key(aci_state_t *aci_stat, aci_key_type_t key_rsp_type, uint8_t *key, uint8_t len)
 {
+  uint8_t *p_cmd;
+  uint8_t length;
   aci_cmd_params_set_key_t aci_cmd_params_set_key;
+
+  /* acil_encode_cmd_set_key() only knows how to encode these two key types */
+  if (ACI_KEY_TYPE_INVALID == key_rsp_type)
+  {
+    length = MSG_SET_KEY_REJECT_LEN;
+  }
+  else if (ACI_KEY_TYPE_PASSKEY == key_rsp_type)
+  {
+    length = MSG_SET_KEY_PASSKEY_LEN;
+  }
+  else
+  {
+    return false;
+  }
+
   aci_cmd_params_set_key.key_type = key_rsp_type;
   memcpy((uint8_t*)&(aci_cmd_params_set_key.key), key, len);
-  acil_encode_cmd_set_key(&(msg_to_send.buffer[0]), &aci_cmd_params_set_key);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, length);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_set_key(p_cmd, &aci_cmd_params_set_key);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_echo_msg(uint8_t msg_size, uint8_t *p_msg_data)
+bool lib_aci_echo_msg(aci_state_t *aci_stat, uint8_t msg_size, uint8_t *p_msg_data)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_echo_t aci_cmd_params_echo;
   if(msg_size > (ACI_ECHO_DATA_MAX_LEN))
   {
@@ -543,95 +1121,438 @@ bool lib_aci_echo_msg(uint8_t msg_size, uint8_t *p_msg_data)
   }
 
   memcpy(&(aci_cmd_params_echo.echo_data[0]), p_msg_data, msg_size);
-  acil_encode_cmd_echo_msg(&(msg_to_send.buffer[0]), &aci_cmd_params_echo, msg_size);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_ECHO_MSG_CMD_BASE_LEN + msg_size);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_echo_msg(p_cmd, &aci_cmd_params_echo, msg_size);
 
-  return hal_aci_tl_send(&msg_to_send);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_bond_request()
+/*
+  Sends one echo of ACI_ECHO_DATA_MAX_LEN bytes and waits for it to come back.
+  Returns true if the echo came back intact.
+*/
+static bool lib_aci_spi_echo_check(aci_state_t *aci_stat, uint8_t seed)
 {
-  acil_encode_cmd_bond_security_request(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t        echo_data[ACI_ECHO_DATA_MAX_LEN];
+  hal_aci_evt_t  aci_data;
+  uint32_t       start;
+  uint8_t        i;
+
+  for (i = 0; i < ACI_ECHO_DATA_MAX_LEN; i++)
+  {
+    // Alternate bit patterns and vary them between round trips
+    echo_data[i] = (uint8_t)(((i & 0x01) ? 0xAA : 0x55) ^ (seed + i));
+  }
+
+  if (!lib_aci_echo_msg(aci_stat, ACI_ECHO_DATA_MAX_LEN, &echo_data[0]))
+  {
+    return false;
+  }
+
+  start = efm_lf_ticks_get();
+  while ((efm_lf_ticks_get() - start) < EFM_LF_MS_TO_TICKS(LIB_ACI_SPI_NEGOTIATE_TIMEOUT_MS))
+  {
+    if (lib_aci_event_get(aci_stat, &aci_data))
+    {
+      return ((ACI_EVT_ECHO == aci_data.evt.evt_opcode) &&
+              ((ACI_ECHO_DATA_MAX_LEN + 1) == aci_data.evt.len) &&
+              (0 == memcmp(&echo_data[0], &(aci_data.evt.params.echo.echo_data[0]), ACI_ECHO_DATA_MAX_LEN)));
+    }
+  }
+
+  return false;
 }
 
-bool lib_aci_event_peek(hal_aci_evt_t *p_aci_evt_data)
+bool lib_aci_spi_clock_negotiate(aci_state_t *aci_stat)
 {
-  return hal_aci_tl_event_peek((hal_aci_data_t *)p_aci_evt_data);
+  uint8_t  best_divider = aci_stat->aci_pins.spi_clock_divider;
+  uint32_t best_rate    = 0;
+  uint32_t rate;
+  uint8_t  i;
+  uint8_t  echo;
+
+  aci_stat->spi_echo_errors = 0;
+
+  for (i = 0; i < sizeof(spi_clock_divider_candidates); i++)
+  {
+    rate = hal_aci_tl_spi_clock_divider_set(aci_stat->aci_tl, spi_clock_divider_candidates[i]);
+
+    // The rate is capped at 3 MHz, so the smaller divisors may not be any faster
+    if (rate <= best_rate)
+    {
+      continue;
+    }
+
+    for (echo = 0; echo < LIB_ACI_SPI_NEGOTIATE_ECHO_COUNT; echo++)
+    {
+      if (!lib_aci_spi_echo_check(aci_stat, (uint8_t)(i + echo)))
+      {
+        aci_stat->spi_echo_errors++;
+        break;
+      }
+    }
+
+    if (echo < LIB_ACI_SPI_NEGOTIATE_ECHO_COUNT)
+    {
+      // Faster rates will not do any better
+      break;
+    }
+
+    best_rate    = rate;
+    best_divider = spi_clock_divider_candidates[i];
+  }
+
+  hal_aci_tl_spi_clock_divider_set(aci_stat->aci_tl, best_divider);
+
+  if (0 != aci_stat->spi_echo_errors)
+  {
+    /* A corrupted transfer may leave an echo in flight, discard anything that arrives late until
+       the ACI is quiet, bounded in case the device keeps sending */
+    hal_aci_evt_t  aci_data;
+    const uint32_t start = efm_lf_ticks_get();
+    uint32_t       quiet = start;
+
+    while (((efm_lf_ticks_get() - quiet) < EFM_LF_MS_TO_TICKS(LIB_ACI_SPI_NEGOTIATE_TIMEOUT_MS)) &&
+           ((efm_lf_ticks_get() - start) < EFM_LF_MS_TO_TICKS(4 * LIB_ACI_SPI_NEGOTIATE_TIMEOUT_MS)))
+    {
+      if (lib_aci_event_get(aci_stat, &aci_data))
+      {
+        quiet = efm_lf_ticks_get();
+      }
+    }
+  }
+
+  return (0 != best_rate);
 }
 
-bool lib_aci_event_get(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data)
+uint32_t lib_aci_spi_clock_get(aci_state_t *aci_stat)
 {
-  bool status = false;
-  
-  status = hal_aci_tl_event_get((hal_aci_data_t *)p_aci_evt_data);
-  
-  /**
-  Update the state of the ACI with the 
-  ACI Events -> Pipe Status, Disconnected, Connected, Bond Status, Pipe Error
-  */
-  if (true == status)
+  return hal_aci_tl_spi_baudrate_get(aci_stat->aci_tl);
+}
+
+uint16_t lib_aci_spi_echo_errors_get(aci_state_t *aci_stat)
+{
+  return aci_stat->spi_echo_errors;
+}
+
+bool lib_aci_bond_request(aci_state_t *aci_stat)
+{
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_BOND_SECURITY_REQUEST_LEN);
+  if (NULL == p_cmd)
   {
-    aci_evt_t * aci_evt;
-    
-    aci_evt = &p_aci_evt_data->evt;  
-    
-    switch(aci_evt->evt_opcode)
-    {
-        case ACI_EVT_PIPE_STATUS:
-            {
-                uint8_t i=0;
-                
-                for (i=0; i < PIPES_ARRAY_SIZE; i++)
-                {
-                  aci_stat->pipes_open_bitmap[i]   = aci_evt->params.pipe_status.pipes_open_bitmap[i];
-                  aci_stat->pipes_closed_bitmap[i] = aci_evt->params.pipe_status.pipes_closed_bitmap[i];
-                }
-            }
-            break;
-        
-        case ACI_EVT_DISCONNECTED:
-            {
-                uint8_t i=0;
-                
-                for (i=0; i < PIPES_ARRAY_SIZE; i++)
-                {
-                  aci_stat->pipes_open_bitmap[i] = 0;
-                  aci_stat->pipes_closed_bitmap[i] = 0;
-                }
-                aci_stat->confirmation_pending = false;
+    return false;
+  }
+  acil_encode_cmd_bond_security_request(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
+}
+
+bool lib_aci_event_peek(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data)
+{
+  return hal_aci_tl_event_peek(aci_stat->aci_tl, (hal_aci_data_t *)p_aci_evt_data);
+}
+
+/**
+Update the state of the ACI with the 
+ACI Events -> Device Started, Pipe Status, Disconnected, Timing, Data Credit, Pipe Error
+*/
+static void lib_aci_event_state_update(aci_state_t *aci_stat, const uint8_t *p_evt)
+{
+  switch(aci_evt_view_opcode(p_evt))
+  {
+      case ACI_EVT_DEVICE_STARTED:
+          {
+              aci_evt_view_device_started_t device_started;
+
+              if (aci_evt_view_device_started(p_evt, &device_started))
+              {
+                aci_stat->data_credit_total     = aci_evt_device_started_credit_available(&device_started);
                 aci_stat->data_credit_available = aci_stat->data_credit_total;
-                
-            }
-            break;
-            
-        case ACI_EVT_TIMING:            
-                aci_stat->connection_interval = aci_evt->params.timing.conn_rf_interval;
-                aci_stat->slave_latency       = aci_evt->params.timing.conn_slave_rf_latency;
-                aci_stat->supervision_timeout = aci_evt->params.timing.conn_rf_timeout;
-            break;
-
-        default:
-            /* Need default case to avoid compiler warnings about missing enum
-             * values on some platforms.
-             */
-            break;
+              }
+          }
+          break;
+
+      case ACI_EVT_DATA_CREDIT:
+          {
+              aci_evt_view_data_credit_t data_credit;
+
+              if (aci_evt_view_data_credit(p_evt, &data_credit))
+              {
+                aci_stat->data_credit_available += aci_evt_data_credit_credit(&data_credit);
+              }
+          }
+          break;
+
+      case ACI_EVT_PIPE_ERROR:
+          {
+              aci_evt_view_pipe_error_t pipe_error;
+
+              // The data was not sent, except for an Attribute protocol Error Response from the peer,
+              // which does not return the credit
+              if (aci_evt_view_pipe_error(p_evt, &pipe_error) &&
+                  (ACI_STATUS_ERROR_PEER_ATT_ERROR != aci_evt_pipe_error_error_code(&pipe_error)))
+              {
+                aci_stat->data_credit_available++;
+              }
+          }
+          break;
+
+      case ACI_EVT_PIPE_STATUS:
+          {
+              aci_evt_view_pipe_status_t pipe_status;
+
+              if (aci_evt_view_pipe_status(p_evt, &pipe_status))
+              {
+                memcpy(aci_stat->pipes_open_bitmap, aci_evt_pipe_status_pipes_open_bitmap(&pipe_status), PIPES_ARRAY_SIZE);
+                memcpy(aci_stat->pipes_closed_bitmap, aci_evt_pipe_status_pipes_closed_bitmap(&pipe_status), PIPES_ARRAY_SIZE);
+              }
+          }
+          break;
+      
+      case ACI_EVT_DISCONNECTED:
+          {
+              uint8_t i=0;
+              
+              for (i=0; i < PIPES_ARRAY_SIZE; i++)
+              {
+                aci_stat->pipes_open_bitmap[i] = 0;
+                aci_stat->pipes_closed_bitmap[i] = 0;
+              }
+              aci_stat->confirmation_pending = false;
+              aci_stat->data_credit_available = aci_stat->data_credit_total;
+              lib_aci_tx_init(aci_stat);
+              lib_aci_stream_abort(aci_stat);
+              for (i=0; i < LIB_ACI_RX_FRAMED_PIPES; i++)
+              {
+                aci_stat->rx_frames[i].length = 0;
+              }
+              
+          }
+          break;
+          
+      case ACI_EVT_TIMING:            
+          {
+              aci_evt_view_timing_t timing;
+
+              if (aci_evt_view_timing(p_evt, &timing))
+              {
+                aci_stat->connection_interval = aci_evt_timing_conn_rf_interval(&timing);
+                aci_stat->slave_latency       = aci_evt_timing_conn_slave_rf_latency(&timing);
+                aci_stat->supervision_timeout = aci_evt_timing_conn_rf_timeout(&timing);
+              }
+          }
+          break;
+
+      default:
+          /* Need default case to avoid compiler warnings about missing enum
+           * values on some platforms.
+           */
+          break;
 
 			
 			
+  }
+}
+
+hal_aci_evt_t * lib_aci_event_peek_slot(aci_state_t *aci_stat)
+{
+  return (hal_aci_evt_t *)hal_aci_tl_event_peek_slot(aci_stat->aci_tl);
+}
+
+hal_aci_evt_t * lib_aci_event_get_slot(aci_state_t *aci_stat)
+{
+  hal_aci_evt_t *p_aci_evt_data;
+
+  ACI_PROBE_ENTER(ACI_PROBE_EVENT_GET_SLOT);
+  for (;;)
+  {
+    p_aci_evt_data = (hal_aci_evt_t *)hal_aci_tl_event_peek_slot(aci_stat->aci_tl);
+    if ((NULL == p_aci_evt_data) || aci_stat->event_updated)
+    {
+      break;
     }
+    lib_aci_event_state_update(aci_stat, aci_evt_view_raw(&p_aci_evt_data->evt));
+
+    // The fragments of the framed pipes are not passed on
+    if (!lib_aci_rx_frame(aci_stat, aci_evt_view_raw(&p_aci_evt_data->evt)))
+    {
+      // Handed out until lib_aci_event_release(), getting it again does not update the state again
+      aci_stat->event_updated = true;
+      break;
+    }
+    hal_aci_tl_event_release(aci_stat->aci_tl);
+  }
+  lib_aci_tx_release(aci_stat);
+  lib_aci_stream_pump(aci_stat);
+
+  ACI_PROBE_EXIT(ACI_PROBE_EVENT_GET_SLOT);
+  return p_aci_evt_data;
+}
+
+void lib_aci_event_release(aci_state_t *aci_stat)
+{
+  aci_stat->event_updated = false;
+  hal_aci_tl_event_release(aci_stat->aci_tl);
+}
+
+bool lib_aci_event_get(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data)
+{
+  hal_aci_evt_t *p_slot;
+
+  ACI_PROBE_ENTER(ACI_PROBE_EVENT_GET);
+  p_slot = lib_aci_event_get_slot(aci_stat);
+  if (NULL == p_slot)
+  {
+    ACI_PROBE_EXIT(ACI_PROBE_EVENT_GET);
+    return false;
+  }
+
+  memcpy(p_aci_evt_data, p_slot, sizeof(hal_aci_evt_t));
+  lib_aci_event_release(aci_stat);
+
+  ACI_PROBE_EXIT(ACI_PROBE_EVENT_GET);
+  return true;
+}
+
+bool lib_aci_evt_handler_set(aci_state_t *aci_stat, aci_evt_opcode_t evt_opcode,
+                             lib_aci_evt_handler_t handler, void *p_context)
+{
+  lib_aci_evt_handler_entry_t *p_entry;
+
+  if ((evt_opcode < ACI_EVT_DEVICE_STARTED) || (evt_opcode > ACI_EVT_KEY_REQUEST))
+  {
+    return false;
+  }
+
+  p_entry = &aci_stat->dispatch.evt_handlers[evt_opcode - ACI_EVT_DEVICE_STARTED];
+  p_entry->handler   = handler;
+  p_entry->p_context = p_context;
+
+  return true;
+}
+
+bool lib_aci_pipe_handler_set(aci_state_t *aci_stat, uint8_t pipe,
+                              lib_aci_evt_handler_t handler, void *p_context)
+{
+  lib_aci_evt_handler_entry_t *p_entry;
+
+  if ((0 == pipe) || (pipe > ACI_DEVICE_MAX_PIPES))
+  {
+    return false;
+  }
+
+  p_entry = &aci_stat->dispatch.pipe_handlers[pipe];
+  p_entry->handler   = handler;
+  p_entry->p_context = p_context;
+
+  return true;
+}
+
+bool lib_aci_event_dispatch(aci_state_t *aci_stat)
+{
+  hal_aci_evt_t                     *p_aci_evt_data;
+  const uint8_t                     *p_evt;
+  const lib_aci_evt_handler_entry_t *p_entry = NULL;
+  uint8_t                            pipe    = 0;
+  aci_evt_opcode_t                   evt_opcode;
+
+  ACI_PROBE_ENTER(ACI_PROBE_EVENT_DISPATCH);
+  p_aci_evt_data = lib_aci_event_get_slot(aci_stat);
+  if (NULL == p_aci_evt_data)
+  {
+    ACI_PROBE_EXIT(ACI_PROBE_EVENT_DISPATCH);
+    return false;
+  }
+  p_evt      = aci_evt_view_raw(&p_aci_evt_data->evt);
+  evt_opcode = aci_evt_view_opcode(p_evt);
+
+  switch (evt_opcode)
+  {
+    case ACI_EVT_DATA_RECEIVED:
+      {
+        aci_evt_view_data_received_t data_received;
+
+        if (aci_evt_view_data_received(p_evt, &data_received))
+        {
+          pipe = aci_evt_data_received_pipe_number(&data_received);
+        }
+      }
+      break;
+
+    case ACI_EVT_DATA_ACK:
+      {
+        aci_evt_view_data_ack_t data_ack;
+
+        if (aci_evt_view_data_ack(p_evt, &data_ack))
+        {
+          pipe = aci_evt_data_ack_pipe_number(&data_ack);
+        }
+      }
+      break;
+
+    case ACI_EVT_PIPE_ERROR:
+      {
+        aci_evt_view_pipe_error_t pipe_error;
+
+        if (aci_evt_view_pipe_error(p_evt, &pipe_error))
+        {
+          pipe = aci_evt_pipe_error_pipe_number(&pipe_error);
+        }
+      }
+      break;
+
+    default:
+      break;
   }
-  return status;
+
+  if ((0 != pipe) && (pipe <= ACI_DEVICE_MAX_PIPES) && (NULL != aci_stat->dispatch.pipe_handlers[pipe].handler))
+  {
+    p_entry = &aci_stat->dispatch.pipe_handlers[pipe];
+  }
+  else if ((evt_opcode >= ACI_EVT_DEVICE_STARTED) && (evt_opcode <= ACI_EVT_KEY_REQUEST))
+  {
+    p_entry = &aci_stat->dispatch.evt_handlers[evt_opcode - ACI_EVT_DEVICE_STARTED];
+  }
+
+  if ((NULL != p_entry) && (NULL != p_entry->handler))
+  {
+    p_entry->handler(aci_stat, &p_aci_evt_data->evt, p_entry->p_context);
+  }
+  else
+  {
+    aci_stat->dispatch.unhandled++;
+  }
+
+  lib_aci_event_release(aci_stat);
+
+  ACI_PROBE_EXIT(ACI_PROBE_EVENT_DISPATCH);
+  return true;
+}
+
+uint32_t lib_aci_unhandled_events_get(aci_state_t *aci_stat)
+{
+  return aci_stat->dispatch.unhandled;
 }
 
 
 bool lib_aci_send_ack(aci_state_t *aci_stat, const uint8_t pipe)
 {
+  uint8_t *p_cmd;
   bool ret_val = false;
   {
-    acil_encode_cmd_send_data_ack(&(msg_to_send.buffer[0]), pipe);
+    p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_ACK_LEN);
+    if (NULL == p_cmd)
+    {
+      return false;
+    }
+    acil_encode_cmd_send_data_ack(p_cmd, pipe);
     
-    ret_val = hal_aci_tl_send(&msg_to_send);
+    ret_val = hal_aci_tl_cmd_commit(aci_stat->aci_tl);
   }
   return ret_val;
 }
@@ -639,19 +1560,26 @@ bool lib_aci_send_ack(aci_state_t *aci_stat, const uint8_t pipe)
 
 bool lib_aci_send_nack(aci_state_t *aci_stat, const uint8_t pipe, const uint8_t error_code)
 {
+  uint8_t *p_cmd;
   bool ret_val = false;
   
   {
     
-    acil_encode_cmd_send_data_nack(&(msg_to_send.buffer[0]), pipe, error_code);
-    ret_val = hal_aci_tl_send(&msg_to_send);
+    p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_NACK_LEN);
+    if (NULL == p_cmd)
+    {
+      return false;
+    }
+    acil_encode_cmd_send_data_nack(p_cmd, pipe, error_code);
+    ret_val = hal_aci_tl_cmd_commit(aci_stat->aci_tl);
   }
   return ret_val;
 }
 
 
-bool lib_aci_broadcast(const uint16_t timeout, const uint16_t adv_interval)
+bool lib_aci_broadcast(aci_state_t *aci_stat, const uint16_t timeout, const uint16_t adv_interval)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_broadcast_t aci_cmd_params_broadcast;
   if (timeout > 16383)
   {
@@ -667,88 +1595,202 @@ bool lib_aci_broadcast(const uint16_t timeout, const uint16_t adv_interval)
 
   aci_cmd_params_broadcast.timeout = timeout;
   aci_cmd_params_broadcast.adv_interval = adv_interval;
-  acil_encode_cmd_broadcast(&(msg_to_send.buffer[0]), &aci_cmd_params_broadcast);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_BROADCAST_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_broadcast(p_cmd, &aci_cmd_params_broadcast);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_open_adv_pipes(const uint8_t * const adv_service_data_pipes)
+bool lib_aci_open_adv_pipes(aci_state_t *aci_stat, const uint8_t * const adv_service_data_pipes)
 {
+  uint8_t *p_cmd;
   uint8_t i;
     
   for (i = 0; i < PIPES_ARRAY_SIZE; i++)
   {
-    aci_cmd_params_open_adv_pipe.pipes[i] = adv_service_data_pipes[i];
+    aci_stat->aci_cmd_params_open_adv_pipe.pipes[i] = adv_service_data_pipes[i];
   }
 
-  acil_encode_cmd_open_adv_pipes(&(msg_to_send.buffer[0]), &aci_cmd_params_open_adv_pipe);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_OPEN_ADV_PIPES_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_open_adv_pipes(p_cmd, &aci_stat->aci_cmd_params_open_adv_pipe);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
-bool lib_aci_open_adv_pipe(const uint8_t pipe)
+bool lib_aci_open_adv_pipe(aci_state_t *aci_stat, const uint8_t pipe)
 {
+  uint8_t *p_cmd;
   uint8_t byte_idx = pipe / 8;
   
-  aci_cmd_params_open_adv_pipe.pipes[byte_idx] |= (0x01 << (pipe % 8));
-  acil_encode_cmd_open_adv_pipes(&(msg_to_send.buffer[0]), &aci_cmd_params_open_adv_pipe);
-  return hal_aci_tl_send(&msg_to_send);
+  aci_stat->aci_cmd_params_open_adv_pipe.pipes[byte_idx] |= (0x01 << (pipe % 8));
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_OPEN_ADV_PIPES_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_open_adv_pipes(p_cmd, &aci_stat->aci_cmd_params_open_adv_pipe);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_read_dynamic_data()
+bool lib_aci_read_dynamic_data(aci_state_t *aci_stat)
 {
-  acil_encode_cmd_read_dynamic_data(&(msg_to_send.buffer[0]));
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_READ_DYNAMIC_DATA_LEN);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_read_dynamic_data(p_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
 
-bool lib_aci_write_dynamic_data(uint8_t sequence_number, uint8_t* dynamic_data, uint8_t length)
+bool lib_aci_write_dynamic_data(aci_state_t *aci_stat, uint8_t sequence_number, uint8_t* dynamic_data, uint8_t length)
 {
-  acil_encode_cmd_write_dynamic_data(&(msg_to_send.buffer[0]), sequence_number, dynamic_data, length);
-  return hal_aci_tl_send(&msg_to_send);
+  uint8_t *p_cmd;
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_WRITE_DYNAMIC_DATA_BASE_LEN + length);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_write_dynamic_data(p_cmd, sequence_number, dynamic_data, length);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
 }
 
-bool lib_aci_dtm_command(uint8_t dtm_command_msbyte, uint8_t dtm_command_lsbyte)
+bool lib_aci_dtm_command(aci_state_t *aci_stat, uint8_t dtm_command_msbyte, uint8_t dtm_command_lsbyte)
 {
+  uint8_t *p_cmd;
   aci_cmd_params_dtm_cmd_t aci_cmd_params_dtm_cmd;
   aci_cmd_params_dtm_cmd.cmd_msb = dtm_command_msbyte;
   aci_cmd_params_dtm_cmd.cmd_lsb = dtm_command_lsbyte;
-  acil_encode_cmd_dtm_cmd(&(msg_to_send.buffer[0]), &aci_cmd_params_dtm_cmd);
-  return hal_aci_tl_send(&msg_to_send);
+  p_cmd = lib_aci_cmd_reserve(aci_stat, MSG_DTM_CMD);
+  if (NULL == p_cmd)
+  {
+    return false;
+  }
+  acil_encode_cmd_dtm_cmd(p_cmd, &aci_cmd_params_dtm_cmd);
+  return hal_aci_tl_cmd_commit(aci_stat->aci_tl);
+}
+
+uint8_t lib_aci_pump(aci_state_t *aci_stat, uint8_t max_transactions)
+{
+  return hal_aci_tl_pump(aci_stat->aci_tl, max_transactions);
+}
+
+uint8_t lib_aci_idle(aci_state_t *aci_stat)
+{
+  uint8_t       energy_mode = 2;
+  uint32_t      start;
+  hal_aci_tl_t *p_tl;
+  uint8_t       i;
+
+  /* The log records wait for the MCU to be idle, writing them out blocks on the SWO output */
+  aci_log_drain();
+
+  start = efm_lf_ticks_get();
+
+  /* The interrupts are masked so that an event arriving between the checks and the sleep
+     wakes the MCU up immediately. The interrupt is serviced when they are unmasked. */
+  noInterrupts();
+
+  /* All the nRF8001s share the MCU, so every transport has to allow the sleep */
+  for (i = 0; NULL != (p_tl = hal_aci_tl_instance_get(i)); i++)
+  {
+    // In polling mode nothing would wake the MCU up when the nRF8001 has an event,
+    // and events that are waiting have to be processed
+    if (!hal_aci_tl_is_interrupt(p_tl) || !hal_aci_tl_rx_q_empty(p_tl))
+    {
+      interrupts();
+      return 0;
+    }
+
+    /* The command queue is either empty or waiting for the nRF8001 to lower RDYN, which
+       wakes the MCU up. A running transfer needs the high frequency clocks. */
+    if (hal_aci_tl_spi_busy(p_tl))
+    {
+      energy_mode = 1;
+    }
+  }
+
+  if (1 == energy_mode)
+  {
+    efm_sleep_em1();
+  }
+  else
+  {
+    efm_sleep_em2();
+  }
+
+  // Account the time before the interrupt that woke the MCU up is serviced
+  if (1 == energy_mode)
+  {
+    idle_stats.em1_ticks += efm_lf_ticks_get() - start;
+    idle_stats.em1_entries++;
+  }
+  else
+  {
+    idle_stats.em2_ticks += efm_lf_ticks_get() - start;
+    idle_stats.em2_entries++;
+  }
+
+  interrupts();
+
+  return energy_mode;
+}
+
+void lib_aci_idle_stats_get(lib_aci_idle_stats_t *p_stats)
+{
+  *p_stats           = idle_stats;
+  p_stats->em0_ticks = (efm_lf_ticks_get() - idle_stats_start) - idle_stats.em1_ticks - idle_stats.em2_ticks;
+}
+
+void lib_aci_idle_stats_clear(void)
+{
+  memset(&idle_stats, 0, sizeof(idle_stats));
+  idle_stats_start = efm_lf_ticks_get();
 }
 
-void lib_aci_flush(void)
+void lib_aci_flush(aci_state_t *aci_stat)
 {
-  hal_aci_tl_q_flush();
+  hal_aci_tl_q_flush(aci_stat->aci_tl);
+  aci_stat->event_updated = false;
 }
 
-void lib_aci_debug_print(bool enable)
+void lib_aci_debug_print(aci_state_t *aci_stat, bool enable)
 {
-  hal_aci_tl_debug_print(enable);
+  hal_aci_tl_debug_print(aci_stat->aci_tl, enable);
 
 }
 
-void lib_aci_pin_reset(void)
+void lib_aci_pin_reset(aci_state_t *aci_stat)
 {
-    hal_aci_tl_pin_reset();
+    hal_aci_tl_pin_reset(aci_stat->aci_tl);
 }
 
-bool lib_aci_event_queue_empty(void)
+bool lib_aci_event_queue_empty(aci_state_t *aci_stat)
 {
-  return hal_aci_tl_rx_q_empty();
+  return hal_aci_tl_rx_q_empty(aci_stat->aci_tl);
 }
 
-bool lib_aci_event_queue_full(void)
+bool lib_aci_event_queue_full(aci_state_t *aci_stat)
 {
-  return hal_aci_tl_rx_q_full();
+  return hal_aci_tl_rx_q_full(aci_stat->aci_tl);
 }
 
-bool lib_aci_command_queue_empty(void)
+bool lib_aci_command_queue_empty(aci_state_t *aci_stat)
 {
-  return hal_aci_tl_tx_q_empty();
+  return hal_aci_tl_tx_q_empty(aci_stat->aci_tl);
 }
 
-bool lib_aci_command_queue_full(void)
+bool lib_aci_command_queue_full(aci_state_t *aci_stat)
 {
-  return hal_aci_tl_tx_q_full();
+  return hal_aci_tl_tx_q_full(aci_stat->aci_tl);
 }
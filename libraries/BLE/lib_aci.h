@@ -43,6 +43,17 @@
 
 #define PIPES_ARRAY_SIZE                ((ACI_DEVICE_MAX_PIPES + 7)/8)
 
+/* Number of echo round trips used to validate each rate in lib_aci_spi_clock_negotiate() */
+#ifndef LIB_ACI_SPI_NEGOTIATE_ECHO_COUNT
+#define LIB_ACI_SPI_NEGOTIATE_ECHO_COUNT 8
+#endif
+
+/* Time lib_aci_spi_clock_negotiate() waits for an echo to come back, and for the events in flight
+   after a failed rate. The discarding of late events is limited to four times this. */
+#ifndef LIB_ACI_SPI_NEGOTIATE_TIMEOUT_MS
+#define LIB_ACI_SPI_NEGOTIATE_TIMEOUT_MS 100
+#endif
+
 /* Same size as a hal_aci_data_t */
 typedef struct {
   uint8_t   debug_byte;
@@ -51,6 +62,117 @@ typedef struct {
 
 ACI_ASSERT_SIZE(hal_aci_evt_t, 34);
 
+/* Notifications lib_aci_send_data() can hold while the nRF8001 has no data credits, for all pipes */
+#ifndef LIB_ACI_TX_BUFFERS
+#define LIB_ACI_TX_BUFFERS 8
+#endif
+
+#if (LIB_ACI_TX_BUFFERS < 1) || (LIB_ACI_TX_BUFFERS > 254)
+#error "LIB_ACI_TX_BUFFERS must be from 1 to 254"
+#endif
+
+#define LIB_ACI_TX_NONE 0xFF
+
+/* A SendData waiting for a data credit */
+typedef struct lib_aci_tx_buffer_t
+{
+  uint8_t next;                                         /* Next buffer of the pipe or of the free list */
+  uint8_t size;
+  uint8_t data[ACI_PIPE_TX_DATA_MAX_LEN];
+} lib_aci_tx_buffer_t;
+
+/* Send queues of the pipes, linked lists of buffers in a pool shared by the pipes */
+typedef struct lib_aci_tx_t
+{
+  lib_aci_tx_buffer_t buffers[LIB_ACI_TX_BUFFERS];
+  uint8_t             free;                             /* First free buffer */
+  uint8_t             queued;                           /* Buffers in the send queues */
+  uint8_t             next_pipe;                        /* The queues are served round robin from this pipe */
+  uint8_t             head[ACI_DEVICE_MAX_PIPES + 1];   /* By pipe number, LIB_ACI_TX_NONE when empty */
+  uint8_t             tail[ACI_DEVICE_MAX_PIPES + 1];
+} lib_aci_tx_t;
+
+/* Buffers lib_aci_stream_write() can send at the same time, on different pipes */
+#ifndef LIB_ACI_STREAMS
+#define LIB_ACI_STREAMS 2
+#endif
+
+#if (LIB_ACI_STREAMS < 1) || (LIB_ACI_STREAMS > 8)
+#error "LIB_ACI_STREAMS must be from 1 to 8"
+#endif
+
+struct aci_state_t;
+
+/* Called when a stream is over, length_sent is less than the length written if it was aborted */
+typedef void (*lib_aci_stream_done_t)(struct aci_state_t *aci_stat, uint8_t pipe, uint16_t length_sent, void *p_context);
+
+/* A buffer being sent by lib_aci_stream_write() */
+typedef struct lib_aci_stream_t
+{
+  const uint8_t                *p_data;
+  uint16_t                      length;
+  uint16_t                      offset;                 /* Bytes handed to the transport */
+  lib_aci_stream_done_t         done_handler;
+  void                         *p_context;
+  uint8_t                       pipe;                   /* 0 while the stream is unused */
+} lib_aci_stream_t;
+
+/* RX pipes lib_aci_rx_framing_set() can reassemble messages on */
+#ifndef LIB_ACI_RX_FRAMED_PIPES
+#define LIB_ACI_RX_FRAMED_PIPES 2
+#endif
+
+#if (LIB_ACI_RX_FRAMED_PIPES < 1) || (LIB_ACI_RX_FRAMED_PIPES > 8)
+#error "LIB_ACI_RX_FRAMED_PIPES must be from 1 to 8"
+#endif
+
+/* Fragment format of the framed RX pipes. Every fragment starts with a byte holding a sequence
+   number that counts the fragments of the pipe modulo 128, with LIB_ACI_RX_FRAME_START set on the
+   first fragment of a message. The first fragment follows it with the message length, 16 bits
+   little endian. The rest of each fragment is message data. */
+#define LIB_ACI_RX_FRAME_START        0x80
+#define LIB_ACI_RX_FRAME_SEQ_MASK     0x7F
+#define LIB_ACI_RX_FRAME_HEADER_LEN   1
+#define LIB_ACI_RX_FRAME_START_LEN    3
+
+/* Called with a complete message, p_message is valid until the handler returns */
+typedef void (*lib_aci_rx_message_t)(struct aci_state_t *aci_stat, uint8_t pipe, const uint8_t *p_message,
+                                     uint16_t length, void *p_context);
+
+/* Reassembly of the messages of a framed RX pipe */
+typedef struct lib_aci_rx_frame_t
+{
+  uint8_t                      *p_buffer;               /* Storage of the application */
+  uint16_t                      size;
+  uint16_t                      length;                 /* Of the message being reassembled, 0 when none is */
+  uint16_t                      received;
+  lib_aci_rx_message_t          handler;
+  void                         *p_context;
+  uint16_t                      errors;                 /* Messages dropped for a lost fragment or their size */
+  uint8_t                       pipe;                   /* 0 while unused */
+  uint8_t                       seq;                    /* Sequence number the next fragment must have */
+} lib_aci_rx_frame_t;
+
+/* Event opcodes lib_aci_event_dispatch() has handlers for, by evt_opcode - ACI_EVT_DEVICE_STARTED */
+#define LIB_ACI_EVT_HANDLERS (ACI_EVT_KEY_REQUEST - ACI_EVT_DEVICE_STARTED + 1)
+
+/* Called by lib_aci_event_dispatch(), aci_evt is valid until the handler returns */
+typedef void (*lib_aci_evt_handler_t)(struct aci_state_t *aci_stat, const aci_evt_t *aci_evt, void *p_context);
+
+typedef struct lib_aci_evt_handler_entry_t
+{
+  lib_aci_evt_handler_t         handler;                /* NULL when not registered */
+  void                         *p_context;
+} lib_aci_evt_handler_entry_t;
+
+/* Handler tables of lib_aci_event_dispatch() */
+typedef struct lib_aci_dispatch_t
+{
+  lib_aci_evt_handler_entry_t   evt_handlers[LIB_ACI_EVT_HANDLERS];
+  lib_aci_evt_handler_entry_t   pipe_handlers[ACI_DEVICE_MAX_PIPES + 1];  /* By pipe number, for DataReceived, DataAck and PipeError */
+  uint32_t                      unhandled;              /* Events dispatched without a handler */
+} lib_aci_dispatch_t;
+
 typedef struct
 {
   uint8_t  location; /**< enum aci_pipe_store_t */
@@ -81,6 +203,7 @@ typedef struct aci_setup_info_t
 typedef struct aci_state_t
 {
   aci_pins_t                    aci_pins;                               /* Pins on the MCU used to connect to the nRF8001 */ 
+  hal_aci_tl_t                 *aci_tl;                                 /* Transport of the nRF8001, set by lib_aci_init() */
   aci_setup_info_t              aci_setup_info;                         /* Data structures that are created from nRFgo Studio */
   uint8_t                       bonded;                                 /* ( aci_bond_status_code_t ) Is the nRF8001 bonded to a peer device */
   uint8_t                       data_credit_total;                      /* Total data credit available for the specific version of the nRF8001, total equals available when a link is established */
@@ -100,11 +223,30 @@ typedef struct aci_state_t
   bool                          confirmation_pending;                   /* Attribute protocol Handle Value confirmation is pending for a Handle Value Indication
                                                                         (ACK is pending for a TX_ACK pipe) on local GATT Server*/
   /* End : Variables that are valid only when in a connection */                                                                        
+
+  aci_cmd_params_open_adv_pipe_t aci_cmd_params_open_adv_pipe;         /* Pipes opened by the last Open Adv Pipe command */
+  uint16_t                      spi_echo_errors;                        /* Echo round trips that failed during the last SPI clock negotiation */
+  lib_aci_tx_t                  tx;                                     /* Data waiting for credits, see lib_aci_send_data() */
+  lib_aci_stream_t              streams[LIB_ACI_STREAMS];               /* See lib_aci_stream_write() */
+  uint8_t                       stream_next;                            /* The streams are served round robin from this one */
+  lib_aci_rx_frame_t            rx_frames[LIB_ACI_RX_FRAMED_PIPES];     /* See lib_aci_rx_framing_set() */
+  lib_aci_dispatch_t            dispatch;                               /* See lib_aci_event_dispatch() */
+  bool                          event_updated;                          /* The state is updated from the event lib_aci_event_get_slot() handed out, until it is released */
   
 } aci_state_t;
 
 
 
+/** Time spent in each energy mode, in ticks of EFM_LF_TICKS_PER_SECOND */
+typedef struct lib_aci_idle_stats_t
+{
+  uint32_t                      em0_ticks;                              /* Time awake, since the statistics were cleared */
+  uint32_t                      em1_ticks;                              /* Time in EM1, waiting for an SPI transfer to complete */
+  uint32_t                      em2_ticks;                              /* Time in EM2, waiting for the nRF8001 */
+  uint32_t                      em1_entries;                            /* Number of times EM1 was entered by lib_aci_idle() */
+  uint32_t                      em2_entries;                            /* Number of times EM2 was entered by lib_aci_idle() */
+} lib_aci_idle_stats_t;
+
 #define DISCONNECT_REASON_CX_TIMEOUT                 0x08
 #define DISCONNECT_REASON_CX_CLOSED_BY_PEER_DEVICE   0x13
 #define DISCONNECT_REASON_POWER_LOSS                 0x14
@@ -119,12 +261,12 @@ typedef struct aci_state_t
  *  @details This function shall be used to enable or disable the debug printing.
               Debug printing is disabled by default.
  */
-void lib_aci_debug_print(bool enable);
+void lib_aci_debug_print(aci_state_t *aci_stat, bool enable);
 
 /** @brief Function to pin reset the nRF8001
  *  @details Pin resets the nRF8001 also handles differences between development boards
  */
-void lib_aci_pin_reset(void);
+void lib_aci_pin_reset(aci_state_t *aci_stat);
 
 /** @brief Initialization function.
  *  @details This function shall be used to initialize/reset ACI Library and also Resets the 
@@ -141,6 +283,10 @@ void lib_aci_init(aci_state_t *aci_stat, bool debug);
  */
 uint8_t lib_aci_get_nb_available_credits(aci_state_t *aci_stat);
 
+/** @brief Gets the number of lib_aci_send_data() calls waiting for data credits
+ */
+uint8_t lib_aci_tx_queued_get(aci_state_t *aci_stat);
+
 /** @brief Gets the connection interval in milliseconds.
  *  @return Connection interval in milliseconds.
  */
@@ -186,44 +332,44 @@ bool lib_aci_is_discovery_finished(aci_state_t *aci_stat);
  *  if advertising or disconnect if in a connection.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_sleep(void);
+bool lib_aci_sleep(aci_state_t *aci_stat);
 
 /** @brief Resets the radio.
  *  @details The function sends a @c BasebandReset command to the radio.  
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_radio_reset(void);
+bool lib_aci_radio_reset(aci_state_t *aci_stat);
 
 /** @brief Radio starts directed advertising to bonded device.
  *  @details The function sends a @c DirectedConnect command to the radio.  
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_direct_connect(void);
+bool lib_aci_direct_connect(aci_state_t *aci_stat);
 
 /** @brief Gets the radio's version.
  *  @details This function sends a @c GetDeviceVersion command.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_device_version(void);
+bool lib_aci_device_version(aci_state_t *aci_stat);
 
 /** @brief Gets the device address.
  *  @details This function sends a @c GetDeviceAddress command.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_get_address(void);
+bool lib_aci_get_address(aci_state_t *aci_stat);
 
 /** @brief Gets the temperature.
  *  @details This function sends a @c GetTemperature command. lib_aci
  *  calls the @ref lib_aci_transaction_finished_hook() function when the temperature is received.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_get_temperature(void);
+bool lib_aci_get_temperature(aci_state_t *aci_stat);
 
 /** @brief Gets the battery level.
  *  @details This function sends a @c GetBatteryLevel command. 
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_get_battery_level(void);
+bool lib_aci_get_battery_level(aci_state_t *aci_stat);
 
 //@}
 
@@ -236,7 +382,7 @@ bool lib_aci_get_battery_level(void);
  *  a @c CommandResponseEvent.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_wakeup(void);
+bool lib_aci_wakeup(aci_state_t *aci_stat);
 
 //@}
 
@@ -253,14 +399,14 @@ bool lib_aci_wakeup(void);
  *  @param enter_exit_test_mode Enter a Test mode, or exit Test mode.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_test(aci_test_mode_change_t enter_exit_test_mode);
+bool lib_aci_test(aci_state_t *aci_stat, aci_test_mode_change_t enter_exit_test_mode);
 
 /** @brief Sets the radio's TX power.
  *  @details This function sends a @c SetTxPower command.
  *  @param tx_power TX power to be used by the radio.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_set_tx_power(aci_device_output_power_t tx_power);
+bool lib_aci_set_tx_power(aci_state_t *aci_stat, aci_device_output_power_t tx_power);
 
 /** @brief Tries to connect to a peer device.
  *  @details This function sends a @c Connect command to the radio.
@@ -268,7 +414,7 @@ bool lib_aci_set_tx_power(aci_device_output_power_t tx_power);
  *  @param adv_interval Advertising interval (in multiple of 0.625&nbsp;ms).
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_connect(uint16_t run_timeout, uint16_t adv_interval);
+bool lib_aci_connect(aci_state_t *aci_stat, uint16_t run_timeout, uint16_t adv_interval);
 
 /** @brief Tries to bond with a peer device.
  *  @details This function sends a @c Bond command to the radio.
@@ -276,7 +422,7 @@ bool lib_aci_connect(uint16_t run_timeout, uint16_t adv_interval);
  *  @param adv_interval Advertising interval (in multiple of 0.625&nbsp;ms).
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_bond(uint16_t run_timeout, uint16_t adv_interval);
+bool lib_aci_bond(aci_state_t *aci_stat, uint16_t run_timeout, uint16_t adv_interval);
 
 /** @brief Disconnects from peer device.
  *  @details This function sends a @c Disconnect command to the radio.
@@ -306,7 +452,7 @@ bool lib_aci_set_local_data(aci_state_t *aci_stat, uint8_t pipe, uint8_t *value,
  *  Valid values: 160 to 16384 (which corresponds to an interval from 100 ms to 10.24 s).
  *  @return True if the broadcast message is sent successfully to the radio. 
 */
-bool lib_aci_broadcast(const uint16_t timeout, const uint16_t adv_interval);
+bool lib_aci_broadcast(aci_state_t *aci_stat, const uint16_t timeout, const uint16_t adv_interval);
 
 /** @name Open Advertising Pipes.  */
 
@@ -319,7 +465,7 @@ bool lib_aci_broadcast(const uint16_t timeout, const uint16_t adv_interval);
  *  @param pipe The pipe that has to be placed in advertising service data.
  *  @return True if the Open Adv Pipe message is sent successfully to the radio. 
 */
-bool lib_aci_open_adv_pipe(const uint8_t pipe);
+bool lib_aci_open_adv_pipe(aci_state_t *aci_stat, const uint8_t pipe);
 
 
 /** @name Open Advertising Pipes  */
@@ -335,7 +481,7 @@ bool lib_aci_open_adv_pipe(const uint8_t pipe);
  *  TX_BROADCAST pipe data is to be placed in Advertising Service Data fields
  *  @return true if the Open Adv Pipe message was sent successfully to the radio. 
 */
-bool lib_aci_open_adv_pipes(const uint8_t * const adv_service_data_pipes);
+bool lib_aci_open_adv_pipes(aci_state_t *aci_stat, const uint8_t * const adv_service_data_pipes);
 
 
 //@}
@@ -348,7 +494,7 @@ bool lib_aci_open_adv_pipes(const uint8_t * const adv_service_data_pipes);
  *  @details This function sends a @c setApplicationLatency command. 
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_set_app_latency(uint16_t latency, aci_app_latency_mode_t latency_mode);
+bool lib_aci_set_app_latency(aci_state_t *aci_stat, uint16_t latency, aci_app_latency_mode_t latency_mode);
 
 /** @brief Opens a remote pipe.
  *  @details This function sends an @c OpenRemotePipe command.
@@ -366,14 +512,59 @@ bool lib_aci_close_remote_pipe(aci_state_t *aci_stat, uint8_t pipe);
 
 /** @brief Sends data on a given pipe.
  *  @details This function sends a @c SendData command with application data to
- *  the radio. This function memorizes credit use, and checks that
- *  enough credits are available.
+ *  the radio. Every SendData takes a data credit. Without a credit, or with data of the pipe
+ *  still waiting, the data is copied to the send queue of the pipe, and sent when
+ *  @ref lib_aci_event_get() sees the credits return in a DataCredit or PipeError event.
+ *  The queues share LIB_ACI_TX_BUFFERS buffers and are served round robin. A Disconnected
+ *  event drops the data that is waiting.
  *  @param pipe Pipe number on which the data should be sent.
  *  @param value Pointer to the data to send.
  *  @param size Size of the data to send.
- *  @return True if the transaction is successfully initiated.
+ *  @return True if the data is sent or queued, false if the pipe cannot send or the buffers are full.
+ */
+bool lib_aci_send_data(aci_state_t *aci_stat, uint8_t pipe, uint8_t *value, uint8_t size);
+
+/** @brief Sends a buffer of any length on a given pipe.
+ *  @details The buffer is cut into SendData commands of ACI_PIPE_TX_DATA_MAX_LEN bytes,
+ *  which are queued as long as there are data credits and room in the command queue. The
+ *  rest follows from @ref lib_aci_event_get() as the credits return, so the command queue is
+ *  kept busy between the calls of the event loop. The buffer is not copied, it must stay
+ *  unchanged until done_handler is called, in the main context, possibly before this function
+ *  returns. A Disconnected event aborts the stream. @ref lib_aci_send_data() is refused on the
+ *  pipe while the stream runs.
+ *  @param pipe Pipe number on which the data should be sent.
+ *  @param p_data Data to send.
+ *  @param length Length of the data, at least one byte.
+ *  @param done_handler Called when the last byte is queued or the stream is aborted, can be NULL.
+ *  @param p_context Passed to done_handler.
+ *  @return True if the stream is started, false if the pipe cannot send, already streams or
+ *  all LIB_ACI_STREAMS streams are in use.
+ */
+bool lib_aci_stream_write(aci_state_t *aci_stat, uint8_t pipe, const uint8_t *p_data, uint16_t length,
+                          lib_aci_stream_done_t done_handler, void *p_context);
+
+/** @brief Checks if lib_aci_stream_write() is still sending on a pipe
  */
-bool lib_aci_send_data(uint8_t pipe, uint8_t *value, uint8_t size);
+bool lib_aci_stream_busy(aci_state_t *aci_stat, uint8_t pipe);
+
+/** @brief Reassembles the messages received on an RX pipe
+ *  @details The DataReceived events of the pipe carry fragments in the format described at
+ *  LIB_ACI_RX_FRAME_START. @ref lib_aci_event_get() consumes them and calls the handler once per
+ *  complete message, with the message in p_buffer, or in the event itself when it fits in one
+ *  fragment. A message with a missing fragment or longer than size is dropped and counted.
+ *  @param pipe RX pipe number.
+ *  @param p_buffer Storage for a message, NULL with a NULL handler stops the framing on the pipe.
+ *  @param size Size of p_buffer, the longest message that can be received.
+ *  @param handler Called for each complete message in the main context.
+ *  @param p_context Passed to the handler.
+ *  @return True on success, false if all LIB_ACI_RX_FRAMED_PIPES pipes are in use.
+ */
+bool lib_aci_rx_framing_set(aci_state_t *aci_stat, uint8_t pipe, uint8_t *p_buffer, uint16_t size,
+                            lib_aci_rx_message_t handler, void *p_context);
+
+/** @brief Gets the number of messages dropped on a framed RX pipe
+ */
+uint16_t lib_aci_rx_framing_errors_get(aci_state_t *aci_stat, uint8_t pipe);
 
 /** @brief Requests data from a given pipe.
  *  @details This function sends a @c RequestData command to the radio. This
@@ -398,7 +589,7 @@ bool lib_aci_request_data(aci_state_t *aci_stat, uint8_t pipe);
  *  @param timeout requested slave timeout, in multiple of 10&nbsp;ms.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_change_timing(uint16_t minimun_cx_interval, uint16_t maximum_cx_interval, uint16_t slave_latency, uint16_t timeout);
+bool lib_aci_change_timing(aci_state_t *aci_stat, uint16_t minimun_cx_interval, uint16_t maximum_cx_interval, uint16_t slave_latency, uint16_t timeout);
 
 /** @brief Sends a L2CAP change connection parameters request with the connection predefined preffered connection parameters.
  *  @details This function sends a @c ChangeTiming command to the radio. This command triggers a "L2CAP change connection parameters" request 
@@ -411,7 +602,7 @@ bool lib_aci_change_timing(uint16_t minimun_cx_interval, uint16_t maximum_cx_int
  *  The Timing parameters as stored as the GAP Preferred Peripheral Connection Parameters.
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_change_timing_GAP_PPCP(void);
+bool lib_aci_change_timing_GAP_PPCP(aci_state_t *aci_stat);
 
 /** @brief Sends acknowledgement message to peer.
  *  @details This function sends @c SendDataAck command to radio. The radio is expected 
@@ -441,7 +632,7 @@ bool lib_aci_send_nack(aci_state_t *aci_stat, const uint8_t pipe, const uint8_t
  *  and later chose to write it back using the function lib_aci_write_dynamic_data.
  *  @return True if the command was sent successfully through the ACI. False otherwise.
 */
-bool lib_aci_read_dynamic_data(void);
+bool lib_aci_read_dynamic_data(aci_state_t *aci_stat);
 
 /** @brief Sends WriteDynamicData command to the host.
  *  @details This function sends @c WriteDynamicData command to host. The host is expected
@@ -456,7 +647,7 @@ bool lib_aci_read_dynamic_data(void);
  *  @param length Length of the dynamic data.
  *  @return True if the command was sent successfully through the ACI. False otherwise.
 */
-bool lib_aci_write_dynamic_data(uint8_t sequence_number, uint8_t* dynamic_data, uint8_t length);
+bool lib_aci_write_dynamic_data(aci_state_t *aci_stat, uint8_t sequence_number, uint8_t* dynamic_data, uint8_t length);
 //@}
 
 /** @name ACI commands available while connected in Bond mode */
@@ -468,7 +659,7 @@ bool lib_aci_write_dynamic_data(uint8_t sequence_number, uint8_t* dynamic_data,
  *  master rejects with a pairing failed or if the bond timer expires the connection is closed. 
  *  @return True if the transaction is successfully initiated.
  */
-bool lib_aci_bond_request(void);
+bool lib_aci_bond_request(aci_state_t *aci_stat);
 
 /** @brief Set the key requested by the 8001. 
  *  @details This function sends an @c SetKey command to the radio. 
@@ -477,7 +668,7 @@ bool lib_aci_bond_request(void);
  *  @param len Length of the key.
  *  @return True if the transaction is successfully initiated.
 */
-bool lib_aci_set_key(aci_key_type_t key_rsp_type, uint8_t *key, uint8_t len);
+bool lib_aci_set_key(aci_state_t *aci_stat, aci_key_type_t key_rsp_type, uint8_t *key, uint8_t len);
 
 //@}
 
@@ -493,7 +684,31 @@ bool lib_aci_set_key(aci_key_type_t key_rsp_type, uint8_t *key, uint8_t len);
  *  @param message_data Pointer to the data to send.
  *  @return True if the transaction is successfully initiated.
 */
-bool lib_aci_echo_msg(uint8_t message_size, uint8_t *message_data);
+bool lib_aci_echo_msg(aci_state_t *aci_stat, uint8_t message_size, uint8_t *message_data);
+
+/** @brief Negotiates the fastest reliable ACI SPI clock
+ *  @details This function steps the SPI clock up through divisors of the peripheral clock,
+ *  limited to 3&nbsp;MHz. Every rate is validated with @ref LIB_ACI_SPI_NEGOTIATE_ECHO_COUNT echo
+ *  round trips of @c ACI_ECHO_DATA_MAX_LEN bytes. The highest rate where all echoes came back
+ *  intact within @ref LIB_ACI_SPI_NEGOTIATE_TIMEOUT_MS is locked in. The nRF8001 must be in Test mode, and the ACI command and event queues
+ *  must be empty. The function blocks until the negotiation is complete.
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @return True if at least one rate passed. The SPI clock is then set to the highest passing rate,
+ *  otherwise it is restored to the rate in use when the function was called.
+*/
+bool lib_aci_spi_clock_negotiate(aci_state_t *aci_stat);
+
+/** @brief Gets the current ACI SPI clock
+ *  @return SPI clock in Hz.
+*/
+uint32_t lib_aci_spi_clock_get(aci_state_t *aci_stat);
+
+/** @brief Gets the number of failed echo round trips
+ *  @details Echoes that timed out or came back corrupted during the last call to
+ *  @ref lib_aci_spi_clock_negotiate().
+ *  @return Number of failed echo round trips.
+*/
+uint16_t lib_aci_spi_echo_errors_get(aci_state_t *aci_stat);
 
 /** @brief Sends an DTM command
  *  @details This function sends an @c DTM command to the radio. 
@@ -501,7 +716,7 @@ bool lib_aci_echo_msg(uint8_t message_size, uint8_t *message_data);
  *  @param dtm_command_lsbyte Least significant byte of the DTM command.
  *  @return True if the transaction is successfully initiated.
 */
-bool lib_aci_dtm_command(uint8_t dtm_command_msbyte, uint8_t dtm_command_lsbyte);
+bool lib_aci_dtm_command(aci_state_t *aci_stat, uint8_t dtm_command_msbyte, uint8_t dtm_command_lsbyte);
 
 /** @brief Gets an ACI event from the ACI Event Queue
  *  @details This function gets an ACI event from the ACI event queue. 
@@ -519,36 +734,132 @@ bool lib_aci_event_get(aci_state_t *aci_stat, hal_aci_evt_t * aci_evt);
  * only peek at it.
  * @return True if an ACI Event was copied to the pointer.
 */
-bool lib_aci_event_peek(hal_aci_evt_t *p_aci_evt_data);
+bool lib_aci_event_peek(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data);
+
+/** @brief Gets an ACI event in place from the ACI Event Queue
+ *  @details Zero copy variant of @ref lib_aci_event_get(). The state of the ACI is updated the same
+ *  way, but the event is left in the queue and the returned pointer refers to the queue slot.
+ *  Call @ref lib_aci_event_release() when done with the event, the pointer is not valid after that.
+ *  The state is updated once per event, getting the same event again before releasing it returns
+ *  the slot without updating the state a second time.
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @return Pointer to the ACI Event, NULL if there is no pending event.
+*/
+hal_aci_evt_t * lib_aci_event_get_slot(aci_state_t *aci_stat);
+
+/** @brief Registers the handler of an ACI event
+ *  @details @ref lib_aci_event_dispatch() calls the handler for every event with this opcode,
+ *  unless a pipe handler takes the event. lib_aci_init() clears all handlers.
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @param evt_opcode Event to handle, from ACI_EVT_DEVICE_STARTED to ACI_EVT_KEY_REQUEST.
+ *  @param handler Function to call, NULL removes the handler.
+ *  @param p_context Passed to the handler.
+ *  @return False if the opcode is out of range.
+*/
+bool lib_aci_evt_handler_set(aci_state_t *aci_stat, aci_evt_opcode_t evt_opcode,
+                             lib_aci_evt_handler_t handler, void *p_context);
+
+/** @brief Registers the handler of the events of a pipe
+ *  @details @ref lib_aci_event_dispatch() calls the handler for the DataReceived, DataAck and
+ *  PipeError events of the pipe instead of the handler of the event opcode. This lets the
+ *  services of an application handle their own pipes.
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @param pipe Pipe number.
+ *  @param handler Function to call, NULL removes the handler.
+ *  @param p_context Passed to the handler.
+ *  @return False if the pipe number is out of range.
+*/
+bool lib_aci_pipe_handler_set(aci_state_t *aci_stat, uint8_t pipe,
+                              lib_aci_evt_handler_t handler, void *p_context);
+
+/** @brief Gets an ACI event and calls its handler
+ *  @details The state of the ACI is updated as by @ref lib_aci_event_get_slot(), then the handler
+ *  registered for the pipe or the opcode of the event is called and the event is released.
+ *  The event is not copied. Events without a handler are counted, see
+ *  @ref lib_aci_unhandled_events_get(). Handlers must not call this function.
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @return True if an event was dispatched, false if there was no pending event.
+*/
+bool lib_aci_event_dispatch(aci_state_t *aci_stat);
+
+/** @brief Gets the number of events dispatched without a handler
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @return Events since lib_aci_init().
+*/
+uint32_t lib_aci_unhandled_events_get(aci_state_t *aci_stat);
+
+/** @brief Peeks an ACI event in place from the ACI Event Queue
+ *  @details Zero copy variant of @ref lib_aci_event_peek(). The state of the ACI is not updated.
+ *  @return Pointer to the ACI Event, NULL if there is no pending event.
+*/
+hal_aci_evt_t * lib_aci_event_peek_slot(aci_state_t *aci_stat);
+
+/** @brief Releases the ACI event returned by @ref lib_aci_event_get_slot()
+ *  @details Frees the queue slot so the transport can store the next event in it.
+*/
+void lib_aci_event_release(aci_state_t *aci_stat);
+
+/** @brief Runs ACI transactions back to back in polling mode
+ *  @details Moves queued commands to the nRF8001 and its events into the event queue for as
+ *  long as it has something to send, up to max_transactions. Call it before processing the
+ *  events to handle bursts, e.g. notifications, in one pass of the main loop. Does nothing in
+ *  interrupt mode, where the RDYN interrupt runs the transactions.
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @param max_transactions Most transactions to run.
+ *  @return Number of transactions that were run.
+*/
+uint8_t lib_aci_pump(aci_state_t *aci_stat, uint8_t max_transactions);
+
+/** @brief Sleeps until the nRF8001 needs attention
+ *  @details Call this function from the main loop when @ref lib_aci_event_get() returns false.
+ *  The MCU sleeps only when the ACI event queues are empty and the interfaces use the RDYN
+ *  interrupt, as nothing else would wake it up. It enters EM1 while an SPI transfer is in
+ *  progress, otherwise EM2 with the RDYN interrupt as the wake up source. The clocks are
+ *  restored before the function returns. Other interrupts wake the MCU up as well.
+ *  With several nRF8001s the transports of all of them are checked, as they share the MCU.
+ *  The records of aci_log.h are written to the ITM before the checks.
+ *  @param aci_stat pointer to the state of the ACI.
+ *  @return The energy mode that was entered, 0 if the MCU did not sleep.
+*/
+uint8_t lib_aci_idle(aci_state_t *aci_stat);
+
+/** @brief Gets the time spent in each energy mode
+ *  @param p_stats Filled with the time spent in each energy mode since the statistics were cleared.
+*/
+void lib_aci_idle_stats_get(lib_aci_idle_stats_t *p_stats);
+
+/** @brief Clears the energy mode statistics
+*/
+void lib_aci_idle_stats_clear(void);
 
 /** @brief Flushes the events in the ACI command queues and ACI Event queue
  *
 */
-void lib_aci_flush(void);
+void lib_aci_flush(aci_state_t *aci_stat);
 
 /** @brief Return full status of the Event queue
  *  @details
  *
  */
- bool lib_aci_event_queue_full(void);
+ bool lib_aci_event_queue_full(aci_state_t *aci_stat);
  
  /** @brief Return empty status of the Event queue
  *  @details
  *
  */
- bool lib_aci_event_queue_empty(void);
+ bool lib_aci_event_queue_empty(aci_state_t *aci_stat);
 
 /** @brief Return full status of Command queue
  *  @details
  *
  */
- bool lib_aci_command_queue_full(void);
+ bool lib_aci_command_queue_full(aci_state_t *aci_stat);
  
  /** @brief Return empty status of Command queue
  *  @details
  *
  */
- bool lib_aci_command_queue_empty(void);
+ bool lib_aci_command_queue_empty(aci_state_t *aci_stat);
 
 //@}
 
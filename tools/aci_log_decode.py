@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Prints the deferred log of aci_log.h from a capture of the SWO output.
+
+    tools/aci_log_decode.py capture.bin firmware.axf
+
+The log records carry the flash address of their format string, which is looked up in the ELF
+file the firmware was built into, the .axf of Keil or the program of the host build. Use the file
+of the exact build that made the capture.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+import itm_stream
+
+# Keep in step with aci_log.h
+LOG_MARKER = 0xA1
+LOG_TICKS_PER_SECOND = 32768.0
+LOG_ARGS_MAX = 6
+LEVEL_NAMES = {1: 'ERROR', 2: 'WARNING', 3: 'INFO', 4: 'DEBUG'}
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 0x2
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|t|j)?([diouxXcsp%])')
+
+
+class Image(object):
+    """The loaded sections of an ELF file, to read the strings at an address."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as image:
+            data = image.read()
+        if data[:4] != b'\x7fELF':
+            raise ValueError('%s is not an ELF file' % path)
+        if data[4] == 2:
+            shoff, = struct.unpack_from('<Q', data, 0x28)
+            shentsize, shnum = struct.unpack_from('<HH', data, 0x3A)
+            section = '<IIQQQQ'
+        else:
+            shoff, = struct.unpack_from('<I', data, 0x20)
+            shentsize, shnum = struct.unpack_from('<HH', data, 0x2E)
+            section = '<IIIIII'
+        self.sections = []
+        for i in range(shnum):
+            _, kind, flags, address, offset, size = struct.unpack_from(section, data, shoff + i * shentsize)
+            if kind == SHT_PROGBITS and flags & SHF_ALLOC and size:
+                self.sections.append((address, data[offset:offset + size]))
+
+    def string(self, address):
+        for start, contents in self.sections:
+            if start <= address < start + len(contents):
+                end = contents.find(b'\0', address - start)
+                return contents[address - start:end if end >= 0 else None].decode('latin-1')
+        return None
+
+
+def records(words):
+    """Yields (level, dropped, ticks, format address, arguments) per record."""
+    words = iter(words)
+    ticks_high = 0
+    last_ticks = None
+    for header in words:
+        argc = (header >> 12) & 0x0F
+        if (header & 0xFF) != LOG_MARKER or argc > LOG_ARGS_MAX:
+            continue
+        try:
+            ticks = next(words)
+            address = next(words)
+            args = [next(words) for _ in range(argc)]
+        except StopIteration:
+            return
+        # The tick counter wraps after 36 hours
+        if last_ticks is not None and ticks < last_ticks:
+            ticks_high += 1 << 32
+        last_ticks = ticks
+        yield (header >> 8) & 0x0F, header >> 16, ticks_high + ticks, address, args
+
+
+def format_message(image, fmt, args):
+    """printf() with the 32-bit arguments of a record."""
+    args = list(args)
+
+    def convert(match):
+        flags, width, precision, _, conversion = match.groups()
+        if conversion == '%':
+            return '%'
+        value = args.pop(0) if args else 0
+        if conversion in 'di':
+            value = value - (1 << 32) if value & 0x80000000 else value
+        elif conversion == 's':
+            value = image.string(value)
+            if value is None:
+                value = '<string at 0x%08x>' % value
+        elif conversion == 'c':
+            value = chr(value & 0xFF)
+        elif conversion == 'p':
+            return '0x%08x' % value
+        python = '%' + flags + width + ('.' + precision if precision else '') + \
+                 {'i': 'd', 'u': 'd'}.get(conversion, conversion)
+        return python % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('capture', help='raw SWO capture')
+    parser.add_argument('image', help='ELF file of the firmware that made the capture')
+    parser.add_argument('--port', type=int, default=3, help='ITM port of the log, ACI_LOG_ITM_PORT')
+    args = parser.parse_args()
+
+    image = Image(args.image)
+    words = (value for port, value, size in itm_stream.writes(itm_stream.read(args.capture))
+             if port == args.port and size == 4)
+    for level, dropped, ticks, address, values in records(words):
+        if dropped:
+            sys.stdout.write('%12.6f %-7s %d messages dropped, the log ring was full\n'
+                             % (ticks / LOG_TICKS_PER_SECOND, 'WARNING', dropped))
+        fmt = image.string(address)
+        if fmt is None:
+            message = 'unknown format string at 0x%08x %s' % (address, ' '.join('0x%x' % v for v in values))
+        else:
+            message = format_message(image, fmt, values).rstrip('\n')
+        sys.stdout.write('%12.6f %-7s %s\n' % (ticks / LOG_TICKS_PER_SECOND, LEVEL_NAMES.get(level, level), message))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+"""Cycle histograms per ACI probe from a capture of the SWO output.
+
+Build the library with ACI_PROBE defined, capture the SWO pin (or set EFM_HOST_SWO on the host
+build) and run:
+
+    tools/aci_probe_decode.py capture.bin [--port 1] [--clock 48000000]
+
+A probe that nests in itself, from an interrupt, is paired the inner exit with the inner entry.
+The cycles of a probe include the probes it calls.
+"""
+
+import argparse
+import sys
+
+import itm_stream
+
+# Keep in step with aci_probe_id_t in libraries/BLE/aci_probe.h
+PROBE_NAMES = {
+    1:  'm_aci_spi_transfer',
+    2:  'm_aci_spi_transfer_done',
+    3:  'aci_queue_enqueue',
+    4:  'aci_queue_dequeue',
+    5:  'aci_queue_peek',
+    6:  'aci_queue_acquire',
+    7:  'aci_queue_commit',
+    8:  'aci_queue_peek_slot',
+    9:  'aci_queue_release',
+    10: 'lib_aci_event_get',
+    11: 'lib_aci_event_get_slot',
+    12: 'acil_decode_evt',
+    13: 'do_aci_setup',
+    14: 'lib_aci_event_dispatch',
+}
+
+EXIT_FLAG = 0x80000000
+CYCLE_MASK = 0x00FFFFFF
+HISTOGRAM_WIDTH = 40
+
+
+def spans(records):
+    """Pairs the entry and exit records, returns {probe id: [cycles]} and the unpaired count."""
+    open_entries = {}
+    cycles = {}
+    unpaired = 0
+    for record in records:
+        probe = (record >> 24) & 0x7F
+        stamp = record & CYCLE_MASK
+        stack = open_entries.setdefault(probe, [])
+        if not record & EXIT_FLAG:
+            stack.append(stamp)
+        elif stack:
+            cycles.setdefault(probe, []).append((stamp - stack.pop()) & CYCLE_MASK)
+        else:
+            unpaired += 1
+    unpaired += sum(len(stack) for stack in open_entries.values())
+    return cycles, unpaired
+
+
+def percentile(ordered, fraction):
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def histogram(ordered):
+    """Counts per power of two bin, as (low, high, count)."""
+    bins = {}
+    for value in ordered:
+        low = 1 << (value.bit_length() - 1) if value else 0
+        bins[low] = bins.get(low, 0) + 1
+    return [(low, (low << 1) - 1 if low else 0, bins[low]) for low in sorted(bins)]
+
+
+def report(cycles, clock, out):
+    for probe in sorted(cycles):
+        ordered = sorted(cycles[probe])
+        name = PROBE_NAMES.get(probe, 'probe %d' % probe)
+        mean = sum(ordered) / len(ordered)
+        out.write('%s: %d calls, cycles min %d median %d p99 %d max %d mean %.1f'
+                  % (name, len(ordered), ordered[0], percentile(ordered, 0.5),
+                     percentile(ordered, 0.99), ordered[-1], mean))
+        if clock:
+            out.write(' (%.2f us)' % (mean * 1e6 / clock))
+        out.write('\n')
+
+        bins = histogram(ordered)
+        largest = max(count for _, _, count in bins)
+        for low, high, count in bins:
+            bar = '#' * max(1, count * HISTOGRAM_WIDTH // largest)
+            out.write('  %8d - %-8d %8d %s\n' % (low, high, count, bar))
+        out.write('\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('capture', help='raw SWO capture')
+    parser.add_argument('--port', type=int, default=1, help='ITM port of the probes, ACI_PROBE_ITM_PORT')
+    parser.add_argument('--clock', type=float, default=0, help='core clock in Hz, adds the mean time')
+    args = parser.parse_args()
+
+    records = [value for port, value, size in itm_stream.writes(itm_stream.read(args.capture))
+               if port == args.port and size == 4]
+    cycles, unpaired = spans(records)
+    if not cycles:
+        sys.exit('no probe records on ITM port %d' % args.port)
+    report(cycles, args.clock, sys.stdout)
+    if unpaired:
+        sys.stdout.write('%d records without a partner, the capture starts or ends inside a probe '
+                         'or lost writes\n' % unpaired)
+
+
+if __name__ == '__main__':
+    main()
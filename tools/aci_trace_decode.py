@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Dissects the binary ACI packet trace of hal_aci_tl, built with ACI_TRACE defined.
+
+    tools/aci_trace_decode.py capture.bin                  # one line per packet
+    tools/aci_trace_decode.py capture.bin --pcap aci.pcap  # for Wireshark
+
+The capture is the raw SWO output, or the EFM_HOST_SWO file of the host build. The names of the
+opcodes and status codes are read from aci_cmds.h, aci_evts.h and aci.h of the BLE library.
+
+The pcap file uses the link type USER0. Every packet is the flags byte of the record (bit 0 set for
+an event, the transport instance in bits 7..4), the status byte of an event and the ACI packet
+starting with its length byte.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+import itm_stream
+
+# Keep in step with hal_aci_tl.h
+TRACE_MARKER = 0xAC
+TRACE_FLAG_EVENT = 0x01
+TRACE_TICKS_PER_SECOND = 32768.0
+MAX_LENGTH = 31
+
+LINKTYPE_USER0 = 147
+
+EVT_CMD_RSP = 0x84
+# Events and commands whose first parameter is a pipe number
+PIPE_EVENTS = (0x8B, 0x8C, 0x8D)
+PIPE_COMMANDS = (0x14, 0x15, 0x16, 0x17, 0x18, 0x1F)
+
+DEFAULT_HEADERS = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'libraries', 'BLE')
+
+
+def opcode_table(path, prefix):
+    """Maps the values of the enum entries called prefix* in a header to their names."""
+    table = {}
+    with open(path) as header:
+        for name, value in re.findall(r'\b%s(\w+)\s*=\s*(0x[0-9A-Fa-f]+|\d+)' % prefix, header.read()):
+            table.setdefault(int(value, 0), name)
+    return table
+
+
+class Tables(object):
+    def __init__(self, directory):
+        self.commands = opcode_table(os.path.join(directory, 'aci_cmds.h'), 'ACI_CMD_')
+        self.events = opcode_table(os.path.join(directory, 'aci_evts.h'), 'ACI_EVT_')
+        self.status = opcode_table(os.path.join(directory, 'aci.h'), 'ACI_STATUS_')
+
+
+def records(words):
+    """Yields (flags, status, ticks, packet) per record, packet starting with the length byte."""
+    words = iter(words)
+    ticks_high = 0
+    last_ticks = None
+    for header in words:
+        length = (header >> 16) & 0xFF
+        if (header & 0xFF) != TRACE_MARKER or length > MAX_LENGTH:
+            continue
+        try:
+            ticks = next(words)
+            payload = b''.join(struct.pack('<I', next(words)) for _ in range((length + 3) // 4))
+        except StopIteration:
+            return
+        # The tick counter wraps after 36 hours
+        if last_ticks is not None and ticks < last_ticks:
+            ticks_high += 1 << 32
+        last_ticks = ticks
+        yield (header >> 8) & 0xFF, header >> 24, ticks_high + ticks, bytes([length]) + payload[:length]
+
+
+def describe(tables, flags, status, packet):
+    length = packet[0]
+    if length == 0:
+        return 'empty'
+    opcode = packet[1]
+    params = packet[2:]
+    if flags & TRACE_FLAG_EVENT:
+        text = tables.events.get(opcode, 'event 0x%02X' % opcode)
+        if opcode == EVT_CMD_RSP and len(params) >= 2:
+            text += ' %s %s' % (tables.commands.get(params[0], '0x%02X' % params[0]),
+                                tables.status.get(params[1], '0x%02X' % params[1]))
+            params = params[2:]
+        elif opcode in PIPE_EVENTS and params:
+            text += ' pipe %d' % params[0]
+            params = params[1:]
+    else:
+        text = tables.commands.get(opcode, 'command 0x%02X' % opcode)
+        if opcode in PIPE_COMMANDS and params:
+            text += ' pipe %d' % params[0]
+            params = params[1:]
+    if params:
+        text += ': ' + ' '.join('%02x' % byte for byte in params)
+    return text
+
+
+def write_text(tables, trace, out):
+    for flags, status, ticks, packet in trace:
+        out.write('%12.6f %d %s %2d %s\n' % (ticks / TRACE_TICKS_PER_SECOND, flags >> 4,
+                                             'E' if flags & TRACE_FLAG_EVENT else 'C', packet[0],
+                                             describe(tables, flags, status, packet)))
+
+
+def write_pcap(trace, out):
+    out.write(struct.pack('<IHHiIII', 0xA1B2C3D4, 2, 4, 0, 0, 65535, LINKTYPE_USER0))
+    for flags, status, ticks, packet in trace:
+        seconds, rest = divmod(ticks, int(TRACE_TICKS_PER_SECOND))
+        data = bytes([flags, status]) + packet
+        out.write(struct.pack('<IIII', seconds, int(rest * 1e6 / TRACE_TICKS_PER_SECOND), len(data), len(data)))
+        out.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('capture', help='raw SWO capture')
+    parser.add_argument('--port', type=int, default=2, help='ITM port of the trace, ACI_TRACE_ITM_PORT')
+    parser.add_argument('--pcap', metavar='FILE', help='write a pcap file instead of text')
+    parser.add_argument('--headers', default=DEFAULT_HEADERS, help='directory of aci_cmds.h and aci_evts.h')
+    args = parser.parse_args()
+
+    words = (value for port, value, size in itm_stream.writes(itm_stream.read(args.capture))
+             if port == args.port and size == 4)
+    trace = records(words)
+    if args.pcap:
+        with open(args.pcap, 'wb') as out:
+            write_pcap(trace, out)
+    else:
+        write_text(Tables(args.headers), trace, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,64 @@
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Splits a raw capture of the SWO pin into ITM stimulus port writes.
+
+The capture is the byte stream the TPIU sends in NRZ mode without the formatter, as setupSWO()
+configures it, or the file the host build writes to EFM_HOST_SWO. Synchronisation, overflow,
+timestamp and hardware source packets (the DWT PC and interrupt samples) are skipped.
+"""
+
+_PAYLOAD_SIZE = {1: 1, 2: 2, 3: 4}
+
+
+def writes(data):
+    """Yields (port, value, size) for every stimulus port write in data."""
+    i = 0
+    end = len(data)
+    while i < end:
+        header = data[i]
+        i += 1
+        if header == 0x00:
+            # Synchronisation, zeros up to a byte with bit 7 set
+            while i < end and data[i] == 0x00:
+                i += 1
+            if i < end:
+                i += 1
+        elif header == 0x70:
+            # Overflow, writes were lost before this point
+            continue
+        elif (header & 0x03) == 0:
+            # Timestamp or extension, continuation bytes have bit 7 set
+            if header & 0x80:
+                while i < end and data[i] & 0x80:
+                    i += 1
+                i += 1
+        else:
+            size = _PAYLOAD_SIZE[header & 0x03]
+            if i + size > end:
+                break
+            if not header & 0x04:
+                yield header >> 3, int.from_bytes(data[i:i + size], 'little'), size
+            i += size
+
+
+def read(path):
+    with open(path, 'rb') as capture:
+        return capture.read()